@@ -90,6 +90,10 @@
 
 #define NS_CONN_MAXCLS		 16
 
+#define NS_GZIP_FLUSH		0x01
+#define NS_GZIP_FINISH		0x02
+#define NS_GZIP_FREE		0x04
+
 #define NS_AOLSERVER_3_PLUS
 #define NS_UNAUTHORIZED		(-2)
 #define NS_FORBIDDEN		(-3)
@@ -115,6 +119,9 @@
 #define NS_SCHED_WEEKLY		  8
 #define NS_SCHED_PAUSED		 16 
 #define NS_SCHED_RUNNING	 32 
+#define NS_SCHED_SKIP		 64
+#define NS_SCHED_QUEUE		128
+#define NS_SCHED_PARALLEL	256
 
 #define NS_SOCK_READ	 	0x01 
 #define NS_SOCK_WRITE		0x02
@@ -270,6 +277,8 @@ typedef struct _Ns_Cache	*Ns_Cache;
 typedef struct _Ns_Entry	*Ns_Entry;
 typedef Tcl_HashSearch 		 Ns_CacheSearch;
 typedef struct _Ns_Cls 		*Ns_Cls;
+typedef struct _Ns_Arena	*Ns_Arena;
+typedef struct _Ns_TimerWheel	*Ns_TimerWheel;
 typedef void 	      		*Ns_OpContext;
 typedef struct _Ns_TaskQueue 	*Ns_TaskQueue;
 typedef struct _Ns_Task 	*Ns_Task;
@@ -324,6 +333,8 @@ typedef int   (Ns_LogFlushProc) (char *msg, size_t len);
 typedef int   (Ns_LogProc) (Ns_DString *dsPtr, Ns_LogSeverity severity,
 			    char * fmt, va_list ap);
 typedef int   (Ns_GzipProc)(char *buf, int len, int level, Tcl_DString *dsPtr);
+typedef int   (Ns_GzipStreamProc)(void **ctxPtr, char *buf, int len,
+			int level, int flags, Tcl_DString *dsPtr);
 
 /*
  * The field of a key-value data structure.
@@ -343,8 +354,24 @@ typedef struct Ns_Set {
     int          size;
     int          maxSize;
     Ns_SetField *fields;
+    Ns_Arena    *arena;		/* Arena for set memory, if any. */
+    struct SetIndex *index;	/* Hash index of keys, if any. */
 } Ns_Set;
 
+/*
+ * The following structure defines a timer in an Ns_TimerWheel, usually
+ * embedded in some larger structure.
+ */
+
+typedef struct Ns_Timer {
+    struct Ns_Timer *nextPtr;
+    struct Ns_Timer *prevPtr;	/* NULL unless pending. */
+    Ns_Time          expires;	/* Absolute expiry time. */
+    void            *arg;	/* Client data. */
+} Ns_Timer;
+
+#define Ns_TimerPending(t)	((t)->prevPtr != NULL)
+
 /*
  * The request structure.
  */
@@ -391,6 +418,26 @@ typedef struct Ns_ConnFile {
     off_t   length;
 } Ns_ConnFile;
 
+/*
+ * The following structure defines a request for Ns_HttpMulti.  The
+ * caller sets the first fields and initializes the content string;
+ * the remaining fields are set with the result.
+ */
+
+typedef struct Ns_HttpReq {
+    char       *method;		/* Method or NULL for GET. */
+    char       *url;
+    Ns_Set     *headers;	/* Request headers or NULL. */
+    char       *body;		/* Request content or NULL. */
+    int         length;
+    int         done;		/* Response read completely. */
+    int         status;		/* HTTP status code. */
+    char       *error;		/* Error message or NULL. */
+    Ns_Time     elapsed;
+    Ns_Set     *rheaders;	/* Set for response headers or NULL. */
+    Ns_DString  content;	/* Response content. */
+} Ns_HttpReq;
+
 /*
  * The index data structure.  This is a linear array of values.
  */
@@ -520,6 +567,18 @@ NS_EXTERN int Ns_AdpRegisterParser(char *extension, Ns_AdpParserProc *proc);
 NS_EXTERN int Ns_AdpRequest(Ns_Conn *conn, char *file);
 NS_EXTERN int Ns_AdpRequestEx(Ns_Conn *conn, char *file, Ns_Time *ttlPtr);
 
+/*
+ * arena.c:
+ */
+
+NS_EXTERN Ns_Arena *Ns_ArenaCreate(void);
+NS_EXTERN void Ns_ArenaDestroy(Ns_Arena *arena);
+NS_EXTERN void *Ns_ArenaAlloc(Ns_Arena *arena, size_t size);
+NS_EXTERN char *Ns_ArenaStrDup(Ns_Arena *arena, char *string);
+NS_EXTERN void Ns_ArenaReset(Ns_Arena *arena);
+NS_EXTERN void Ns_ArenaStats(Ns_Arena *arena, size_t *usedPtr,
+			     int *chunksPtr);
+
 /*
  * auth.c:
  */
@@ -595,6 +654,9 @@ NS_EXTERN void Ns_ClsSet(Ns_Cls *clsPtr, Ns_Conn *conn, void *data);
 
 NS_EXTERN void Ns_SetGzipProc(Ns_GzipProc *procPtr);
 NS_EXTERN int Ns_Gzip(char *buf, int len, int level, Tcl_DString *dsPtr);
+NS_EXTERN void Ns_SetGzipStreamProc(Ns_GzipStreamProc *procPtr);
+NS_EXTERN int Ns_GzipStream(void **ctxPtr, char *buf, int len, int level,
+			    int flags, Tcl_DString *dsPtr);
 
 /*
  * config.c:
@@ -651,11 +713,15 @@ NS_EXTERN int Ns_ConnModifiedSince(Ns_Conn *conn, time_t inTime);
 NS_EXTERN char *Ns_ConnGets(char *outBuffer, size_t inSize, Ns_Conn *conn);
 NS_EXTERN int Ns_ConnReadHeaders(Ns_Conn *conn, Ns_Set *set, int *nreadPtr);
 NS_EXTERN int Ns_ParseHeader(Ns_Set *set, char *header, Ns_HeaderCaseDisposition disp);
+NS_EXTERN int Ns_ParseHeaders(Ns_Set *set, char *headers,
+			      Ns_HeaderCaseDisposition disp);
 NS_EXTERN int Ns_QueryToSet(char *query, Ns_Set *qset);
 NS_EXTERN Ns_Set *Ns_ConnHeaders(Ns_Conn *conn);
 NS_EXTERN Ns_Set *Ns_ConnOutputHeaders(Ns_Conn *conn);
 NS_EXTERN char *Ns_ConnAuthUser(Ns_Conn *conn);
 NS_EXTERN char *Ns_ConnAuthPasswd(Ns_Conn *conn);
+NS_EXTERN Ns_Arena *Ns_ConnArena(Ns_Conn *conn);
+NS_EXTERN void *Ns_ConnAlloc(Ns_Conn *conn, size_t size);
 NS_EXTERN int Ns_ConnContentLength(Ns_Conn *conn);
 NS_EXTERN int Ns_ConnContentAvail(Ns_Conn *conn);
 NS_EXTERN char *Ns_ConnContent(Ns_Conn *conn);
@@ -831,6 +897,7 @@ NS_EXTERN double Ns_DRand(void);
  */
 
 NS_EXTERN Ns_TaskQueue *Ns_CreateTaskQueue(char *name);
+NS_EXTERN Ns_TaskQueue *Ns_CreateTaskQueueEx(char *name, int nthreads);
 NS_EXTERN void Ns_DestroyTaskQueue(Ns_TaskQueue *queue);
 NS_EXTERN Ns_Task *Ns_TaskCreate(SOCKET sock, Ns_TaskProc *proc, void *arg);
 NS_EXTERN int  Ns_TaskEnqueue(Ns_Task *task, Ns_TaskQueue *queue);
@@ -838,6 +905,7 @@ NS_EXTERN void  Ns_TaskRun(Ns_Task *task);
 NS_EXTERN void Ns_TaskCallback(Ns_Task *task, int when, Ns_Time *timeoutPtr);
 NS_EXTERN void Ns_TaskDone(Ns_Task *task);
 NS_EXTERN int  Ns_TaskCancel(Ns_Task *task);
+NS_EXTERN int  Ns_TaskResume(Ns_Task *task, int when);
 NS_EXTERN int  Ns_TaskWait(Ns_Task *task, Ns_Time *timeoutPtr);
 NS_EXTERN SOCKET Ns_TaskFree(Ns_Task *task);
 
@@ -1079,6 +1147,8 @@ NS_EXTERN int Ns_ScheduleWeekly(Ns_SchedProc *proc, void *arg, int flags,
 			     Ns_SchedProc *cleanupProc);
 NS_EXTERN int Ns_ScheduleProcEx(Ns_SchedProc *proc, void *arg, int flags,
 			     int interval, Ns_SchedProc *cleanupProc);
+NS_EXTERN int Ns_ScheduleProcTime(Ns_SchedProc *proc, void *arg, int flags,
+			     Ns_Time *intervalPtr, Ns_SchedProc *cleanupProc);
 NS_EXTERN void Ns_UnscheduleProc(int id);
 
 /*
@@ -1087,8 +1157,10 @@ NS_EXTERN void Ns_UnscheduleProc(int id);
 
 NS_EXTERN void Ns_SetUpdate(Ns_Set *set, char *key, char *value);
 NS_EXTERN Ns_Set *Ns_SetCreate(char *name);
+NS_EXTERN Ns_Set *Ns_SetCreateInArena(Ns_Arena *arena, char *name);
 NS_EXTERN void Ns_SetFree(Ns_Set *set);
 NS_EXTERN int Ns_SetPut(Ns_Set *set, char *key, char *value);
+NS_EXTERN int Ns_SetPutRef(Ns_Set *set, char *key, char *value);
 NS_EXTERN int Ns_SetUniqueCmp(Ns_Set *set, char *key, int (*cmp) (char *s1,
 			   char *s2));
 NS_EXTERN int Ns_SetFindCmp(Ns_Set *set, char *key, int (*cmp) (char *s1,
@@ -1195,6 +1267,13 @@ NS_EXTERN int Ns_TclGetOpenChannel(Tcl_Interp *interp, char *chanId, int write,
 NS_EXTERN int Ns_TclGetOpenFd(Tcl_Interp *interp, char *chanId, int write,
 			   int *fdPtr);
 
+/*
+ * tclhttp.c:
+ */
+
+NS_EXTERN int Ns_HttpMulti(Ns_HttpReq *reqs, int nreqs, int nwait,
+			   Ns_Time *timeoutPtr);
+
 /*
  * tclinit.c:
  */
@@ -1238,6 +1317,20 @@ NS_EXTERN Ns_Set *Ns_TclGetSet(Tcl_Interp *interp, char *setId);
 NS_EXTERN int Ns_TclGetSet2(Tcl_Interp *interp, char *setId, Ns_Set **setPtrPtr);
 NS_EXTERN int Ns_TclFreeSet(Tcl_Interp *interp, char *setId);
 
+/*
+ * timer.c:
+ */
+
+NS_EXTERN Ns_TimerWheel *Ns_TimerWheelCreate(Ns_Time *nowPtr);
+NS_EXTERN void Ns_TimerWheelDestroy(Ns_TimerWheel *wheel);
+NS_EXTERN int Ns_TimerWheelNext(Ns_TimerWheel *wheel, Ns_Time *nextPtr);
+NS_EXTERN Ns_Timer *Ns_TimerWheelExpire(Ns_TimerWheel *wheel,
+					Ns_Time *nowPtr);
+NS_EXTERN void Ns_TimerInit(Ns_Timer *timerPtr, void *arg);
+NS_EXTERN void Ns_TimerAdd(Ns_TimerWheel *wheel, Ns_Timer *timerPtr,
+			   Ns_Time *expiresPtr);
+NS_EXTERN int Ns_TimerCancel(Ns_TimerWheel *wheel, Ns_Timer *timerPtr);
+
 /*
  * time.c:
  */
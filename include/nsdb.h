@@ -84,7 +84,11 @@ typedef enum {
     DbFn_SpExec,
     DbFn_SpReturnCode,
     DbFn_SpGetParams,
-    DbFn_End
+    DbFn_End,
+    DbFn_PrepareStmt,
+    DbFn_ExecStmt,
+    DbFn_FreeStmt,
+    DbFn_GetRows
 } Ns_DbProcId;
 
 /*
@@ -118,6 +122,22 @@ typedef struct Ns_DbHandle {
     int         fetchingRows;
 } Ns_DbHandle;
 
+/*
+ * The following structure is a columnar buffer of rows fetched
+ * in batches with Ns_DbGetRows.  Values are stored NUL terminated
+ * in the data string at the offsets given by column major index
+ * col * maxrows + row, with an offset of -1 for an SQL NULL.
+ */
+
+typedef struct Ns_DbRows {
+    int         ncols;
+    int         nrows;
+    int         maxrows;
+    int        *offsets;
+    int        *lengths;
+    Ns_DString  data;
+} Ns_DbRows;
+
 /*
  * The following structure is no longer supported and only provided to
  * allow existing database modules to compile.  All of the TableInfo
@@ -141,8 +161,19 @@ NS_EXTERN char *Ns_DbDriverDbType(Ns_DbHandle *handle);
 NS_EXTERN int Ns_DbDML(Ns_DbHandle *handle, char *sql);
 NS_EXTERN Ns_Set *Ns_DbSelect(Ns_DbHandle *handle, char *sql);
 NS_EXTERN int Ns_DbExec(Ns_DbHandle *handle, char *sql);
+NS_EXTERN int Ns_DbDMLBind(Ns_DbHandle *handle, char *sql, Ns_Set *bind);
+NS_EXTERN Ns_Set *Ns_DbSelectBind(Ns_DbHandle *handle, char *sql,
+				  Ns_Set *bind);
+NS_EXTERN int Ns_DbExecBind(Ns_DbHandle *handle, char *sql, Ns_Set *bind);
 NS_EXTERN Ns_Set *Ns_DbBindRow(Ns_DbHandle *handle);
 NS_EXTERN int Ns_DbGetRow(Ns_DbHandle *handle, Ns_Set *row);
+NS_EXTERN int Ns_DbGetRows(Ns_DbHandle *handle, Ns_DbRows *rowsPtr);
+NS_EXTERN void Ns_DbRowsInit(Ns_DbRows *rowsPtr, int maxrows);
+NS_EXTERN void Ns_DbRowsFree(Ns_DbRows *rowsPtr);
+NS_EXTERN void Ns_DbRowsPutValue(Ns_DbRows *rowsPtr, int row, int col,
+				 char *value, int len);
+NS_EXTERN char *Ns_DbRowsGetValue(Ns_DbRows *rowsPtr, int row, int col,
+				  int *lenPtr);
 NS_EXTERN int Ns_DbFlush(Ns_DbHandle *handle);
 NS_EXTERN int Ns_DbCancel(Ns_DbHandle *handle);
 NS_EXTERN int Ns_DbResetHandle(Ns_DbHandle *handle);
@@ -154,6 +185,12 @@ NS_EXTERN int Ns_DbSpReturnCode(Ns_DbHandle *handle, char *returnCode,
 			     int bufsize);
 NS_EXTERN Ns_Set *Ns_DbSpGetParams(Ns_DbHandle *handle);
 
+/*
+ * dbcache.c:
+ */
+
+NS_EXTERN void Ns_DbCacheInvalidate(char *tag);
+
 /*
  * dbinit.c:
  */
@@ -170,6 +207,7 @@ NS_EXTERN int Ns_DbPoolGetMultipleHandles(Ns_DbHandle **handles, char *pool,
 NS_EXTERN int Ns_DbPoolTimedGetMultipleHandles(Ns_DbHandle **handles, char *pool,
 					    int nwant, int wait);
 NS_EXTERN int Ns_DbBouncePool(char *pool);
+NS_EXTERN int Ns_DbPoolStats(char *pool, Ns_DString *dsPtr);
 
 /*
  * dbtcl.c:
@@ -185,6 +223,10 @@ NS_EXTERN int Ns_TclDbGetHandle(Tcl_Interp *interp, char *handleId,
 NS_EXTERN void Ns_DbQuoteValue(Ns_DString *pds, char *string);
 NS_EXTERN Ns_Set *Ns_Db0or1Row(Ns_DbHandle *handle, char *sql, int *nrows);
 NS_EXTERN Ns_Set *Ns_Db1Row(Ns_DbHandle *handle, char *sql);
+NS_EXTERN Ns_Set *Ns_Db0or1RowBind(Ns_DbHandle *handle, char *sql,
+				   Ns_Set *bind, int *nrows);
+NS_EXTERN Ns_Set *Ns_Db1RowBind(Ns_DbHandle *handle, char *sql,
+				Ns_Set *bind);
 NS_EXTERN int Ns_DbInterpretSqlFile(Ns_DbHandle *handle, char *filename);
 NS_EXTERN void Ns_DbSetException(Ns_DbHandle *handle, char *code, char *msg);
 
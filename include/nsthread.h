@@ -204,6 +204,8 @@ NS_EXTERN void *ns_calloc(size_t num, size_t size) _nsmalloc;
 NS_EXTERN void ns_free(void *buf);
 NS_EXTERN void *ns_realloc(void *buf, size_t size);
 NS_EXTERN char *ns_strdup(const char *string) _nsmalloc;
+NS_EXTERN void Ns_MemorySetCache(int enable);
+NS_EXTERN void Ns_MemoryList(Tcl_DString *dsPtr);
 NS_EXTERN char *ns_strcopy(const char *string) _nsmalloc;
 
 /*
@@ -218,6 +220,8 @@ NS_EXTERN void Ns_MutexUnlock(Ns_Mutex *mutexPtr);
 NS_EXTERN void Ns_MutexSetName(Ns_Mutex *mutexPtr, char *name);
 NS_EXTERN void Ns_MutexSetName2(Ns_Mutex *mutexPtr, char *prefix, char *name);
 NS_EXTERN void Ns_MutexList(Tcl_DString *dsPtr);
+NS_EXTERN void Ns_MutexSetSpin(int spin);
+NS_EXTERN void Ns_MutexSetProfile(int enabled);
 
 /*
  * rwlock.c:
@@ -0,0 +1,333 @@
+/*
+ * The contents of this file are subject to the AOLserver Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://aolserver.com/.
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is AOLserver Code and related documentation
+ * distributed by AOL.
+ * 
+ * The Initial Developer of the Original Code is America Online,
+ * Inc. Portions created by AOL are Copyright (C) 1999 America Online,
+ * Inc. All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+
+
+/*
+ * arena.c --
+ *
+ *	Arena allocator for memory with a common lifetime, e.g., the
+ *	headers and other data of a connection.  Memory is allocated
+ *	from chunks which are only freed together when the arena is
+ *	reset or destroyed.
+ */
+
+#include "nsd.h"
+
+/*
+ * The following structure is the header of each chunk of memory.
+ */
+
+typedef struct Chunk {
+    struct Chunk   *nextPtr;	/* Next chunk in arena. */
+    size_t	    size;	/* Size of memory after header. */
+} Chunk;
+
+#define ALIGN(n)	(((n) + 7) & ~((size_t) 7))
+#define CHUNKHDR	ALIGN(sizeof(Chunk))
+#define CHUNKDATA(c)	((char *) (c) + CHUNKHDR)
+#define CHUNKSIZE	8192
+
+/*
+ * Local functions defined in this file
+ */
+
+static void *AllocChunk(Arena *arenaPtr, size_t size);
+static void FreeChunks(Arena *arenaPtr);
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ArenaCreate --
+ *
+ *	Create a new, empty arena.
+ *
+ * Results:
+ *	Pointer to Ns_Arena.
+ *
+ * Side effects:
+ *	Free with Ns_ArenaDestroy.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Arena *
+Ns_ArenaCreate(void)
+{
+    return (Ns_Arena *) ns_calloc(1, sizeof(Arena));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ArenaDestroy --
+ *
+ *	Free an arena and all memory allocated from it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_ArenaDestroy(Ns_Arena *arena)
+{
+    FreeChunks((Arena *) arena);
+    ns_free(arena);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ArenaAlloc --
+ *
+ *	Allocate memory from an arena.
+ *
+ * Results:
+ *	Pointer to memory aligned for any basic type.
+ *
+ * Side effects:
+ *	A new chunk may be allocated.  Memory is only freed when the
+ *	arena is reset or destroyed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void *
+Ns_ArenaAlloc(Ns_Arena *arena, size_t size)
+{
+    Arena *arenaPtr = (Arena *) arena;
+    char *ptr;
+
+    size = ALIGN(size);
+    arenaPtr->used += size;
+    if ((size_t) (arenaPtr->end - arenaPtr->next) < size) {
+	return AllocChunk(arenaPtr, size);
+    }
+    ptr = arenaPtr->next;
+    arenaPtr->next += size;
+    return ptr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ArenaStrDup --
+ *
+ *	Copy a string into an arena.
+ *
+ * Results:
+ *	Pointer to copy or NULL if string is NULL.
+ *
+ * Side effects:
+ *	See Ns_ArenaAlloc.
+ *
+ *----------------------------------------------------------------------
+ */
+
+char *
+Ns_ArenaStrDup(Ns_Arena *arena, char *string)
+{
+    size_t len;
+
+    if (string == NULL) {
+	return NULL;
+    }
+    len = strlen(string) + 1;
+    return memcpy(Ns_ArenaAlloc(arena, len), string, len);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ArenaReset --
+ *
+ *	Free all memory allocated from an arena, keeping one chunk
+ *	for reuse.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_ArenaReset(Ns_Arena *arena)
+{
+    Arena *arenaPtr = (Arena *) arena;
+    Chunk *chunkPtr, *nextPtr, *keepPtr;
+
+    keepPtr = NULL;
+    chunkPtr = arenaPtr->firstPtr;
+    while (chunkPtr != NULL) {
+	nextPtr = chunkPtr->nextPtr;
+	if (keepPtr == NULL && chunkPtr->size == CHUNKSIZE) {
+	    keepPtr = chunkPtr;
+	} else {
+	    ns_free(chunkPtr);
+	}
+	chunkPtr = nextPtr;
+    }
+    arenaPtr->firstPtr = keepPtr;
+    arenaPtr->used = 0;
+    if (keepPtr == NULL) {
+	arenaPtr->next = arenaPtr->end = NULL;
+    } else {
+	keepPtr->nextPtr = NULL;
+	arenaPtr->next = CHUNKDATA(keepPtr);
+	arenaPtr->end = arenaPtr->next + CHUNKSIZE;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ArenaStats --
+ *
+ *	Get the bytes allocated from an arena since it was created or
+ *	last reset and the number of chunks it holds, i.e., the calls
+ *	to ns_malloc made for the arena.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Stats are returned in usedPtr and chunksPtr if not NULL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_ArenaStats(Ns_Arena *arena, size_t *usedPtr, int *chunksPtr)
+{
+    Arena *arenaPtr = (Arena *) arena;
+    Chunk *chunkPtr;
+    int    nchunks;
+
+    if (usedPtr != NULL) {
+	*usedPtr = arenaPtr->used;
+    }
+    if (chunksPtr != NULL) {
+	nchunks = 0;
+	for (chunkPtr = arenaPtr->firstPtr; chunkPtr != NULL;
+		chunkPtr = chunkPtr->nextPtr) {
+	    ++nchunks;
+	}
+	*chunksPtr = nchunks;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeChunks --
+ *
+ *	Free all chunks of an arena.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Arena is left empty but valid.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeChunks(Arena *arenaPtr)
+{
+    Chunk *chunkPtr;
+
+    while ((chunkPtr = arenaPtr->firstPtr) != NULL) {
+	arenaPtr->firstPtr = chunkPtr->nextPtr;
+	ns_free(chunkPtr);
+    }
+    arenaPtr->next = arenaPtr->end = NULL;
+    arenaPtr->used = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AllocChunk --
+ *
+ *	Allocate memory which does not fit in the current chunk.  Large
+ *	requests get a chunk of their own, linked after the current
+ *	chunk so its remaining memory is still used.  Otherwise, a new
+ *	chunk becomes the current chunk.
+ *
+ * Results:
+ *	Pointer to memory.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+AllocChunk(Arena *arenaPtr, size_t size)
+{
+    Chunk *chunkPtr;
+
+    if (size > CHUNKSIZE / 4) {
+	chunkPtr = ns_malloc(CHUNKHDR + size);
+	chunkPtr->size = size;
+	if (arenaPtr->firstPtr == NULL) {
+	    chunkPtr->nextPtr = NULL;
+	    arenaPtr->firstPtr = chunkPtr;
+	} else {
+	    chunkPtr->nextPtr = arenaPtr->firstPtr->nextPtr;
+	    arenaPtr->firstPtr->nextPtr = chunkPtr;
+	}
+	return CHUNKDATA(chunkPtr);
+    }
+    chunkPtr = ns_malloc(CHUNKHDR + CHUNKSIZE);
+    chunkPtr->size = CHUNKSIZE;
+    chunkPtr->nextPtr = arenaPtr->firstPtr;
+    arenaPtr->firstPtr = chunkPtr;
+    arenaPtr->next = CHUNKDATA(chunkPtr) + size;
+    arenaPtr->end = CHUNKDATA(chunkPtr) + CHUNKSIZE;
+    return CHUNKDATA(chunkPtr);
+}
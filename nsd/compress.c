@@ -37,7 +37,21 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd
 
 #include "nsd.h"
 
+/*
+ * The following structure defines a cached gzip output, stored after
+ * the original content which is compared on lookup.
+ */
+
+typedef struct Gzip {
+    int      len;		/* Length of original content. */
+    int      gzlen;		/* Length of gzip output. */
+    Ns_Time  time;		/* Time spent compressing. */
+    char    *gzip;		/* Gzip output following content. */
+    char     bytes[1];		/* Grown to content plus gzip output. */
+} Gzip;
+
 static Ns_GzipProc *gzipProcPtr;
+static Ns_GzipStreamProc *streamProcPtr;
 
 
 /*
@@ -89,7 +103,225 @@ Ns_SetGzipProc(Ns_GzipProc *procPtr)
     gzipProcPtr = procPtr;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_GzipStream --
+ *
+ *      Compress the next part of a gzip stream.  The stream context
+ *	at ctxPtr, which must initially be NULL, is created on the
+ *	first call.  With NS_GZIP_FLUSH, all output so far is flushed
+ *	on a byte boundary so the client can decompress it, and with
+ *	NS_GZIP_FINISH the stream is ended.  NS_GZIP_FREE discards
+ *	an unfinished stream.
+ *
+ * Results:
+ *      Result of external compress proc, if any, otherwise NS_ERROR.
+ *
+ * Side effects:
+ *      Will append compressed content to given Tcl_DString.  The
+ *	context is freed and reset to NULL on finish, free, or error.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_GzipStream(void **ctxPtr, char *buf, int len, int level, int flags,
+	      Tcl_DString *dsPtr)
+{
+    if (streamProcPtr != NULL) {
+	return (*streamProcPtr)(ctxPtr, buf, len, level, flags, dsPtr);
+    }
+    return NS_ERROR;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_SetGzipStreamProc --
+ *
+ *      Set the global procedure for stream compression.  Called by
+ *	the nszlib module when loaded.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Later calls to Ns_GzipStream will use given function.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_SetGzipStreamProc(Ns_GzipStreamProc *procPtr)
+{
+    streamProcPtr = procPtr;
+}
+
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsGzipCache --
+ *
+ *      Create the gzip output cache for a server.
+ *
+ * Results:
+ *      Pointer to Ns_Cache.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Cache *
+NsGzipCache(char *server, int size)
+{
+    Ns_DString ds;
+    Ns_Cache  *cache;
+
+    Ns_DStringInit(&ds);
+    Ns_DStringVarAppend(&ds, "nsgzip:", server, NULL);
+    cache = Ns_CacheCreateSz(ds.string, TCL_STRING_KEYS, (size_t) size,
+			     ns_free);
+    Ns_DStringFree(&ds);
+    return cache;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsGzip --
+ *
+ *      Compress content at the server gzip level, reusing the output
+ *	for identical content in the server gzip cache, if enabled.
+ *	Content is keyed by a hash of its bytes and length and compared
+ *	in full on lookup.
+ *
+ * Results:
+ *      See Ns_Gzip.
+ *
+ * Side effects:
+ *      Output is added to the cache and hit and time stats are
+ *	updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsGzip(NsServer *servPtr, char *buf, int len, Tcl_DString *dsPtr)
+{
+    Ns_Cache      *cache = servPtr->gzip.cache;
+    Ns_Entry      *entry;
+    Gzip          *gzPtr;
+    Ns_Time        start, end, diff;
+    unsigned int   hash;
+    char           key[40];
+    int            i, new, status;
+
+    if (cache == NULL) {
+	return Ns_Gzip(buf, len, servPtr->opts.gziplevel, dsPtr);
+    }
+
+    /*
+     * FNV-1a hash of the content.
+     */
+
+    hash = 2166136261U;
+    for (i = 0; i < len; ++i) {
+	hash = (hash ^ UCHAR(buf[i])) * 16777619U;
+    }
+    sprintf(key, "%x:%d", hash, len);
+
+    Ns_CacheLock(cache);
+    entry = Ns_CacheFindEntry(cache, key);
+    if (entry != NULL) {
+	gzPtr = Ns_CacheGetValue(entry);
+	if (gzPtr != NULL && gzPtr->len == len
+		&& memcmp(gzPtr->bytes, buf, (size_t) len) == 0) {
+	    Tcl_DStringAppend(dsPtr, gzPtr->gzip, gzPtr->gzlen);
+	    ++servPtr->gzip.nhits;
+	    Ns_IncrTime(&servPtr->gzip.saved, gzPtr->time.sec,
+			gzPtr->time.usec);
+	    Ns_CacheUnlock(cache);
+	    return NS_OK;
+	}
+    }
+    Ns_CacheUnlock(cache);
+
+    /*
+     * Compress and cache the content and output.
+     */
+
+    i = Tcl_DStringLength(dsPtr);
+    Ns_GetTime(&start);
+    status = Ns_Gzip(buf, len, servPtr->opts.gziplevel, dsPtr);
+    Ns_GetTime(&end);
+    Ns_DiffTime(&end, &start, &diff);
+    if (status != NS_OK) {
+	return status;
+    }
+    gzPtr = ns_malloc(sizeof(Gzip) + (size_t) len
+		      + (size_t) (Tcl_DStringLength(dsPtr) - i));
+    gzPtr->len = len;
+    gzPtr->gzlen = Tcl_DStringLength(dsPtr) - i;
+    gzPtr->time = diff;
+    gzPtr->gzip = gzPtr->bytes + len;
+    memcpy(gzPtr->bytes, buf, (size_t) len);
+    memcpy(gzPtr->gzip, dsPtr->string + i, (size_t) gzPtr->gzlen);
+    Ns_CacheLock(cache);
+    entry = Ns_CacheCreateEntry(cache, key, &new);
+    Ns_CacheSetValueSz(entry, gzPtr, (size_t) (len + gzPtr->gzlen));
+    ++servPtr->gzip.nmisses;
+    Ns_IncrTime(&servPtr->gzip.spent, diff.sec, diff.usec);
+    Ns_CacheUnlock(cache);
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclGzipStatsObjCmd --
+ *
+ *      Implements ns_server gzipstats, returning the gzip cache hits
+ *	and misses, the time spent compressing misses, and the
+ *	compression time saved by hits.
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclGzipStatsObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
+		     Tcl_Obj *CONST objv[])
+{
+    NsServer *servPtr = ((NsInterp *) arg)->servPtr;
+    char      buf[200];
+
+    if (servPtr->gzip.cache == NULL) {
+	return TCL_OK;
+    }
+    Ns_CacheLock(servPtr->gzip.cache);
+    sprintf(buf, "hits %lu misses %lu spent %ld.%06ld saved %ld.%06ld",
+	    servPtr->gzip.nhits, servPtr->gzip.nmisses,
+	    servPtr->gzip.spent.sec, servPtr->gzip.spent.usec,
+	    servPtr->gzip.saved.sec, servPtr->gzip.saved.usec);
+    Ns_CacheUnlock(servPtr->gzip.cache);
+    Tcl_SetResult(interp, buf, TCL_VOLATILE);
+    return TCL_OK;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -137,6 +137,54 @@ Ns_ConnAuthPasswd(Ns_Conn *conn)
     return conn->authPasswd;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ConnArena --
+ *
+ *	Get the arena for memory with the lifetime of the connection.
+ *
+ * Results:
+ *	Pointer to Ns_Arena.
+ *
+ * Side effects:
+ *	The arena is reset when the connection is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Arena *
+Ns_ConnArena(Ns_Conn *conn)
+{
+    Conn *connPtr = (Conn *) conn;
+
+    return (Ns_Arena *) &connPtr->arena;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ConnAlloc --
+ *
+ *	Allocate memory from the connection arena.
+ *
+ * Results:
+ *	Pointer to memory.
+ *
+ * Side effects:
+ *	Memory is freed when the connection is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void *
+Ns_ConnAlloc(Ns_Conn *conn, size_t size)
+{
+    return Ns_ArenaAlloc(Ns_ConnArena(conn), size);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -1032,24 +1080,25 @@ NsTclConnObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     Tcl_HashSearch search;
     Ns_ConnFile	 *filePtr;
     int		  idx, off, len, flag, fd;
+    size_t	  size;
     char	 *content;
 
     static CONST char *opts[] = {
-         "authpassword", "authuser", "channel", "close",
+         "arena", "authpassword", "authuser", "channel", "close",
 	 "contentavail", "content", "contentlength", "contentsentlength",
 	 "contentchannel", "copy", "driver", "encoding", "files",
 	 "fileoffset", "filelength", "fileheaders", "flags", "form",
-	 "headers", "host", "id", "isconnected", "location", "method",
+	 "gzip", "headers", "host", "id", "isconnected", "location", "method",
 	 "outputheaders", "peeraddr", "peerport", "port", "protocol",
 	 "query", "request", "server", "sock", "start", "status",
 	 "url", "urlc", "urlencoding", "urlv", "version",
 	 "write_encoded", "interp", NULL
     };
     enum {
-	 CAuthPasswordIdx, CAuthUserIdx, CChannelIdx, CCloseIdx, CAvailIdx, CContentIdx,
+	 CArenaIdx, CAuthPasswordIdx, CAuthUserIdx, CChannelIdx, CCloseIdx, CAvailIdx, CContentIdx,
 	 CContentLengthIdx, CContentSentLenIdx, CContentChannelIdx, CCopyIdx, CDriverIdx,
 	 CEncodingIdx, CFilesIdx, CFileOffIdx, CFileLenIdx,
-	 CFileHdrIdx, CFlagsIdx, CFormIdx, CHeadersIdx, CHostIdx,
+	 CFileHdrIdx, CFlagsIdx, CFormIdx, CGzipIdx, CHeadersIdx, CHostIdx,
 	 CIdIdx, CIsConnectedIdx, CLocationIdx, CMethodIdx,
 	 COutputHeadersIdx, CPeerAddrIdx, CPeerPortIdx, CPortIdx,
 	 CProtocolIdx, CQueryIdx, CRequestIdx, CServerIdx, CSockIdx,
@@ -1098,6 +1147,17 @@ NsTclConnObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    }
 	    break;
 
+	case CArenaIdx:
+	    Ns_ArenaStats(Ns_ConnArena(conn), &size, &idx);
+	    Tcl_ListObjAppendElement(interp, result,
+				     Tcl_NewStringObj("bytes", -1));
+	    Tcl_ListObjAppendElement(interp, result,
+				     Tcl_NewLongObj((long) size));
+	    Tcl_ListObjAppendElement(interp, result,
+				     Tcl_NewStringObj("chunks", -1));
+	    Tcl_ListObjAppendElement(interp, result, Tcl_NewIntObj(idx));
+	    break;
+
 	case CAuthUserIdx:
 	    Tcl_SetResult(interp, connPtr->authUser, TCL_STATIC);
 	    break;
@@ -1275,6 +1335,16 @@ NsTclConnObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    }
 	    break;
 
+        case CGzipIdx:
+	    if (objc > 2) {
+		if (Tcl_GetBooleanFromObj(interp, objv[2], &flag) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                Ns_ConnSetGzipFlag(conn, flag);
+           }
+	   Tcl_SetBooleanObj(result, Ns_ConnGetGzipFlag(conn));
+           break;
+
         case CWriteEncodedIdx:
 	    if (objc > 2) {
 		if (Tcl_GetBooleanFromObj(interp, objv[2], &flag) != TCL_OK) {
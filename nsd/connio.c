@@ -47,6 +47,8 @@ static int ConnSend(Ns_Conn *conn, int nsend, Tcl_Channel chan,
         FILE *fp, int fd, off_t off);
 static int ConnCopy(Ns_Conn *conn, size_t ncopy, Ns_DString *dsPtr,
         Tcl_Channel chan, FILE *fp, int fd);
+static int ConnGzip(Conn *connPtr, char *buf, int len, int flags,
+	Tcl_DString *dsPtr);
  
 
 /*
@@ -91,8 +93,25 @@ int
 Ns_ConnClose(Ns_Conn *conn)
 {
     Conn             *connPtr = (Conn *)conn;
+    Tcl_DString	      gzip;
     int		      keep;
     
+    /*
+     * Finish a gzip stream started for unchunked output, e.g., with
+     * ns_headers and ns_write.  A chunked stream not ended by a
+     * final flush is incomplete and simply discarded.
+     */
+
+    if (connPtr->gzip != NULL) {
+	if (connPtr->sockPtr != NULL && !(conn->flags & NS_CONN_CHUNK)) {
+	    Tcl_DStringInit(&gzip);
+	    if (ConnGzip(connPtr, NULL, 0, NS_GZIP_FINISH, &gzip) == NS_OK) {
+		(void) Ns_ConnWrite(conn, gzip.string, gzip.length);
+	    }
+	    Tcl_DStringFree(&gzip);
+	}
+	ConnGzip(connPtr, NULL, 0, NS_GZIP_FREE, NULL);
+    }
     if (connPtr->sockPtr != NULL) {
 	Ns_GetTime(&connPtr->times.close);
 	keep = (conn->flags & NS_CONN_KEEPALIVE) ? 1 : 0;
@@ -132,7 +151,6 @@ Ns_ConnFlush(Ns_Conn *conn, char *buf, int len, int stream)
     NsServer *servPtr = connPtr->servPtr;
     Tcl_Encoding encoding;
     Tcl_DString  enc, gzip;
-    char *ahdr;
     int status;
 
     Tcl_DStringInit(&enc);
@@ -153,27 +171,43 @@ Ns_ConnFlush(Ns_Conn *conn, char *buf, int len, int stream)
     }
 
     /*
-     * GZIP the content when not streaming if enabled and the content
-     * length is above the minimum.
+     * GZIP the content if enabled and the content length, or the
+     * length of the first chunk when streaming, is above the minimum.
+     * Streamed content is compressed incrementally with each chunk
+     * flushed so the client can decompress what it has received.
      */
 
-    if (!stream
-	    && (conn->flags & NS_CONN_GZIP)
-	    && (servPtr->opts.flags & SERV_GZIP)
-	    && (len > (int) servPtr->opts.gzipmin)
-	    && (ahdr = Ns_SetIGet(conn->headers, "Accept-Encoding")) != NULL
-	    && strstr(ahdr, "gzip") != NULL
-	    && Ns_Gzip(buf, len, servPtr->opts.gziplevel, &gzip) == NS_OK) {
+    status = NS_OK;
+    if (connPtr->gzip == NULL) {
+	if (len > (int) servPtr->opts.gzipmin && NsConnGzipOk(conn)) {
+	    if (!stream) {
+		status = NsGzip(servPtr, buf, len, &gzip);
+	    } else {
+		status = ConnGzip(connPtr, buf, len, NS_GZIP_FLUSH, &gzip);
+	    }
+	    if (status == NS_OK) {
+		buf = gzip.string;
+		len = gzip.length;
+		Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
+	    } else {
+		Tcl_DStringTrunc(&gzip, 0);
+		status = NS_OK;
+	    }
+	}
+    } else if (len > 0 || !stream) {
+	status = ConnGzip(connPtr, buf, len,
+			  stream ? NS_GZIP_FLUSH : NS_GZIP_FINISH, &gzip);
 	buf = gzip.string;
 	len = gzip.length;
-	Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
     }
 
     /*
      * Flush content.
      */
 
-    status = Ns_ConnFlushDirect(conn, buf, len, stream);
+    if (status == NS_OK) {
+	status = Ns_ConnFlushDirect(conn, buf, len, stream);
+    }
     Tcl_DStringFree(&enc);
     Tcl_DStringFree(&gzip);
     return status;
@@ -429,6 +463,20 @@ Ns_ConnWrite(Ns_Conn *conn, void *vbuf, int towrite)
 int
 Ns_WriteConn(Ns_Conn *conn, char *buf, int len)
 {
+    Conn       *connPtr = (Conn *) conn;
+    Tcl_DString gzip;
+    int         status;
+
+    if (connPtr->gzip != NULL && len > 0) {
+	Tcl_DStringInit(&gzip);
+	status = ConnGzip(connPtr, buf, len, NS_GZIP_FLUSH, &gzip);
+	if (status == NS_OK
+		&& Ns_ConnWrite(conn, gzip.string, gzip.length) != gzip.length) {
+	    status = NS_ERROR;
+	}
+	Tcl_DStringFree(&gzip);
+	return status;
+    }
     if (Ns_ConnWrite(conn, buf, len) != len) {
 	return NS_ERROR;
     }
@@ -937,3 +985,115 @@ ConnSend(Ns_Conn *conn, int nsend, Tcl_Channel chan, FILE *fp, int fd,
     }
     return status;
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConnAcceptGzip --
+ *
+ *	Check if the client accepts gzip content encoding.
+ *
+ * Results:
+ *	1 if gzip is accepted, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsConnAcceptGzip(Ns_Conn *conn)
+{
+    char *ahdr;
+
+    ahdr = Ns_SetIGet(conn->headers, "Accept-Encoding");
+    return (ahdr != NULL && strstr(ahdr, "gzip") != NULL);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConnGzipOk --
+ *
+ *	Check if the response may be gzip'ed, i.e., the gzip flag is
+ *	set, the server enables gzip, headers have not yet been sent,
+ *	the content is not already encoded, e.g., a pre-compressed
+ *	file from fastpath, and the client accepts gzip.
+ *
+ * Results:
+ *	1 if output may be gzip'ed, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsConnGzipOk(Ns_Conn *conn)
+{
+    Conn *connPtr = (Conn *) conn;
+
+    return ((conn->flags & NS_CONN_GZIP)
+	    && !(conn->flags & NS_CONN_SENTHDRS)
+	    && (connPtr->servPtr->opts.flags & SERV_GZIP)
+	    && (conn->outputheaders == NULL
+		|| Ns_SetIFind(conn->outputheaders, "Content-Encoding") < 0)
+	    && NsConnAcceptGzip(conn));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConnStartGzip --
+ *
+ *	Start a gzip stream for content written after the headers,
+ *	e.g., with ns_headers and ns_write.  Called before the headers
+ *	are sent so the response can remain uncompressed if the stream
+ *	cannot be started, e.g., without the nszlib module.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR if the stream could not be started.
+ *
+ * Side effects:
+ *	The gzip header is appended to dsPtr for the caller to write
+ *	after the headers.  Later calls to Ns_WriteConn are compressed
+ *	and flushed, and the stream is finished by Ns_ConnClose.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsConnStartGzip(Ns_Conn *conn, Tcl_DString *dsPtr)
+{
+    return ConnGzip((Conn *) conn, "", 0, 0, dsPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ConnGzip --
+ *
+ *	Compress the next part of the connection gzip stream at the
+ *	server gzip level.
+ *
+ * Results:
+ *	See Ns_GzipStream.
+ *
+ * Side effects:
+ *	Stream is created on first call and freed on finish or error.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ConnGzip(Conn *connPtr, char *buf, int len, int flags, Tcl_DString *dsPtr)
+{
+    return Ns_GzipStream(&connPtr->gzip, buf, len,
+			 connPtr->servPtr->opts.gziplevel, flags, dsPtr);
+}
@@ -84,6 +84,7 @@ typedef enum {
     E_RECV,
     E_FDAGAIN,
     E_FDWRITE,
+    E_FDREAD,
     E_FDTRUNC,
     E_FDSEEK,
     E_NOHOST,
@@ -158,6 +159,7 @@ static void SockClose(Sock *sockPtr);
 static void SockRead(Sock *sockPtr);
 static ReadErr SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr);
 static ReadErr SockReadContent(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr);
+static void SetBufLength(Conn *connPtr, int length);
 static int Poll(PollData *pdataPtr, SOCKET sock, int events, Ns_Time *timeoutPtr);
 static Conn *AllocConn(Driver *drvPtr, Ns_Time *nowPtr, Sock *sockPtr);
 static void FreeConn(Conn *connPtr);
@@ -423,6 +425,8 @@ Ns_DriverInit(char *server, char *module, Ns_DriverInitData *init)
     drvPtr->freeSockPtr = NULL;
     sockPtr = ns_malloc(sizeof(Sock) * drvPtr->maxsock);
     for (n = 0; n < drvPtr->maxsock; ++n) {
+	Ns_TimerInit(&sockPtr->timer, sockPtr);
+	Tcl_DStringInit(&sockPtr->pipe);
         sockPtr->nextPtr = drvPtr->freeSockPtr;
         drvPtr->freeSockPtr = sockPtr;
         ++sockPtr;
@@ -943,7 +947,7 @@ DriverThread(void *arg)
     PollData pdata;
     Limits *limitsPtr;
     char drain[1024];
-    Ns_Time now;
+    Ns_Time now, next;
     Sock *waitPtr = NULL;	/* Sock's waiting for I/O events. */
     Sock *readSockPtr = NULL;	/* Sock's to send to reader threads. */
     Sock *preqSockPtr = NULL;	/* Sock's ready for pre-queue callbacks. */
@@ -985,6 +989,7 @@ DriverThread(void *arg)
     pdata.nfds = pdata.maxfds = 0;
     pdata.pfds = NULL;
     pdata.timeoutPtr = NULL;
+    drvPtr->wheel = Ns_TimerWheelCreate(NULL);
     stop = (flags & DRIVER_SHUTDOWN);
     while (!stop || drvPtr->nactive) {
 
@@ -1003,14 +1008,14 @@ DriverThread(void *arg)
 	}
 
 	/*
-	 * Poll waiting sockets, determining the minimum relative timeout.
+	 * Poll waiting sockets, determining the minimum relative timeout
+	 * from the next Sock timer and any queue wait events.
 	 */
 
 	sockPtr = waitPtr;
         while (sockPtr != NULL) {
             if (sockPtr->state != SOCK_QUEWAIT) {
-            	sockPtr->pidx = Poll(&pdata, sockPtr->sock, POLLIN,
-				     &sockPtr->timeout);
+            	sockPtr->pidx = Poll(&pdata, sockPtr->sock, POLLIN, NULL);
 	    } else {
 		/* NB: No client timeout with active queue wait events. */
             	sockPtr->pidx = Poll(&pdata, sockPtr->sock, POLLIN, NULL);
@@ -1024,9 +1029,16 @@ DriverThread(void *arg)
 	    }
             sockPtr = sockPtr->nextPtr;
         }
+	if (Ns_TimerWheelNext(drvPtr->wheel, &next)
+		&& (pdata.timeoutPtr == NULL
+		    || Ns_DiffTime(&next, pdata.timeoutPtr, NULL) < 0)) {
+	    pdata.timeoutPtr = &next;
+	}
 
 	/*
-	 * Poll, drain the trigger pipe if necessary, and get current time.
+	 * Poll, drain the trigger pipe if necessary, get current time,
+	 * and expire Sock timers.  Sock's with expired timers are found
+	 * with Ns_TimerPending() below.
 	 */
 
 	++drvPtr->stats.spins;
@@ -1037,6 +1049,7 @@ DriverThread(void *arg)
 		     ns_sockstrerror(ns_sockerrno));
 	}
         Ns_GetTime(&now);
+	(void) Ns_TimerWheelExpire(drvPtr->wheel, &now);
 
 	/*
          * Get current flags, free conns, closing socks, and socks returning
@@ -1100,10 +1113,10 @@ DriverThread(void *arg)
 		    n = recv(sockPtr->sock, drain, sizeof(drain), 0);
 		    if (n <= 0) {
                         /* NB: Timeout Sock on end-of-file or error. */
-		        sockPtr->timeout = now;
+		        Ns_TimerCancel(drvPtr->wheel, &sockPtr->timer);
 		    }
 	    	}
-	    	if (Ns_DiffTime(&sockPtr->timeout, &now, NULL) <= 0 || stop) {
+	    	if (!Ns_TimerPending(&sockPtr->timer) || stop) {
                     /* Close wait complete or timeout. */
                     SockClose(sockPtr);
 	    	} else {
@@ -1131,8 +1144,7 @@ DriverThread(void *arg)
                  */
 
 	    	if (!PollIn(&pdata, sockPtr->pidx)) {
-                    if (Ns_DiffTime(&sockPtr->timeout, &now, NULL) <= 0
-				    || stop) {
+                    if (!Ns_TimerPending(&sockPtr->timer) || stop) {
                         /* Timeout waiting for input. */
                         SockClose(sockPtr);
 		    } else {
@@ -1140,6 +1152,7 @@ DriverThread(void *arg)
 		    }
 	    	} else {
                     /* Input now available */
+		    Ns_TimerCancel(drvPtr->wheel, &sockPtr->timer);
 		    if (sockPtr->connPtr->ibuf.length == 0) {
 			sockPtr->connPtr->times.read = now;
 		    }
@@ -1169,6 +1182,50 @@ DriverThread(void *arg)
 	    sockPtr = nextPtr;
 	}
 
+	/*
+         * Process Sock's returned for keep-alive or close.
+	 */
+
+        while ((sockPtr = closePtr) != NULL) {
+            closePtr = sockPtr->nextPtr;
+            if (!stop && sockPtr->state == SOCK_READWAIT) {
+		sockPtr->connPtr = AllocConn(drvPtr, &now, sockPtr);
+		if (sockPtr->pipe.length == 0) {
+                    SockWait(sockPtr, &now, drvPtr->keepwait, &waitPtr);
+		} else {
+		    /*
+		     * Parse input already read beyond the previous
+		     * request, queueing a complete pipelined request
+		     * now instead of waiting for more input.  Drivers
+		     * without async read-ahead may block in recv and
+		     * are read by the reader threads as above.
+		     */
+
+		    sockPtr->connPtr->times.read = now;
+		    ++drvPtr->stats.pipelined;
+		    if (!(drvPtr->opts & NS_DRIVER_ASYNC)) {
+			SockPush(sockPtr, &readSockPtr);
+		    } else {
+			SockRead(sockPtr);
+			if (sockPtr->state != SOCK_READWAIT) {
+			    SockPush(sockPtr, &preqSockPtr);
+			} else if (sockPtr->connPtr->ibuf.length > 0) {
+			    SockWait(sockPtr, &now, drvPtr->recvwait,
+				     &waitPtr);
+			} else {
+			    SockWait(sockPtr, &now, drvPtr->keepwait,
+				     &waitPtr);
+			}
+		    }
+		}
+            } else if (!drvPtr->closewait || shutdown(sockPtr->sock, 1) != 0) {
+                /* Graceful close diabled or shutdown() failed. */
+                SockClose(sockPtr);
+            } else {
+                SockWait(sockPtr, &now, drvPtr->closewait, &waitPtr);
+            }
+	}
+
 	/*
          * Move Sock's to the reader threads if necessary.
 	 */
@@ -1196,23 +1253,6 @@ DriverThread(void *arg)
             }
 	}
 
-	/*
-         * Process Sock's returned for keep-alive or close.
-	 */
-
-        while ((sockPtr = closePtr) != NULL) {
-            closePtr = sockPtr->nextPtr;
-            if (!stop && sockPtr->state == SOCK_READWAIT) {
-		sockPtr->connPtr = AllocConn(drvPtr, &now, sockPtr);
-                SockWait(sockPtr, &now, drvPtr->keepwait, &waitPtr);
-            } else if (!drvPtr->closewait || shutdown(sockPtr->sock, 1) != 0) {
-                /* Graceful close diabled or shutdown() failed. */
-                SockClose(sockPtr);
-            } else {
-                SockWait(sockPtr, &now, drvPtr->closewait, &waitPtr);
-            }
-	}
-
 	/*
          * Process sockets ready to run.
 	 */
@@ -1255,8 +1295,9 @@ DriverThread(void *arg)
 	    if (sockPtr->state == SOCK_ERROR) {
 		SockClose(sockPtr);
 	    } else {
-		sockPtr->timeout = connPtr->times.queue = now;
-		Ns_IncrTime(&sockPtr->timeout, connPtr->limitsPtr->timeout, 0);
+		connPtr->times.queue = next = now;
+		Ns_IncrTime(&next, connPtr->limitsPtr->timeout, 0);
+		Ns_TimerAdd(drvPtr->wheel, &sockPtr->timer, &next);
 		AppendConn(drvPtr, connPtr);
 	    }
 	}
@@ -1283,7 +1324,7 @@ DriverThread(void *arg)
             if (limitsPtr->nrunning < limitsPtr->maxrun) {
             	++limitsPtr->nrunning;
 		SockState(sockPtr, SOCK_RUNNING);
-	    } else if (Ns_DiffTime(&sockPtr->timeout, &now, NULL) <= 0) {
+	    } else if (!Ns_TimerPending(&sockPtr->timer)) {
 		++limitsPtr->ntimeout;
 		++drvPtr->stats.timeout;
 		SockState(sockPtr, SOCK_TIMEOUT);
@@ -1318,6 +1359,7 @@ dropped:
 
 	    case SOCK_RUNNING:
 	    	/* NB: Sock no longer responsible for Conn. */
+		Ns_TimerCancel(drvPtr->wheel, &sockPtr->timer);
 		sockPtr->connPtr->times.run = now;
 	    	sockPtr->connPtr = NULL;
 	    	NsQueueConn(connPtr);
@@ -1354,12 +1396,12 @@ dropped:
 	    Ns_DStringPrintf(drvPtr->queryPtr,
 		"time %ld:%ld "
 		"spins %d accepts %u queued %u reads %u "
-		"dropped %u overflow %d timeout %u",
+		"dropped %u overflow %d timeout %u pipelined %u",
 	    	now.sec, now.usec,
 		drvPtr->stats.spins, drvPtr->stats.accepts,
 		drvPtr->stats.queued, drvPtr->stats.reads,
 		drvPtr->stats.dropped, drvPtr->stats.overflow,
-		drvPtr->stats.timeout);
+		drvPtr->stats.timeout, drvPtr->stats.pipelined);
 	    Tcl_DStringEndSublist(drvPtr->queryPtr);
 	    Tcl_DStringAppendElement(drvPtr->queryPtr, "socks");
 	    sockPtr = waitPtr;
@@ -1373,7 +1415,7 @@ dropped:
 		    pdata.pfds[sockPtr->pidx].events, 
 		    pdata.pfds[sockPtr->pidx].revents, 
 		    sockPtr->acceptTime.sec, sockPtr->acceptTime.usec,
-		    sockPtr->timeout.sec, sockPtr->timeout.usec);
+		    sockPtr->timer.expires.sec, sockPtr->timer.expires.usec);
 		if (sockPtr->connPtr != NULL) {
 		    NsAppendConn(drvPtr->queryPtr, sockPtr->connPtr, "i/o");
 		} else {
@@ -1401,6 +1443,7 @@ dropped:
     	--drvPtr->nreaders;
 	Ns_ThreadJoin(&drvPtr->readers[drvPtr->nreaders], NULL);
     }
+    Ns_TimerWheelDestroy(drvPtr->wheel);
 
     Ns_MutexLock(&drvPtr->lock);
     drvPtr->flags |= DRIVER_STOPPED;
@@ -1494,7 +1537,7 @@ SockState(Sock *sockPtr, int state)
  *
  * SockWait --
  *
- *	Update Sock timeout and queue on given list.
+ *	Update Sock timer and queue on given list.
  *
  * Results:
  *	None.
@@ -1508,8 +1551,11 @@ SockState(Sock *sockPtr, int state)
 static void
 SockWait(Sock *sockPtr, Ns_Time *nowPtr, int timeout, Sock **listPtrPtr)
 {
-    sockPtr->timeout = *nowPtr;
-    Ns_IncrTime(&sockPtr->timeout, timeout, 0);
+    Ns_Time expires;
+
+    expires = *nowPtr;
+    Ns_IncrTime(&expires, timeout, 0);
+    Ns_TimerAdd(sockPtr->drvPtr->wheel, &sockPtr->timer, &expires);
     SockPush(sockPtr, listPtrPtr);
 }
 
@@ -1631,6 +1677,8 @@ SockClose(Sock *sockPtr)
 {
     Driver *drvPtr = sockPtr->drvPtr;
 
+    Ns_TimerCancel(drvPtr->wheel, &sockPtr->timer);
+
     /*
      * Free the Conn if the Sock is still responsible for it.
      */
@@ -1643,6 +1691,7 @@ SockClose(Sock *sockPtr)
 
     (void) (*drvPtr->proc)(DriverClose, (Ns_Sock *) sockPtr, NULL, 0);
     ns_sockclose(sockPtr->sock);
+    Tcl_DStringFree(&sockPtr->pipe);
     SockState(sockPtr, SOCK_CLOSED);
     sockPtr->sock = INVALID_SOCKET;
     drvPtr->stats.reads += sockPtr->nreads;
@@ -1707,6 +1756,7 @@ SockRead(Sock *sockPtr)
     Conn *connPtr = sockPtr->connPtr;
     Ns_Sock *sock = (Ns_Sock *) sockPtr;
     ReadErr err;
+    int n, off;
 
     /*
      * Read any waiting request+headers and/or content.
@@ -1729,10 +1779,25 @@ SockRead(Sock *sockPtr)
     	if (!RunFilters(connPtr, NS_FILTER_READ)) {
 	    err = E_FILTER;
 	} else if (connPtr->avail >= (size_t) connPtr->contentLength) {
+	    n = (int) connPtr->avail - connPtr->contentLength;
+	    if (n > 0 && !(connPtr->flags & NS_CONN_FILECONTENT)) {
+		/* NB: Save start of a pipelined request, if any. */
+		Tcl_DStringAppend(&sockPtr->pipe,
+				  connPtr->content + connPtr->contentLength, n);
+	    } else if (n > 0) {
+		/* NB: Same for input written to the temp file. */
+		off = sockPtr->pipe.length;
+		Tcl_DStringSetLength(&sockPtr->pipe, off + n);
+		if (pread(connPtr->tfd, sockPtr->pipe.string + off,
+			  (size_t) n, (off_t) connPtr->contentLength) != n) {
+		    Tcl_DStringSetLength(&sockPtr->pipe, off);
+		    err = E_FDREAD;
+		}
+	    }
 	    connPtr->avail = connPtr->contentLength;
 	    if (!(connPtr->flags & NS_CONN_FILECONTENT)) {
 		connPtr->content[connPtr->avail] = '\0';
-	    } else {
+	    } else if (!err) {
 		if (ftruncate(connPtr->tfd, connPtr->avail) != 0) {
 		    err = E_FDTRUNC;
 		} else if (lseek(connPtr->tfd, (off_t) 0, SEEK_SET) != 0) {
@@ -1776,42 +1841,62 @@ SockRead(Sock *sockPtr)
 static ReadErr
 SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
 {
+    Sock *sockPtr = (Sock *) sock;
     Tcl_DString *bufPtr;
     NsServer *servPtr;
     Ns_Request *request;
     ServerMap *mapPtr;
     Tcl_HashEntry *hPtr;
     struct iovec buf;
-    char *s, *e, *hdr, save;
+    char *s, *e, *sep, *hdr, save;
     int len, n, max;
 
     /*
-     * Setup the request buffer and read more input.
+     * Setup the request buffer with input saved from a previous
+     * pipelined request, if any, or read more input.  Room for a
+     * full read is reserved after saved input so a request split
+     * across reads does not move the buffer, leaving the request
+     * line and headers already parsed in place.
      */
 
     bufPtr = &connPtr->ibuf;
     len = bufPtr->length;
-    if (len >= drvPtr->maxinput) {
-	return E_RRANGE;
-    }
-    max = bufPtr->spaceAvl - 1;
-    if (max < drvPtr->bufsize) {
-        max += drvPtr->bufsize;
-        if (max > drvPtr->maxinput) {
-            max = drvPtr->maxinput;
-        }
-    }
-    Tcl_DStringSetLength(bufPtr, max);
-    buf.iov_base = bufPtr->string + len;
-    buf.iov_len = max - len;
-    n = (*drvPtr->proc)(DriverRecv, sock, &buf, 1);
-    if (n < 0) {
-	return E_RECV;
-    } else if (n == 0) {
-	return E_CLOSE;
+    if (sockPtr->pipe.length > 0) {
+	n = sockPtr->pipe.length;
+	max = len + n + drvPtr->bufsize;
+	if (max > drvPtr->maxinput) {
+	    max = drvPtr->maxinput;
+	}
+	if (max < len + n) {
+	    max = len + n;
+	}
+	SetBufLength(connPtr, max);
+	memcpy(bufPtr->string + len, sockPtr->pipe.string, (size_t) n);
+	Tcl_DStringSetLength(bufPtr, len + n);
+	Tcl_DStringFree(&sockPtr->pipe);
+    } else {
+	if (len >= drvPtr->maxinput) {
+	    return E_RRANGE;
+	}
+	max = bufPtr->spaceAvl - 1;
+	if (max < drvPtr->bufsize) {
+	    max += drvPtr->bufsize;
+	    if (max > drvPtr->maxinput) {
+		max = drvPtr->maxinput;
+	    }
+	}
+	SetBufLength(connPtr, max);
+	buf.iov_base = bufPtr->string + len;
+	buf.iov_len = max - len;
+	n = (*drvPtr->proc)(DriverRecv, sock, &buf, 1);
+	if (n < 0) {
+	    return E_RECV;
+	} else if (n == 0) {
+	    return E_CLOSE;
+	}
+	len += n;
+	Tcl_DStringSetLength(bufPtr, len);
     }
-    len += n;
-    Tcl_DStringSetLength(bufPtr, len);
 
     /*
      * Scan available content for lines until end-of-headers.
@@ -1819,12 +1904,13 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
 
     while (!(connPtr->flags & NS_CONN_READHDRS)) {
 	/*
-	 * Look for a newline past the current read offset. If the buffer
-	 * does not include a full line, return now to request more input.
+	 * Look for a newline past the current read offset, noting the
+	 * header separator in the same pass. If the buffer does not
+	 * include a full line, return now to request more input.
 	 */
 
         s = bufPtr->string + connPtr->roff;
-        e = strchr(s, '\n');
+        e = NsFindLine(s, bufPtr->string + bufPtr->length, &sep);
         if (e == NULL) {
             return E_NOERROR;
 	}
@@ -1847,34 +1933,39 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
 	if (e > s && e[-1] == '\r') {
 	    --e;
 	}
-        save = *e;
-        *e = '\0';
 
+	/*
+	 * Skip empty lines before the request line, e.g., the \r\n
+	 * sent by some clients after POST content.
+	 */
+
+	if (e == s && connPtr->rstart == NULL) {
+	    continue;
+	}
 	/*
  	 * On the first line, save the offsets for later request parsing,
 	 * checking for pre-HTTP/1.0 requests.  Otherwise, parse the line
-	 * as the next header.
+	 * as the next header in place, leaving the key and value null
+	 * terminated in the buffer and referenced by the header set.
 	 */
 
         if (connPtr->rstart == NULL) {
+	    save = *e;
+	    *e = '\0';
 	    connPtr->rstart = s;
 	    connPtr->rend = e;
 	    if (NsFindVersion(s, &connPtr->major, &connPtr->minor) == NULL
 		    || connPtr->major < 1) {
         	connPtr->flags |= (NS_CONN_SKIPHDRS | NS_CONN_READHDRS);
 	    }
+	    *e = save;
 	} else if (e > s) {
-            if (Ns_ParseHeader(connPtr->headers, s, Preserve) != NS_OK) {
+	    *e = '\0';
+            if (NsParseHeader(connPtr->headers, s, sep, Preserve, 1)
+		    != NS_OK) {
 		return E_HINVAL;
 	    }
-	}
-
-	/*
-	 * Restore the line and check for end-of-headers.
-	 */
-
-        *e = save;
-	if (e == s) {
+	} else {
             connPtr->flags |= NS_CONN_READHDRS;
 	}
     }
@@ -1943,7 +2034,8 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
                     ++e;
                 }
                 len = strlen(e) + 3;
-                connPtr->authUser = ns_malloc((size_t) len);
+                connPtr->authUser = Ns_ConnAlloc((Ns_Conn *) connPtr,
+						 (size_t) len);
                 len = Ns_HtuuDecode(e, (unsigned char *) connPtr->authUser, len);
                 connPtr->authUser[len] = '\0';
                 e = strchr(connPtr->authUser, ':');
@@ -1978,13 +2070,21 @@ SockReadLine(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
      */
 
     connPtr->avail = bufPtr->length - connPtr->roff;
+    if (connPtr->avail > (size_t) connPtr->contentLength) {
+	/* NB: Save input beyond the content, i.e., pipelined requests. */
+	Tcl_DStringAppend(&sockPtr->pipe,
+			  bufPtr->string + connPtr->roff + connPtr->contentLength,
+			  (int) connPtr->avail - connPtr->contentLength);
+	connPtr->avail = connPtr->contentLength;
+	Tcl_DStringSetLength(bufPtr, connPtr->roff + connPtr->contentLength);
+    }
     max = connPtr->roff + connPtr->contentLength + 2;	/* NB: Space for \r\n if present. */
     if (max < connPtr->drvPtr->maxinput) {
         /*
          * Content will fit at end of request buffer.
          */
 
-        Tcl_DStringSetLength(bufPtr, max);
+        SetBufLength(connPtr, max);
         connPtr->content = bufPtr->string + connPtr->roff;
     } else {
         /*
@@ -2061,6 +2161,57 @@ SockReadContent(Driver *drvPtr, Ns_Sock *sock, Conn *connPtr)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetBufLength --
+ *
+ *	Set the length of the request buffer, e.g., to make room for
+ *	more input.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	If the buffer moves, the request line and header keys and values
+ *	parsed in place are rebased.  Other header strings, e.g., values
+ *	copied to the arena, are left as is.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetBufLength(Conn *connPtr, int length)
+{
+    Tcl_DString *bufPtr = &connPtr->ibuf;
+    Ns_Set *set = connPtr->headers;
+    Ns_SetField *fPtr;
+    char *old, *end, *new;
+    int i;
+
+    old = bufPtr->string;
+    end = old + connPtr->roff;
+    Tcl_DStringSetLength(bufPtr, length);
+    new = bufPtr->string;
+    if (new == old) {
+	return;
+    }
+    if (connPtr->rstart != NULL) {
+	connPtr->rstart = new + (connPtr->rstart - old);
+	connPtr->rend = new + (connPtr->rend - old);
+    }
+    for (i = 0; i < set->size; ++i) {
+	fPtr = &set->fields[i];
+	if (fPtr->name >= old && fPtr->name < end) {
+	    fPtr->name = new + (fPtr->name - old);
+	}
+	if (fPtr->value >= old && fPtr->value < end) {
+	    fPtr->value = new + (fPtr->value - old);
+	}
+    }
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -2241,8 +2392,10 @@ AllocConn(Driver *drvPtr, Ns_Time *nowPtr, Sock *sockPtr)
      */
 
     connPtr->tfd = -1;
-    connPtr->headers = Ns_SetCreate(NULL);
-    connPtr->outputheaders = Ns_SetCreate(NULL);
+    connPtr->headers = Ns_SetCreateInArena(Ns_ConnArena((Ns_Conn *) connPtr),
+					   NULL);
+    connPtr->outputheaders =
+	Ns_SetCreateInArena(Ns_ConnArena((Ns_Conn *) connPtr), NULL);
     Tcl_InitHashTable(&connPtr->files, TCL_STRING_KEYS);
     connPtr->drvPtr = drvPtr;
     connPtr->times.accept = *nowPtr;
@@ -2304,20 +2457,18 @@ FreeConn(Conn *connPtr)
     if (connPtr->tfd != -1) {
         Ns_ReleaseTemp(connPtr->tfd);
     }
-    if (connPtr->authUser != NULL) {
-        ns_free(connPtr->authUser);
-    }
     Ns_SetFree(connPtr->headers);
     Ns_SetFree(connPtr->outputheaders);
 
     /*
-     * Truncate the I/O buffers, zero remaining elements of the Conn,
-     * and return the Conn to the free list.
+     * Truncate the I/O buffers and reset the arena, zero remaining
+     * elements of the Conn, and return the Conn to the free list.
      *
      */
 
     Ns_DStringTrunc(&connPtr->obuf, 0);
     Ns_DStringTrunc(&connPtr->ibuf, 0);
+    Ns_ArenaReset(Ns_ConnArena(conn));
     zlen = (size_t) ((char *) &connPtr->ibuf - (char *) connPtr);
     memset(connPtr, 0, zlen);
 
@@ -2490,6 +2641,9 @@ LogReadError(Conn *connPtr, ReadErr err)
     case E_FDWRITE:		
 	msg = "fd write failed";
 	break;
+    case E_FDREAD:		
+	msg = "fd read failed";
+	break;
     case E_FDTRUNC:		
 	msg = "fd truncate failed";
 	break;
@@ -2532,6 +2686,7 @@ LogReadError(Conn *connPtr, ReadErr err)
     switch (err) {
     case E_RECV:		
     case E_FDWRITE:		
+    case E_FDREAD:		
     case E_FDTRUNC:		
     case E_FDSEEK:		
 	fmt = "conn[%d]: %s: %s";
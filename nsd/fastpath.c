@@ -56,6 +56,8 @@ typedef struct {
     time_t mtime;
     int size;
     int refcnt;
+    int gzsize;		/* Size of gzip'ed copy, if any. */
+    char *gzbytes;	/* Gzip'ed copy following the file bytes. */
     char bytes[1];	/* Grown to actual file size. */
 } File;
 
@@ -69,6 +71,7 @@ static int UrlIs(char *server, char *url, int dir);
 static int FastStat(char *file, struct stat *stPtr);
 static int FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
     char *type, char *file, struct stat *stPtr);
+static int GzipType(char *type);
 
 
 /*
@@ -469,10 +472,12 @@ static int
 FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
     char *type, char *file, struct stat *stPtr)
 {
-    int             result = NS_ERROR, fd, new, nread;
+    int             result = NS_ERROR, fd, new, nread, encoded;
     File	   *filePtr;
     char	   *key;
     Ns_Entry	   *entPtr;
+    Ns_DString	    gzfile, gzip;
+    struct stat     gzst;
     void           *map, *arg;
 #ifndef _WIN32
     FileKey	    ukey;
@@ -485,6 +490,27 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
     if (type == NULL) {
     	type = Ns_GetMimeType(file);
     }
+
+    /*
+     * Substitute a pre-compressed file.gz at least as new as the
+     * file for clients which accept gzip.
+     */
+
+    Ns_DStringInit(&gzfile);
+    encoded = 0;
+    if (servPtr->fastpath.gzipstatic) {
+	Ns_DStringVarAppend(&gzfile, file, ".gz", NULL);
+	if (stat(gzfile.string, &gzst) == 0 && S_ISREG(gzst.st_mode)
+		&& gzst.st_mtime >= stPtr->st_mtime) {
+	    Ns_ConnCondSetHeaders(conn, "Vary", "Accept-Encoding");
+	    if (NsConnAcceptGzip(conn)) {
+		Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
+		file = gzfile.string;
+		stPtr = &gzst;
+		encoded = 1;
+	    }
+	}
+    }
     
     /*
      * Set the last modified header if not set yet and, if not
@@ -493,7 +519,8 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
      
     Ns_ConnSetLastModifiedHeader(conn, &stPtr->st_mtime);
     if (Ns_ConnModifiedSince(conn, stPtr->st_mtime) == NS_FALSE) {
-	return Ns_ConnReturnNotModified(conn);
+	result = Ns_ConnReturnNotModified(conn);
+	goto done;
     }
     
     /*
@@ -503,7 +530,8 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
      
     if (conn->flags & NS_CONN_SKIPBODY) {
 	Ns_ConnSetRequiredHeaders(conn, type, (int) stPtr->st_size);
-	return Ns_ConnFlushHeaders(conn, status);
+	result = Ns_ConnFlushHeaders(conn, status);
+	goto done;
     }
 
     if (servPtr->fastpath.cache == NULL
@@ -580,6 +608,8 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 		filePtr->refcnt = 1;
 		filePtr->size = stPtr->st_size;
 		filePtr->mtime = stPtr->st_mtime;
+		filePtr->gzsize = 0;
+		filePtr->gzbytes = NULL;
 		nread = read(fd, filePtr->bytes, (size_t)filePtr->size);
 		close(fd);
 		if (nread != filePtr->size) {
@@ -589,10 +619,33 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 		    filePtr = NULL;
 		}
 	    }
+
+	    /*
+	     * Compress text files once per version, keeping the
+	     * result only if smaller than the original.
+	     */
+
+	    if (filePtr != NULL && !encoded && servPtr->fastpath.gzipcache
+		    && filePtr->size > (int) servPtr->opts.gzipmin
+		    && GzipType(type)) {
+		Ns_DStringInit(&gzip);
+		if (Ns_Gzip(filePtr->bytes, filePtr->size,
+			    servPtr->opts.gziplevel, &gzip) == NS_OK
+			&& gzip.length < filePtr->size) {
+		    filePtr = ns_realloc(filePtr, sizeof(File)
+					 + (size_t) filePtr->size
+					 + (size_t) gzip.length);
+		    filePtr->gzbytes = filePtr->bytes + filePtr->size;
+		    filePtr->gzsize = gzip.length;
+		    memcpy(filePtr->gzbytes, gzip.string, (size_t) gzip.length);
+		}
+		Ns_DStringFree(&gzip);
+	    }
 	    Ns_CacheLock(servPtr->fastpath.cache);
 	    entPtr = Ns_CacheCreateEntry(servPtr->fastpath.cache, key, &new);
 	    if (filePtr != NULL) {
-		Ns_CacheSetValueSz(entPtr, filePtr, (size_t)filePtr->size);
+		Ns_CacheSetValueSz(entPtr, filePtr,
+				   (size_t) (filePtr->size + filePtr->gzsize));
 	    } else {
 		Ns_CacheFlushEntry(entPtr);
 	    }
@@ -601,8 +654,20 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 	if (filePtr != NULL) {
 	    ++filePtr->refcnt;
 	    Ns_CacheUnlock(servPtr->fastpath.cache);
-            result = Ns_ConnReturnData(conn, status, filePtr->bytes,
-			    filePtr->size, type);
+	    if (filePtr->gzbytes == NULL) {
+		result = Ns_ConnReturnData(conn, status, filePtr->bytes,
+					   filePtr->size, type);
+	    } else {
+		Ns_ConnCondSetHeaders(conn, "Vary", "Accept-Encoding");
+		if (NsConnAcceptGzip(conn)) {
+		    Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
+		    result = Ns_ConnReturnData(conn, status, filePtr->gzbytes,
+					       filePtr->gzsize, type);
+		} else {
+		    result = Ns_ConnReturnData(conn, status, filePtr->bytes,
+					       filePtr->size, type);
+		}
+	    }
 	    Ns_CacheLock(servPtr->fastpath.cache);
 	    DecrEntry(filePtr);
 	}
@@ -611,13 +676,43 @@ FastReturn(NsServer *servPtr, Ns_Conn *conn, int status,
 	    goto notfound;
 	}
     }
+
+done:
+    Ns_DStringFree(&gzfile);
     return result;
 
 notfound:
+    Ns_DStringFree(&gzfile);
     return Ns_ConnReturnNotFound(conn);
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * GzipType --
+ *
+ *      Check if a mime type is text which compresses well.
+ *
+ * Results:
+ *      1 if compressible, 0 otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GzipType(char *type)
+{
+    return (strncmp(type, "text/", 5) == 0
+	    || strstr(type, "javascript") != NULL
+	    || strstr(type, "json") != NULL
+	    || strstr(type, "xml") != NULL);
+}
+
+
 int
 NsUrlToFile(Ns_DString *dsPtr, NsServer *servPtr, char *url)
 {
@@ -77,7 +77,7 @@ Ns_ConnGetQuery(Ns_Conn *conn)
     }
     if (connPtr->query == NULL) {
 	encoding = connPtr->queryEncoding = Ns_ConnGetUrlEncoding(conn);
-	connPtr->query = Ns_SetCreate(NULL);
+	connPtr->query = Ns_SetCreateInArena(Ns_ConnArena(conn), NULL);
 	if (!STREQ(connPtr->request->method, "POST")) {
 	    form = connPtr->request->query;
 	    if (form != NULL) {
@@ -144,7 +144,6 @@ Ns_ConnClearQuery(Ns_Conn *conn)
     while (hPtr != NULL) {
 	filePtr = Tcl_GetHashValue(hPtr);
 	Ns_SetFree(filePtr->headers);
-	ns_free(filePtr);
 	hPtr = Tcl_NextHashEntry(&search);
     }
     Tcl_DeleteHashTable(&connPtr->files);
@@ -435,7 +434,7 @@ ParseMultiInput(Conn *connPtr, char *form, Tcl_Encoding encoding,
 
     Tcl_DStringInit(&kds);
     Tcl_DStringInit(&vds);
-    set = Ns_SetCreate(NULL);
+    set = Ns_SetCreateInArena(Ns_ConnArena((Ns_Conn *) connPtr), NULL);
 
     /*
      * Trim off the trailing \r\n and null terminate the input.
@@ -479,7 +478,8 @@ ParseMultiInput(Conn *connPtr, char *form, Tcl_Encoding encoding,
 	    value = Ext2Utf(&vds, fs, fe-fs, encoding);
 	    hPtr = Tcl_CreateHashEntry(&connPtr->files, key, &new);
 	    if (new) {
-		filePtr = ns_malloc(sizeof(Ns_ConnFile));
+		filePtr = Ns_ConnAlloc((Ns_Conn *) connPtr,
+				       sizeof(Ns_ConnFile));
 		filePtr->name = Tcl_GetHashKey(&connPtr->files, hPtr);
 		filePtr->headers = set;
 	    	filePtr->offset = start - form;
@@ -502,7 +502,7 @@ NsTclInfoObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	"config", "home", "hostname", "label", "locks", "log",
 	"major", "minor", "name", "nsd", "pageroot", "patchlevel",
 	"pid", "platform", "pools", "scheduled", "server", "servers",
-	"sockcallbacks", "tag", "tcllib", "threads", "uptime",
+	"sockcallbacks", "tag", "taskqueues", "tcllib", "threads", "uptime",
 	"version", "winnt", NULL
     };
     enum {
@@ -510,7 +510,7 @@ NsTclInfoObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	IConfigIdx, IHomeIdx, hostINameIdx, ILabelIdx, ILocksIdx, ILogIdx,
 	IMajorIdx, IMinorIdx, INameIdx, INsdIdx, IPageRootIdx, IPatchLevelIdx,
 	IPidIdx, IPlatformIdx, IPoolsIdx, IScheduledIdx, IServerIdx, IServersIdx,
-	sockICallbacksIdx, ITagIdx, ITclLibIdx, IThreadsIdx, IUptimeIdx,
+	sockICallbacksIdx, ITagIdx, ITaskQueuesIdx, ITclLibIdx, IThreadsIdx, IUptimeIdx,
 	IVersionIdx, IWinntIdx,
     } _nsmayalias opt;
 
@@ -556,6 +556,11 @@ NsTclInfoObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	Tcl_DStringResult(interp, &ds);
 	break;
 
+    case ITaskQueuesIdx:
+    	NsGetTaskQueues(&ds);
+	Tcl_DStringResult(interp, &ds);
+	break;
+
     case ILocksIdx:
 	Ns_MutexList(&ds);
 	Tcl_DStringResult(interp, &ds);
@@ -567,6 +572,11 @@ NsTclInfoObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	break;
 
     case IPoolsIdx:
+	Ns_MemoryList(&ds);
+	if (ds.length > 0) {
+	    Tcl_DStringResult(interp, &ds);
+	    break;
+	}
 #if !defined(_WIN32) && defined(USE_THREAD_ALLOC) && (STATIC_BUILD == 0)
 	Tcl_GetMemoryInfo(&ds); /* As of Tcl8.4.1 this is not exported. */
 	Tcl_DStringResult(interp, &ds);
@@ -39,6 +39,11 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd
 
 #define THREAD_STACKSIZE	(128*1024)
 #define SCHED_MAXELAPSED	2
+#define SCHED_MAXTHREADS	10
+#define SOCKCB_THREADS		0
+#define TCLHTTP_THREADS		1
+#define TCLHTTP_MAXIDLE		4
+#define TCLHTTP_IDLETIMEOUT	4
 #define SHUTDOWNTIMEOUT		20
 #define LISTEN_BACKLOG		32
 #define TCL_INITLCK		0
@@ -103,6 +108,11 @@ NsInitConf(void)
 
     nsconf.shutdowntimeout = SHUTDOWNTIMEOUT;
     nsconf.sched.maxelapsed = SCHED_MAXELAPSED;
+    nsconf.sched.maxthreads = SCHED_MAXTHREADS;
+    nsconf.sockcb.threads = SOCKCB_THREADS;
+    nsconf.tclhttp.threads = TCLHTTP_THREADS;
+    nsconf.tclhttp.maxidle = TCLHTTP_MAXIDLE;
+    nsconf.tclhttp.idletimeout = TCLHTTP_IDLETIMEOUT;
     nsconf.backlog = LISTEN_BACKLOG;
     nsconf.http.major = HTTP_MAJOR;
     nsconf.http.minor = HTTP_MINOR;
@@ -139,7 +149,7 @@ NsInitConf(void)
 void
 NsConfUpdate(void)
 {
-    int stacksize;
+    int stacksize, spin, profile, cache;
     Ns_DString ds;
     
     Ns_DStringInit(&ds);
@@ -148,6 +158,21 @@ NsConfUpdate(void)
 
     nsconf.shutdowntimeout = NsParamInt("shutdowntimeout", SHUTDOWNTIMEOUT);
     nsconf.sched.maxelapsed = NsParamInt("schedmaxelapsed", SCHED_MAXELAPSED);
+    nsconf.sched.maxthreads = NsParamInt("schedmaxthreads", SCHED_MAXTHREADS);
+    if (nsconf.sched.maxthreads < 1) {
+	nsconf.sched.maxthreads = 1;
+    }
+    nsconf.sockcb.threads = NsParamInt("sockcallbackthreads", SOCKCB_THREADS);
+    if (nsconf.sockcb.threads < 0) {
+	nsconf.sockcb.threads = 0;
+    }
+    nsconf.tclhttp.threads = NsParamInt("tclhttpthreads", TCLHTTP_THREADS);
+    if (nsconf.tclhttp.threads < 1) {
+	nsconf.tclhttp.threads = 1;
+    }
+    nsconf.tclhttp.maxidle = NsParamInt("tclhttpmaxidle", TCLHTTP_MAXIDLE);
+    nsconf.tclhttp.idletimeout = NsParamInt("tclhttpidletimeout",
+					    TCLHTTP_IDLETIMEOUT);
     nsconf.backlog = NsParamInt("listenbacklog", LISTEN_BACKLOG);
     nsconf.http.major = (unsigned) NsParamInt("httpmajor", HTTP_MAJOR);
     nsconf.http.minor = (unsigned) NsParamInt("httpmajor", HTTP_MINOR);
@@ -157,6 +182,18 @@ NsConfUpdate(void)
     	stacksize = NsParamInt("stacksize", THREAD_STACKSIZE);
     }
     Ns_ThreadStackSize(stacksize);
+    if (!Ns_ConfigGetInt(NS_CONFIG_THREADS, "mutexspin", &spin)) {
+	spin = 0;
+    }
+    Ns_MutexSetSpin(spin);
+    if (!Ns_ConfigGetBool(NS_CONFIG_THREADS, "mutexprofile", &profile)) {
+	profile = 0;
+    }
+    Ns_MutexSetProfile(profile);
+    if (!Ns_ConfigGetBool(NS_CONFIG_THREADS, "memorycache", &cache)) {
+	cache = 0;
+    }
+    Ns_MemorySetCache(cache);
 
     NsLogConf();
     NsEnableDNSCache();
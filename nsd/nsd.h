@@ -179,8 +179,19 @@ struct _nsconf {
     
     struct {
 	int maxelapsed;
+	int maxthreads;
     } sched;
 
+    struct {
+	int threads;
+    } sockcb;
+
+    struct {
+	int threads;
+	int maxidle;
+	int idletimeout;
+    } tclhttp;
+
 #ifdef _WIN32    
     struct {
 	bool checkexit;
@@ -322,6 +333,7 @@ typedef struct Driver {
     int		 maxinput;	    /* Maximum request bytes to read. */
 
     struct Sock *freeSockPtr;       /* Sock free list. */
+    Ns_TimerWheel *wheel;	    /* Sock timeouts, driver thread only. */
     int     	 maxsock;	    /* Maximum open Sock's. */
     int     	 nactive;	    /* Number of active Sock's. */
     unsigned int nextid;	    /* Next sock unique id. */
@@ -352,6 +364,7 @@ typedef struct Driver {
         unsigned int timeout;
         unsigned int overflow;
         unsigned int dropped;
+        unsigned int pipelined;
     } stats;
     
 } Driver;
@@ -383,9 +396,11 @@ typedef struct Sock {
     int		 state;
     int		 pidx;		    /* poll() index. */
     Ns_Time      acceptTime;
-    Ns_Time	 timeout;
+    Ns_Timer	 timer;		    /* Timeout in driver timer wheel. */
     unsigned int nreads;
     unsigned int nwrites;
+    Tcl_DString  pipe;		    /* Input read beyond the request, e.g.,
+				     * pipelined requests. */
 } Sock;
 
 /*
@@ -406,6 +421,17 @@ typedef struct Limits {
     int             timeout;
 } Limits;
 
+/*
+ * The following structure defines an arena for Ns_ArenaAlloc.
+ */
+
+typedef struct Arena {
+    struct Chunk   *firstPtr;	/* Chunks, current chunk first. */
+    char	   *next;	/* Next free memory in current chunk. */
+    char	   *end;	/* End of current chunk. */
+    size_t	    used;	/* Bytes allocated since last reset. */
+} Arena;
+
 /*
  * The following structure maintains state for a connection
  * being processed.
@@ -479,6 +505,7 @@ typedef struct Conn {
     int          recursionCount;
     Ns_Set      *query;
     Tcl_HashTable files;
+    void	*gzip;		/* Gzip stream context, if any. */
 
     /*
      * The following are copied from Sock.
@@ -510,14 +537,16 @@ typedef struct Conn {
      * The following offsets are used to manage the 
      * buffer read-ahead process.
      *
-     * NB: The ibuf and obuf dstrings must be the last elements of
-     * the conn as all elements before are zero'ed during conn cleanup.
+     * NB: The ibuf and obuf dstrings and the arena must be the last
+     * elements of the conn as all elements before are zero'ed during
+     * conn cleanup.
      *
      */
 
     int		    roff;	/* Next read buffer offset. */
     Tcl_DString	    ibuf;	/* Request and content input buffer. */
     Tcl_DString	    obuf;	/* Output buffer for queued headers. */
+    Arena	    arena;	/* Arena for request lifetime memory. */
 
 } Conn;
 
@@ -648,11 +677,26 @@ typedef struct NsServer {
 	char	    	   *dirproc;
 	char	    	   *diradp;
 	bool	    	    mmap;
+	bool		    gzipstatic;
+	bool		    gzipcache;
 	int 	    	    cachemaxentry;
 	Ns_UrlToFileProc   *url2file;
 	Ns_Cache    	   *cache;
     } fastpath;
 
+    /*
+     * The following struct maintains the cache of gzip output for
+     * repeated response bodies and its stats, locked by the cache.
+     */
+
+    struct {
+	Ns_Cache	   *cache;
+	unsigned long	    nhits;
+	unsigned long	    nmisses;
+	Ns_Time		    spent;	/* Time spent compressing. */
+	Ns_Time		    saved;	/* Compression time saved by hits. */
+    } gzip;
+
     /*
      * The following struct maintains request tables.
      */
@@ -908,11 +952,19 @@ extern void NsInitUrlSpace(void);
 extern void NsInitRequests(void);
 extern char *NsFindVersion(char *request, unsigned int *majorPtr,
 			   unsigned int *minorPtr);
+extern char *NsFindLine(char *s, char *end, char **sepPtr);
+extern int NsParseHeader(Ns_Set *set, char *line, char *sep,
+			 Ns_HeaderCaseDisposition disp, int inplace);
 extern void NsQueueConn(Conn *connPtr);
 extern int NsCheckQuery(Ns_Conn *conn);
 extern void NsAppendConn(Tcl_DString *bufPtr, Conn *connPtr, char *state);
 extern void NsAppendRequest(Tcl_DString *dsPtr, Ns_Request *request);
 extern int  NsConnSend(Ns_Conn *conn, struct iovec *bufs, int nbufs);
+extern int  NsConnAcceptGzip(Ns_Conn *conn);
+extern Ns_Cache *NsGzipCache(char *server, int size);
+extern int  NsGzip(NsServer *servPtr, char *buf, int len, Tcl_DString *dsPtr);
+extern int  NsConnGzipOk(Ns_Conn *conn);
+extern int  NsConnStartGzip(Ns_Conn *conn, Tcl_DString *dsPtr);
 extern void NsSockClose(Sock *sockPtr, int keep);
 extern int  NsPoll(struct pollfd *pfds, int nfds, Ns_Time *timeoutPtr);
 extern void NsFreeConn(Conn *connPtr);
@@ -950,6 +1002,7 @@ extern Ns_ArgProc NsConnArgProc;
 extern void NsGetCallbacks(Tcl_DString *dsPtr);
 extern void NsGetSockCallbacks(Tcl_DString *dsPtr);
 extern void NsGetScheduled(Tcl_DString *dsPtr);
+extern void NsGetTaskQueues(Tcl_DString *dsPtr);
 
 extern char *NsConnContent(Ns_Conn *conn, char **nextPtr, int *availPtr);
 extern void NsConnSeek(Ns_Conn *conn, int count);
@@ -986,6 +1039,7 @@ extern void NsStartPools(void);
 extern void NsStopPools(Ns_Time *timeoutPtr);
 extern int NsTclGetPool(Tcl_Interp *interp, char *pool, Pool **poolPtrPtr);
 extern Tcl_ObjCmdProc NsTclListPoolsObjCmd;
+extern Tcl_ObjCmdProc NsTclGzipStatsObjCmd;
 extern void NsCreateConnThread(Pool *poolPtr, int joinThreads);
 extern void NsJoinConnThreads(void);
 extern int  NsStartDrivers(void);
@@ -239,12 +239,12 @@ NsTclServerObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
     char buf[100], *pool;
     Tcl_DString ds;
     static CONST char *opts[] = {
-	 "active", "all", "connections", "keepalive", "pools", "queued",
-	 "threads", "waiting", NULL, 
+	 "active", "all", "connections", "gzipstats", "keepalive", "pools",
+	 "queued", "threads", "waiting", NULL, 
     };
     enum {
-	 SActiveIdx, SAllIdx, SConnectionsIdx, SKeepaliveIdx, SPoolsIdx,
-	 SQueuedIdx, SThreadsIdx, SWaitingIdx,
+	 SActiveIdx, SAllIdx, SConnectionsIdx, SGzipStatsIdx, SKeepaliveIdx,
+	 SPoolsIdx, SQueuedIdx, SThreadsIdx, SWaitingIdx,
     } _nsmayalias opt;
 
     if (objc != 2 && objc != 3) {
@@ -258,6 +258,9 @@ NsTclServerObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
     if (opt == SPoolsIdx) {
 	return NsTclListPoolsObjCmd(arg, interp, objc, objv);
     }
+    if (opt == SGzipStatsIdx) {
+	return NsTclGzipStatsObjCmd(arg, interp, objc, objv);
+    }
     if (objc == 2) {
         pool = "default";
     } else {
@@ -269,6 +272,7 @@ NsTclServerObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
     Ns_MutexLock(&poolPtr->lock);
     switch (opt) {
     case SPoolsIdx:
+    case SGzipStatsIdx:
 	/* NB: Silence compiler. */
 	break;
 	  
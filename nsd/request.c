@@ -38,6 +38,9 @@
 static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd/request.c,v 1.12 2005/08/10 13:24:41 jgdavidson Exp $, compiled: " __DATE__ " " __TIME__;
 
 #include "nsd.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define HTTP "HTTP/"
 
@@ -47,6 +50,9 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd
 
 static void SetUrl(Ns_Request * request, char *url, Tcl_Encoding encoding);
 static void FreeUrl(Ns_Request * request);
+#ifdef __SSE2__
+static int FirstBit(int mask);
+#endif
 static Ns_Mutex reqlock;
 
 
@@ -467,6 +473,133 @@ SetUrl(Ns_Request *request, char *url, Tcl_Encoding encoding)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFindLine --
+ *
+ *	Find the end of the next line and the first colon within it in
+ *	a single pass, 16 bytes at a time with SSE2 when available.
+ *
+ * Results:
+ *	Pointer to the newline or NULL if none before end.  If found,
+ *	sepPtr is set to the first colon before the newline or NULL.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+char *
+NsFindLine(char *s, char *end, char **sepPtr)
+{
+    char *sep = NULL;
+#ifdef __SSE2__
+    __m128i nl, colon, v;
+    int nlmask, cmask;
+
+    nl = _mm_set1_epi8('\n');
+    colon = _mm_set1_epi8(':');
+    while ((end - s) >= 16) {
+	v = _mm_loadu_si128((__m128i *) s);
+	nlmask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+	if (sep == NULL) {
+	    cmask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, colon));
+	    if (nlmask != 0) {
+		/* NB: Ignore colons after the newline. */
+		cmask &= (nlmask & -nlmask) - 1;
+	    }
+	    if (cmask != 0) {
+		sep = s + FirstBit(cmask);
+	    }
+	}
+	if (nlmask != 0) {
+	    *sepPtr = sep;
+	    return s + FirstBit(nlmask);
+	}
+	s += 16;
+    }
+#endif
+    while (s < end) {
+	if (*s == '\n') {
+	    *sepPtr = sep;
+	    return s;
+	}
+	if (*s == ':' && sep == NULL) {
+	    sep = s;
+	}
+	++s;
+    }
+    return NULL;
+}
+
+#ifdef __SSE2__
+static int
+FirstBit(int mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctz((unsigned int) mask);
+#else
+    int bit = 0;
+
+    while (!(mask & 1)) {
+	mask >>= 1;
+	++bit;
+    }
+    return bit;
+#endif
+}
+#endif
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ParseHeaders --
+ *
+ *	Parse a block of header lines, e.g., as sent with an HTTP
+ *	request or response, up to the first empty line.
+ *
+ * Results:
+ *	NS_OK/NS_ERROR 
+ *
+ * Side effects:
+ *	Headers are added to the given set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_ParseHeaders(Ns_Set *set, char *headers, Ns_HeaderCaseDisposition disp)
+{
+    char *end, *e, *sep, save;
+    int   status;
+
+    end = headers + strlen(headers);
+    status = NS_OK;
+    while (status == NS_OK && headers < end) {
+	e = NsFindLine(headers, end, &sep);
+	if (e == NULL) {
+	    e = end;
+	    sep = strchr(headers, ':');
+	}
+	if (e > headers && e[-1] == '\r') {
+	    --e;
+	}
+	if (e == headers) {
+	    break;
+	}
+	save = *e;
+	*e = '\0';
+	status = NsParseHeader(set, headers, sep, disp, 0);
+	*e = save;
+	headers = (save == '\r' ? e + 2 : e + 1);
+    }
+    return status;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -487,7 +620,33 @@ SetUrl(Ns_Request *request, char *url, Tcl_Encoding encoding)
 int
 Ns_ParseHeader(Ns_Set *set, char *line, Ns_HeaderCaseDisposition disp)
 {
-    char           *key, *sep;
+    return NsParseHeader(set, line, strchr(line, ':'), disp, 0);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsParseHeader --
+ *
+ *	Parse a header line as with Ns_ParseHeader given the first
+ *	colon, if any, e.g., as found with NsFindLine.
+ *
+ * Results:
+ *	NS_OK/NS_ERROR 
+ *
+ * Side effects:
+ *	If inplace is set, the key and value are added to the set
+ *	with Ns_SetPutRef, leaving the colon replaced by a null.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsParseHeader(Ns_Set *set, char *line, char *sep,
+	      Ns_HeaderCaseDisposition disp, int inplace)
+{
+    char           *key;
     char           *value;
     int             index;
     Ns_DString	    ds;
@@ -514,7 +673,6 @@ Ns_ParseHeader(Ns_Set *set, char *line, Ns_HeaderCaseDisposition disp)
 	    Ns_DStringFree(&ds);
 	}
     } else {
-        sep = strchr(line, ':');
         if (sep == NULL) {
 	    return NS_ERROR;	/* Malformed header. */
 	}
@@ -523,7 +681,11 @@ Ns_ParseHeader(Ns_Set *set, char *line, Ns_HeaderCaseDisposition disp)
         while (*value != '\0' && isspace(UCHAR(*value))) {
             ++value;
         }
-        index = Ns_SetPut(set, line, value);
+        if (inplace) {
+            index = Ns_SetPutRef(set, line, value);
+        } else {
+            index = Ns_SetPut(set, line, value);
+        }
         key = Ns_SetKey(set, index);
 	if (disp == ToLower) {
             while (*key != '\0') {
@@ -540,7 +702,9 @@ Ns_ParseHeader(Ns_Set *set, char *line, Ns_HeaderCaseDisposition disp)
 		++key;
 	    }
         }
-        *sep = ':';
+        if (!inplace) {
+            *sep = ':';
+        }
     }
     return NS_OK;
 }
@@ -1388,13 +1388,16 @@ CheckKeep(Ns_Conn *conn, int status)
 
     /*
      * First, ensure the driver supports keep-alive, the request method
-     * was GET, and the client sent a connection: keep-alive header.
+     * was GET, and the client sent a connection: keep-alive header or
+     * is an HTTP/1.1 client which did not send connection: close.
      */
 
     if (connPtr->drvPtr->keepwait > 0 &&
 	conn->request != NULL &&
 	STREQ(conn->request->method, "GET") &&
-	HdrEq(conn->headers, "connection", "keep-alive")) {
+	(HdrEq(conn->headers, "connection", "keep-alive") ||
+	 (conn->request->version >= 1.1 &&
+	  !HdrEq(conn->headers, "connection", "close")))) {
 
 	/*
 	 * Status 304, without any content, is ok.
@@ -33,16 +33,19 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd
  * sched.c --
  *
  *	Support for the background task and scheduled procedure
- *	interfaces.  The implementation is based on the paper:
- *
- *	"A Heap-based Callout Implementation to Meet Real-Time Needs",
- *	by Barkley and Lee, in "Proceeding of the Summer 1988 USENIX
- *	Conference".
- *
- *	The heap code in particular is based on:
- *
- *	"Chapter 9. Priority Queues and Heapsort", Sedgewick "Algorithms
- *	in C, 3rd Edition", Addison-Wesley, 1998.
+ *	interfaces.  Events are queued as timers on a millisecond
+ *	resolution timer wheel, see timer.c.  NS_SCHED_THREAD events
+ *	are run by a pool of at most schedmaxthreads threads, waiting
+ *	in a queue when all threads are busy.
+ *
+ *	By default, a repeating event is queued again an interval
+ *	after it finishes so runs never overlap.  With one of the
+ *	NS_SCHED_SKIP, NS_SCHED_QUEUE, or NS_SCHED_PARALLEL flags the
+ *	event is instead queued again an interval after it was due, and
+ *	when it is due while a previous run is waiting or running the
+ *	run is skipped, deferred until the previous run finishes, or,
+ *	for parallel events which are always run in threads, run
+ *	concurrently.
  */
 
 #include "nsd.h"
@@ -55,14 +58,23 @@ typedef struct Event {
     struct Event   *nextPtr;
     Tcl_HashEntry  *hPtr;	/* Entry in event hash or NULL if deleted. */
     unsigned int    id;		/* Unique event id. */
-    int             qid;	/* Current priority queue id. */
-    time_t          nextqueue;	/* Next time to queue for run. */
+    Ns_Timer        timer;	/* Timer, pending while queued to run. */
+    Ns_Time         due;	/* Time the current run was due. */
+    int             nrunning;	/* Number of runs in progress. */
+    int             waiting;	/* Waiting in the thread queue. */
+    int             deferred;	/* NS_SCHED_QUEUE run deferred. */
+    unsigned int    nrun;	/* Number of runs started. */
+    unsigned int    nskip;	/* Number of runs skipped. */
+    Ns_Time         totallate;	/* Total time runs started after due. */
+    Ns_Time         maxlate;	/* Max time a run started after due. */
     time_t	    lastqueue;	/* Last time queued for run. */
     time_t	    laststart;	/* Last time run started. */
     time_t	    lastend;	/* Last time run finished. */
     int             flags;	/* One or more of NS_SCHED_ONCE, NS_SCHED_THREAD,
-				 * NS_SCHED_DAILY, or NS_SCHED_WEEKLY. */
-    int             interval;	/* Interval specification. */
+				 * NS_SCHED_DAILY, NS_SCHED_WEEKLY, and
+				 * NS_SCHED_SKIP, NS_SCHED_QUEUE, or
+				 * NS_SCHED_PARALLEL. */
+    Ns_Time         interval;	/* Interval specification. */
     Ns_SchedProc   *proc;	/* Procedure to execute. */
     void           *arg;	/* Client data for procedure. */
     Ns_SchedProc   *deleteProc;	/* Procedure to cleanup when done (if any). */
@@ -74,41 +86,32 @@ typedef struct Event {
 
 static Ns_ThreadProc SchedThread;	/* Detached event firing thread. */
 static Ns_ThreadProc EventThread;	/* Proc for NS_SCHED_THREAD events. */
-static void QueueEvent(Event *ePtr, time_t *nowPtr);	/* Queue event on heap. */
-static Event *DeQueueEvent(int qid);	/* Remove event from heap. */
+static void QueueEvent(Event *ePtr, Ns_Time *nowPtr);	/* Queue event timer. */
 static void FreeEvent(Event *ePtr);	/* Free completed or cancelled event. */
+static void StartEvent(Event *ePtr, Ns_Time *nowPtr);	/* Update run stats. */
+static int FinishEvent(Event *ePtr, Ns_Time *nowPtr);	/* Re-queue or free. */
+static void AppendEvent(Event *ePtr);	/* Add to thread queue. */
+
+#define FIXEDRATE (NS_SCHED_SKIP|NS_SCHED_QUEUE|NS_SCHED_PARALLEL)
 
 /*
  * Static variables defined in this file.
  */
 
 static Tcl_HashTable eventsTable; /* Hash table of events. */
-static Ns_Mutex lock;		/* Lock around heap and hash table. */
+static Ns_Mutex lock;		/* Lock around wheel and hash table. */
 static Ns_Cond  schedcond;	/* Condition to wakeup SchedThread. */
 static Ns_Cond  eventcond;	/* Condition to wakeup EventThread(s). */
-static Event  **queue;		/* Heap priority queue (dynamically re-sized). */
-static int      nqueue;		/* Number of events in queue. */
-static int      maxqueue;	/* Max queue events (dynamically re-sized). */
+static Ns_TimerWheel *wheel;	/* Timer wheel of queued events. */
 static int      running;
 static int  	shutdownPending;
 static Ns_Thread schedThread;
 static int nThreads;
 static int nIdleThreads;
-static Event *threadEventPtr;
+static int nWaiting;		/* Number of events in thread queue. */
+static Event *firstEventPtr;	/* Thread queue head. */
+static Event *lastEventPtr;	/* Thread queue tail. */
 static Ns_Thread *eventThreads;
-
-/*
- * Macro to exchange two events in the heap, used in QueueEvent() and
- * DeQueueEvent().
- */
-
-#define EXCH(i,j) \
-    {\
-    	Event *tmp = queue[(i)];\
-	queue[(i)] = queue[(j)], queue[(j)] = tmp;\
-	queue[(i)]->qid = (i), queue[(j)]->qid = (j);\
-    }
-    
 
 /*
  *----------------------------------------------------------------------
@@ -132,6 +135,7 @@ NsInitSched(void)
     Ns_MutexInit(&lock);
     Ns_MutexSetName(&lock, "ns:sched");
     Tcl_InitHashTable(&eventsTable, TCL_ONE_WORD_KEYS);
+    wheel = Ns_TimerWheelCreate(NULL);
 }
 
 
@@ -262,11 +266,12 @@ Ns_ScheduleWeekly(Ns_SchedProc * proc, void *clientData, int flags,
 /*
  *----------------------------------------------------------------------
  *
- * Ns_ScheduleProcEx --
+ * Ns_ScheduleProcEx, Ns_ScheduleProcTime --
  *
- *	Schedule a proc to run at a given interval.  The interpretation
- *	of interval (whether interative, daily, or weekly) is handled
- * 	by QueueEvent.
+ *	Schedule a proc to run at a given interval in seconds or, for
+ *	Ns_ScheduleProcTime, with millisecond resolution.  The
+ *	interpretation of interval (whether interative, daily, or
+ *	weekly) is handled by QueueEvent.
  *
  * Results:
  *	Event id of NS_ERROR if interval is out of range.
@@ -280,22 +285,41 @@ Ns_ScheduleWeekly(Ns_SchedProc * proc, void *clientData, int flags,
 int
 Ns_ScheduleProcEx(Ns_SchedProc *proc, void *arg, int flags,
 	int interval, Ns_SchedProc *deleteProc)
+{
+    Ns_Time incr;
+
+    incr.sec = interval;
+    incr.usec = 0;
+    return Ns_ScheduleProcTime(proc, arg, flags, &incr, deleteProc);
+}
+
+int
+Ns_ScheduleProcTime(Ns_SchedProc *proc, void *arg, int flags,
+	Ns_Time *intervalPtr, Ns_SchedProc *deleteProc)
 {
     Event          *ePtr;
     int             id, new;
     static int	    nextId;
-    time_t	    now;
+    Ns_Time	    now;
 
-    if (interval < 0) {
+    if (intervalPtr->sec < 0 || intervalPtr->usec < 0) {
     	return NS_ERROR;
     }
 
-    time(&now);
+    Ns_GetTime(&now);
     ePtr = ns_malloc(sizeof(Event));
     ePtr->flags = flags;
-    ePtr->nextqueue = 0;
+    if (flags & NS_SCHED_PARALLEL) {
+	ePtr->flags |= NS_SCHED_THREAD;
+    }
     ePtr->lastqueue = ePtr->laststart = ePtr->lastend = -1;
-    ePtr->interval = interval;
+    ePtr->nrunning = ePtr->waiting = ePtr->deferred = 0;
+    ePtr->nrun = ePtr->nskip = 0;
+    ePtr->totallate.sec = ePtr->totallate.usec = 0;
+    ePtr->maxlate = ePtr->totallate;
+    ePtr->interval = *intervalPtr;
+    Ns_AdjTime(&ePtr->interval);
+    Ns_TimerInit(&ePtr->timer, ePtr);
     ePtr->proc = proc;
     ePtr->deleteProc = deleteProc;
     ePtr->arg = arg;
@@ -334,7 +358,8 @@ Ns_ScheduleProcEx(Ns_SchedProc *proc, void *arg, int flags,
  *	Ns_Cancel:          1 if cancelled, 0 otherwise.
  *
  * Side effects:
- *	See FreeEvent().
+ *	See FreeEvent().  An event which is running or waiting to
+ *	run is freed when done.
  *
  *----------------------------------------------------------------------
  */
@@ -350,9 +375,9 @@ Ns_Cancel(int id)
 {
     Tcl_HashEntry  *hPtr = NULL;
     Event          *ePtr = NULL;
-    int		    cancelled;
+    int		    cancelled, free;
 
-    cancelled = 0;
+    cancelled = free = 0;
     Ns_MutexLock(&lock);
     if (!shutdownPending) {
     	hPtr = Tcl_FindHashEntry(&eventsTable, (char *) id);
@@ -360,14 +385,13 @@ Ns_Cancel(int id)
 	    ePtr = Tcl_GetHashValue(hPtr);
 	    Tcl_DeleteHashEntry(hPtr);
 	    ePtr->hPtr = NULL;
-	    if (ePtr->qid > 0) {
-	    	DeQueueEvent(ePtr->qid);
-	    	cancelled = 1;
-	    }
+	    ePtr->deferred = 0;
+	    cancelled = Ns_TimerCancel(wheel, &ePtr->timer);
+	    free = (cancelled && ePtr->nrunning == 0 && !ePtr->waiting);
     	}
     }
     Ns_MutexUnlock(&lock);
-    if (cancelled) {
+    if (free) {
 	FreeEvent(ePtr);
     }
     return cancelled;
@@ -405,9 +429,7 @@ Ns_Pause(int id)
 	    ePtr = Tcl_GetHashValue(hPtr);
 	    if (!(ePtr->flags & NS_SCHED_PAUSED)) {
 		ePtr->flags |= NS_SCHED_PAUSED;
-	    	if (ePtr->qid > 0) {
-	    	    DeQueueEvent(ePtr->qid);
-		}
+		(void) Ns_TimerCancel(wheel, &ePtr->timer);
 		paused = 1;
 	    }
     	}
@@ -439,7 +461,7 @@ Ns_Resume(int id)
     Tcl_HashEntry  *hPtr;
     Event          *ePtr;
     int		    resumed;
-    time_t	    now;
+    Ns_Time	    now;
 
     resumed = 0;
     Ns_MutexLock(&lock);
@@ -449,7 +471,7 @@ Ns_Resume(int id)
 	    ePtr = Tcl_GetHashValue(hPtr);
 	    if ((ePtr->flags & NS_SCHED_PAUSED)) {
 		ePtr->flags &= ~NS_SCHED_PAUSED;
-		time(&now);
+		Ns_GetTime(&now);
 	    	QueueEvent(ePtr, &now);
 		resumed = 1;
 	    }
@@ -512,7 +534,7 @@ NsWaitSchedShutdown(Ns_Time *toPtr)
  *
  * QueueEvent --
  *
- *	Add an event to the priority queue heap.
+ *	Add an event timer to the wheel.
  *
  * Results:
  *	None.
@@ -524,58 +546,38 @@ NsWaitSchedShutdown(Ns_Time *toPtr)
  */
 
 static void
-QueueEvent(Event *ePtr, time_t *nowPtr)
+QueueEvent(Event *ePtr, Ns_Time *nowPtr)
 {
     struct tm      *tp;
+    Ns_Time         next;
 
     if (ePtr->flags & NS_SCHED_PAUSED) {
 	return;
     }
 
     /*
-     * Calculate the time from now in seconds this event should run.
+     * Calculate the time this event should next run.
      */
      
     if (ePtr->flags & (NS_SCHED_DAILY | NS_SCHED_WEEKLY)) {
-	tp = ns_localtime(nowPtr);
-	tp->tm_sec = ePtr->interval;
+	tp = ns_localtime(&nowPtr->sec);
+	tp->tm_sec = ePtr->interval.sec;
 	tp->tm_hour = 0;
 	tp->tm_min = 0;
 	if (ePtr->flags & NS_SCHED_WEEKLY) {
 	    tp->tm_mday -= tp->tm_wday;
 	}
-	ePtr->nextqueue = mktime(tp);
-	if (ePtr->nextqueue <= *nowPtr) {
+	next.sec = mktime(tp);
+	if (next.sec <= nowPtr->sec) {
 	    tp->tm_mday += (ePtr->flags & NS_SCHED_WEEKLY) ? 7 : 1;
-	    ePtr->nextqueue = mktime(tp);
+	    next.sec = mktime(tp);
 	}
+	next.usec = 0;
     } else {
-	ePtr->nextqueue = *nowPtr + ePtr->interval;
-    }
-
-    /*
-     * Place the new event at the end of the queue array and
-     * heap it up into place.  The queue array is extended
-     * if necessary.
-     */
-     
-    ePtr->qid = ++nqueue;
-    if (maxqueue <= nqueue) {
-	maxqueue += 1000;
-	queue = ns_realloc(queue, (sizeof(Event *)) * (maxqueue + 1));
-    }
-    queue[nqueue] = ePtr;
-    if (nqueue > 1) {
-	int             j, k;
-
-	k = nqueue;
-	j = k / 2;
-	while (k > 1 && queue[j]->nextqueue > queue[k]->nextqueue) {
-	    EXCH(j, k);
-	    k = j;
-	    j = k / 2;
-	}
+	next = *nowPtr;
+	Ns_IncrTime(&next, ePtr->interval.sec, ePtr->interval.usec);
     }
+    Ns_TimerAdd(wheel, &ePtr->timer, &next);
     
     /*
      * Signal or create the SchedThread if necessary.
@@ -589,53 +591,7 @@ QueueEvent(Event *ePtr, time_t *nowPtr)
     }
 }
 
-
-/*
- *----------------------------------------------------------------------
- *
- * DeQueueEvent --
- *
- *	Remove an event from the priority queue heap.
- *
- * Results:
- *	Pointer to removed event.
- *
- * Side effects:
- *	None.
- *
- *----------------------------------------------------------------------
- */
 
-static Event   *
-DeQueueEvent(int k)
-{
-    Event          *ePtr;
-    int             j;
-
-    /*
-     * Swap out the event to be removed and heap down to restore the
-     * order of events to be fired.
-     */
-     
-    EXCH(k, nqueue);
-    ePtr = queue[nqueue--];
-    ePtr->qid = 0;
-
-    while ((j = 2 * k) <= nqueue) {
-	if (j < nqueue && queue[j]->nextqueue > queue[j + 1]->nextqueue) {
-	    ++j;
-	}
-	if (queue[j]->nextqueue > queue[k]->nextqueue) {
-	    break;
-	}
-	EXCH(k, j);
-	k = j;
-    }
-
-    return ePtr;
-}
-
-
 /*
  *----------------------------------------------------------------------
  *
@@ -657,48 +613,137 @@ EventThread(void *arg)
 {
     Event          *ePtr;
     char	    name[20], idle[20];
-    time_t	    now;
+    Ns_Time	    now;
 
     sprintf(idle, "-sched:idle%d-", (int) arg);
     Ns_ThreadSetName(idle);
     Ns_Log(Notice, "starting");
     Ns_MutexLock(&lock);
     while (1) {
-	while (threadEventPtr == NULL && !shutdownPending) {
+	while (firstEventPtr == NULL && !shutdownPending) {
 	    Ns_CondWait(&eventcond, &lock);
 	}
-	if (threadEventPtr == NULL) {
+	if (firstEventPtr == NULL) {
 	    break;
 	}
-	ePtr = threadEventPtr;
-	threadEventPtr = ePtr->nextPtr;
-	if (threadEventPtr != NULL) {
+	ePtr = firstEventPtr;
+	firstEventPtr = ePtr->nextPtr;
+	if (firstEventPtr != NULL) {
 	    Ns_CondSignal(&eventcond);
+	} else {
+	    lastEventPtr = NULL;
 	}
+	ePtr->waiting = 0;
+	--nWaiting;
 	--nIdleThreads;
+	Ns_GetTime(&now);
+	StartEvent(ePtr, &now);
 	Ns_MutexUnlock(&lock);
     	sprintf(name, "-sched:%u-", ePtr->id);
     	Ns_ThreadSetName(name);
     	(*ePtr->proc) (ePtr->arg, (int)ePtr->id);
     	Ns_ThreadSetName(idle);
-    	time(&now);
+    	Ns_GetTime(&now);
     	Ns_MutexLock(&lock);
 	++nIdleThreads;
-    	if (ePtr->hPtr == NULL) {
+    	if (FinishEvent(ePtr, &now)) {
 	    Ns_MutexUnlock(&lock);
 	    FreeEvent(ePtr);
 	    Ns_MutexLock(&lock);
-	} else {
-	    ePtr->flags &= ~NS_SCHED_RUNNING;
-	    ePtr->lastend = now;
-    	    QueueEvent(ePtr, &now);
-    	}
+	}
     }
     Ns_MutexUnlock(&lock);
     Ns_Log(Notice, "exiting");
 }
 
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AppendEvent --
+ *
+ *	Add an event to the end of the thread queue.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Caller must ensure an EventThread is available or signalled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AppendEvent(Event *ePtr)
+{
+    ePtr->waiting = 1;
+    ePtr->nextPtr = NULL;
+    if (lastEventPtr == NULL) {
+	firstEventPtr = ePtr;
+    } else {
+	lastEventPtr->nextPtr = ePtr;
+    }
+    lastEventPtr = ePtr;
+    ++nWaiting;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StartEvent, FinishEvent --
+ *
+ *	Update event state and stats as a run starts or finishes.
+ *
+ * Results:
+ *	FinishEvent: 1 if the cancelled or one-shot event should now
+ *	be freed, 0 otherwise.
+ *
+ * Side effects:
+ *	FinishEvent re-queues an event which runs an interval after the
+ *	previous run or adds a deferred NS_SCHED_QUEUE run to the thread
+ *	queue.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StartEvent(Event *ePtr, Ns_Time *nowPtr)
+{
+    Ns_Time late;
+
+    ePtr->flags |= NS_SCHED_RUNNING;
+    ++ePtr->nrunning;
+    ++ePtr->nrun;
+    ePtr->laststart = nowPtr->sec;
+    if (Ns_DiffTime(nowPtr, &ePtr->due, &late) > 0) {
+	Ns_IncrTime(&ePtr->totallate, late.sec, late.usec);
+	if (Ns_DiffTime(&late, &ePtr->maxlate, NULL) > 0) {
+	    ePtr->maxlate = late;
+	}
+    }
+}
+
+static int
+FinishEvent(Event *ePtr, Ns_Time *nowPtr)
+{
+    ePtr->lastend = nowPtr->sec;
+    if (--ePtr->nrunning == 0) {
+	ePtr->flags &= ~NS_SCHED_RUNNING;
+    }
+    if (ePtr->hPtr == NULL) {
+	return (ePtr->nrunning == 0 && !ePtr->waiting);
+    }
+    if (!(ePtr->flags & FIXEDRATE)) {
+	QueueEvent(ePtr, nowPtr);
+    } else if (ePtr->deferred) {
+	ePtr->deferred = 0;
+	AppendEvent(ePtr);
+    }
+    return 0;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -745,9 +790,11 @@ static void
 SchedThread(void *ignored)
 {
     Event          *ePtr, *readyPtr;
-    time_t          now;
-    Ns_Time         timeout;
+    Ns_Timer       *timerPtr;
+    Ns_Time         now, timeout, due, next;
     int		    elapsed;
+    Tcl_HashEntry  *hPtr;
+    Tcl_HashSearch  search;
     Ns_Thread      *joinThreads;
     int             nJoinThreads;
 
@@ -759,23 +806,43 @@ SchedThread(void *ignored)
     while (!shutdownPending) {
     
     	/*
-	 * For events ready to run, either create a thread for
-	 * detached events or add to a list of synchronous events.
+	 * For events ready to run, either add to the queue for
+	 * detached events or to a list of synchronous events.  Fixed
+	 * rate events are queued again an interval after they were
+	 * due or from now if that has already passed.
 	 */
 	 
-	time(&now);
-	while (nqueue > 0 && queue[1]->nextqueue <= now) {
-	    ePtr = DeQueueEvent(1);
+	Ns_GetTime(&now);
+	timerPtr = Ns_TimerWheelExpire(wheel, &now);
+	while (timerPtr != NULL) {
+	    ePtr = timerPtr->arg;
+	    timerPtr = timerPtr->nextPtr;
+	    due = ePtr->timer.expires;
 	    if (ePtr->flags & NS_SCHED_ONCE) {
 		Tcl_DeleteHashEntry(ePtr->hPtr);
 		ePtr->hPtr = NULL;
+	    } else if (ePtr->flags & FIXEDRATE) {
+		next = due;
+		Ns_IncrTime(&next, ePtr->interval.sec, ePtr->interval.usec);
+		QueueEvent(ePtr,
+			   Ns_DiffTime(&next, &now, NULL) > 0 ? &due : &now);
+	    }
+	    ePtr->lastqueue = now.sec;
+	    if (ePtr->nrunning > 0 || ePtr->waiting) {
+		if ((ePtr->flags & NS_SCHED_QUEUE) && !ePtr->waiting
+			&& !ePtr->deferred) {
+		    ePtr->deferred = 1;
+		    ePtr->due = due;
+		    continue;
+		}
+		if (!(ePtr->flags & NS_SCHED_PARALLEL) || ePtr->waiting) {
+		    ++ePtr->nskip;
+		    continue;
+		}
 	    }
-	    ePtr->lastqueue = now;
+	    ePtr->due = due;
 	    if (ePtr->flags & NS_SCHED_THREAD) {
-	    	ePtr->flags |= NS_SCHED_RUNNING;
-	    	ePtr->laststart = now;
-		ePtr->nextPtr = threadEventPtr;
-		threadEventPtr = ePtr;
+		AppendEvent(ePtr);
 	    } else {
 	    	ePtr->nextPtr = readyPtr;
 	    	readyPtr = ePtr;
@@ -783,11 +850,13 @@ SchedThread(void *ignored)
 	}
 
 	/*
-	 * Dispatch any threaded events.
+	 * Dispatch any threaded events, creating threads up to the
+	 * max if all are busy.
 	 */
 
-	if (threadEventPtr != NULL) {
-	    if (nIdleThreads == 0) {
+	if (nWaiting > 0) {
+	    while (nIdleThreads < nWaiting
+		    && nThreads < nsconf.sched.maxthreads) {
 		eventThreads = ns_realloc(eventThreads, sizeof(Ns_Thread) * (nThreads+1));
 		Ns_ThreadCreate(EventThread, (void *) nThreads, 0, &eventThreads[nThreads]);
 		++nIdleThreads;
@@ -802,26 +871,21 @@ SchedThread(void *ignored)
 	 
 	while ((ePtr = readyPtr) != NULL) {
 	    readyPtr = ePtr->nextPtr;
-	    ePtr->laststart = now;
-	    ePtr->flags |= NS_SCHED_RUNNING;
+	    StartEvent(ePtr, &now);
 	    Ns_MutexUnlock(&lock);
 	    (*ePtr->proc) (ePtr->arg, (int)ePtr->id);
-	    time(&now);
-	    elapsed = (int) difftime(now, ePtr->laststart);
+	    Ns_GetTime(&now);
+	    elapsed = (int) difftime(now.sec, ePtr->laststart);
 	    if (elapsed > nsconf.sched.maxelapsed) {
 		Ns_Log(Warning, "sched: "
 		       "excessive time taken by proc %d (%d seconds)",
 		       ePtr->id, elapsed);
 	    }
-	    if (ePtr->hPtr == NULL) {
-		FreeEvent(ePtr);
-		ePtr = NULL;
-	    }
 	    Ns_MutexLock(&lock);
-	    if (ePtr != NULL) {
-	    	ePtr->flags &= ~NS_SCHED_RUNNING;
-	    	ePtr->lastend = now;
-		QueueEvent(ePtr, &now);
+	    if (FinishEvent(ePtr, &now)) {
+		Ns_MutexUnlock(&lock);
+		FreeEvent(ePtr);
+		Ns_MutexLock(&lock);
 	    }
 	}
 
@@ -829,11 +893,9 @@ SchedThread(void *ignored)
 	 * Wait for the next ready event.
 	 */
 
-	if (nqueue == 0) {
+	if (!Ns_TimerWheelNext(wheel, &timeout)) {
 	    Ns_CondWait(&schedcond, &lock);
 	} else if (!shutdownPending) {
-	    timeout.sec = queue[1]->nextqueue;
-	    timeout.usec = 0;
 	    (void) Ns_CondTimedWait(&schedcond, &lock, &timeout);
 	}
     }
@@ -861,11 +923,22 @@ SchedThread(void *ignored)
             Ns_MutexLock(&lock);
 	}
     }
+    readyPtr = NULL;
+    hPtr = Tcl_FirstHashEntry(&eventsTable, &search);
+    while (hPtr != NULL) {
+	ePtr = Tcl_GetHashValue(hPtr);
+	if (Ns_TimerCancel(wheel, &ePtr->timer)) {
+	    ePtr->nextPtr = readyPtr;
+	    readyPtr = ePtr;
+	}
+	hPtr = Tcl_NextHashEntry(&search);
+    }
     Ns_MutexUnlock(&lock);
-    while (nqueue > 0) {
-	FreeEvent(queue[nqueue--]);
+    while ((ePtr = readyPtr) != NULL) {
+	readyPtr = ePtr->nextPtr;
+	FreeEvent(ePtr);
     }
-    ns_free(queue);
+    Ns_TimerWheelDestroy(wheel);
     Tcl_DeleteHashTable(&eventsTable);
     Ns_Log(Notice, "sched: shutdown complete");
     Ns_MutexLock(&lock);
@@ -890,11 +963,23 @@ NsGetScheduled(Tcl_DString *dsPtr)
     while (hPtr != NULL) {
 	ePtr = Tcl_GetHashValue(hPtr);
 	Tcl_DStringStartSublist(dsPtr);
-	sprintf(buf, "%u %d %d %ld %ld %ld %ld",
-		ePtr->id, ePtr->flags, ePtr->interval, ePtr->nextqueue,
-		ePtr->lastqueue, ePtr->laststart, ePtr->lastend);
+	if (ePtr->interval.usec == 0) {
+	    sprintf(buf, "%u %d %ld", ePtr->id, ePtr->flags,
+		    (long) ePtr->interval.sec);
+	} else {
+	    sprintf(buf, "%u %d %ld.%06ld", ePtr->id, ePtr->flags,
+		    (long) ePtr->interval.sec, ePtr->interval.usec);
+	}
+	Tcl_DStringAppend(dsPtr, buf, -1);
+	sprintf(buf, " %ld %ld %ld %ld", (long) ePtr->timer.expires.sec,
+		(long) ePtr->lastqueue, (long) ePtr->laststart,
+		(long) ePtr->lastend);
 	Tcl_DStringAppend(dsPtr, buf, -1);
 	Ns_GetProcInfo(dsPtr, (void *) ePtr->proc, ePtr->arg);
+	sprintf(buf, " %u %u %ld.%06ld %ld.%06ld", ePtr->nrun, ePtr->nskip,
+		(long) ePtr->totallate.sec, ePtr->totallate.usec,
+		(long) ePtr->maxlate.sec, ePtr->maxlate.usec);
+	Tcl_DStringAppend(dsPtr, buf, -1);
 	Tcl_DStringEndSublist(dsPtr);
 	hPtr = Tcl_NextHashEntry(&search);
     }
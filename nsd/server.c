@@ -292,6 +292,9 @@ CreateServer(char *server)
 	i = 4;
     }
     servPtr->opts.gziplevel = i;
+    if (Ns_ConfigGetInt(path, "gzipcachesize", &i) && i > 0) {
+	servPtr->gzip.cache = NsGzipCache(server, i);
+    }
 
     /*
      * Set the default URL encoding used to decode the request.  The default
@@ -397,6 +400,12 @@ CreateServer(char *server)
     if (!Ns_ConfigGetBool(path, "mmap", &servPtr->fastpath.mmap)) {
     	servPtr->fastpath.mmap = 0;
     }
+    if (!Ns_ConfigGetBool(path, "gzipstatic", &servPtr->fastpath.gzipstatic)) {
+    	servPtr->fastpath.gzipstatic = 0;
+    }
+    if (!Ns_ConfigGetBool(path, "gzipcache", &servPtr->fastpath.gzipcache)) {
+    	servPtr->fastpath.gzipcache = 0;
+    }
     dirf = Ns_ConfigGetValue(path, "directoryfile");
     if (dirf == NULL) {
     	dirf = Ns_ConfigGetValue(spath, "directoryfile");
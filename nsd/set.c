@@ -38,6 +38,43 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd
 
 #include "nsd.h"
 
+/*
+ * The following structure defines a hash index of the keys of a large
+ * set, built when a set grows past SET_INDEX_MIN fields and maintained
+ * as fields are added and removed so lookups never modify the set,
+ * e.g., config sections read by several threads.  The index is an
+ * open addressed table of field numbers with linear probing.  Keys are
+ * hashed without case so the index serves both case sensitive and
+ * insensitive lookups and is unaffected by changes of case made to
+ * keys in place, e.g., in Ns_ParseHeader.  As fields are always
+ * indexed in order, the first match found along a probe sequence is
+ * the first matching field.
+ */
+
+#define SET_INDEX_MIN	8
+
+typedef struct SetSlot {
+    unsigned int    hash;	/* Hash of key. */
+    int             field;	/* Field number or -1 if empty. */
+} SetSlot;
+
+typedef struct SetIndex {
+    int             nslots;	/* Number of slots, a power of 2. */
+    int             nfields;	/* Number of fields indexed. */
+    SetSlot         slots[1];	/* Slots, allocated with index. */
+} SetIndex;
+
+/*
+ * Local functions defined in this file
+ */
+
+static int SetPut(Ns_Set *set, char *key, char *value);
+static int SetFind(Ns_Set *set, char *key, int nocase);
+static void SetUpdateIndex(Ns_Set *set, int rebuild);
+static unsigned int SetHash(char *key);
+static char *SetCopy(Ns_Set *set, char *string);
+static void SetFree(Ns_Set *set, void *ptr);
+
 
 /*
  *----------------------------------------------------------------------
@@ -89,6 +126,43 @@ Ns_SetCreate(char *name)
     setPtr->maxSize = 10;
     setPtr->name = ns_strcopy(name);
     setPtr->fields = ns_malloc(sizeof(Ns_SetField) * setPtr->maxSize);
+    setPtr->arena = NULL;
+    setPtr->index = NULL;
+    return setPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_SetCreateInArena --
+ *
+ *	Initialize a new set with memory allocated from an arena.
+ *
+ * Results:
+ *	A pointer to a new set. 
+ *
+ * Side effects:
+ *	The set and its tuples remain allocated until the arena is
+ *	reset; Ns_SetFree and functions which replace or delete tuples
+ *	do not free memory. 
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Set *
+Ns_SetCreateInArena(Ns_Arena *arena, char *name)
+{
+    Ns_Set *setPtr;
+
+    setPtr = Ns_ArenaAlloc(arena, sizeof(Ns_Set));
+    setPtr->size = 0;
+    setPtr->maxSize = 10;
+    setPtr->arena = arena;
+    setPtr->index = NULL;
+    setPtr->name = SetCopy(setPtr, name);
+    setPtr->fields = Ns_ArenaAlloc(arena,
+				   sizeof(Ns_SetField) * setPtr->maxSize);
     return setPtr;
 }
 
@@ -114,13 +188,14 @@ Ns_SetFree(Ns_Set *set)
 {
     int i;
 
-    if (set != NULL) {
+    if (set != NULL && set->arena == NULL) {
         for (i = 0; i < set->size; ++i) {
             ns_free(set->fields[i].name);
             ns_free(set->fields[i].value);
         }
         ns_free(set->fields);
         ns_free(set->name);
+        ns_free(set->index);
         ns_free(set);
     }
 }
@@ -145,18 +220,83 @@ Ns_SetFree(Ns_Set *set)
 int
 Ns_SetPut(Ns_Set *set, char *key, char *value)
 {
+    return SetPut(set, SetCopy(set, key), SetCopy(set, value));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_SetPutRef --
+ *
+ *	Insert a tuple into an existing arena set, referencing the
+ *	key and value instead of copying them, e.g., for request
+ *	headers parsed in place in the connection input buffer. 
+ *
+ * Results:
+ *	The index number of the new tuple. 
+ *
+ * Side effects:
+ *	The key and value must remain valid until the arena is reset.
+ *	As arena sets never modify or free their strings, replacing
+ *	the value leaves the original untouched.  For other sets, the
+ *	key/value will be strdup'ed as with Ns_SetPut. 
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_SetPutRef(Ns_Set *set, char *key, char *value)
+{
+    if (set->arena == NULL) {
+	return Ns_SetPut(set, key, value);
+    }
+    return SetPut(set, key, value);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetPut --
+ *
+ *	Append a tuple with the given strings, growing the set as
+ *	needed.
+ *
+ * Results:
+ *	The index number of the new tuple. 
+ *
+ * Side effects:
+ *	The key is added to the hash index of a large set.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SetPut(Ns_Set *set, char *key, char *value)
+{
+    Ns_SetField *fields;
     int index;
 
     index = set->size;
     set->size++;
     if (set->size > set->maxSize) {
         set->maxSize = set->size * 2;
-        set->fields = ns_realloc(set->fields,
-				 sizeof(Ns_SetField) * set->maxSize);
+	if (set->arena == NULL) {
+	    set->fields = ns_realloc(set->fields,
+				     sizeof(Ns_SetField) * set->maxSize);
+	} else {
+	    fields = Ns_ArenaAlloc(set->arena,
+				   sizeof(Ns_SetField) * set->maxSize);
+	    memcpy(fields, set->fields, sizeof(Ns_SetField) * index);
+	    set->fields = fields;
+	}
+    }
+    set->fields[index].name = key;
+    set->fields[index].value = value;
+    if (set->size > SET_INDEX_MIN) {
+	SetUpdateIndex(set, 0);
     }
-    set->fields[index].name = ns_strcopy(key);
-    set->fields[index].value = ns_strcopy(value);
-    
     return index;
 }
 
@@ -333,7 +473,7 @@ Ns_SetIUnique(Ns_Set *set, char *key)
 int
 Ns_SetFind(Ns_Set *set, char *key)
 {
-    return Ns_SetFindCmp(set, key, (int (*) (char *, char *)) strcmp);
+    return SetFind(set, key, 0);
 }
 
 
@@ -356,7 +496,7 @@ Ns_SetFind(Ns_Set *set, char *key)
 int
 Ns_SetIFind(Ns_Set *set, char *key)
 {
-    return Ns_SetFindCmp(set, key, (int (*) (char *, char *)) strcasecmp);
+    return SetFind(set, key, 1);
 }
 
 
@@ -379,7 +519,10 @@ Ns_SetIFind(Ns_Set *set, char *key)
 char *
 Ns_SetGet(Ns_Set *set, char *key)
 {
-    return Ns_SetGetCmp(set, key, (int (*) (char *, char *)) strcmp);
+    int i;
+
+    i = SetFind(set, key, 0);
+    return (i < 0 ? NULL : set->fields[i].value);
 }
 
 
@@ -402,7 +545,10 @@ Ns_SetGet(Ns_Set *set, char *key)
 char *
 Ns_SetIGet(Ns_Set *set, char *key)
 {
-    return Ns_SetGetCmp(set, key, (int (*) (char *, char *)) strcasecmp);
+    int i;
+
+    i = SetFind(set, key, 1);
+    return (i < 0 ? NULL : set->fields[i].value);
 }
 
 
@@ -429,10 +575,13 @@ Ns_SetTrunc(Ns_Set *set, int size)
 	int index;
 
         for (index = size; index < set->size; index++) {
-            ns_free(set->fields[index].name);
-            ns_free(set->fields[index].value);
+            SetFree(set, set->fields[index].name);
+            SetFree(set, set->fields[index].value);
         }
         set->size = size;
+	if (set->index != NULL) {
+	    SetUpdateIndex(set, 1);
+	}
     }
 }
 
@@ -459,13 +608,16 @@ Ns_SetDelete(Ns_Set *set, int index)
     if ((index != -1) && (index < set->size)) {
 	int i;
 
-        ns_free(set->fields[index].name);
-        ns_free(set->fields[index].value);
+        SetFree(set, set->fields[index].name);
+        SetFree(set, set->fields[index].value);
         for (i = index; i < set->size; ++i) {
             set->fields[i].name = set->fields[i + 1].name;
             set->fields[i].value = set->fields[i + 1].value;
         }
         --set->size;
+	if (set->index != NULL) {
+	    SetUpdateIndex(set, 1);
+	}
     }
 }
 
@@ -490,8 +642,8 @@ void
 Ns_SetPutValue(Ns_Set *set, int index, char *value)
 {
     if ((index != -1) && (index < set->size)) {
-        ns_free(set->fields[index].value);
-        set->fields[index].value = ns_strcopy(value);
+        SetFree(set, set->fields[index].value);
+        set->fields[index].value = SetCopy(set, value);
     }
 }
 
@@ -800,3 +952,196 @@ Ns_SetPrint(Ns_Set *set)
         }
     }
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetFind --
+ *
+ *	Locate the first field with the given key, using the hash index
+ *	of a large set or a linear scan of a small set.
+ *
+ * Results:
+ *	A field index or -1 if not found. 
+ *
+ * Side effects:
+ *	None. 
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SetFind(Ns_Set *set, char *key, int nocase)
+{
+    SetIndex     *indexPtr = set->index;
+    SetSlot      *slotPtr;
+    char         *name;
+    unsigned int  hash, mask, i;
+
+    if (indexPtr == NULL) {
+	return Ns_SetFindCmp(set, key, (int (*) (char *, char *))
+			     (nocase ? strcasecmp : strcmp));
+    }
+    hash = SetHash(key);
+    mask = (unsigned int) indexPtr->nslots - 1;
+    for (i = hash & mask; ; i = (i + 1) & mask) {
+	slotPtr = &indexPtr->slots[i];
+	if (slotPtr->field < 0) {
+	    break;
+	}
+	if (slotPtr->hash != hash) {
+	    continue;
+	}
+	name = set->fields[slotPtr->field].name;
+	if (key == NULL || name == NULL) {
+	    if (key == name) {
+		return slotPtr->field;
+	    }
+	} else if ((nocase ? strcasecmp(key, name) : strcmp(key, name)) == 0) {
+	    return slotPtr->field;
+	}
+    }
+    return -1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetUpdateIndex --
+ *
+ *	Add new fields to the hash index of a large set, creating or
+ *	growing the index as needed, or rebuild the index after fields
+ *	have been removed.
+ *
+ * Results:
+ *	None. 
+ *
+ * Side effects:
+ *	The index is freed if the set is no longer large.  Indexes of
+ *	arena sets are allocated in the arena.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetUpdateIndex(Ns_Set *set, int rebuild)
+{
+    SetIndex     *indexPtr = set->index;
+    SetSlot      *slotPtr;
+    unsigned int  hash, mask, i;
+    int           nslots;
+    size_t        size;
+
+    if (set->size <= SET_INDEX_MIN) {
+	SetFree(set, indexPtr);
+	set->index = NULL;
+	return;
+    }
+
+    /*
+     * Keep the table at most half full, growing it to a quarter full
+     * so it is replaced only as often as the number of fields doubles.
+     */
+
+    if (indexPtr == NULL || set->size * 2 > indexPtr->nslots) {
+	nslots = 32;
+	while (nslots < set->size * 4) {
+	    nslots *= 2;
+	}
+	size = sizeof(SetIndex) + sizeof(SetSlot) * (nslots - 1);
+	SetFree(set, indexPtr);
+	if (set->arena != NULL) {
+	    indexPtr = Ns_ArenaAlloc(set->arena, size);
+	} else {
+	    indexPtr = ns_malloc(size);
+	}
+	indexPtr->nslots = nslots;
+	set->index = indexPtr;
+	rebuild = 1;
+    }
+    if (rebuild) {
+	for (i = 0; i < (unsigned int) indexPtr->nslots; ++i) {
+	    indexPtr->slots[i].field = -1;
+	}
+	indexPtr->nfields = 0;
+    }
+    mask = (unsigned int) indexPtr->nslots - 1;
+    while (indexPtr->nfields < set->size) {
+	hash = SetHash(set->fields[indexPtr->nfields].name);
+	i = hash & mask;
+	while (indexPtr->slots[i].field >= 0) {
+	    i = (i + 1) & mask;
+	}
+	slotPtr = &indexPtr->slots[i];
+	slotPtr->hash = hash;
+	slotPtr->field = indexPtr->nfields++;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetHash --
+ *
+ *	Hash a key without case.
+ *
+ * Results:
+ *	Hash value, 0 for a NULL key.
+ *
+ * Side effects:
+ *	None. 
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned int
+SetHash(char *key)
+{
+    unsigned int hash = 0;
+
+    if (key != NULL) {
+	while (*key != '\0') {
+	    hash += (hash << 3) + tolower(UCHAR(*key));
+	    ++key;
+	}
+    }
+    return hash;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetCopy, SetFree --
+ *
+ *	Copy a string for or free memory of a set, either with ns_malloc
+ *	or in the set's arena.
+ *
+ * Results:
+ *	SetCopy returns a copy of the string or NULL if string is NULL.
+ *
+ * Side effects:
+ *	SetFree does nothing for arena sets.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+SetCopy(Ns_Set *set, char *string)
+{
+    if (set->arena != NULL) {
+	return Ns_ArenaStrDup(set->arena, string);
+    }
+    return ns_strcopy(string);
+}
+
+static void
+SetFree(Ns_Set *set, void *ptr)
+{
+    if (set->arena == NULL) {
+	ns_free(ptr);
+    }
+}
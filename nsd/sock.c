@@ -846,7 +846,7 @@ NsPoll(struct pollfd *pfds, int nfds, Ns_Time *timeoutPtr)
             if (Ns_DiffTime(timeoutPtr, &now, &diff) <= 0)  {
                 ms = 0;
             } else {
-            	ms = diff.sec * 1000 + diff.usec / 1000;
+            	ms = diff.sec * 1000 + (diff.usec + 999) / 1000;
             }
 	}
 	n = ns_poll(pfds, (size_t) nfds, ms);
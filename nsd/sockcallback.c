@@ -32,11 +32,22 @@
  * sockcallback.c --
  *
  *	Support for the socket callback thread.
+ *
+ *	Registrations are kept in a table keyed by socket.  Where
+ *	available, an epoll descriptor mirrors the table so each
+ *	registration, change or cancel is a single epoll_ctl() call;
+ *	otherwise the poll() array is rebuilt from the table on each
+ *	pass.  With the "sockcallbackthreads" parameter set, ready
+ *	callbacks are run by a pool of worker threads and their
+ *	sockets are not watched until the callback returns.
  */
 
 static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd/sockcallback.c,v 1.17 2006/04/13 19:06:41 jgdavidson Exp $, compiled: " __DATE__ " " __TIME__;
 
 #include "nsd.h"
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
 
 /*
  * The following defines a socket being monitored.
@@ -45,32 +56,72 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd
 typedef struct SockCallback {
     struct SockCallback *nextPtr;
     SOCKET               sock;
-    int			 idx;
     int                  when;
+    int			 ready;		/* Ready conditions for a worker. */
+    int			 busy;		/* Running in a worker thread. */
+    int			 exit;		/* Run exit callback when done. */
     Ns_SockProc         *proc;
     void                *arg;
 } SockCallback;
 
+/*
+ * The following defines the maximum number of events returned by
+ * each epoll_wait().
+ */
+
+#define MAX_EVENTS	256
+
+/*
+ * The following defines a worker thread.  Each socket is always run
+ * by the same worker as Tcl channels created by a callback may only
+ * be used by the thread which created them.
+ */
+
+typedef struct Worker {
+    Ns_Thread		 thread;
+    Ns_Cond		 cond;
+    struct SockCallback *firstPtr;	/* Ready callbacks. */
+    struct SockCallback *lastPtr;
+} Worker;
+
 /*
  * Local functions defined in this file
  */
 
 static Ns_ThreadProc SockCallbackThread;
+static Ns_ThreadProc SockWorkerThread;
 static int QueueSock(SOCKET sock, Ns_SockProc *proc, void *arg, int when);
 static void CallbackTrigger(void);
+static void DrainTrigger(void);
+static void WatchSock(SockCallback *cbPtr);
+static void UnwatchSock(SockCallback *cbPtr);
+static void RemoveSock(SockCallback *cbPtr);
+static void DispatchSock(SockCallback *cbPtr, int ready);
+static void QueueWorker(SockCallback *cbPtr, int ready);
+static void RunSock(SockCallback *cbPtr, int ready);
 
 /*
  * Static variables defined in this file
  */
 
 static SockCallback *firstCallbackPtr, *lastCallbackPtr;
+static SockCallback *firstDonePtr;	/* Returned by workers. */
 static int	     shutdownPending;
+static int	     workerShutdown;
 static int	     running;
+static int	     nworkers;
 static Ns_Thread     sockThread;
+static Worker	    *workers;
 static Ns_Mutex      lock;
 static Ns_Cond	     cond;
 static SOCKET	     trigPipe[2];
 static Tcl_HashTable table;
+#ifdef HAVE_EPOLL_CREATE
+static int	     epfd;
+#endif
+static int	     when[3] = {
+    NS_SOCK_READ, NS_SOCK_WRITE, NS_SOCK_EXCEPTION | NS_SOCK_DROP
+};
 
 
 /*
@@ -178,9 +229,10 @@ NsWaitSockShutdown(Ns_Time *toPtr)
 /*
  *----------------------------------------------------------------------
  *
- * CallbackTrigger --
+ * CallbackTrigger, DrainTrigger --
  *
- *	Wakeup the callback thread if it's in poll().
+ *	Wakeup the callback thread if it's in poll() and drain the
+ *	pending wakeups.
  *
  * Results:
  *	None.
@@ -199,6 +251,16 @@ CallbackTrigger(void)
     }
 }
 
+static void
+DrainTrigger(void)
+{
+    char buf[64];
+
+    if (recv(trigPipe[0], buf, sizeof(buf), 0) <= 0) {
+	Ns_Fatal("trigger read() failed: %s", ns_sockstrerror(ns_sockerrno));
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -227,6 +289,7 @@ QueueSock(SOCKET sock, Ns_SockProc *proc, void *arg, int when)
     cbPtr->proc = proc;
     cbPtr->arg = arg;
     cbPtr->when = when;
+    cbPtr->exit = 0;
     trigger = create = 0;
     Ns_MutexLock(&lock);
     if (shutdownPending) {
@@ -263,12 +326,15 @@ QueueSock(SOCKET sock, Ns_SockProc *proc, void *arg, int when)
 }
 
 
+
+
 /*
  *----------------------------------------------------------------------
  *
  * SockCallbackThread --
  *
- *	Run callbacks registered with Ns_SockCallback.
+ *	Run callbacks registered with Ns_SockCallback, or dispatch
+ *	them to the worker threads.
  *
  * Results:
  *	None. 
@@ -282,55 +348,100 @@ QueueSock(SOCKET sock, Ns_SockProc *proc, void *arg, int when)
 static void
 SockCallbackThread(void *ignored)
 {
-    char          c;
-    int           when[3], events[3];
-    int           n, i, new, stop;
-    int		  max, nfds;
-    SockCallback *cbPtr, *nextPtr;
+    int            n, i, new, stop, ready;
+    SockCallback  *cbPtr, *nextPtr, *donePtr;
     Tcl_HashEntry *hPtr;
     Tcl_HashSearch search;
+#ifdef HAVE_EPOLL_CREATE
+    struct epoll_event ev, *evs;
+#else
+    int		   events[3], max, nfds;
+    SockCallback **cbs;
     struct pollfd *pfds;
+#endif
 
     Ns_ThreadSetName("-socks-");
     Ns_WaitForStartup();
     Ns_Log(Notice, "socks: starting");
 
+#ifdef HAVE_EPOLL_CREATE
+    epfd = epoll_create(MAX_EVENTS);
+    if (epfd < 0) {
+	Ns_Fatal("socks: epoll_create() failed: %s", strerror(errno));
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = trigPipe[0];
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, trigPipe[0], &ev) != 0) {
+	Ns_Fatal("socks: epoll_ctl() failed: %s", strerror(errno));
+    }
+    evs = ns_malloc(sizeof(struct epoll_event) * MAX_EVENTS);
+#else
     events[0] = POLLIN;
     events[1] = POLLOUT;
     events[2] = POLLPRI;
-    when[0] = NS_SOCK_READ;
-    when[1] = NS_SOCK_WRITE;
-    when[2] = NS_SOCK_EXCEPTION | NS_SOCK_DROP;
     max = 100;
     pfds = ns_malloc(sizeof(struct pollfd) * max);
+    cbs = ns_malloc(sizeof(SockCallback *) * max);
     pfds[0].fd = trigPipe[0];
     pfds[0].events = POLLIN;
+#endif
+
+    nworkers = nsconf.sockcb.threads;
+    if (nworkers > 0) {
+	Ns_Log(Notice, "socks: starting %d worker threads", nworkers);
+	workers = ns_calloc((size_t) nworkers, sizeof(Worker));
+	for (i = 0; i < nworkers; ++i) {
+	    Ns_ThreadCreate(SockWorkerThread, &workers[i], 0,
+			    &workers[i].thread);
+	}
+    }
     
     while (1) {
 
 	/*
-	 * Grab the list of any queue updates and the shutdown
-	 * flag.
+	 * Grab the list of any queue updates, callbacks returned
+	 * by the workers, and the shutdown flag.
 	 */
 
     	Ns_MutexLock(&lock);
 	cbPtr = firstCallbackPtr;
 	firstCallbackPtr = NULL;
         lastCallbackPtr = NULL;
+	donePtr = firstDonePtr;
+	firstDonePtr = NULL;
 	stop = shutdownPending;
 	Ns_MutexUnlock(&lock);
+
+	/*
+	 * Watch callbacks returned by the workers again unless they
+	 * were cancelled or replaced while running.
+	 */
+
+	while (donePtr != NULL) {
+	    nextPtr = donePtr->nextPtr;
+	    donePtr->busy = 0;
+	    hPtr = Tcl_FindHashEntry(&table, (char *) (intptr_t) donePtr->sock);
+	    if (hPtr == NULL || Tcl_GetHashValue(hPtr) != donePtr) {
+		ns_free(donePtr);
+	    } else if (!(donePtr->when & NS_SOCK_ANY)) {
+		RemoveSock(donePtr);
+	    } else {
+		WatchSock(donePtr);
+	    }
+	    donePtr = nextPtr;
+	}
     
 	/*
-    	 * Move any queued callbacks to the active table.
+    	 * Move any queued callbacks to the active table.  Callbacks
+	 * still running in a worker are freed when they return.
 	 */
 
         while (cbPtr != NULL) {
             nextPtr = cbPtr->nextPtr;
             if (cbPtr->when & NS_SOCK_CANCEL) {
-                hPtr = Tcl_FindHashEntry(&table, (char *) cbPtr->sock);
+                hPtr = Tcl_FindHashEntry(&table, (char *) (intptr_t) cbPtr->sock);
                 if (hPtr != NULL) {
-                    ns_free(Tcl_GetHashValue(hPtr));
-                    Tcl_DeleteHashEntry(hPtr);
+		    RemoveSock(Tcl_GetHashValue(hPtr));
                 }
                 if (cbPtr->proc != NULL) {
                     (void) (*cbPtr->proc)(cbPtr->sock, cbPtr->arg,
@@ -338,32 +449,75 @@ SockCallbackThread(void *ignored)
                 }
                 ns_free(cbPtr);
             } else {
-                hPtr = Tcl_CreateHashEntry(&table, (char *) cbPtr->sock, &new);
-                if (!new) {
+                hPtr = Tcl_CreateHashEntry(&table, (char *) (intptr_t) cbPtr->sock, &new);
+                if (!new && !((SockCallback *) Tcl_GetHashValue(hPtr))->busy) {
                     ns_free(Tcl_GetHashValue(hPtr));
                 }
+		cbPtr->busy = 0;
                 Tcl_SetHashValue(hPtr, cbPtr);
+		WatchSock(cbPtr);
             }
             cbPtr = nextPtr;
         }
+	if (stop) {
+	    break;
+	}
+
+#ifdef HAVE_EPOLL_CREATE
+
+    	/*
+	 * Wait for events and execute any ready callbacks.  Errors
+	 * and hangups are reported to all registered conditions so
+	 * the callback can close the socket.
+	 */
+
+	n = epoll_wait(epfd, evs, MAX_EVENTS, -1);
+	if (n < 0 && errno != EINTR) {
+	    Ns_Fatal("socks: epoll_wait() failed: %s", strerror(errno));
+	}
+	for (i = 0; i < n; ++i) {
+	    if (evs[i].data.fd == trigPipe[0]) {
+		DrainTrigger();
+		continue;
+	    }
+	    hPtr = Tcl_FindHashEntry(&table, (char *) (intptr_t) evs[i].data.fd);
+	    if (hPtr == NULL) {
+		continue;
+	    }
+	    cbPtr = Tcl_GetHashValue(hPtr);
+	    ready = 0;
+	    if (evs[i].events & EPOLLIN) {
+		ready |= NS_SOCK_READ;
+	    }
+	    if (evs[i].events & EPOLLOUT) {
+		ready |= NS_SOCK_WRITE;
+	    }
+	    if (evs[i].events & EPOLLPRI) {
+		ready |= when[2];
+	    }
+	    if (evs[i].events & (EPOLLERR | EPOLLHUP)) {
+		ready |= cbPtr->when;
+	    }
+	    DispatchSock(cbPtr, ready);
+	}
+#else
 
 	/*
-	 * Verify and set the poll bits for all active callbacks.
+	 * Set the poll bits for all active callbacks not running
+	 * in a worker.
 	 */
 
 	if (max <= table.numEntries) {
 	    max  = table.numEntries + 100;
-	    pfds = ns_realloc(pfds, (size_t)max);
+	    pfds = ns_realloc(pfds, sizeof(struct pollfd) * max);
+	    cbs = ns_realloc(cbs, sizeof(SockCallback *) * max);
 	}
 	nfds = 1;
 	hPtr = Tcl_FirstHashEntry(&table, &search);
 	while (hPtr != NULL) {
 	    cbPtr = Tcl_GetHashValue(hPtr);
-	    if (!(cbPtr->when & NS_SOCK_ANY)) {
-	    	Tcl_DeleteHashEntry(hPtr);
-		ns_free(cbPtr);
-	    } else {
-		cbPtr->idx = nfds;
+	    if (!cbPtr->busy) {
+		cbs[nfds] = cbPtr;
 		pfds[nfds].fd = cbPtr->sock;
 		pfds[nfds].events = pfds[nfds].revents = 0;
         	for (i = 0; i < 3; ++i) {
@@ -377,51 +531,99 @@ SockCallbackThread(void *ignored)
         }
 
     	/*
-	 * Select on the sockets and drain the trigger pipe if
-	 * necessary.
+	 * Select on the sockets, drain the trigger pipe if
+	 * necessary, and execute any ready callbacks.
 	 */
 
-	if (stop) {
-	    break;
-	}
 	pfds[0].revents = 0;
 	n = NsPoll(pfds, (size_t) nfds, NULL);
-	if ((pfds[0].revents & POLLIN) && recv(trigPipe[0], &c, 1, 0) != 1) {
-	    Ns_Fatal("trigger read() failed: %s", strerror(errno));
+	if (pfds[0].revents & POLLIN) {
+	    DrainTrigger();
 	}
-
-    	/*
-	 * Execute any ready callbacks.
-	 */
-	 
-    	hPtr = Tcl_FirstHashEntry(&table, &search);
-	while (n > 0 && hPtr != NULL) {
-	    cbPtr = Tcl_GetHashValue(hPtr);
-            for (i = 0; i < 3; ++i) {
-                if ((cbPtr->when & when[i])
-		    && (pfds[cbPtr->idx].revents & events[i])) {
-                    if (!((*cbPtr->proc)(cbPtr->sock, cbPtr->arg, when[i]))) {
-			cbPtr->when = 0;
-		    }
-                }
-            }
-	    hPtr = Tcl_NextHashEntry(&search);
-        }
+	for (i = 1; n > 0 && i < nfds; ++i) {
+	    ready = 0;
+	    if (pfds[i].revents & POLLIN) {
+		ready |= NS_SOCK_READ;
+	    }
+	    if (pfds[i].revents & POLLOUT) {
+		ready |= NS_SOCK_WRITE;
+	    }
+	    if (pfds[i].revents & POLLPRI) {
+		ready |= when[2];
+	    }
+	    if (pfds[i].revents & (POLLERR | POLLHUP)) {
+		ready |= cbs[i]->when;
+	    }
+	    DispatchSock(cbs[i], ready);
+	}
+#endif
     }
 
     /*
-     * Invoke any exit callabacks, cleanup the callback
-     * system, and signal shutdown complete.
+     * Invoke any exit callbacks, cleanup the callback system, and
+     * signal shutdown complete.  With worker threads, exit callbacks
+     * are queued to the worker assigned to the socket, after any
+     * callback still running, before the workers are stopped as
+     * Tcl channels may only be closed by the thread which created
+     * them.
      */
 
     Ns_Log(Notice, "socks: shutdown pending");
-    hPtr = Tcl_FirstHashEntry(&table, &search);
-    while (hPtr != NULL) {
-	cbPtr = Tcl_GetHashValue(hPtr);
-	if (cbPtr->when & NS_SOCK_EXIT) {
-	    (void) ((*cbPtr->proc)(cbPtr->sock, cbPtr->arg, NS_SOCK_EXIT));
+    if (nworkers > 0) {
+	Ns_MutexLock(&lock);
+	donePtr = firstDonePtr;
+	firstDonePtr = NULL;
+	while (donePtr != NULL) {
+	    nextPtr = donePtr->nextPtr;
+	    donePtr->busy = 0;
+	    hPtr = Tcl_FindHashEntry(&table, (char *) (intptr_t) donePtr->sock);
+	    if (hPtr == NULL || Tcl_GetHashValue(hPtr) != donePtr) {
+		ns_free(donePtr);
+	    }
+	    donePtr = nextPtr;
+	}
+	hPtr = Tcl_FirstHashEntry(&table, &search);
+	while (hPtr != NULL) {
+	    cbPtr = Tcl_GetHashValue(hPtr);
+	    if (cbPtr->when & NS_SOCK_EXIT) {
+		if (cbPtr->busy) {
+		    cbPtr->exit = 1;
+		} else {
+		    QueueWorker(cbPtr, NS_SOCK_EXIT);
+		}
+	    }
+	    hPtr = Tcl_NextHashEntry(&search);
+	}
+	workerShutdown = 1;
+	for (i = 0; i < nworkers; ++i) {
+	    Ns_CondSignal(&workers[i].cond);
+	}
+	Ns_MutexUnlock(&lock);
+	for (i = 0; i < nworkers; ++i) {
+	    Ns_ThreadJoin(&workers[i].thread, NULL);
+	    Ns_CondDestroy(&workers[i].cond);
+	}
+	ns_free(workers);
+	donePtr = firstDonePtr;
+	firstDonePtr = NULL;
+	while (donePtr != NULL) {
+	    nextPtr = donePtr->nextPtr;
+	    donePtr->busy = 0;
+	    hPtr = Tcl_FindHashEntry(&table, (char *) (intptr_t) donePtr->sock);
+	    if (hPtr == NULL || Tcl_GetHashValue(hPtr) != donePtr) {
+		ns_free(donePtr);
+	    }
+	    donePtr = nextPtr;
+	}
+    } else {
+	hPtr = Tcl_FirstHashEntry(&table, &search);
+	while (hPtr != NULL) {
+	    cbPtr = Tcl_GetHashValue(hPtr);
+	    if (cbPtr->when & NS_SOCK_EXIT) {
+		(void) ((*cbPtr->proc)(cbPtr->sock, cbPtr->arg, NS_SOCK_EXIT));
+	    }
+	    hPtr = Tcl_NextHashEntry(&search);
 	}
-	hPtr = Tcl_NextHashEntry(&search);
     }
     hPtr = Tcl_FirstHashEntry(&table, &search);
     while (hPtr != NULL) {
@@ -429,6 +631,13 @@ SockCallbackThread(void *ignored)
 	hPtr = Tcl_NextHashEntry(&search);
     }
     Tcl_DeleteHashTable(&table);
+#ifdef HAVE_EPOLL_CREATE
+    close(epfd);
+    ns_free(evs);
+#else
+    ns_free(pfds);
+    ns_free(cbs);
+#endif
 
     Ns_Log(Notice, "socks: shutdown complete");
     Ns_MutexLock(&lock);
@@ -438,6 +647,228 @@ SockCallbackThread(void *ignored)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockWorkerThread --
+ *
+ *	Run ready callbacks dispatched by the callback thread.
+ *
+ * Results:
+ *	None. 
+ *
+ * Side effects:
+ *	Callbacks are returned to the callback thread to be watched
+ *	again or removed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockWorkerThread(void *arg)
+{
+    Worker       *workerPtr = arg;
+    SockCallback *cbPtr;
+    char          name[32];
+
+    sprintf(name, "-socks:%d-", (int) (workerPtr - workers));
+    Ns_ThreadSetName(name);
+
+    Ns_MutexLock(&lock);
+    while (1) {
+	while (workerPtr->firstPtr == NULL && !workerShutdown) {
+	    Ns_CondWait(&workerPtr->cond, &lock);
+	}
+	cbPtr = workerPtr->firstPtr;
+	if (cbPtr == NULL) {
+	    break;
+	}
+	workerPtr->firstPtr = cbPtr->nextPtr;
+	Ns_MutexUnlock(&lock);
+	RunSock(cbPtr, cbPtr->ready);
+	Ns_MutexLock(&lock);
+	if (cbPtr->exit) {
+	    cbPtr->exit = 0;
+	    Ns_MutexUnlock(&lock);
+	    RunSock(cbPtr, NS_SOCK_EXIT);
+	    Ns_MutexLock(&lock);
+	}
+	if (firstDonePtr == NULL) {
+	    CallbackTrigger();
+	}
+	cbPtr->nextPtr = firstDonePtr;
+	firstDonePtr = cbPtr;
+    }
+    Ns_MutexUnlock(&lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WatchSock, UnwatchSock --
+ *
+ *	Add or update, and remove, the epoll registration for a
+ *	callback.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None without epoll, the poll array is rebuilt on each pass.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WatchSock(SockCallback *cbPtr)
+{
+#ifdef HAVE_EPOLL_CREATE
+    struct epoll_event ev;
+
+    ev.events = 0;
+    if (cbPtr->when & when[0]) {
+	ev.events |= EPOLLIN;
+    }
+    if (cbPtr->when & when[1]) {
+	ev.events |= EPOLLOUT;
+    }
+    if (cbPtr->when & when[2]) {
+	ev.events |= EPOLLPRI;
+    }
+    ev.data.u64 = 0;
+    ev.data.fd = cbPtr->sock;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, cbPtr->sock, &ev) != 0
+	    && (errno != ENOENT
+		|| epoll_ctl(epfd, EPOLL_CTL_ADD, cbPtr->sock, &ev) != 0)) {
+	Ns_Log(Error, "socks: epoll_ctl(%d) failed: %s",
+	       (int) cbPtr->sock, strerror(errno));
+    }
+#endif
+}
+
+static void
+UnwatchSock(SockCallback *cbPtr)
+{
+#ifdef HAVE_EPOLL_CREATE
+    struct epoll_event ev;
+
+    (void) epoll_ctl(epfd, EPOLL_CTL_DEL, cbPtr->sock, &ev);
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RemoveSock --
+ *
+ *	Remove a callback from the active table.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Callback is freed unless running in a worker, in which case
+ *	it is freed when returned.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RemoveSock(SockCallback *cbPtr)
+{
+    Tcl_HashEntry *hPtr;
+
+    hPtr = Tcl_FindHashEntry(&table, (char *) (intptr_t) cbPtr->sock);
+    if (hPtr != NULL && Tcl_GetHashValue(hPtr) == cbPtr) {
+	Tcl_DeleteHashEntry(hPtr);
+    }
+    if (!cbPtr->busy) {
+	UnwatchSock(cbPtr);
+	ns_free(cbPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DispatchSock, QueueWorker, RunSock --
+ *
+ *	Run a ready callback directly or queue it for the worker
+ *	assigned to the socket, and invoke the callback for each
+ *	ready condition or, at shutdown, the exit condition.  The
+ *	lock must be held by callers of QueueWorker.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The socket is not watched while queued for or running in a
+ *	worker.  A callback which returns 0 is removed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DispatchSock(SockCallback *cbPtr, int ready)
+{
+    if (cbPtr->busy || !(ready & cbPtr->when)) {
+	return;
+    }
+    if (nworkers == 0) {
+	RunSock(cbPtr, ready);
+	if (!(cbPtr->when & NS_SOCK_ANY)) {
+	    RemoveSock(cbPtr);
+	}
+	return;
+    }
+    UnwatchSock(cbPtr);
+    Ns_MutexLock(&lock);
+    QueueWorker(cbPtr, ready);
+    Ns_MutexUnlock(&lock);
+}
+
+static void
+QueueWorker(SockCallback *cbPtr, int ready)
+{
+    Worker *workerPtr;
+
+    cbPtr->busy = 1;
+    cbPtr->ready = ready;
+    cbPtr->nextPtr = NULL;
+    workerPtr = &workers[cbPtr->sock % nworkers];
+    if (workerPtr->firstPtr == NULL) {
+	workerPtr->firstPtr = cbPtr;
+    } else {
+	workerPtr->lastPtr->nextPtr = cbPtr;
+    }
+    workerPtr->lastPtr = cbPtr;
+    Ns_CondSignal(&workerPtr->cond);
+}
+
+static void
+RunSock(SockCallback *cbPtr, int ready)
+{
+    int i;
+
+    if (ready & NS_SOCK_EXIT) {
+	if (cbPtr->when & NS_SOCK_EXIT) {
+	    (void) ((*cbPtr->proc)(cbPtr->sock, cbPtr->arg, NS_SOCK_EXIT));
+	}
+	return;
+    }
+    for (i = 0; i < 3; ++i) {
+	if ((cbPtr->when & when[i]) && (ready & when[i])) {
+	    if (!((*cbPtr->proc)(cbPtr->sock, cbPtr->arg, when[i]))) {
+		cbPtr->when = 0;
+	    }
+	}
+    }
+}
+
+
 void
 NsGetSockCallbacks(Tcl_DString *dsPtr)
 {
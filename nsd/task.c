@@ -27,31 +27,65 @@
  * version of this file under either the License or the GPL.
  */
 
+
 /*
  * task.c --
  *
  *	Support for I/O tasks.
+ *
+ *	A task queue runs one or more threads.  Enqueued tasks are
+ *	assigned to the thread with the fewest tasks and run there
+ *	until done.  Each thread keeps task timeouts in a timer wheel
+ *	and, where available, task sockets in an epoll descriptor
+ *	which is updated only when a task's wait conditions change.
  */
 
 static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd/task.c,v 1.4 2005/08/01 20:29:24 jgdavidson Exp $, compiled: " __DATE__ " " __TIME__;
 
 #include "nsd.h"
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
 
 /*
- * The following defines a task queue.
+ * The following defines a thread of a task queue.  The wheel,
+ * tasks table and epoll descriptor are private to the thread.
  */
 
 #define NAME_SIZE 31
+#define MAX_EVENTS 256
 
-typedef struct TaskQueue {
-    struct TaskQueue *nextPtr;	  /* Next in list of all queues. */
+typedef struct QueueThread {
+    struct TaskQueue *queuePtr;	  /* Queue of this thread. */
     struct Task  *firstSignalPtr; /* First in list of task signals. */
     Ns_Thread	  tid;		  /* Thread id. */
-    Ns_Mutex	  lock;		  /* Queue list and signal lock. */
+    Ns_Mutex	  lock;		  /* Signal and stats lock. */
     Ns_Cond	  cond;		  /* Task and queue signal condition. */
     int		  shutdown;	  /* Shutdown flag. */
     int		  stopped;	  /* Stop flag. */
     SOCKET	  trigger[2];	  /* Trigger pipe. */
+    int		  ntasks;	  /* Tasks assigned, locked by queue. */
+    Ns_TimerWheel *wheel;	  /* Task timeouts. */
+    Tcl_HashTable tasks;	  /* Tasks being run. */
+#ifdef HAVE_EPOLL_CREATE
+    int		  epfd;		  /* Epoll descriptor. */
+#endif
+    unsigned long ntotal;	  /* Total tasks run. */
+    unsigned long nspins;	  /* Total wakeups. */
+    unsigned long ncalls;	  /* Callbacks for ready sockets. */
+    Ns_Time	  totallat;	  /* Total time from wakeup to callback. */
+    Ns_Time	  maxlat;	  /* Max time from wakeup to callback. */
+} QueueThread;
+
+/*
+ * The following defines a task queue.
+ */
+
+typedef struct TaskQueue {
+    struct TaskQueue *nextPtr;	  /* Next in list of all queues. */
+    Ns_Mutex	  lock;		  /* Task assignment lock. */
+    int		  nthreads;	  /* Number of threads. */
+    QueueThread	 *threads;	  /* Array of threads. */
     char	  name[NAME_SIZE+1]; /* String name. */
 } TaskQueue;
 
@@ -66,6 +100,7 @@ typedef struct TaskQueue {
 #define TASK_TIMEOUT		0x08
 #define TASK_DONE			0x10
 #define TASK_PENDING		0x20
+#define TASK_RESUME		0x40
 
 /*
  * The following defines a task.
@@ -73,14 +108,17 @@ typedef struct TaskQueue {
 
 typedef struct Task {
     struct TaskQueue *queuePtr;	  /* Monitoring queue. */
-    struct Task  *nextWaitPtr;	  /* Next on wait queue. */
+    struct QueueThread *threadPtr; /* Monitoring queue thread. */
+    struct Task  *nextWaitPtr;	  /* Next on list of signalled tasks. */
     struct Task  *nextSignalPtr;  /* Next on signal queue. */
     SOCKET	  sock;		  /* Underlying socket. */
     Ns_TaskProc  *proc;		  /* Queue callback. */
     void         *arg;		  /* Callback data. */
-    int		  idx;		  /* Poll index. */
     int		  events;	  /* Poll events. */
+    int		  resume;	  /* When bits signalled by Ns_TaskResume. */
+    int		  watched;	  /* Poll events being watched. */
     Ns_Time	  timeout;	  /* Non-null timeout data. */
+    Ns_Timer	  timer;	  /* Timeout timer in queue thread. */
     int		  signal;	  /* Signal bits sent to/from queue thread. */
     int		  flags;	  /* Flags private to queue. */
 } Task;
@@ -89,12 +127,14 @@ typedef struct Task {
  * Local functions defined in this file
  */
 
-static void TriggerQueue(TaskQueue *queuePtr);
+static void TriggerQueue(QueueThread *threadPtr);
 static void JoinQueue(TaskQueue *queuePtr);
 static void StopQueue(TaskQueue *queuePtr);
 static int SignalQueue(Task *taskPtr, int bit);
 static Ns_ThreadProc TaskThread;
 static void RunTask(Task *taskPtr, int revents, Ns_Time *nowPtr);
+static int UpdateTask(QueueThread *threadPtr, Task *taskPtr);
+static void WatchTask(QueueThread *threadPtr, Task *taskPtr, int events);
 #define Call(tp,w) ((*((tp)->proc))((Ns_Task *)(tp),(tp)->sock,(tp)->arg,(w)))
 
 /*
@@ -119,13 +159,14 @@ static struct {
     {NS_SOCK_READ,	POLLIN}
 };
 
-
+
 /*
  *----------------------------------------------------------------------
  *
- * Ns_CreateTaskQueue --
+ * Ns_CreateTaskQueue, Ns_CreateTaskQueueEx --
  *
- *	Create a new task queue.
+ *	Create a new task queue, optionally run by more than one
+ *	thread.
  *
  * Results:
  *	Handle to task queue.. 
@@ -138,19 +179,39 @@ static struct {
 
 Ns_TaskQueue *
 Ns_CreateTaskQueue(char *name)
+{
+    return Ns_CreateTaskQueueEx(name, 1);
+}
+
+Ns_TaskQueue *
+Ns_CreateTaskQueueEx(char *name, int nthreads)
 {
     TaskQueue *queuePtr;
+    QueueThread *threadPtr;
+    int i;
 
+    if (nthreads < 1) {
+	nthreads = 1;
+    }
     queuePtr = ns_calloc(1, sizeof(TaskQueue));
     strncpy(queuePtr->name, name ? name : "", NAME_SIZE);
-    if (ns_sockpair(queuePtr->trigger) != 0) {
-	Ns_Fatal("queue: ns_sockpair() failed: %s",
-		 ns_sockstrerror(ns_sockerrno));
+    queuePtr->nthreads = nthreads;
+    queuePtr->threads = ns_calloc((size_t) nthreads, sizeof(QueueThread));
+    for (i = 0; i < nthreads; ++i) {
+	threadPtr = &queuePtr->threads[i];
+	threadPtr->queuePtr = queuePtr;
+    	if (ns_sockpair(threadPtr->trigger) != 0) {
+	    Ns_Fatal("queue: ns_sockpair() failed: %s",
+		     ns_sockstrerror(ns_sockerrno));
+	}
     }
     Ns_MutexLock(&lock);
     queuePtr->nextPtr = firstQueuePtr;
     firstQueuePtr = queuePtr;
-    Ns_ThreadCreate(TaskThread, queuePtr, 0, &queuePtr->tid);
+    for (i = 0; i < nthreads; ++i) {
+	threadPtr = &queuePtr->threads[i];
+    	Ns_ThreadCreate(TaskThread, threadPtr, 0, &threadPtr->tid);
+    }
     Ns_MutexUnlock(&lock);
     return (Ns_TaskQueue *) queuePtr;
 }
@@ -224,6 +285,7 @@ Ns_TaskCreate(SOCKET sock, Ns_TaskProc *proc, void *arg)
     taskPtr->sock = sock;
     taskPtr->proc = proc;
     taskPtr->arg = arg;
+    Ns_TimerInit(&taskPtr->timer, taskPtr);
     return (Ns_Task *) taskPtr;
 }
 
@@ -233,7 +295,8 @@ Ns_TaskCreate(SOCKET sock, Ns_TaskProc *proc, void *arg)
  *
  * Ns_TaskEnqueue --
  *
- *	Add a task to a queue.
+ *	Add a task to a queue, assigning it to the queue thread
+ *	running the fewest tasks.
  *
  * Results:
  *	NS_OK if task sent, NS_ERROR otherwise.
@@ -244,14 +307,35 @@ Ns_TaskCreate(SOCKET sock, Ns_TaskProc *proc, void *arg)
  *----------------------------------------------------------------------
  */
 
+
 int
 Ns_TaskEnqueue(Ns_Task *task, Ns_TaskQueue *queue)
 {
     Task *taskPtr = (Task *) task;
     TaskQueue *queuePtr = (TaskQueue *) queue;
+    QueueThread *threadPtr;
+    int i;
+
+    /*
+     * Assign the task to the thread running the fewest tasks.
+     */
+
+    Ns_MutexLock(&queuePtr->lock);
+    threadPtr = &queuePtr->threads[0];
+    for (i = 1; i < queuePtr->nthreads; ++i) {
+	if (queuePtr->threads[i].ntasks < threadPtr->ntasks) {
+	    threadPtr = &queuePtr->threads[i];
+	}
+    }
+    ++threadPtr->ntasks;
+    Ns_MutexUnlock(&queuePtr->lock);
 
     taskPtr->queuePtr = queuePtr;
+    taskPtr->threadPtr = threadPtr;
     if (!SignalQueue(taskPtr, TASK_INIT)) {
+    	Ns_MutexLock(&queuePtr->lock);
+	--threadPtr->ntasks;
+    	Ns_MutexUnlock(&queuePtr->lock);
 	return NS_ERROR;
     }
     return NS_OK;
@@ -332,13 +416,53 @@ Ns_TaskCancel(Ns_Task *task)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TaskResume --
+ *
+ *	Signal a task queue to watch a task again for the given
+ *	conditions, e.g., after the task callback stopped reading
+ *	with Ns_TaskCallback until another thread has consumed its
+ *	output.  The timeout, if any, is unchanged.
+ *
+ * Results:
+ *	NS_OK if resume sent, NS_ERROR otherwise, including for a
+ *	task run with Ns_TaskRun.
+ *
+ * Side effects:
+ *	Task callback will be invoked when ready.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_TaskResume(Ns_Task *task, int when)
+{
+    Task *taskPtr = (Task *) task;
+    QueueThread *threadPtr = taskPtr->threadPtr;
+
+    if (taskPtr->queuePtr == NULL) {
+	return NS_ERROR;
+    }
+    Ns_MutexLock(&threadPtr->lock);
+    taskPtr->resume = when;
+    Ns_MutexUnlock(&threadPtr->lock);
+    if (!SignalQueue(taskPtr, TASK_RESUME)) {
+	return NS_ERROR;
+    }
+    return NS_OK;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
  * Ns_TaskWait --
  *
  *	Wait for a task to complete.  Infinite wait is indicated
- *	by a NULL timeoutPtr.	
+ *	by a NULL timeoutPtr.  A task signalled as it completed is
+ *	not complete until the queue thread has removed the signal.
  *
  * Results:
  *	NS_TIMEOUT if task did not complete by absolute time,
@@ -354,22 +478,24 @@ int
 Ns_TaskWait(Ns_Task *task, Ns_Time *timeoutPtr)
 {
     Task *taskPtr = (Task *) task;
-    TaskQueue *queuePtr = taskPtr->queuePtr;
+    QueueThread *threadPtr = taskPtr->threadPtr;
     int status = NS_OK;
 
-    if (queuePtr == NULL) {
+    if (taskPtr->queuePtr == NULL) {
 	if (!(taskPtr->signal & TASK_DONE)) {
 	    status = NS_TIMEOUT;
 	}
     } else {
-    	Ns_MutexLock(&queuePtr->lock);
-    	while (status == NS_OK && !(taskPtr->signal & TASK_DONE)) {
-	    status = Ns_CondTimedWait(&queuePtr->cond, &queuePtr->lock,
+    	Ns_MutexLock(&threadPtr->lock);
+    	while (status == NS_OK && (!(taskPtr->signal & TASK_DONE)
+				   || (taskPtr->signal & TASK_PENDING))) {
+	    status = Ns_CondTimedWait(&threadPtr->cond, &threadPtr->lock,
 				      timeoutPtr);
     	}
-    	Ns_MutexUnlock(&queuePtr->lock);
+    	Ns_MutexUnlock(&threadPtr->lock);
 	if (status == NS_OK) {
 	    taskPtr->queuePtr = NULL;
+	    taskPtr->threadPtr = NULL;
 	}
     }
     return status;
@@ -547,7 +673,8 @@ void
 NsWaitQueueShutdown(Ns_Time *toPtr)
 {
     TaskQueue *queuePtr, *nextPtr;
-    int status;
+    QueueThread *threadPtr;
+    int i, status;
     
     /*
      * Clear out list of any remaining task queues.
@@ -565,11 +692,15 @@ NsWaitQueueShutdown(Ns_Time *toPtr)
     status = NS_OK;
     while (status == NS_OK && queuePtr != NULL) {
 	nextPtr = queuePtr->nextPtr;
-	Ns_MutexLock(&queuePtr->lock);
-	while (status == NS_OK && !queuePtr->stopped) {
-	    status = Ns_CondTimedWait(&queuePtr->cond, &queuePtr->lock, toPtr);
+	for (i = 0; status == NS_OK && i < queuePtr->nthreads; ++i) {
+	    threadPtr = &queuePtr->threads[i];
+	    Ns_MutexLock(&threadPtr->lock);
+	    while (status == NS_OK && !threadPtr->stopped) {
+		status = Ns_CondTimedWait(&threadPtr->cond, &threadPtr->lock,
+					  toPtr);
+	    }
+	    Ns_MutexUnlock(&threadPtr->lock);
 	}
-	Ns_MutexUnlock(&queuePtr->lock);
 	if (status == NS_OK) {
 	    JoinQueue(queuePtr);
 	}
@@ -610,6 +741,9 @@ RunTask(Task *taskPtr, int revents, Ns_Time *nowPtr)
     if (revents & POLLHUP) {
 	revents |= POLLIN;
     }
+    if (revents & POLLERR) {
+	revents |= taskPtr->events;
+    }
     if (revents) {
     	for (i = 0; i < 3; ++i) {
 	    if (revents & map[i].event) {
@@ -623,13 +757,13 @@ RunTask(Task *taskPtr, int revents, Ns_Time *nowPtr)
     }
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
  * SignalQueue --
  *
- *	Send a signal for a task to a task queue.
+ *	Send a signal for a task to its task queue thread.
  *
  * Results:
  *	None. 
@@ -643,12 +777,12 @@ RunTask(Task *taskPtr, int revents, Ns_Time *nowPtr)
 static int
 SignalQueue(Task *taskPtr, int bit)
 {
-    TaskQueue *queuePtr = taskPtr->queuePtr;
+    QueueThread *threadPtr = taskPtr->threadPtr;
     int pending = 0, shutdown;
 
-    Ns_MutexLock(&queuePtr->lock);
-    shutdown = queuePtr->shutdown;
-    if (!shutdown) {
+    Ns_MutexLock(&threadPtr->lock);
+    shutdown = threadPtr->shutdown;
+    if (!shutdown && !(taskPtr->signal & TASK_DONE)) {
 
 	/*
 	 * Mark the signal and add event to signal list if not
@@ -659,27 +793,27 @@ SignalQueue(Task *taskPtr, int bit)
     	pending = (taskPtr->signal & TASK_PENDING);
     	if (!pending) {
 	    taskPtr->signal |= TASK_PENDING;
-	    taskPtr->nextSignalPtr = queuePtr->firstSignalPtr;
-	    queuePtr->firstSignalPtr = taskPtr;
+	    taskPtr->nextSignalPtr = threadPtr->firstSignalPtr;
+	    threadPtr->firstSignalPtr = taskPtr;
     	}
     }
-    Ns_MutexUnlock(&queuePtr->lock);
+    Ns_MutexUnlock(&threadPtr->lock);
     if (shutdown) {
 	return 0;
     }
     if (!pending) {
-	TriggerQueue(queuePtr);
+	TriggerQueue(threadPtr);
     }
     return 1;
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
  * TriggerQueue --
  *
- *	Wakeup a task queue.
+ *	Wakeup a task queue thread.
  *
  * Results:
  *	None.
@@ -691,21 +825,21 @@ SignalQueue(Task *taskPtr, int bit)
  */
 
 static void
-TriggerQueue(TaskQueue *queuePtr)
+TriggerQueue(QueueThread *threadPtr)
 {
-    if (send(queuePtr->trigger[1], "", 1, 0) != 1) {
+    if (send(threadPtr->trigger[1], "", 1, 0) != 1) {
 	Ns_Fatal("queue: trigger send() failed: %s",
 		  ns_sockstrerror(ns_sockerrno));
     }
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
  * StopQueue --
  *
- *	Signal a task queue to shutdown.
+ *	Signal the threads of a task queue to shutdown.
  *
  * Results:
  *	None. 
@@ -720,13 +854,19 @@ TriggerQueue(TaskQueue *queuePtr)
 static void
 StopQueue(TaskQueue *queuePtr)
 {
-    Ns_MutexLock(&queuePtr->lock);
-    queuePtr->shutdown = 1;
-    Ns_MutexUnlock(&queuePtr->lock);
-    TriggerQueue(queuePtr);
+    QueueThread *threadPtr;
+    int i;
+
+    for (i = 0; i < queuePtr->nthreads; ++i) {
+	threadPtr = &queuePtr->threads[i];
+    	Ns_MutexLock(&threadPtr->lock);
+    	threadPtr->shutdown = 1;
+    	Ns_MutexUnlock(&threadPtr->lock);
+    	TriggerQueue(threadPtr);
+    }
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -746,20 +886,28 @@ StopQueue(TaskQueue *queuePtr)
 static void
 JoinQueue(TaskQueue *queuePtr)
 {
-    Ns_ThreadJoin(&queuePtr->tid, NULL);
-    ns_sockclose(queuePtr->trigger[0]);
-    ns_sockclose(queuePtr->trigger[1]);
+    QueueThread *threadPtr;
+    int i;
+
+    for (i = 0; i < queuePtr->nthreads; ++i) {
+	threadPtr = &queuePtr->threads[i];
+    	Ns_ThreadJoin(&threadPtr->tid, NULL);
+    	ns_sockclose(threadPtr->trigger[0]);
+    	ns_sockclose(threadPtr->trigger[1]);
+    	Ns_MutexDestroy(&threadPtr->lock);
+    }
     Ns_MutexDestroy(&queuePtr->lock);
+    ns_free(queuePtr->threads);
     ns_free(queuePtr);
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
  * TaskThread --
  *
- *	Run an task queue.
+ *	Run a task queue thread.
  *
  * Results:
  *	None. 
@@ -773,21 +921,55 @@ JoinQueue(TaskQueue *queuePtr)
 static void
 TaskThread(void *arg)
 {
-    TaskQueue	 *queuePtr = arg;
-    char          c;
-    int           n, broadcast, max, nfds, shutdown;
+    QueueThread  *threadPtr = arg;
+    TaskQueue	 *queuePtr = threadPtr->queuePtr;
+    char          buf[64];
+    int           n, i, new, revents, broadcast, shutdown;
+    unsigned long ncalls;
     Task	 *taskPtr, *nextPtr, *firstWaitPtr;
+    Ns_Timer	 *timerPtr, *nextTimerPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    Ns_Time	  now, wake, next, diff, totallat, maxlat;
+    char	  name[NAME_SIZE+20];
+#ifdef HAVE_EPOLL_CREATE
+    struct epoll_event ev, *evs;
+    int		  ms;
+#else
     struct pollfd *pfds;
-    Ns_Time	  now, *timeoutPtr;
-    char	  name[NAME_SIZE+10];
-
-    sprintf(name, "task:%s", queuePtr->name);
+    Task	 **tasks;
+    int		  max, nfds;
+    Ns_Time	  *timeoutPtr;
+#endif
+
+    if (queuePtr->nthreads > 1) {
+	sprintf(name, "task:%s:%d", queuePtr->name,
+		(int) (threadPtr - queuePtr->threads));
+    } else {
+	sprintf(name, "task:%s", queuePtr->name);
+    }
     Ns_ThreadSetName(name);
     Ns_Log(Notice, "starting");
 
+    threadPtr->wheel = Ns_TimerWheelCreate(NULL);
+    Tcl_InitHashTable(&threadPtr->tasks, TCL_ONE_WORD_KEYS);
+#ifdef HAVE_EPOLL_CREATE
+    threadPtr->epfd = epoll_create(MAX_EVENTS);
+    if (threadPtr->epfd < 0) {
+	Ns_Fatal("queue: epoll_create() failed: %s", strerror(errno));
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(threadPtr->epfd, EPOLL_CTL_ADD, threadPtr->trigger[0],
+		  &ev) != 0) {
+	Ns_Fatal("queue: epoll_ctl() failed: %s", strerror(errno));
+    }
+    evs = ns_malloc(sizeof(struct epoll_event) * MAX_EVENTS);
+#else
     max = 100;
     pfds = ns_malloc(sizeof(struct pollfd) * max);
-    firstWaitPtr = NULL;
+    tasks = ns_malloc(sizeof(Task *) * max);
+#endif
 
     while (1) {
 
@@ -795,16 +977,27 @@ TaskThread(void *arg)
 	 * Get the shutdown flag and process any incoming signals.
 	 */
 
-    	Ns_MutexLock(&queuePtr->lock);
-	shutdown = queuePtr->shutdown;
-	while ((taskPtr = queuePtr->firstSignalPtr) != NULL) {
-	    queuePtr->firstSignalPtr = taskPtr->nextSignalPtr;
+	broadcast = 0;
+    	Ns_MutexLock(&threadPtr->lock);
+	shutdown = threadPtr->shutdown;
+	firstWaitPtr = NULL;
+	while ((taskPtr = threadPtr->firstSignalPtr) != NULL) {
+	    threadPtr->firstSignalPtr = taskPtr->nextSignalPtr;
 	    taskPtr->nextSignalPtr = NULL;
-	    if (!(taskPtr->flags & TASK_WAIT)) {
-		taskPtr->flags |= TASK_WAIT;
-		taskPtr->nextWaitPtr = firstWaitPtr;
-		firstWaitPtr = taskPtr;
+
+	    /*
+	     * Ignore signals for a task which completed after it was
+	     * signalled, e.g., cancelled as it timed out, but wake up
+	     * threads waiting for the signal to be removed.
+	     */
+
+	    if (taskPtr->signal & TASK_DONE) {
+		taskPtr->signal &= ~(TASK_CANCEL|TASK_PENDING);
+		broadcast = 1;
+		continue;
 	    }
+	    taskPtr->nextWaitPtr = firstWaitPtr;
+	    firstWaitPtr = taskPtr;
 	    if (taskPtr->signal & TASK_INIT) {
 		taskPtr->signal &= ~TASK_INIT;
 		taskPtr->flags  |= TASK_INIT;
@@ -813,67 +1006,46 @@ TaskThread(void *arg)
 		taskPtr->signal &= ~TASK_CANCEL;
 		taskPtr->flags  |= TASK_CANCEL;
 	    }
+	    if (taskPtr->signal & TASK_RESUME) {
+		taskPtr->signal &= ~TASK_RESUME;
+		taskPtr->flags  |= TASK_RESUME;
+	    }
 	    taskPtr->signal &= ~TASK_PENDING;
 	}
-	Ns_MutexUnlock(&queuePtr->lock);
+	Ns_MutexUnlock(&threadPtr->lock);
 
 	/*
-	 * Invoke pre-poll callbacks, determine minimum timeout, and set
-	 * the pollfd structs for all waiting tasks.
+	 * Call init and/or cancel for signalled tasks.  Note that a
+	 * task can go from init to done immediately so all required
+	 * callbacks are invoked before updating the wait conditions.
 	 */
 
-    	pfds[0].fd = queuePtr->trigger[0];
-    	pfds[0].events = POLLIN;
-	pfds[0].revents = 0;
-	nfds = 1;
-	timeoutPtr = NULL;
 	taskPtr = firstWaitPtr;
-	firstWaitPtr = NULL;
-	broadcast = 0;
 	while (taskPtr != NULL) {
 	    nextPtr = taskPtr->nextWaitPtr;
-	    
-	    /*
-	     * Call init and/or cancel and signal done if necessary.
-	     * Note that a task can go from init to done immediately
-	     * so all required callbacks are invoked before determining
-	     * if a wait is required.
-	     */
-
 	    if (taskPtr->flags & TASK_INIT) {
 		taskPtr->flags &= ~TASK_INIT;
+		hPtr = Tcl_CreateHashEntry(&threadPtr->tasks, (char *) taskPtr,
+					   &new);
 		Call(taskPtr, NS_SOCK_INIT);
 	    }
 	    if (taskPtr->flags & TASK_CANCEL) {
-		taskPtr->flags &= ~(TASK_CANCEL|TASK_WAIT);
+		taskPtr->flags &= ~(TASK_CANCEL|TASK_WAIT|TASK_RESUME);
 		taskPtr->flags |= TASK_DONE;
 		Call(taskPtr, NS_SOCK_CANCEL);
 	    }
-	    if (taskPtr->flags & TASK_DONE) {
-		taskPtr->flags &= ~(TASK_DONE|TASK_WAIT);
-    		Ns_MutexLock(&queuePtr->lock);
-    		taskPtr->signal |= TASK_DONE;
-    		Ns_MutexUnlock(&queuePtr->lock);
-		broadcast = 1;
-	    }
-	    if (taskPtr->flags & TASK_WAIT) {
-		if (max <= nfds) {
-	    	    max  = nfds + 100;
-	    	    pfds = ns_realloc(pfds, (size_t) max);
+	    if (taskPtr->flags & TASK_RESUME) {
+		taskPtr->flags &= ~TASK_RESUME;
+		for (i = 0; i < 3; ++i) {
+		    if (taskPtr->resume & map[i].when) {
+			taskPtr->events |= map[i].event;
+		    }
+		}
+		if (taskPtr->events) {
+		    taskPtr->flags |= TASK_WAIT;
 		}
-	    	taskPtr->idx = nfds;
-	    	pfds[nfds].fd = taskPtr->sock;
-	    	pfds[nfds].events = taskPtr->events;
-	    	pfds[nfds].revents = 0;
-	    	if ((taskPtr->flags & TASK_TIMEOUT) && (timeoutPtr == NULL
-			|| Ns_DiffTime(&taskPtr->timeout,
-				       timeoutPtr, NULL) < 0)) {
-		    timeoutPtr = &taskPtr->timeout;
-	    	}
-		taskPtr->nextWaitPtr = firstWaitPtr;
-		firstWaitPtr = taskPtr;
-		++nfds;
 	    }
+	    broadcast |= UpdateTask(threadPtr, taskPtr);
 	    taskPtr = nextPtr;
         }
 
@@ -882,7 +1054,7 @@ TaskThread(void *arg)
 	 */
 
 	if (broadcast) {
-    	    Ns_CondBroadcast(&queuePtr->cond);
+    	    Ns_CondBroadcast(&threadPtr->cond);
 	}
 
 	/*
@@ -893,26 +1065,135 @@ TaskThread(void *arg)
 	    break;
 	}
 
-    	/*
-	 * Poll sockets and drain the trigger pipe if necessary.
+	/*
+	 * Wait for ready sockets, the trigger pipe, or the next timeout
+	 * and execute any ready callbacks, recording the delay from the
+	 * wakeup to each callback.
 	 */
 
+	broadcast = 0;
+	ncalls = 0;
+	totallat.sec = totallat.usec = 0;
+	maxlat = totallat;
+#ifdef HAVE_EPOLL_CREATE
+	if (!Ns_TimerWheelNext(threadPtr->wheel, &next)) {
+	    ms = -1;
+	} else {
+	    Ns_GetTime(&now);
+	    if (Ns_DiffTime(&next, &now, &diff) <= 0) {
+		ms = 0;
+	    } else {
+		ms = diff.sec * 1000 + (diff.usec + 999) / 1000;
+	    }
+	}
+	n = epoll_wait(threadPtr->epfd, evs, MAX_EVENTS, ms);
+	if (n < 0) {
+	    if (errno != EINTR) {
+		Ns_Fatal("queue: epoll_wait() failed: %s", strerror(errno));
+	    }
+	    n = 0;
+	}
+	Ns_GetTime(&wake);
+	for (i = 0; i < n; ++i) {
+	    taskPtr = evs[i].data.ptr;
+	    if (taskPtr == NULL) {
+		if (recv(threadPtr->trigger[0], buf, sizeof(buf), 0) <= 0) {
+		    Ns_Fatal("queue: trigger read() failed: %s",
+			      ns_sockstrerror(ns_sockerrno));
+		}
+		continue;
+	    }
+	    revents = 0;
+	    if (evs[i].events & EPOLLIN) {
+		revents |= POLLIN;
+	    }
+	    if (evs[i].events & EPOLLOUT) {
+		revents |= POLLOUT;
+	    }
+	    if (evs[i].events & EPOLLPRI) {
+		revents |= POLLPRI;
+	    }
+	    if (evs[i].events & EPOLLHUP) {
+		revents |= POLLHUP;
+	    }
+	    if (evs[i].events & EPOLLERR) {
+		revents |= POLLERR;
+	    }
+#else
+	if (max <= threadPtr->tasks.numEntries) {
+	    max = threadPtr->tasks.numEntries + 100;
+	    pfds = ns_realloc(pfds, sizeof(struct pollfd) * max);
+	    tasks = ns_realloc(tasks, sizeof(Task *) * max);
+	}
+    	pfds[0].fd = threadPtr->trigger[0];
+    	pfds[0].events = POLLIN;
+	nfds = 1;
+	hPtr = Tcl_FirstHashEntry(&threadPtr->tasks, &search);
+	while (hPtr != NULL) {
+	    taskPtr = (Task *) Tcl_GetHashKey(&threadPtr->tasks, hPtr);
+	    if (taskPtr->watched) {
+		tasks[nfds] = taskPtr;
+		pfds[nfds].fd = taskPtr->sock;
+		pfds[nfds].events = taskPtr->watched;
+		++nfds;
+	    }
+	    hPtr = Tcl_NextHashEntry(&search);
+	}
+	if (Ns_TimerWheelNext(threadPtr->wheel, &next)) {
+	    timeoutPtr = &next;
+	} else {
+	    timeoutPtr = NULL;
+	}
 	n = NsPoll(pfds, nfds, timeoutPtr);
-	if ((pfds[0].revents & POLLIN) && recv(pfds[0].fd, &c, 1, 0) != 1) {
+	if ((pfds[0].revents & POLLIN)
+		&& recv(pfds[0].fd, buf, sizeof(buf), 0) <= 0) {
 	    Ns_Fatal("queue: trigger read() failed: %s",
 		      ns_sockstrerror(ns_sockerrno));
 	}
+	Ns_GetTime(&wake);
+	for (i = 1; n > 0 && i < nfds; ++i) {
+	    taskPtr = tasks[i];
+	    revents = pfds[i].revents;
+	    if (revents == 0) {
+		continue;
+	    }
+#endif
+	    Ns_GetTime(&now);
+	    Ns_DiffTime(&now, &wake, &diff);
+	    Ns_IncrTime(&totallat, diff.sec, diff.usec);
+	    if (Ns_DiffTime(&diff, &maxlat, NULL) > 0) {
+		maxlat = diff;
+	    }
+	    ++ncalls;
+	    RunTask(taskPtr, revents, &now);
+	    broadcast |= UpdateTask(threadPtr, taskPtr);
+	}
 
-    	/*
-	 * Execute any ready events or timeouts for waiting tasks.
+	/*
+	 * Execute callbacks for expired timeouts.
 	 */
-	 
-	Ns_GetTime(&now);
-	taskPtr = firstWaitPtr;
-	while (taskPtr != NULL) {
-	    RunTask(taskPtr, pfds[taskPtr->idx].revents, &now);
-	    taskPtr = taskPtr->nextWaitPtr;
-        }
+
+	timerPtr = Ns_TimerWheelExpire(threadPtr->wheel, &wake);
+	while (timerPtr != NULL) {
+	    nextTimerPtr = timerPtr->nextPtr;
+	    taskPtr = timerPtr->arg;
+	    taskPtr->flags &= ~TASK_WAIT;
+	    Call(taskPtr, NS_SOCK_TIMEOUT);
+	    broadcast |= UpdateTask(threadPtr, taskPtr);
+	    timerPtr = nextTimerPtr;
+	}
+	if (broadcast) {
+    	    Ns_CondBroadcast(&threadPtr->cond);
+	}
+
+	Ns_MutexLock(&threadPtr->lock);
+	++threadPtr->nspins;
+	threadPtr->ncalls += ncalls;
+	Ns_IncrTime(&threadPtr->totallat, totallat.sec, totallat.usec);
+	if (Ns_DiffTime(&maxlat, &threadPtr->maxlat, NULL) > 0) {
+	    threadPtr->maxlat = maxlat;
+	}
+	Ns_MutexUnlock(&threadPtr->lock);
     }
 
     Ns_Log(Notice, "shutdown pending");
@@ -921,24 +1202,216 @@ TaskThread(void *arg)
      * Call exit for all remaining tasks.
      */
 
-    taskPtr = firstWaitPtr;
-    while (taskPtr != NULL) {
+    hPtr = Tcl_FirstHashEntry(&threadPtr->tasks, &search);
+    while (hPtr != NULL) {
+	taskPtr = (Task *) Tcl_GetHashKey(&threadPtr->tasks, hPtr);
 	Call(taskPtr, NS_SOCK_EXIT);
-	taskPtr = taskPtr->nextWaitPtr;
+	Ns_TimerCancel(threadPtr->wheel, &taskPtr->timer);
+	hPtr = Tcl_NextHashEntry(&search);
     }
+    Ns_TimerWheelDestroy(threadPtr->wheel);
+#ifdef HAVE_EPOLL_CREATE
+    close(threadPtr->epfd);
+    ns_free(evs);
+#else
+    ns_free(pfds);
+    ns_free(tasks);
+#endif
 
     /*
      * Signal all tasks done and shutdown complete.
      */
 
-    Ns_MutexLock(&queuePtr->lock);
-    while ((taskPtr = firstWaitPtr) != NULL) {
-	firstWaitPtr = taskPtr->nextWaitPtr;
+    Ns_MutexLock(&threadPtr->lock);
+    hPtr = Tcl_FirstHashEntry(&threadPtr->tasks, &search);
+    while (hPtr != NULL) {
+	taskPtr = (Task *) Tcl_GetHashKey(&threadPtr->tasks, hPtr);
     	taskPtr->signal |= TASK_DONE;
+	hPtr = Tcl_NextHashEntry(&search);
     }
-    queuePtr->stopped = 1;
-    Ns_MutexUnlock(&queuePtr->lock);
-    Ns_CondBroadcast(&queuePtr->cond);
+    Tcl_DeleteHashTable(&threadPtr->tasks);
+    threadPtr->stopped = 1;
+    Ns_MutexUnlock(&threadPtr->lock);
+    Ns_CondBroadcast(&threadPtr->cond);
 
     Ns_Log(Notice, "shutdown complete");
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UpdateTask --
+ *
+ *	Update the watched events and timeout of a task after its
+ *	callbacks have run, and signal the task done if required.
+ *
+ * Results:
+ *	1 if the task is done and waiting threads must be signalled,
+ *	0 otherwise.
+ *
+ * Side effects:
+ *	A done task is removed from the queue thread and may be freed
+ *	by another thread once signalled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+UpdateTask(QueueThread *threadPtr, Task *taskPtr)
+{
+    TaskQueue *queuePtr = threadPtr->queuePtr;
+    Tcl_HashEntry *hPtr;
+
+    if (!(taskPtr->flags & TASK_DONE)) {
+	if (!(taskPtr->flags & TASK_WAIT)) {
+	    WatchTask(threadPtr, taskPtr, 0);
+	    Ns_TimerCancel(threadPtr->wheel, &taskPtr->timer);
+	} else {
+	    WatchTask(threadPtr, taskPtr, taskPtr->events);
+	    if (taskPtr->flags & TASK_TIMEOUT) {
+		Ns_TimerAdd(threadPtr->wheel, &taskPtr->timer,
+			    &taskPtr->timeout);
+	    } else {
+		Ns_TimerCancel(threadPtr->wheel, &taskPtr->timer);
+	    }
+	}
+	return 0;
+    }
+    taskPtr->flags &= ~(TASK_DONE|TASK_WAIT);
+    WatchTask(threadPtr, taskPtr, 0);
+    Ns_TimerCancel(threadPtr->wheel, &taskPtr->timer);
+    hPtr = Tcl_FindHashEntry(&threadPtr->tasks, (char *) taskPtr);
+    if (hPtr != NULL) {
+	Tcl_DeleteHashEntry(hPtr);
+	Ns_MutexLock(&queuePtr->lock);
+	--threadPtr->ntasks;
+	Ns_MutexUnlock(&queuePtr->lock);
+    }
+    Ns_MutexLock(&threadPtr->lock);
+    ++threadPtr->ntotal;
+    taskPtr->signal |= TASK_DONE;
+    Ns_MutexUnlock(&threadPtr->lock);
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WatchTask --
+ *
+ *	Set the poll events watched for a task, updating the epoll
+ *	registration if the events have changed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None without epoll, the poll array is rebuilt on each spin.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WatchTask(QueueThread *threadPtr, Task *taskPtr, int events)
+{
+#ifdef HAVE_EPOLL_CREATE
+    struct epoll_event ev;
+    int op;
+
+    if (events == taskPtr->watched) {
+	return;
+    }
+    ev.events = 0;
+    if (events & POLLIN) {
+	ev.events |= EPOLLIN;
+    }
+    if (events & POLLOUT) {
+	ev.events |= EPOLLOUT;
+    }
+    if (events & POLLPRI) {
+	ev.events |= EPOLLPRI;
+    }
+    ev.data.ptr = taskPtr;
+    if (taskPtr->watched == 0) {
+	op = EPOLL_CTL_ADD;
+    } else if (events == 0) {
+	op = EPOLL_CTL_DEL;
+    } else {
+	op = EPOLL_CTL_MOD;
+    }
+    if (epoll_ctl(threadPtr->epfd, op, taskPtr->sock, &ev) != 0
+	    && op != EPOLL_CTL_DEL) {
+	Ns_Log(Error, "queue: epoll_ctl(%d) failed: %s",
+	       (int) taskPtr->sock, strerror(errno));
+    }
+#endif
+    taskPtr->watched = events;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsGetTaskQueues --
+ *
+ *	Append the name, number of threads and stats of each task
+ *	queue to the given dstring, for ns_info taskqueues.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsGetTaskQueues(Tcl_DString *dsPtr)
+{
+    TaskQueue *queuePtr;
+    QueueThread *threadPtr;
+    unsigned long ntotal, nspins, ncalls;
+    Ns_Time totallat, maxlat;
+    int i, ntasks;
+    char buf[200];
+
+    Ns_MutexLock(&lock);
+    for (queuePtr = firstQueuePtr; queuePtr != NULL;
+	    queuePtr = queuePtr->nextPtr) {
+	ntasks = 0;
+	ntotal = nspins = ncalls = 0;
+	totallat.sec = totallat.usec = 0;
+	maxlat = totallat;
+	Ns_MutexLock(&queuePtr->lock);
+	for (i = 0; i < queuePtr->nthreads; ++i) {
+	    ntasks += queuePtr->threads[i].ntasks;
+	}
+	Ns_MutexUnlock(&queuePtr->lock);
+	for (i = 0; i < queuePtr->nthreads; ++i) {
+	    threadPtr = &queuePtr->threads[i];
+	    Ns_MutexLock(&threadPtr->lock);
+	    ntotal += threadPtr->ntotal;
+	    nspins += threadPtr->nspins;
+	    ncalls += threadPtr->ncalls;
+	    Ns_IncrTime(&totallat, threadPtr->totallat.sec,
+			threadPtr->totallat.usec);
+	    if (Ns_DiffTime(&threadPtr->maxlat, &maxlat, NULL) > 0) {
+		maxlat = threadPtr->maxlat;
+	    }
+	    Ns_MutexUnlock(&threadPtr->lock);
+	}
+	Tcl_DStringStartSublist(dsPtr);
+	Tcl_DStringAppendElement(dsPtr, queuePtr->name);
+	sprintf(buf, "%d %d %lu %lu %lu %ld.%06ld %ld.%06ld",
+		queuePtr->nthreads, ntasks, ntotal, nspins, ncalls,
+		(long) totallat.sec, totallat.usec,
+		(long) maxlat.sec, maxlat.usec);
+	Tcl_DStringAppend(dsPtr, " ", 1);
+	Tcl_DStringAppend(dsPtr, buf, -1);
+	Tcl_DStringEndSublist(dsPtr);
+    }
+    Ns_MutexUnlock(&lock);
+}
@@ -123,6 +123,7 @@ extern Tcl_ObjCmdProc
     NsTclNsvNamesObjCmd,
     NsTclNsvSetObjCmd,
     NsTclNsvUnsetObjCmd,
+    NsTclParseHeadersObjCmd,
     NsTclParseHttpTimeObjCmd,
     NsTclParseQueryObjCmd,
     NsTclPoolsObjCmd,
@@ -347,6 +348,7 @@ static Cmd cmds[] = {
     {"ns_mutex", NULL, NsTclMutexObjCmd},
     {"ns_normalizepath", NULL, NsTclNormalizePathObjCmd},
     {"ns_parseheader", NsTclParseHeaderCmd, NULL},
+    {"ns_parseheaders", NULL, NsTclParseHeadersObjCmd},
     {"ns_parsehttptime", NULL, NsTclParseHttpTimeObjCmd},
     {"ns_parsequery", NULL, NsTclParseQueryObjCmd},
     {"ns_pause", NsTclPauseCmd, NULL},
@@ -42,30 +42,91 @@ extern Tcl_ObjCmdProc NsTclHttpObjCmd;
 typedef struct {
     Ns_Task *task;
     SOCKET sock;
+    char *key;		/* Host and port of idle connection pool. */
     char *error;
     char *next;
     size_t len;
     int status;
+    int keep;		/* Connection may be kept alive. */
+    int head;		/* Response has no content. */
+    int bodyoff;	/* Offset of content, 0 until headers read. */
+    int length;		/* Content length, -1 if unknown. */
+    int nbody;		/* Content bytes received, after decoding. */
+    int chunked;	/* Content has chunked transfer encoding. */
+    int state;		/* Chunk decoder state, see below. */
+    int chunk;		/* Bytes remaining in current chunk. */
+    int linelen;	/* Length of partial chunk size or trailer line. */
+    char line[64];
+    int fd;		/* File for content, or -1. */
+    Tcl_Obj *callback;	/* Script to receive content, or NULL. */
+    int done;		/* Task is done, locked with lockPtr. */
+    Ns_Mutex lock;
+    Ns_Cond cond;
+    Ns_Mutex *lockPtr;	/* Lock and condition signaled for content */
+    Ns_Cond *condPtr;	/* and when done, own or shared by a batch. */
+    Tcl_DString pending;/* Content waiting for callback. */
+    int paused;		/* Reading stopped until pending is drained. */
     Ns_Time timeout;
     Ns_Time stime;
     Ns_Time etime;
     Tcl_DString ds;
 } Http;
 
+/*
+ * The following defines the states of the chunked content decoder.
+ */
+
+#define CHUNK_SIZE	0	/* Reading chunk size line. */
+#define CHUNK_DATA	1	/* Reading chunk data. */
+#define CHUNK_END	2	/* Reading CRLF after chunk data. */
+#define CHUNK_TRAILER	3	/* Reading trailer to empty line. */
+#define CHUNK_DONE	4	/* Last chunk and trailer read. */
+
+/*
+ * The following defines the high-water mark of content waiting for
+ * a -callback script, above which the task stops reading from the
+ * server until HttpCallback has taken the content.
+ */
+
+#define MAX_PENDING	65536
+
+/*
+ * The following structure defines an idle keep-alive connection.
+ */
+
+typedef struct Idle {
+    struct Idle *nextPtr;
+    SOCKET       sock;
+    time_t       expires;
+} Idle;
+
 /*
  * Local functions defined in this file
  */
 
 static int HttpWaitCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv);
 static int HttpQueueCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv, int run);
+static int HttpMultiCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv);
+static int HttpQueue(Http *httpPtr, Ns_Time *timeoutPtr, int run);
 static int SetWaitVar(Tcl_Interp *interp, Tcl_Obj *varPtr, Tcl_Obj *valPtr);
 static int HttpConnect(Tcl_Interp *interp, char *method, char *url,
-			Ns_Set *hdrs, Tcl_Obj *bodyPtr, Http **httpPtrPtr);
+			Ns_Set *hdrs, char *body, int len, Http **httpPtrPtr);
 static char *HttpResult(Tcl_DString ds, int *statusPtr, Ns_Set *hdrs, Tcl_Obj **objPtrPtr);
 static void HttpClose(Http *httpPtr);
 static void HttpCancel(Http *httpPtr);
 static void HttpAbort(Http *httpPtr);
+static int HttpCallback(Tcl_Interp *interp, Http *httpPtr);
+static int HttpRead(Http *httpPtr, char *buf, int len);
+static int HttpHeaders(Http *httpPtr);
+static int HttpContent(Http *httpPtr, char *buf, int len);
+static int HttpChunks(Http *httpPtr, char *buf, int len);
+static int HttpOutput(Http *httpPtr, char *buf, int len);
+static int HttpComplete(Http *httpPtr);
 static int GetHttp(NsInterp *itPtr, Tcl_Obj *obj, Http **httpPtrPtr);
+static SOCKET GetIdle(char *key);
+static void PutIdle(char *key, SOCKET sock);
+static void ReapIdle(time_t now, int all);
+static Ns_Callback CloseIdle;
 static Ns_TaskProc HttpProc;
 
 /*
@@ -74,6 +135,20 @@ static Ns_TaskProc HttpProc;
  
 static Ns_TaskQueue *queue;
 
+/*
+ * The following maintain idle keep-alive connections by host and
+ * port, shared by all threads, and their stats.
+ */
+
+static Ns_Mutex      lock;
+static Tcl_HashTable hosts;
+static int           initialized;
+static int           stopped;
+static int           nidle;
+static unsigned long nconnects;
+static unsigned long nreuses;
+static unsigned long nexpired;
+
 
 /*
  *----------------------------------------------------------------------
@@ -98,12 +173,14 @@ NsTclNHttpObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj *CONST ob
     Http *httpPtr;
     Tcl_HashEntry *hPtr;
     Tcl_HashSearch search;
+    char buf[200];
     int run = 0;
     static CONST char *opts[] = {
-       "cancel", "cleanup", "run", "queue", "wait", NULL
+       "cancel", "cleanup", "multi", "run", "queue", "stats", "wait", NULL
     };
     enum {
-        HCancelIdx, HCleanupIdx, HRunIdx, HQueueIdx, HWaitIdx
+        HCancelIdx, HCleanupIdx, HMultiIdx, HRunIdx, HQueueIdx, HStatsIdx,
+	HWaitIdx
     } opt;
 
     if (objc < 2) {
@@ -127,6 +204,10 @@ NsTclNHttpObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj *CONST ob
 	return HttpWaitCmd(itPtr, objc, objv);
 	break;
 
+    case HMultiIdx:
+	return HttpMultiCmd(itPtr, objc, objv);
+	break;
+
     case HCancelIdx:
         if (objc != 2) {
             Tcl_WrongNumArgs(interp, 2, objv, "id");
@@ -148,6 +229,14 @@ NsTclNHttpObjCmd(ClientData arg, Tcl_Interp *interp, int objc, Tcl_Obj *CONST ob
         Tcl_DeleteHashTable(&itPtr->https);
         Tcl_InitHashTable(&itPtr->https, TCL_STRING_KEYS);
         break;
+
+    case HStatsIdx:
+	Ns_MutexLock(&lock);
+	sprintf(buf, "connects %lu reuses %lu idle %d expired %lu",
+		nconnects, nreuses, nidle, nexpired);
+	Ns_MutexUnlock(&lock);
+	Tcl_SetResult(interp, buf, TCL_VOLATILE);
+	break;
     }
     return TCL_OK;
 }
@@ -180,12 +269,18 @@ HttpQueueCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv, int run)
     char *method = "GET";
     Ns_Set *hdrs = NULL;
     Tcl_Obj *bodyPtr = NULL;
-    Ns_Time incr;
+    Tcl_Obj *callbackPtr = NULL;
+    Tcl_Channel chan;
+    char *file = NULL, *channel = NULL, *body = NULL;
+    int fd = -1, len = 0;
+    Ns_Time incr, timeout;
     static CONST char *opts[] = {
-       "-method", "-timeout", "-body", "-headers", NULL
+       "-method", "-timeout", "-body", "-headers", "-file", "-channel",
+       "-callback", NULL
     };
     enum {
-        QMethodIdx, QTimeoutIdx, QBodyIdx, QHeadersIdx
+        QMethodIdx, QTimeoutIdx, QBodyIdx, QHeadersIdx, QFileIdx,
+	QChannelIdx, QCallbackIdx
     } opt;
 
     incr.sec = 2;
@@ -222,35 +317,77 @@ HttpQueueCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv, int run)
 		return TCL_ERROR;
 	    }
 	    break;
+	case QFileIdx:
+	    file = Tcl_GetString(objv[i]);
+	    break;
+	case QChannelIdx:
+	    channel = Tcl_GetString(objv[i]);
+	    break;
+	case QCallbackIdx:
+	    callbackPtr = objv[i];
+	    break;
 	}
     }
     if ((objc - i) != 1) {
         Tcl_WrongNumArgs(interp, 2, objv, "?flags? url");
         return TCL_ERROR;
     }
-    url = Tcl_GetString(objv[i]);
-    if (!HttpConnect(interp, method, url, hdrs, bodyPtr, &httpPtr)) {
+    if ((file != NULL) + (channel != NULL) + (callbackPtr != NULL) > 1) {
+	Tcl_AppendResult(interp, "only one of -file, -channel or -callback "
+			 "may be given", NULL);
 	return TCL_ERROR;
     }
-    Ns_GetTime(&httpPtr->stime);
-    httpPtr->timeout = httpPtr->stime;
-    Ns_IncrTime(&httpPtr->timeout, incr.sec, incr.usec);
-    httpPtr->task = Ns_TaskCreate(httpPtr->sock, HttpProc, httpPtr);
-    if (run) {
-	Ns_TaskRun(httpPtr->task);
-    } else {
-	if (queue == NULL) {
-	    Ns_MasterLock();
-	    if (queue == NULL) {
-		queue = Ns_CreateTaskQueue("tclhttp");
-	    }
-	    Ns_MasterUnlock();
+    if (run && callbackPtr != NULL) {
+	Tcl_AppendResult(interp, "-callback may not be used with run", NULL);
+	return TCL_ERROR;
+    }
+
+    /*
+     * Content written to a file or channel is written directly by the
+     * task thread to a private descriptor.
+     */
+
+    if (file != NULL) {
+	fd = open(file, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0644);
+	if (fd < 0) {
+	    Tcl_AppendResult(interp, "could not open \"", file, "\": ",
+			     Tcl_PosixError(interp), NULL);
+	    return TCL_ERROR;
 	}
-	if (Ns_TaskEnqueue(httpPtr->task, queue) != NS_OK) {
-	    HttpClose(httpPtr);
-	    Tcl_AppendResult(interp, "could not queue http task", NULL);
+    } else if (channel != NULL) {
+	if (Ns_TclGetOpenChannel(interp, channel, 1, 1, &chan) != TCL_OK
+		|| Ns_TclGetOpenFd(interp, channel, 1, &fd) != TCL_OK) {
 	    return TCL_ERROR;
 	}
+	Tcl_Flush(chan);
+	fd = dup(fd);
+	if (fd < 0) {
+	    Tcl_AppendResult(interp, "could not dup \"", channel, "\": ",
+			     Tcl_PosixError(interp), NULL);
+	    return TCL_ERROR;
+	}
+    }
+    url = Tcl_GetString(objv[i]);
+    if (bodyPtr != NULL) {
+	body = (char *) Tcl_GetByteArrayFromObj(bodyPtr, &len);
+    }
+    if (!HttpConnect(interp, method, url, hdrs, body, len, &httpPtr)) {
+	if (fd >= 0) {
+	    close(fd);
+	}
+	return TCL_ERROR;
+    }
+    httpPtr->fd = fd;
+    if (callbackPtr != NULL) {
+	httpPtr->callback = callbackPtr;
+	Tcl_IncrRefCount(callbackPtr);
+    }
+    Ns_GetTime(&timeout);
+    Ns_IncrTime(&timeout, incr.sec, incr.usec);
+    if (HttpQueue(httpPtr, &timeout, run) != NS_OK) {
+	HttpClose(httpPtr);
+	Tcl_AppendResult(interp, "could not queue http task", NULL);
+	return TCL_ERROR;
     }
     i = itPtr->https.numEntries;
     do {
@@ -263,6 +400,388 @@ HttpQueueCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv, int run)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpMultiCmd --
+ *
+ *	Implements "ns_http multi" subcommand.
+ *
+ * Results:
+ *	Standard Tcl result.
+ *
+ * Side effects:
+ *	Runs a batch of HTTP requests, see Ns_HttpMulti.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpMultiCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv)
+{
+    Tcl_Interp *interp = itPtr->interp;
+    Tcl_Obj **reqv, **argv, *listPtr, *resPtr, *hdrsPtr, *objPtr;
+    Ns_HttpReq *reqs, *reqPtr;
+    Ns_Set *set;
+    Ns_Time incr, timeout;
+    char *arg;
+    int i, j, k, nreqs, argc, len, nwait, result;
+    static CONST char *opts[] = {
+       "-timeout", "-wait", NULL
+    };
+    enum {
+        MTimeoutIdx, MWaitIdx
+    } opt;
+    static CONST char *ropts[] = {
+       "-method", "-body", "-headers", NULL
+    };
+    enum {
+        RMethodIdx, RBodyIdx, RHeadersIdx
+    } ropt;
+
+    incr.sec = 2;
+    incr.usec = 0;
+    nwait = 0;
+    for (i = 2; i < objc; ++i) {
+	arg = Tcl_GetString(objv[i]);
+	if (arg[0] != '-') {
+	    break;
+	}
+    	if (Tcl_GetIndexFromObj(interp, objv[i], opts, "option", 0,
+                            (int *) &opt) != TCL_OK) {
+            return TCL_ERROR;
+	}
+	if ((i + 2) == objc) {
+	    Tcl_AppendResult(interp, "no argument given to ", opts[opt], NULL);
+	    return TCL_ERROR;
+	}
+	++i;
+	switch (opt) {
+	case MTimeoutIdx:
+	    if (Ns_TclGetTimeFromObj(interp, objv[i], &incr) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    break;
+	case MWaitIdx:
+	    if (Tcl_GetIntFromObj(interp, objv[i], &nwait) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    break;
+	}
+    }
+    if ((objc - i) != 1) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?flags? requests");
+        return TCL_ERROR;
+    }
+    if (Tcl_ListObjGetElements(interp, objv[i], &nreqs, &reqv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (nreqs % 2 != 0) {
+	Tcl_AppendResult(interp, "invalid requests: must be a list of "
+			 "names and requests", NULL);
+	return TCL_ERROR;
+    }
+    nreqs /= 2;
+    if (nreqs == 0) {
+	return TCL_OK;
+    }
+
+    /*
+     * Parse each request as the flags and url of ns_http queue.
+     */
+
+    reqs = ns_calloc((size_t) nreqs, sizeof(Ns_HttpReq));
+    for (j = 0; j < nreqs; ++j) {
+	Ns_DStringInit(&reqs[j].content);
+	reqs[j].rheaders = Ns_SetCreate(NULL);
+    }
+    result = TCL_ERROR;
+    for (j = 0; j < nreqs; ++j) {
+	reqPtr = &reqs[j];
+	if (Tcl_ListObjGetElements(interp, reqv[j * 2 + 1], &argc,
+				   &argv) != TCL_OK) {
+	    goto done;
+	}
+	for (k = 0; k < argc - 1; ++k) {
+    	    if (Tcl_GetIndexFromObj(interp, argv[k], ropts, "option", 0,
+				    (int *) &ropt) != TCL_OK) {
+		goto done;
+	    }
+	    if (++k == argc - 1) {
+		Tcl_AppendResult(interp, "no argument given to ",
+				 ropts[ropt], NULL);
+		goto done;
+	    }
+	    switch (ropt) {
+	    case RMethodIdx:
+		reqPtr->method = Tcl_GetString(argv[k]);
+		break;
+	    case RBodyIdx:
+		reqPtr->body = (char *) Tcl_GetByteArrayFromObj(argv[k], &len);
+		reqPtr->length = len;
+		break;
+	    case RHeadersIdx:
+		if (Ns_TclGetSet2(interp, Tcl_GetString(argv[k]),
+				  &reqPtr->headers) != TCL_OK) {
+		    goto done;
+		}
+		break;
+	    }
+	}
+	if (argc < 1) {
+	    Tcl_AppendResult(interp, "no url given for request: ",
+			     Tcl_GetString(reqv[j * 2]), NULL);
+	    goto done;
+	}
+	reqPtr->url = Tcl_GetString(argv[argc - 1]);
+    }
+    Ns_GetTime(&timeout);
+    Ns_IncrTime(&timeout, incr.sec, incr.usec);
+    Ns_HttpMulti(reqs, nreqs, nwait, &timeout);
+
+    /*
+     * Return a list of names and results, each a list of keys and
+     * values suitable for dict or array set.
+     */
+
+    listPtr = Tcl_NewListObj(0, NULL);
+    for (j = 0; j < nreqs; ++j) {
+	reqPtr = &reqs[j];
+	set = reqPtr->rheaders;
+	hdrsPtr = Tcl_NewListObj(0, NULL);
+	for (k = 0; k < Ns_SetSize(set); ++k) {
+	    Tcl_ListObjAppendElement(NULL, hdrsPtr,
+				     Tcl_NewStringObj(Ns_SetKey(set, k), -1));
+	    Tcl_ListObjAppendElement(NULL, hdrsPtr,
+				   Tcl_NewStringObj(Ns_SetValue(set, k), -1));
+	}
+	resPtr = Tcl_NewListObj(0, NULL);
+	Tcl_ListObjAppendElement(NULL, resPtr, Tcl_NewStringObj("status", -1));
+	Tcl_ListObjAppendElement(NULL, resPtr,
+				 Tcl_NewIntObj(reqPtr->status));
+	Tcl_ListObjAppendElement(NULL, resPtr,
+				 Tcl_NewStringObj("headers", -1));
+	Tcl_ListObjAppendElement(NULL, resPtr, hdrsPtr);
+	Tcl_ListObjAppendElement(NULL, resPtr, Tcl_NewStringObj("body", -1));
+	Tcl_ListObjAppendElement(NULL, resPtr,
+	    Tcl_NewByteArrayObj((unsigned char *) reqPtr->content.string,
+				reqPtr->content.length));
+	Tcl_ListObjAppendElement(NULL, resPtr,
+				 Tcl_NewStringObj("elapsed", -1));
+	objPtr = Tcl_NewObj();
+	Ns_TclSetTimeObj(objPtr, &reqPtr->elapsed);
+	Tcl_ListObjAppendElement(NULL, resPtr, objPtr);
+	if (reqPtr->error != NULL) {
+	    Tcl_ListObjAppendElement(NULL, resPtr,
+				     Tcl_NewStringObj("error", -1));
+	    Tcl_ListObjAppendElement(NULL, resPtr,
+				     Tcl_NewStringObj(reqPtr->error, -1));
+	}
+	Tcl_ListObjAppendElement(NULL, listPtr, reqv[j * 2]);
+	Tcl_ListObjAppendElement(NULL, listPtr, resPtr);
+    }
+    Tcl_SetObjResult(interp, listPtr);
+    result = TCL_OK;
+
+done:
+    for (j = 0; j < nreqs; ++j) {
+	Ns_DStringFree(&reqs[j].content);
+	Ns_SetFree(reqs[j].rheaders);
+    }
+    ns_free(reqs);
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_HttpMulti --
+ *
+ *	Run a batch of HTTP requests in parallel with the ns_http task
+ *	queue, waiting until nwait requests have completed, or all if
+ *	nwait is 0, or the given absolute timeout.  The calling thread
+ *	waits on a single condition signaled by the tasks as they
+ *	complete.
+ *
+ * Results:
+ *	Number of requests completed.
+ *
+ * Side effects:
+ *	Requests not completed are cancelled.  For each request, the
+ *	status, response headers, content and elapsed time are set,
+ *	or the error message if the request failed or was cancelled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_HttpMulti(Ns_HttpReq *reqs, int nreqs, int nwait, Ns_Time *timeoutPtr)
+{
+    Http       **https, *httpPtr;
+    Ns_HttpReq  *reqPtr;
+    Ns_Mutex     mlock;
+    Ns_Cond      mcond;
+    Ns_Time      now;
+    char        *body;
+    int          i, n, nfailed, ndone, done, status;
+
+    if (nreqs <= 0) {
+	return 0;
+    }
+    if (nwait <= 0 || nwait > nreqs) {
+	nwait = nreqs;
+    }
+    mlock = NULL;
+    mcond = NULL;
+    Ns_MutexSetName(&mlock, "ns:httpmulti");
+    https = ns_malloc(sizeof(Http *) * (size_t) nreqs);
+    nfailed = 0;
+    for (i = 0; i < nreqs; ++i) {
+	reqPtr = &reqs[i];
+	reqPtr->done = 0;
+	reqPtr->status = 0;
+	reqPtr->error = NULL;
+	reqPtr->elapsed.sec = reqPtr->elapsed.usec = 0;
+	https[i] = NULL;
+
+	/*
+	 * Connects, which may block resolving the host, are made
+	 * one at a time, so check the deadline before each.
+	 */
+
+	Ns_GetTime(&now);
+	if (Ns_DiffTime(timeoutPtr, &now, NULL) <= 0) {
+	    reqPtr->error = "timeout";
+	    ++nfailed;
+	    continue;
+	}
+	if (!HttpConnect(NULL, reqPtr->method ? reqPtr->method : "GET",
+			 reqPtr->url, reqPtr->headers, reqPtr->body,
+			 reqPtr->body ? reqPtr->length : 0, &httpPtr)) {
+	    reqPtr->error = "connect failed";
+	    ++nfailed;
+	    continue;
+	}
+	httpPtr->lockPtr = &mlock;
+	httpPtr->condPtr = &mcond;
+	if (HttpQueue(httpPtr, timeoutPtr, 0) != NS_OK) {
+	    HttpClose(httpPtr);
+	    reqPtr->error = "could not queue http task";
+	    ++nfailed;
+	    continue;
+	}
+	https[i] = httpPtr;
+    }
+
+    /*
+     * Wait for the requests, counting failures as completed.
+     */
+
+    Ns_MutexLock(&mlock);
+    status = NS_OK;
+    do {
+	n = nfailed;
+	for (i = 0; i < nreqs; ++i) {
+	    if (https[i] != NULL && https[i]->done) {
+		++n;
+	    }
+	}
+	if (n >= nwait) {
+	    break;
+	}
+	status = Ns_CondTimedWait(&mcond, &mlock, timeoutPtr);
+    } while (status == NS_OK);
+    Ns_MutexUnlock(&mlock);
+
+    /*
+     * Collect results and cancel the remaining requests.
+     */
+
+    ndone = 0;
+    for (i = 0; i < nreqs; ++i) {
+	httpPtr = https[i];
+	if (httpPtr == NULL) {
+	    continue;
+	}
+	reqPtr = &reqs[i];
+	Ns_MutexLock(&mlock);
+	done = httpPtr->done;
+	Ns_MutexUnlock(&mlock);
+	if (done) {
+	    Ns_TaskWait(httpPtr->task, NULL);
+	} else {
+
+	    /*
+	     * Report a request cancelled at the deadline as timed out,
+	     * keeping the result of one which completed meanwhile.
+	     */
+
+	    HttpCancel(httpPtr);
+	    if (status == NS_TIMEOUT && httpPtr->error != NULL
+		    && STREQ(httpPtr->error, "cancelled")) {
+		httpPtr->error = "timeout";
+	    }
+	}
+	Ns_DiffTime(&httpPtr->etime, &httpPtr->stime, &reqPtr->elapsed);
+	if (httpPtr->error != NULL) {
+	    reqPtr->error = httpPtr->error;
+	} else {
+	    body = HttpResult(httpPtr->ds, &reqPtr->status, reqPtr->rheaders,
+			      NULL);
+	    Ns_DStringNAppend(&reqPtr->content, body,
+			      httpPtr->ds.length - (body - httpPtr->ds.string));
+	    reqPtr->done = 1;
+	    ++ndone;
+	}
+	HttpClose(httpPtr);
+    }
+    ns_free(https);
+    Ns_CondDestroy(&mcond);
+    Ns_MutexDestroy(&mlock);
+    return ndone;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpQueue --
+ *
+ *	Create the task for a connected request and run it directly or
+ *	queue it on the ns_http task queue.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR if the task could not be queued.
+ *
+ * Side effects:
+ *	Task queue is created on first use.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpQueue(Http *httpPtr, Ns_Time *timeoutPtr, int run)
+{
+    Ns_GetTime(&httpPtr->stime);
+    httpPtr->etime = httpPtr->stime;
+    httpPtr->timeout = *timeoutPtr;
+    httpPtr->task = Ns_TaskCreate(httpPtr->sock, HttpProc, httpPtr);
+    if (run) {
+	Ns_TaskRun(httpPtr->task);
+	return NS_OK;
+    }
+    if (queue == NULL) {
+	Ns_MasterLock();
+	if (queue == NULL) {
+	    queue = Ns_CreateTaskQueueEx("tclhttp", nsconf.tclhttp.threads);
+	}
+	Ns_MasterUnlock();
+    }
+    return Ns_TaskEnqueue(httpPtr->task, queue);
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -339,6 +858,11 @@ HttpWaitCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv)
     if (!GetHttp(itPtr, objv[i], &httpPtr)) {
 	return TCL_ERROR;
     }
+    if (httpPtr->callback != NULL
+	    && HttpCallback(interp, httpPtr) != TCL_OK) {
+	HttpAbort(httpPtr);
+	return TCL_ERROR;
+    }
     if (Ns_TaskWait(httpPtr->task, NULL) != NS_OK) {
 	HttpCancel(httpPtr);
 	Tcl_AppendResult(interp, "timeout waiting for task", NULL);
@@ -368,7 +892,7 @@ HttpWaitCmd(NsInterp *itPtr, int objc, Tcl_Obj **objv)
 	    if (!SetWaitVar(interp, resultPtr, responsePtr)) {
 	        goto err;
 	    }
-	Tcl_SetBooleanObj(Tcl_GetObjResult(interp), 1);
+	Tcl_SetObjResult(interp, Tcl_NewBooleanObj(1));
     }
     result = TCL_OK;
 
@@ -440,6 +964,65 @@ SetWaitVar(Tcl_Interp *interp, Tcl_Obj *varPtr, Tcl_Obj *valPtr)
     return (errPtr ? 1 : 0);
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpCallback --
+ *
+ *	Evaluate the -callback script of a request with each block of
+ *	content as it arrives, until the task is done.
+ *
+ * Results:
+ *	Standard Tcl result.
+ *
+ * Side effects:
+ *	Depends on script.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpCallback(Tcl_Interp *interp, Http *httpPtr)
+{
+    Tcl_DString data;
+    Tcl_Obj *objPtr;
+    int done, resume, result;
+
+    Tcl_DStringInit(&data);
+    result = TCL_OK;
+    do {
+	Ns_MutexLock(httpPtr->lockPtr);
+	while (!httpPtr->done && httpPtr->pending.length == 0) {
+	    Ns_CondWait(httpPtr->condPtr, httpPtr->lockPtr);
+	}
+	done = httpPtr->done;
+	Tcl_DStringAppend(&data, httpPtr->pending.string,
+			  httpPtr->pending.length);
+	Tcl_DStringTrunc(&httpPtr->pending, 0);
+	resume = httpPtr->paused;
+	httpPtr->paused = 0;
+	Ns_MutexUnlock(httpPtr->lockPtr);
+	if (resume && !done) {
+	    Ns_TaskResume(httpPtr->task, NS_SOCK_READ);
+	}
+	if (data.length > 0) {
+	    objPtr = Tcl_DuplicateObj(httpPtr->callback);
+	    Tcl_IncrRefCount(objPtr);
+	    result = Tcl_ListObjAppendElement(interp, objPtr,
+		Tcl_NewByteArrayObj((unsigned char *) data.string,
+				    data.length));
+	    if (result == TCL_OK) {
+		result = Tcl_EvalObjEx(interp, objPtr, TCL_EVAL_DIRECT);
+	    }
+	    Tcl_DecrRefCount(objPtr);
+	    Tcl_DStringTrunc(&data, 0);
+	}
+    } while (result == TCL_OK && !done);
+    Tcl_DStringFree(&data);
+    return result;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -458,17 +1041,20 @@ SetWaitVar(Tcl_Interp *interp, Tcl_Obj *varPtr, Tcl_Obj *valPtr)
  *----------------------------------------------------------------------
  */
 
-int
+static int
 HttpConnect(Tcl_Interp *interp, char *method, char *url, Ns_Set *hdrs,
-	    Tcl_Obj *bodyPtr, Http **httpPtrPtr)
+	    char *body, int len, Http **httpPtrPtr)
 {
     Http *httpPtr = NULL;
     SOCKET sock;
-    char *body, *host, *file, *port;
-    int i, len;
+    Ns_DString key;
+    char *host, *file, *port;
+    int i;
 
     if (strncmp(url, "http://", 7) != 0 || url[7] == '\0') {
-	Tcl_AppendResult(interp, "invalid url: ", url, NULL);
+	if (interp != NULL) {
+	    Tcl_AppendResult(interp, "invalid url: ", url, NULL);
+	}
         return 0;
     }
     host = url + 7;
@@ -483,14 +1069,50 @@ HttpConnect(Tcl_Interp *interp, char *method, char *url, Ns_Set *hdrs,
         *port = '\0';
         i = (int) strtol(port+1, NULL, 10);
     }
-    sock = Ns_SockAsyncConnect(host, i);
+
+    /*
+     * Reuse an idle keep-alive connection to the host, if any.
+     */
+
+    Ns_DStringInit(&key);
+    Ns_DStringPrintf(&key, "%s:%d", host, i);
+    sock = GetIdle(key.string);
+    if (sock == INVALID_SOCKET) {
+	sock = Ns_SockAsyncConnect(host, i);
+	if (sock != INVALID_SOCKET) {
+	    Ns_MutexLock(&lock);
+	    ++nconnects;
+	    Ns_MutexUnlock(&lock);
+	}
+    }
     if (port != NULL) {
         *port = ':';
     }
-    if (sock != INVALID_SOCKET) {
+    if (sock == INVALID_SOCKET) {
+	Ns_DStringFree(&key);
+    } else {
         httpPtr = ns_malloc(sizeof(Http));
         httpPtr->sock = sock;
+	httpPtr->key = Ns_DStringExport(&key);
 	    httpPtr->error = NULL;
+	httpPtr->keep = (nsconf.tclhttp.maxidle > 0);
+	httpPtr->head = STRIEQ(method, "HEAD");
+	httpPtr->bodyoff = 0;
+	httpPtr->length = -1;
+	httpPtr->nbody = 0;
+	httpPtr->chunked = 0;
+	httpPtr->state = CHUNK_SIZE;
+	httpPtr->chunk = 0;
+	httpPtr->linelen = 0;
+	httpPtr->fd = -1;
+	httpPtr->callback = NULL;
+	httpPtr->done = 0;
+	httpPtr->paused = 0;
+	httpPtr->lock = NULL;
+	httpPtr->cond = NULL;
+	httpPtr->lockPtr = &httpPtr->lock;
+	httpPtr->condPtr = &httpPtr->cond;
+	Tcl_DStringInit(&httpPtr->pending);
         Tcl_DStringInit(&httpPtr->ds);
         if (file != NULL) {
             *file = '/';
@@ -498,14 +1120,14 @@ HttpConnect(Tcl_Interp *interp, char *method, char *url, Ns_Set *hdrs,
         Ns_DStringAppend(&httpPtr->ds, method);
         Ns_StrToUpper(Ns_DStringValue(&httpPtr->ds));
         Ns_DStringVarAppend(&httpPtr->ds, " ", file ? file : "/",
-			    " HTTP/1.0\r\n", NULL);
+			    " HTTP/1.1\r\n", NULL);
         if (file != NULL) {
             *file = '\0';
         }
         Ns_DStringVarAppend(&httpPtr->ds,
             "User-Agent: ", Ns_InfoServerName(), "/",
 			    Ns_InfoServerVersion(), "\r\n"
-            "Connection: close\r\n"
+            "Connection: ", httpPtr->keep ? "keep-alive" : "close", "\r\n"
             "Host: ", host, "\r\n", NULL);
         if (file != NULL) {
             *file = '/';
@@ -517,12 +1139,8 @@ HttpConnect(Tcl_Interp *interp, char *method, char *url, Ns_Set *hdrs,
 		            Ns_SetValue(hdrs, i), "\r\n", NULL);
             }
         }
-	    body = NULL;
-	    if (bodyPtr != NULL) {
-	        body = Tcl_GetByteArrayFromObj(bodyPtr, &len);
-	        if (len == 0) {
-		        body = NULL;
-	        }
+	    if (len == 0) {
+		body = NULL;
 	    }
         if (body != NULL) {
             Ns_DStringPrintf(&httpPtr->ds, "Content-Length: %d\r\n", len);
@@ -538,8 +1156,10 @@ HttpConnect(Tcl_Interp *interp, char *method, char *url, Ns_Set *hdrs,
         *file = '/';
     }
     if (httpPtr == NULL) {
-	Tcl_AppendResult(interp, "connect to \"", url, "\" failed: ",
-	 		 ns_sockstrerror(ns_sockerrno), NULL);
+	if (interp != NULL) {
+	    Tcl_AppendResult(interp, "connect to \"", url, "\" failed: ",
+			     ns_sockstrerror(ns_sockerrno), NULL);
+	}
 	return 0;
     }
     *httpPtrPtr = httpPtr;
@@ -584,7 +1204,9 @@ HttpResult(Tcl_DString ds, int *statusPtr, Ns_Set *hdrs, Tcl_Obj **objPtrPtr)
         }
     }
     
-    *objPtrPtr = Tcl_NewByteArrayObj(body, ds.length-(body-response));
+    if (objPtrPtr != NULL) {
+	*objPtrPtr = Tcl_NewByteArrayObj(body, ds.length-(body-response));
+    }
 
     if (eoh == NULL) {
 	    *statusPtr = 0;
@@ -626,7 +1248,21 @@ HttpClose(Http *httpPtr)
 {
     Ns_TaskFree(httpPtr->task);
     Tcl_DStringFree(&httpPtr->ds);
-    ns_sockclose(httpPtr->sock);
+    Tcl_DStringFree(&httpPtr->pending);
+    if (httpPtr->fd >= 0) {
+	close(httpPtr->fd);
+    }
+    if (httpPtr->callback != NULL) {
+	Tcl_DecrRefCount(httpPtr->callback);
+    }
+    Ns_CondDestroy(&httpPtr->cond);
+    Ns_MutexDestroy(&httpPtr->lock);
+    if (httpPtr->keep && httpPtr->error == NULL) {
+	PutIdle(httpPtr->key, httpPtr->sock);
+    } else {
+	ns_sockclose(httpPtr->sock);
+    }
+    ns_free(httpPtr->key);
     ns_free(httpPtr);
 }
 
@@ -643,9 +1279,545 @@ static void
 HttpAbort(Http *httpPtr)
 {
     HttpCancel(httpPtr);
+    httpPtr->keep = 0;
     HttpClose(httpPtr);
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpRead --
+ *
+ *        Process data read from the server, buffering the response
+ *        until the headers are complete and passing content to
+ *        HttpContent.
+ *
+ * Results:
+ *        1 if ok, 0 on error.
+ *
+ * Side effects:
+ *        See HttpHeaders and HttpOutput.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpRead(Http *httpPtr, char *buf, int len)
+{
+    Tcl_DString ds;
+    int status;
+
+    if (httpPtr->bodyoff > 0) {
+	return HttpContent(httpPtr, buf, len);
+    }
+    Tcl_DStringAppend(&httpPtr->ds, buf, len);
+    if (!HttpHeaders(httpPtr)) {
+	return 1;
+    }
+
+    /*
+     * Move any content read with the headers out of the buffer so
+     * it is decoded and output as with later reads.
+     */
+
+    len = httpPtr->ds.length - httpPtr->bodyoff;
+    if (len == 0) {
+	return 1;
+    }
+    Tcl_DStringInit(&ds);
+    Tcl_DStringAppend(&ds, httpPtr->ds.string + httpPtr->bodyoff, len);
+    Tcl_DStringTrunc(&httpPtr->ds, httpPtr->bodyoff);
+    status = HttpContent(httpPtr, ds.string, ds.length);
+    Tcl_DStringFree(&ds);
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpHeaders --
+ *
+ *        Check if the response headers have been read, parsing the
+ *        status, content length, transfer encoding and connection
+ *        headers.
+ *
+ * Results:
+ *        1 if headers read, 0 if more data is expected.
+ *
+ * Side effects:
+ *        Interim 1xx responses are removed from the buffer.  The
+ *        keep flag is cleared unless the content length is known
+ *        or chunked and the server keeps the connection alive.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpHeaders(Http *httpPtr)
+{
+    char *response, *eoh, *p, *q, *hdr;
+    int   major, minor, status, keep;
+
+    while (1) {
+	response = httpPtr->ds.string;
+	eoh = strstr(response, "\r\n\r\n");
+	if (eoh != NULL) {
+	    httpPtr->bodyoff = eoh + 4 - response;
+	} else if ((eoh = strstr(response, "\n\n")) != NULL) {
+	    httpPtr->bodyoff = eoh + 2 - response;
+	} else {
+	    httpPtr->bodyoff = 0;
+	    return 0;
+	}
+	major = minor = status = 0;
+	sscanf(response, "HTTP/%d.%d %d", &major, &minor, &status);
+	if (status < 100 || status >= 200 || status == 101) {
+	    break;
+	}
+
+	/*
+	 * Discard an interim response, e.g., "100 Continue", and
+	 * parse the headers of the response which follows it.
+	 */
+
+	memmove(response, response + httpPtr->bodyoff,
+		(size_t) (httpPtr->ds.length - httpPtr->bodyoff));
+	Tcl_DStringSetLength(&httpPtr->ds,
+			     httpPtr->ds.length - httpPtr->bodyoff);
+    }
+    keep = (major > 1 || (major == 1 && minor > 0));
+    for (p = strchr(response, '\n'); p != NULL && p < eoh; p = q) {
+	hdr = ++p;
+	q = strchr(p, '\n');
+	if (strncasecmp(hdr, "content-length:", 15) == 0) {
+	    httpPtr->length = (int) strtol(hdr + 15, NULL, 10);
+	} else if (strncasecmp(hdr, "transfer-encoding:", 18) == 0) {
+	    hdr += 18;
+	    while (*hdr == ' ' || *hdr == '\t') {
+		++hdr;
+	    }
+	    httpPtr->chunked = (strncasecmp(hdr, "chunked", 7) == 0);
+	} else if (strncasecmp(hdr, "connection:", 11) == 0) {
+	    hdr += 11;
+	    while (*hdr == ' ' || *hdr == '\t') {
+		++hdr;
+	    }
+	    keep = (strncasecmp(hdr, "keep-alive", 10) == 0);
+	}
+    }
+    if (httpPtr->head || status == 204 || status == 304
+	    || (status >= 100 && status < 200)) {
+	httpPtr->length = 0;
+	httpPtr->chunked = 0;
+    } else if (httpPtr->chunked) {
+	httpPtr->length = -1;
+    }
+    if (!keep || (httpPtr->length < 0 && !httpPtr->chunked)) {
+	httpPtr->keep = 0;
+    }
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpContent --
+ *
+ *        Process content read from the server, decoding chunks if
+ *        necessary and discarding data beyond the content length.
+ *
+ * Results:
+ *        1 if ok, 0 on error.
+ *
+ * Side effects:
+ *        See HttpOutput.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpContent(Http *httpPtr, char *buf, int len)
+{
+    if (httpPtr->chunked) {
+	return HttpChunks(httpPtr, buf, len);
+    }
+    if (httpPtr->length >= 0 && httpPtr->nbody + len > httpPtr->length) {
+	len = httpPtr->length - httpPtr->nbody;
+	httpPtr->keep = 0;
+    }
+    return HttpOutput(httpPtr, buf, len);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpChunks --
+ *
+ *        Decode chunked content, which may be split anywhere across
+ *        reads.  Chunk extensions and trailers are ignored.
+ *
+ * Results:
+ *        1 if ok, 0 on error.
+ *
+ * Side effects:
+ *        Decoded content is passed to HttpOutput.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpChunks(Http *httpPtr, char *buf, int len)
+{
+    char *end;
+    int   n, empty;
+
+    while (len > 0 && httpPtr->state != CHUNK_DONE) {
+	if (httpPtr->state == CHUNK_DATA) {
+	    n = (len < httpPtr->chunk ? len : httpPtr->chunk);
+	    if (!HttpOutput(httpPtr, buf, n)) {
+		return 0;
+	    }
+	    buf += n;
+	    len -= n;
+	    httpPtr->chunk -= n;
+	    if (httpPtr->chunk == 0) {
+		httpPtr->state = CHUNK_END;
+	    }
+	    continue;
+	}
+
+	/*
+	 * Collect the next line, truncating overlong extensions.
+	 */
+
+	--len;
+	if (*buf != '\n') {
+	    if (httpPtr->linelen < (int) sizeof(httpPtr->line) - 1) {
+		httpPtr->line[httpPtr->linelen++] = *buf;
+	    }
+	    ++buf;
+	    continue;
+	}
+	++buf;
+	if (httpPtr->linelen > 0
+		&& httpPtr->line[httpPtr->linelen - 1] == '\r') {
+	    --httpPtr->linelen;
+	}
+	httpPtr->line[httpPtr->linelen] = '\0';
+	empty = (httpPtr->linelen == 0);
+	httpPtr->linelen = 0;
+	switch (httpPtr->state) {
+	case CHUNK_SIZE:
+	    httpPtr->chunk = (int) strtol(httpPtr->line, &end, 16);
+	    if (end == httpPtr->line || httpPtr->chunk < 0) {
+		httpPtr->error = "invalid chunk";
+		return 0;
+	    }
+	    httpPtr->state = (httpPtr->chunk > 0 ? CHUNK_DATA : CHUNK_TRAILER);
+	    break;
+
+	case CHUNK_END:
+	    if (!empty) {
+		httpPtr->error = "invalid chunk";
+		return 0;
+	    }
+	    httpPtr->state = CHUNK_SIZE;
+	    break;
+
+	case CHUNK_TRAILER:
+	    if (empty) {
+		httpPtr->state = CHUNK_DONE;
+	    }
+	    break;
+	}
+    }
+    if (len > 0) {
+	httpPtr->keep = 0;
+    }
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpOutput --
+ *
+ *        Output decoded content to the -file or -channel descriptor,
+ *        the -callback queue or the response buffer.
+ *
+ * Results:
+ *        1 if ok, 0 on write error.
+ *
+ * Side effects:
+ *        Thread waiting in HttpCallback, if any, is signaled.  The
+ *        task is marked paused when the -callback queue exceeds
+ *        MAX_PENDING.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpOutput(Http *httpPtr, char *buf, int len)
+{
+    int n;
+
+    httpPtr->nbody += len;
+    if (httpPtr->fd >= 0) {
+	while (len > 0) {
+	    n = write(httpPtr->fd, buf, (size_t) len);
+	    if (n < 0) {
+		if (errno == EINTR) {
+		    continue;
+		}
+		httpPtr->error = "write failed";
+		return 0;
+	    }
+	    buf += n;
+	    len -= n;
+	}
+    } else if (httpPtr->callback != NULL) {
+	Ns_MutexLock(httpPtr->lockPtr);
+	Tcl_DStringAppend(&httpPtr->pending, buf, len);
+	if (httpPtr->pending.length >= MAX_PENDING) {
+	    httpPtr->paused = 1;
+	}
+	Ns_CondBroadcast(httpPtr->condPtr);
+	Ns_MutexUnlock(httpPtr->lockPtr);
+    } else {
+	Tcl_DStringAppend(&httpPtr->ds, buf, len);
+    }
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HttpComplete --
+ *
+ *        Check if the response has been read completely.
+ *
+ * Results:
+ *        1 if done, 0 if the response continues to end of file or
+ *        more data is expected.
+ *
+ * Side effects:
+ *        None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HttpComplete(Http *httpPtr)
+{
+    if (httpPtr->bodyoff == 0) {
+	return 0;
+    }
+    if (httpPtr->chunked) {
+	return (httpPtr->state == CHUNK_DONE);
+    }
+    return (httpPtr->length >= 0 && httpPtr->nbody >= httpPtr->length);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetIdle --
+ *
+ *        Get an idle keep-alive connection to the given host and
+ *        port, closing expired connections and connections closed
+ *        by the server, i.e., readable while idle.
+ *
+ * Results:
+ *        Socket or INVALID_SOCKET if none available.
+ *
+ * Side effects:
+ *        Expired connections of all hosts are closed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static SOCKET
+GetIdle(char *key)
+{
+    Tcl_HashEntry *hPtr;
+    Idle          *idlePtr;
+    struct pollfd  pfd;
+    SOCKET         sock;
+    time_t         now;
+
+    sock = INVALID_SOCKET;
+    time(&now);
+    Ns_MutexLock(&lock);
+    if (initialized) {
+	ReapIdle(now, 0);
+    }
+    if (initialized && (hPtr = Tcl_FindHashEntry(&hosts, key)) != NULL) {
+	while (sock == INVALID_SOCKET
+		&& (idlePtr = Tcl_GetHashValue(hPtr)) != NULL) {
+	    Tcl_SetHashValue(hPtr, idlePtr->nextPtr);
+	    --nidle;
+	    sock = idlePtr->sock;
+	    pfd.fd = sock;
+	    pfd.events = POLLIN;
+	    pfd.revents = 0;
+	    if (idlePtr->expires < now || poll(&pfd, 1, 0) != 0) {
+		ns_sockclose(sock);
+		sock = INVALID_SOCKET;
+		++nexpired;
+	    }
+	    ns_free(idlePtr);
+	}
+	if (sock != INVALID_SOCKET) {
+	    ++nreuses;
+	}
+    }
+    Ns_MutexUnlock(&lock);
+    return sock;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PutIdle --
+ *
+ *        Return a keep-alive connection to the idle list of its host
+ *        and port, or close it if the list is full or the server is
+ *        shutting down.
+ *
+ * Results:
+ *        None.
+ *
+ * Side effects:
+ *        Expired connections of all hosts are closed.  CloseIdle is
+ *        registered at shutdown when the first connection is kept.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PutIdle(char *key, SOCKET sock)
+{
+    Tcl_HashEntry *hPtr;
+    Idle          *idlePtr;
+    time_t         now;
+    int            new, n, init;
+
+    time(&now);
+    init = 0;
+    Ns_MutexLock(&lock);
+    if (!initialized) {
+	Tcl_InitHashTable(&hosts, TCL_STRING_KEYS);
+	initialized = init = 1;
+    }
+    ReapIdle(now, 0);
+    hPtr = Tcl_CreateHashEntry(&hosts, key, &new);
+    n = 0;
+    for (idlePtr = Tcl_GetHashValue(hPtr); idlePtr != NULL;
+	    idlePtr = idlePtr->nextPtr) {
+	++n;
+    }
+    if (stopped || n >= nsconf.tclhttp.maxidle) {
+	ns_sockclose(sock);
+	if (n == 0) {
+	    Tcl_DeleteHashEntry(hPtr);
+	}
+    } else {
+	idlePtr = ns_malloc(sizeof(Idle));
+	idlePtr->sock = sock;
+	idlePtr->expires = now + nsconf.tclhttp.idletimeout;
+	idlePtr->nextPtr = Tcl_GetHashValue(hPtr);
+	Tcl_SetHashValue(hPtr, idlePtr);
+	++nidle;
+    }
+    Ns_MutexUnlock(&lock);
+    if (init) {
+	Ns_RegisterAtShutdown(CloseIdle, NULL);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReapIdle --
+ *
+ *        Close expired idle connections of all hosts, or all idle
+ *        connections, removing hosts left without connections.  Must
+ *        be called with the lock held.
+ *
+ * Results:
+ *        None.
+ *
+ * Side effects:
+ *        Updates the idle and expired counts.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ReapIdle(time_t now, int all)
+{
+    Tcl_HashEntry  *hPtr;
+    Tcl_HashSearch  search;
+    Idle           *idlePtr, **nextPtrPtr;
+
+    hPtr = Tcl_FirstHashEntry(&hosts, &search);
+    while (hPtr != NULL) {
+	nextPtrPtr = (Idle **) &Tcl_GetHashValue(hPtr);
+	while ((idlePtr = *nextPtrPtr) != NULL) {
+	    if (all || idlePtr->expires < now) {
+		*nextPtrPtr = idlePtr->nextPtr;
+		ns_sockclose(idlePtr->sock);
+		ns_free(idlePtr);
+		--nidle;
+		if (!all) {
+		    ++nexpired;
+		}
+	    } else {
+		nextPtrPtr = &idlePtr->nextPtr;
+	    }
+	}
+	if (Tcl_GetHashValue(hPtr) == NULL) {
+	    Tcl_DeleteHashEntry(hPtr);
+	}
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CloseIdle --
+ *
+ *        Shutdown callback to close all idle connections.
+ *
+ * Results:
+ *        None.
+ *
+ * Side effects:
+ *        Connections returned later are closed by PutIdle.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CloseIdle(void *ignored)
+{
+    Ns_MutexLock(&lock);
+    ReapIdle(0, 1);
+    stopped = 1;
+    Ns_MutexUnlock(&lock);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -669,7 +1841,7 @@ HttpProc(Ns_Task *task, SOCKET sock, void *arg, int why)
 {
     Http *httpPtr = arg;
     char buf[1024];
-    int n;
+    int n, paused;
 
     switch (why) {
     case NS_SOCK_INIT:
@@ -685,7 +1857,9 @@ HttpProc(Ns_Task *task, SOCKET sock, void *arg, int why)
     	    httpPtr->next += n;
     	    httpPtr->len -= n;
     	    if (httpPtr->len == 0) {
-            	shutdown(sock, 1);
+		if (!httpPtr->keep) {
+            	    shutdown(sock, 1);
+		}
             	Tcl_DStringTrunc(&httpPtr->ds, 0);
 	    	Ns_TaskCallback(task, NS_SOCK_READ, &httpPtr->timeout);
 	    }
@@ -696,12 +1870,35 @@ HttpProc(Ns_Task *task, SOCKET sock, void *arg, int why)
     case NS_SOCK_READ:
     	n = recv(sock, buf, sizeof(buf), 0);
     	if (n > 0) {
-            Tcl_DStringAppend(&httpPtr->ds, buf, n);
-	    return;
+	    if (!HttpRead(httpPtr, buf, n)) {
+		httpPtr->keep = 0;
+	    } else if (!HttpComplete(httpPtr)) {
+
+		/*
+		 * Stop reading while the -callback queue is full,
+		 * see HttpCallback.
+		 */
+
+		Ns_MutexLock(httpPtr->lockPtr);
+		paused = httpPtr->paused;
+		Ns_MutexUnlock(httpPtr->lockPtr);
+		if (paused) {
+		    Ns_TaskCallback(task, 0, &httpPtr->timeout);
+		}
+		return;
+	    }
+	    break;
 	}
 	if (n < 0) {
 	    httpPtr->error = "recv failed";
+	} else if (httpPtr->bodyoff == 0) {
+	    httpPtr->error = "connection closed";
+	} else if (httpPtr->chunked
+		|| (httpPtr->length >= 0
+		    && httpPtr->nbody < httpPtr->length)) {
+	    httpPtr->error = "incomplete response";
 	}
+	httpPtr->keep = 0;
 	break;
 
     case NS_SOCK_TIMEOUT:
@@ -722,5 +1919,9 @@ HttpProc(Ns_Task *task, SOCKET sock, void *arg, int why)
      */
      
     Ns_GetTime(&httpPtr->etime);
+    Ns_MutexLock(httpPtr->lockPtr);
+    httpPtr->done = 1;
+    Ns_CondBroadcast(httpPtr->condPtr);
+    Ns_MutexUnlock(httpPtr->lockPtr);
     Ns_TaskDone(httpPtr->task);
 }
@@ -92,9 +92,10 @@ int
 NsTclHeadersObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
 		   Tcl_Obj *CONST objv[])
 {
-    int      status, len;
+    int      status, len, result;
     Ns_Conn *conn;
     char    *type;
+    Tcl_DString gzip;
 
     if (objc < 3 || objc > 5) {
         Tcl_WrongNumArgs(interp, 1, objv, "connid status ?type len?");
@@ -116,8 +117,27 @@ NsTclHeadersObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
     } else if (Tcl_GetIntFromObj(interp, objv[4], &len) != TCL_OK) {
 	return TCL_ERROR;
     }
+
+    /*
+     * Content of unspecified length written later with ns_write is
+     * gzip'ed if enabled with ns_conn gzip and the gzip stream can
+     * be started, otherwise it is sent as is.
+     */
+
+    Tcl_DStringInit(&gzip);
+    if (objc < 5 && NsConnGzipOk(conn)
+	    && NsConnStartGzip(conn, &gzip) == NS_OK) {
+	Ns_ConnCondSetHeaders(conn, "Content-Encoding", "gzip");
+	len = -1;
+    }
     Ns_ConnSetRequiredHeaders(conn, type, len);
-    return Result(interp, Ns_ConnFlushHeaders(conn, status));
+    result = Ns_ConnFlushHeaders(conn, status);
+    if (result == NS_OK && gzip.length > 0
+	    && Ns_ConnWrite(conn, gzip.string, gzip.length) != gzip.length) {
+	result = NS_ERROR;
+    }
+    Tcl_DStringFree(&gzip);
+    return Result(interp, result);
 }
 
 
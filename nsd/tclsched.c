@@ -55,6 +55,7 @@ static Ns_Callback FreeCallback;
 static Ns_SchedProc FreeSched;
 static int ReturnValidId(Tcl_Interp *interp, int id, TclCallback *cbPtr);
 static int AtCmd(AtProc *procPtr, Tcl_Interp *interp, int argc, char **argv);
+static int GetInterval(Tcl_Interp *interp, char *str, Ns_Time *timePtr);
 
 
 /*
@@ -130,7 +131,8 @@ NsTclAtExitCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
 int
 NsTclAfterCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
 {
-    int id, seconds;
+    int id;
+    Ns_Time delay;
     TclCallback *cbPtr;
 
     if (argc != 3) {
@@ -138,11 +140,12 @@ NsTclAfterCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
 	    argv[0], " seconds script\"", NULL);
 	return TCL_ERROR;
     }
-    if (Tcl_GetInt(interp, argv[1], &seconds) != TCL_OK) {
+    if (GetInterval(interp, argv[1], &delay) != TCL_OK) {
 	return TCL_ERROR;
     }
     cbPtr = NewCallback(interp, argv[2], NULL);
-    id = Ns_After(seconds, (Ns_Callback *) NsTclSchedProc, cbPtr, FreeCallback);
+    id = Ns_ScheduleProcTime(NsTclSchedProc, cbPtr, NS_SCHED_ONCE, &delay,
+			     (Ns_SchedProc *) FreeCallback);
     return ReturnValidId(interp, id, cbPtr);
 }
    
@@ -442,7 +445,7 @@ int
 NsTclSchedCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
 {
     TclCallback	*cbPtr;
-    int          interval;
+    Ns_Time      interval;
     int          flags;
     int          first;
     int          id;
@@ -461,6 +464,8 @@ NsTclSchedCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
      *   * cmd -once    -thread   interval  script           (5 args)/2
      *   * cmd -once    -thread   interval  procname         (5 args)/2
      *   * cmd -once    -thread   interval  procname arg     (6 args)/3
+     *
+     * The -overlap skip|queue|parallel switch may also be given.
      */
 
     first = 1;
@@ -471,6 +476,21 @@ NsTclSchedCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
             flags |= NS_SCHED_THREAD;
         } else if (strcmp(argv[first], "-once") == 0) {
             flags |= NS_SCHED_ONCE;
+        } else if (strcmp(argv[first], "-overlap") == 0
+		&& argv[first+1] != NULL) {
+	    ++first;
+	    --argc;
+	    if (strcmp(argv[first], "skip") == 0) {
+		flags |= NS_SCHED_SKIP;
+	    } else if (strcmp(argv[first], "queue") == 0) {
+		flags |= NS_SCHED_QUEUE;
+	    } else if (strcmp(argv[first], "parallel") == 0) {
+		flags |= NS_SCHED_PARALLEL;
+	    } else {
+		Tcl_AppendResult(interp, "invalid overlap \"", argv[first],
+		    "\": should be skip, queue, or parallel", NULL);
+		return TCL_ERROR;
+	    }
         } else {
 	    break;
 	}
@@ -479,7 +499,8 @@ NsTclSchedCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
 
     if (argc < 2 || argc > 3) {
         Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
-                " ?-once? ?-thread? interval { script | procname ?arg? }\"", 
+                " ?-once? ?-thread? ?-overlap skip|queue|parallel?"
+		" interval { script | procname ?arg? }\"", 
                 (char *) NULL);
         return TCL_ERROR;
     }
@@ -488,15 +509,48 @@ NsTclSchedCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
      * First is now the first argument that is not a switch.
      */
 
-    if (Tcl_GetInt(interp, argv[first++], &interval) != TCL_OK) {
+    if (GetInterval(interp, argv[first++], &interval) != TCL_OK) {
         return TCL_ERROR;
     }
     cbPtr = NewCallback(interp, argv[first], argv[first+1]);
-    id = Ns_ScheduleProcEx(NsTclSchedProc, cbPtr, flags, interval, FreeSched);
+    id = Ns_ScheduleProcTime(NsTclSchedProc, cbPtr, flags, &interval,
+			     FreeSched);
     return ReturnValidId(interp, id, cbPtr);
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetInterval --
+ *
+ *	Parse an interval in seconds with an optional fraction, e.g.,
+ *	0.25 for 250 milliseconds.
+ *
+ * Results:
+ *	Tcl result.
+ *
+ * Side effects:
+ *	Negative intervals are returned as is and rejected by
+ *	Ns_ScheduleProcTime.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GetInterval(Tcl_Interp *interp, char *str, Ns_Time *timePtr)
+{
+    double d;
+
+    if (Tcl_GetDouble(interp, str, &d) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    timePtr->sec = (time_t) d;
+    timePtr->usec = (long) ((d - (double) timePtr->sec) * 1000000.0);
+    return TCL_OK;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
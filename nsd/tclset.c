@@ -625,6 +625,83 @@ NsTclParseHeaderCmd(ClientData arg, Tcl_Interp *interp, int argc, char **argv)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclParseHeadersObjCmd --
+ *
+ *	This wraps Ns_ParseHeaders. 
+ *
+ * Results:
+ *	Tcl result. 
+ *
+ * Side effects:
+ *	Parse a block of HTTP headers and add them to an existing set;
+ *	see Ns_ParseHeaders. 
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclParseHeadersObjCmd(ClientData arg, Tcl_Interp *interp, int objc,
+			Tcl_Obj *CONST objv[])
+{
+    NsInterp *itPtr = arg;
+    Ns_Set *set;
+    Ns_DString ds;
+    int status;
+    Ns_HeaderCaseDisposition disp;
+    static CONST char *opts[] = {
+	"toupper", "tolower", "preserve", NULL
+    };
+    enum {
+	PToUpperIdx, PToLowerIdx, PPreserveIdx
+    } opt;
+
+    if (objc != 3 && objc != 4) {
+        Tcl_WrongNumArgs(interp, 1, objv,
+			 "set headers ?tolower|toupper|preserve?");
+        return TCL_ERROR;
+    }
+    if (LookupSet(itPtr, Tcl_GetString(objv[1]), 0, &set) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    disp = ToLower;
+    if (objc == 4) {
+	if (Tcl_GetIndexFromObj(interp, objv[3], opts, "disposition", 0,
+				(int *) &opt) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch (opt) {
+	case PToUpperIdx:
+	    disp = ToUpper;
+	    break;
+	case PToLowerIdx:
+	    disp = ToLower;
+	    break;
+	case PPreserveIdx:
+	    disp = Preserve;
+	    break;
+	}
+    }
+
+    /*
+     * Parse a copy as the headers are modified temporarily.
+     */
+
+    Ns_DStringInit(&ds);
+    Ns_DStringAppend(&ds, Tcl_GetString(objv[2]));
+    status = Ns_ParseHeaders(set, ds.string, disp);
+    Ns_DStringFree(&ds);
+    if (status != NS_OK) {
+        Tcl_AppendResult(interp, "invalid headers", NULL);
+        return TCL_ERROR;
+    }
+    Tcl_SetIntObj(Tcl_GetObjResult(interp), Ns_SetSize(set));
+    return TCL_OK;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -623,7 +623,7 @@ ShareTraceProc(clientData, interp, name1, name2, flags)
 
     if (destroyed) {
 	Ns_CsDestroy(&valuePtr->lock);
-	Tcl_Free((char *) valuePtr );
+	ns_free(valuePtr);
     }
 
 done:
@@ -0,0 +1,456 @@
+/*
+ * The contents of this file are subject to the AOLserver Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://aolserver.com/.
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is AOLserver Code and related documentation
+ * distributed by AOL.
+ * 
+ * The Initial Developer of the Original Code is America Online,
+ * Inc. Portions created by AOL are Copyright (C) 1999 America Online,
+ * Inc. All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+
+/*
+ * timer.c --
+ *
+ *	Hierarchical timer wheel with millisecond resolution.  Timers
+ *	are kept in four levels of 256 slots, each level covering 256
+ *	times the range of the level below, so that timers can be added
+ *	and cancelled in constant time.  Timers in the higher levels are
+ *	cascaded down as the wheel turns.  A wheel is not locked and
+ *	must be protected by the caller if shared between threads.
+ */
+
+#include "nsd.h"
+
+#define NLEVELS		4
+#define SLOTBITS	8
+#define NSLOTS		(1 << SLOTBITS)
+#define SLOTMASK	(NSLOTS - 1)
+#define MAXTICKS	0xffffffffUL
+
+/*
+ * The following structure defines a timer wheel.  Each slot is the
+ * head of a circular list of timers.
+ */
+
+typedef struct Wheel {
+    Ns_Time	    base;	/* Time of tick zero. */
+    unsigned long   tick;	/* Next tick to expire. */
+    int		    ntimers;	/* Number of pending timers. */
+    Ns_Timer	    slots[NLEVELS][NSLOTS];
+} Wheel;
+
+/*
+ * Local functions defined in this file
+ */
+
+static unsigned long GetTick(Wheel *wheelPtr, Ns_Time *timePtr, int roundup);
+static void Link(Wheel *wheelPtr, Ns_Timer *timerPtr);
+static void Unlink(Ns_Timer *timerPtr);
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TimerWheelCreate --
+ *
+ *	Create a new, empty timer wheel.
+ *
+ * Results:
+ *	Pointer to Ns_TimerWheel.
+ *
+ * Side effects:
+ *	The wheel starts turning at the given time or the current time
+ *	if nowPtr is NULL.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_TimerWheel *
+Ns_TimerWheelCreate(Ns_Time *nowPtr)
+{
+    Wheel *wheelPtr;
+    Ns_Timer *headPtr;
+    int i, j;
+
+    wheelPtr = ns_malloc(sizeof(Wheel));
+    if (nowPtr != NULL) {
+	wheelPtr->base = *nowPtr;
+    } else {
+	Ns_GetTime(&wheelPtr->base);
+    }
+    wheelPtr->tick = 0;
+    wheelPtr->ntimers = 0;
+    for (i = 0; i < NLEVELS; ++i) {
+	for (j = 0; j < NSLOTS; ++j) {
+	    headPtr = &wheelPtr->slots[i][j];
+	    headPtr->nextPtr = headPtr->prevPtr = headPtr;
+	}
+    }
+    return (Ns_TimerWheel *) wheelPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TimerWheelDestroy --
+ *
+ *	Destroy a timer wheel.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Timers still pending are unlinked but not otherwise touched.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_TimerWheelDestroy(Ns_TimerWheel *wheel)
+{
+    Wheel *wheelPtr = (Wheel *) wheel;
+    Ns_Timer *headPtr;
+    int i, j;
+
+    for (i = 0; i < NLEVELS; ++i) {
+	for (j = 0; j < NSLOTS; ++j) {
+	    headPtr = &wheelPtr->slots[i][j];
+	    while (headPtr->nextPtr != headPtr) {
+		Unlink(headPtr->nextPtr);
+	    }
+	}
+    }
+    ns_free(wheelPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TimerInit --
+ *
+ *	Initialize a timer, usually embedded in some larger structure.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Timer is not pending.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_TimerInit(Ns_Timer *timerPtr, void *arg)
+{
+    timerPtr->nextPtr = timerPtr->prevPtr = NULL;
+    timerPtr->expires.sec = timerPtr->expires.usec = 0;
+    timerPtr->arg = arg;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TimerAdd --
+ *
+ *	Add a timer to a wheel to expire at the given absolute time.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A timer which is already pending is first cancelled.  A time
+ *	in the past will expire on the next Ns_TimerWheelExpire after
+ *	the current millisecond.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_TimerAdd(Ns_TimerWheel *wheel, Ns_Timer *timerPtr, Ns_Time *expiresPtr)
+{
+    Wheel *wheelPtr = (Wheel *) wheel;
+
+    if (timerPtr->prevPtr != NULL) {
+	Unlink(timerPtr);
+    } else {
+	++wheelPtr->ntimers;
+    }
+    timerPtr->expires = *expiresPtr;
+    Link(wheelPtr, timerPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TimerCancel --
+ *
+ *	Cancel a timer.
+ *
+ * Results:
+ *	1 if the timer was pending, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_TimerCancel(Ns_TimerWheel *wheel, Ns_Timer *timerPtr)
+{
+    Wheel *wheelPtr = (Wheel *) wheel;
+
+    if (timerPtr->prevPtr == NULL) {
+	return 0;
+    }
+    Unlink(timerPtr);
+    --wheelPtr->ntimers;
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TimerWheelNext --
+ *
+ *	Determine when Ns_TimerWheelExpire should next be called, i.e.,
+ *	when the earliest timer expires or timers must be cascaded from
+ *	a higher level.
+ *
+ * Results:
+ *	1 if any timers are pending with the time in nextPtr, 0 if the
+ *	wheel is empty.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_TimerWheelNext(Ns_TimerWheel *wheel, Ns_Time *nextPtr)
+{
+    Wheel *wheelPtr = (Wheel *) wheel;
+    Ns_Timer *headPtr;
+    unsigned long tick, next, block;
+    int i, level, shift;
+
+    if (wheelPtr->ntimers == 0) {
+	return 0;
+    }
+
+    /*
+     * The lowest level holds timers expiring within NSLOTS ticks
+     * while a higher level timer is found no later than the start
+     * of the block of ticks for its slot.
+     */
+
+    tick = wheelPtr->tick;
+    next = tick + MAXTICKS;
+    for (i = 0; i < NSLOTS; ++i) {
+	headPtr = &wheelPtr->slots[0][(tick + i) & SLOTMASK];
+	if (headPtr->nextPtr != headPtr) {
+	    next = tick + i;
+	    break;
+	}
+    }
+    for (level = 1; level < NLEVELS; ++level) {
+	shift = level * SLOTBITS;
+	block = tick >> shift;
+	if ((tick & ((1UL << shift) - 1)) != 0) {
+	    ++block;
+	}
+	for (i = 0; i < NSLOTS
+		&& (long) (((block + i) << shift) - next) < 0; ++i) {
+	    headPtr = &wheelPtr->slots[level][(block + i) & SLOTMASK];
+	    if (headPtr->nextPtr != headPtr) {
+		next = (block + i) << shift;
+		break;
+	    }
+	}
+    }
+    *nextPtr = wheelPtr->base;
+    Ns_IncrTime(nextPtr, (time_t) (next / 1000),
+		(long) (next % 1000) * 1000);
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_TimerWheelExpire --
+ *
+ *	Turn the wheel up to the given time, removing expired timers.
+ *
+ * Results:
+ *	List of expired timers linked by nextPtr or NULL if none.
+ *
+ * Side effects:
+ *	Expired timers are no longer pending.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Timer *
+Ns_TimerWheelExpire(Ns_TimerWheel *wheel, Ns_Time *nowPtr)
+{
+    Wheel *wheelPtr = (Wheel *) wheel;
+    Ns_Timer *headPtr, *timerPtr, *firstPtr, **lastPtrPtr;
+    unsigned long now;
+    int level, idx;
+
+    firstPtr = NULL;
+    lastPtrPtr = &firstPtr;
+    now = GetTick(wheelPtr, nowPtr, 0);
+    while ((long) (now - wheelPtr->tick) >= 0) {
+	if (wheelPtr->ntimers == 0) {
+	    wheelPtr->tick = now + 1;
+	    break;
+	}
+
+	/*
+	 * At the start of each block cascade timers from the slot of
+	 * the next level, continuing up when that level also wraps.
+	 */
+
+	for (level = 1; level < NLEVELS; ++level) {
+	    if ((wheelPtr->tick & ((1UL << (level * SLOTBITS)) - 1)) != 0) {
+		break;
+	    }
+	    idx = (wheelPtr->tick >> (level * SLOTBITS)) & SLOTMASK;
+	    headPtr = &wheelPtr->slots[level][idx];
+	    while ((timerPtr = headPtr->nextPtr) != headPtr) {
+		Unlink(timerPtr);
+		Link(wheelPtr, timerPtr);
+	    }
+	}
+	headPtr = &wheelPtr->slots[0][wheelPtr->tick & SLOTMASK];
+	while ((timerPtr = headPtr->nextPtr) != headPtr) {
+	    Unlink(timerPtr);
+	    --wheelPtr->ntimers;
+	    *lastPtrPtr = timerPtr;
+	    lastPtrPtr = &timerPtr->nextPtr;
+	}
+	++wheelPtr->tick;
+    }
+    *lastPtrPtr = NULL;
+    return firstPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetTick --
+ *
+ *	Convert an absolute time to a wheel tick.
+ *
+ * Results:
+ *	Milliseconds since the wheel base time, rounded up if requested
+ *	and zero for earlier times.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static unsigned long
+GetTick(Wheel *wheelPtr, Ns_Time *timePtr, int roundup)
+{
+    Ns_Time diff;
+    unsigned long ms;
+
+    if (Ns_DiffTime(timePtr, &wheelPtr->base, &diff) < 0) {
+	return 0;
+    }
+    ms = (unsigned long) diff.sec * 1000;
+    if (roundup) {
+	ms += (diff.usec + 999) / 1000;
+    } else {
+	ms += diff.usec / 1000;
+    }
+    return ms;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Link, Unlink --
+ *
+ *	Place a timer in the slot for its expiry time or remove it
+ *	from its current slot.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Timers beyond the range of the wheel are placed in the last
+ *	slot and cascaded down again when reached.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Link(Wheel *wheelPtr, Ns_Timer *timerPtr)
+{
+    Ns_Timer *headPtr;
+    unsigned long expires, delta;
+    int level;
+
+    expires = GetTick(wheelPtr, &timerPtr->expires, 1);
+    if ((long) (expires - wheelPtr->tick) < 0) {
+	expires = wheelPtr->tick;
+    }
+    delta = expires - wheelPtr->tick;
+    if (delta > MAXTICKS) {
+	delta = MAXTICKS;
+	expires = wheelPtr->tick + delta;
+    }
+    for (level = 0; level < NLEVELS - 1; ++level) {
+	if (delta < (1UL << ((level + 1) * SLOTBITS))) {
+	    break;
+	}
+    }
+    headPtr = &wheelPtr->slots[level]
+	[(expires >> (level * SLOTBITS)) & SLOTMASK];
+    timerPtr->nextPtr = headPtr;
+    timerPtr->prevPtr = headPtr->prevPtr;
+    headPtr->prevPtr->nextPtr = timerPtr;
+    headPtr->prevPtr = timerPtr;
+}
+
+static void
+Unlink(Ns_Timer *timerPtr)
+{
+    timerPtr->prevPtr->nextPtr = timerPtr->nextPtr;
+    timerPtr->nextPtr->prevPtr = timerPtr->prevPtr;
+    timerPtr->nextPtr = timerPtr->prevPtr = NULL;
+}
@@ -33,12 +33,31 @@
 #define NSDB_EXPORTS
 #include "nsdb.h"
 
+/*
+ * The following structure maintains the per-handle cache of prepared
+ * statements for drivers which support the DbFn_PrepareStmt interface.
+ * Statements are kept in most to least recently used order.
+ */
+
+typedef struct DbStmtCache {
+    int             maxstmts;
+    Tcl_HashTable   stmts;
+    struct DbStmt  *firstPtr;
+    struct DbStmt  *lastPtr;
+} DbStmtCache;
+
 extern void NsDbInitPools(void);
+extern void NsDbInitCache(void);
+extern int  NsDbCacheGet(char *key, int ntags, char **tagv,
+			 unsigned long *gens, Ns_DString *dsPtr);
+extern void NsDbCachePut(char *key, int ntags, char **tagv,
+			 unsigned long *gens, int ttl, Ns_DString *dsPtr);
 extern void NsDbInitServer(char *server);
 extern Ns_TclInterpInitProc NsDbAddCmds;
 extern void 		NsDbClose(Ns_DbHandle *);
 extern void 		NsDbDisconnect(Ns_DbHandle *);
 extern struct DbDriver *NsDbGetDriver(Ns_DbHandle *);
+extern DbStmtCache     *NsDbGetStmtCache(Ns_DbHandle *);
 extern struct DbDriver *NsDbLoadDriver(char *driver);
 extern void 		NsDbLogSql(Ns_DbHandle *, char *sql);
 extern int 		NsDbOpen(Ns_DbHandle *);
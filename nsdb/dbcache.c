@@ -0,0 +1,413 @@
+/*
+ * The contents of this file are subject to the AOLserver Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://aolserver.com/.
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is AOLserver Code and related documentation
+ * distributed by AOL.
+ *
+ * The Initial Developer of the Original Code is America Online,
+ * Inc. Portions created by AOL are Copyright (C) 1999 America Online,
+ * Inc. All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+
+/*
+ * dbcache.c --
+ *
+ *	Cache of materialized query results with expiration times and
+ *	invalidation tags, built on the Ns_Cache size-based LRU cache.
+ *
+ *	Each tag has a generation number which is incremented when the
+ *	tag is invalidated.  Results record the generations of their tags
+ *	when the query is started and are discarded on the next lookup
+ *	if any has changed.  Tags are reference counted by the results
+ *	and fetches using them and deleted when no longer used.  A NULL value is maintained in the cache while
+ *	a result is being fetched so other threads wait for the result
+ *	instead of repeating the query.
+ */
+
+#include "db.h"
+
+/*
+ * The following structure defines an invalidation tag, referenced by
+ * cached results and by fetches in progress.
+ */
+
+typedef struct Tag {
+    Tcl_HashEntry   *hPtr;
+    unsigned long    gen;
+    int              refs;
+} Tag;
+
+/*
+ * The following structure defines a cached result, a string in Tcl
+ * list format with the tag generations used to detect invalidation.
+ */
+
+typedef struct Result {
+    Ns_Time          expires;
+    int              ntags;
+    Tag            **tags;
+    unsigned long   *gens;
+    int              length;
+    char            *string;
+} Result;
+
+/*
+ * Local functions defined in this file
+ */
+
+static int Stale(Result *resPtr, Ns_Time *nowPtr);
+static Tag *GetTag(char *tag);
+static void ReleaseTag(Tag *tagPtr);
+static Ns_Callback FreeResult;
+
+/*
+ * Static variables defined in this file
+ */
+
+static Ns_Cache      *cache;	/* Cache of results. */
+static Tcl_HashTable  tags;	/* Tags by name, locked with cache. */
+static int            wait;	/* Seconds to wait for another thread. */
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbInitCache --
+ *
+ *	Create the result cache.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsDbInitCache(void)
+{
+    int size;
+
+    if (!Ns_ConfigGetInt("ns/db", "cachesize", &size) || size < 0) {
+	size = 10 * 1024 * 1024;
+    }
+    if (!Ns_ConfigGetInt("ns/db", "cachewait", &wait) || wait < 0) {
+	wait = 10;
+    }
+    cache = Ns_CacheCreateSz("nsdb:results", TCL_STRING_KEYS, (size_t) size,
+			     FreeResult);
+    Tcl_InitHashTable(&tags, TCL_STRING_KEYS);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbCacheGet --
+ *
+ *	Find a cached result, waiting for another thread which is
+ *	fetching the same result.
+ *
+ * Results:
+ *	NS_OK if the result was found and copied to dsPtr, NS_ERROR if
+ *	not found and the caller must fetch the result and call
+ *	NsDbCachePut, or NS_TIMEOUT if not found and another thread
+ *	is fetching the result.
+ *
+ * Side effects:
+ *	On NS_ERROR the current generations of the given tags are
+ *	stored in gens for use with NsDbCachePut and the tags are
+ *	referenced until then.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsDbCacheGet(char *key, int ntags, char **tagv, unsigned long *gens,
+	     Ns_DString *dsPtr)
+{
+    Ns_Entry      *entry;
+    Result        *resPtr;
+    Ns_Time        now, timeout;
+    int            i, new, status;
+
+    Ns_GetTime(&now);
+    Ns_CacheLock(cache);
+    entry = Ns_CacheCreateEntry(cache, key, &new);
+    if (!new && Ns_CacheGetValue(entry) == NULL) {
+	timeout = now;
+	Ns_IncrTime(&timeout, wait, 0);
+	status = NS_OK;
+	do {
+	    status = Ns_CacheTimedWait(cache, &timeout);
+	} while (status == NS_OK
+		 && (entry = Ns_CacheFindEntry(cache, key)) != NULL
+		 && Ns_CacheGetValue(entry) == NULL);
+	if (entry == NULL || Ns_CacheGetValue(entry) == NULL) {
+	    Ns_CacheUnlock(cache);
+	    return NS_TIMEOUT;
+	}
+	Ns_GetTime(&now);
+    }
+    if (!new) {
+	resPtr = Ns_CacheGetValue(entry);
+	if (!Stale(resPtr, &now)) {
+	    Ns_DStringNAppend(dsPtr, resPtr->string, resPtr->length);
+	    Ns_CacheUnlock(cache);
+	    return NS_OK;
+	}
+	Ns_CacheUnsetValue(entry);
+    }
+    for (i = 0; i < ntags; ++i) {
+	gens[i] = GetTag(tagv[i])->gen;
+    }
+    Ns_CacheUnlock(cache);
+    return NS_ERROR;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbCachePut --
+ *
+ *	Store a result fetched after NsDbCacheGet returned NS_ERROR.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	If dsPtr is NULL the fetch failed, the entry is removed and the
+ *	tags referenced by NsDbCacheGet are released, otherwise the
+ *	result keeps the references.  Threads waiting for the result
+ *	are woken up.  A ttl of zero never expires.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsDbCachePut(char *key, int ntags, char **tagv, unsigned long *gens,
+	     int ttl, Ns_DString *dsPtr)
+{
+    Ns_Entry *entry;
+    Result   *resPtr;
+    size_t    size;
+    int       i, new;
+
+    Ns_CacheLock(cache);
+    entry = Ns_CacheCreateEntry(cache, key, &new);
+    if (dsPtr == NULL) {
+	Ns_CacheFlushEntry(entry);
+	for (i = 0; i < ntags; ++i) {
+	    ReleaseTag(Tcl_GetHashValue(Tcl_FindHashEntry(&tags, tagv[i])));
+	}
+    } else {
+	size = sizeof(Result) + ntags * (sizeof(Tag *)
+		+ sizeof(unsigned long)) + dsPtr->length + 1;
+	resPtr = ns_malloc(size);
+	resPtr->ntags = ntags;
+	resPtr->tags = (Tag **) (resPtr + 1);
+	resPtr->gens = (unsigned long *) (resPtr->tags + ntags);
+	resPtr->string = (char *) (resPtr->gens + ntags);
+	resPtr->length = dsPtr->length;
+	memcpy(resPtr->string, dsPtr->string, dsPtr->length + 1);
+	for (i = 0; i < ntags; ++i) {
+	    resPtr->tags[i] = Tcl_GetHashValue(Tcl_FindHashEntry(&tags,
+								 tagv[i]));
+	    resPtr->gens[i] = gens[i];
+	}
+	if (ttl > 0) {
+	    Ns_GetTime(&resPtr->expires);
+	    Ns_IncrTime(&resPtr->expires, ttl, 0);
+	} else {
+	    resPtr->expires.sec = resPtr->expires.usec = 0;
+	}
+	Ns_CacheSetValueSz(entry, resPtr, size);
+    }
+    Ns_CacheBroadcast(cache);
+    Ns_CacheUnlock(cache);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbCacheInvalidate --
+ *
+ *	Invalidate all cached results with the given tag.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Results are discarded on their next lookup, including results
+ *	currently being fetched.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_DbCacheInvalidate(char *tag)
+{
+    Tcl_HashEntry *hPtr;
+    Tag           *tagPtr;
+
+    Ns_CacheLock(cache);
+    hPtr = Tcl_FindHashEntry(&tags, tag);
+    if (hPtr != NULL) {
+	tagPtr = Tcl_GetHashValue(hPtr);
+	++tagPtr->gen;
+    }
+    Ns_CacheUnlock(cache);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Stale --
+ *
+ *	Check if a result has expired or been invalidated.
+ *
+ * Results:
+ *	1 if stale, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+Stale(Result *resPtr, Ns_Time *nowPtr)
+{
+    int i;
+
+    if (resPtr->expires.sec > 0 && Ns_DiffTime(&resPtr->expires, nowPtr,
+	    NULL) < 0) {
+	return 1;
+    }
+    for (i = 0; i < resPtr->ntags; ++i) {
+	if (resPtr->tags[i]->gen != resPtr->gens[i]) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetTag --
+ *
+ *	Find or create a tag and add a reference to it.  Must be called
+ *	with the cache locked.
+ *
+ * Results:
+ *	Pointer to Tag.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tag *
+GetTag(char *tag)
+{
+    Tcl_HashEntry *hPtr;
+    Tag           *tagPtr;
+    int            new;
+
+    hPtr = Tcl_CreateHashEntry(&tags, tag, &new);
+    if (new) {
+	tagPtr = ns_malloc(sizeof(Tag));
+	tagPtr->hPtr = hPtr;
+	tagPtr->gen = 0;
+	tagPtr->refs = 0;
+	Tcl_SetHashValue(hPtr, tagPtr);
+    } else {
+	tagPtr = Tcl_GetHashValue(hPtr);
+    }
+    ++tagPtr->refs;
+    return tagPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReleaseTag --
+ *
+ *	Release a reference to a tag.  Must be called with the cache
+ *	locked.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Tag is deleted when no cached result or fetch in progress
+ *	uses it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ReleaseTag(Tag *tagPtr)
+{
+    if (--tagPtr->refs == 0) {
+	Tcl_DeleteHashEntry(tagPtr->hPtr);
+	ns_free(tagPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeResult --
+ *
+ *	Cache free proc for results, called with the cache locked.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Tags of the result are released.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeResult(void *arg)
+{
+    Result *resPtr = arg;
+    int     i;
+
+    for (i = 0; i < resPtr->ntags; ++i) {
+	ReleaseTag(resPtr->tags[i]);
+    }
+    ns_free(resPtr);
+}
@@ -62,6 +62,11 @@ typedef int (SpExecProc) (Ns_DbHandle *handle);
 typedef int (SpReturnCodeProc) (Ns_DbHandle *dbhandle, char *returnCode,
 				int bufsize);
 typedef Ns_Set *(SpGetParamsProc) (Ns_DbHandle *handle);
+typedef void *(PrepareStmtProc) (Ns_DbHandle *handle, char *sql, int nparams);
+typedef int (ExecStmtProc) (Ns_DbHandle *handle, void *stmt, int nparams,
+			    char **values);
+typedef void (FreeStmtProc) (Ns_DbHandle *handle, void *stmt);
+typedef int (GetRowsProc) (Ns_DbHandle *handle, Ns_DbRows *rowsPtr);
 
 /*
  * The following structure specifies the driver-specific functions
@@ -89,7 +94,38 @@ typedef struct DbDriver {
     SpExecProc       *spexecProc;
     SpReturnCodeProc *spreturncodeProc;
     SpGetParamsProc  *spgetparamsProc;
+    PrepareStmtProc  *prepareProc;
+    ExecStmtProc     *execstmtProc;
+    FreeStmtProc     *freestmtProc;
+    GetRowsProc      *getrowsProc;
 } DbDriver;
+
+/*
+ * The following structure defines a prepared statement in the
+ * per-handle statement cache, keyed by the original SQL text.
+ */
+
+typedef struct DbStmt {
+    struct DbStmt  *nextPtr;
+    struct DbStmt  *prevPtr;
+    Tcl_HashEntry  *hPtr;
+    void           *stmt;
+    int             nparams;
+    char           *names;
+} DbStmt;
+
+/*
+ * Local functions defined in this file
+ */
+
+static int ParseSql(Ns_DbHandle *handle, char *sql, Ns_Set *bind,
+		    Ns_DString *sqlPtr, Ns_DString *namesPtr);
+static int BindSql(Ns_DbHandle *handle, char *sql, Ns_Set *bind,
+		   Ns_DString *dsPtr);
+static int ExecStmt(Ns_DbHandle *handle, DbStmtCache *cachePtr, char *sql,
+		    Ns_Set *bind);
+static void FreeStmt(Ns_DbHandle *handle, DbStmtCache *cachePtr,
+		     DbStmt *stmtPtr);
     
 /*
  * Static variables defined in this file
@@ -203,6 +239,22 @@ Ns_DbRegisterDriver(char *driver, Ns_DbProc *procs)
 		driverPtr->spgetparamsProc = (SpGetParamsProc *) procs->func;
 		break;
 
+	    case DbFn_PrepareStmt:
+		driverPtr->prepareProc = (PrepareStmtProc *) procs->func;
+		break;
+
+	    case DbFn_ExecStmt:
+		driverPtr->execstmtProc = (ExecStmtProc *) procs->func;
+		break;
+
+	    case DbFn_FreeStmt:
+		driverPtr->freestmtProc = (FreeStmtProc *) procs->func;
+		break;
+
+	    case DbFn_GetRows:
+		driverPtr->getrowsProc = (GetRowsProc *) procs->func;
+		break;
+
 	    /*
 	     * The following functions are no longer supported.
 	     */
@@ -301,9 +353,10 @@ Ns_DbDriverDbType(Ns_DbHandle *handle)
 /*
  *----------------------------------------------------------------------
  *
- * Ns_DbDML --
+ * Ns_DbDML, Ns_DbDMLBind --
  *
- *	Execute an SQL statement which is expected to be DML.
+ *	Execute an SQL statement which is expected to be DML, optionally
+ *	with :name bind variables taken from the given set.
  *
  * Results:
  *	NS_OK or NS_ERROR.
@@ -316,14 +369,21 @@ Ns_DbDriverDbType(Ns_DbHandle *handle)
 
 int
 Ns_DbDML(Ns_DbHandle *handle, char *sql)
+{
+    return Ns_DbDMLBind(handle, sql, NULL);
+}
+
+int
+Ns_DbDMLBind(Ns_DbHandle *handle, char *sql, Ns_Set *bind)
 {
     DbDriver *driverPtr = NsDbGetDriver(handle);
+    Ns_DString ds;
     int status = NS_ERROR;
 
     if (driverPtr != NULL && handle->connected) {
 
 	if (driverPtr->execProc != NULL) {
-    	    status = Ns_DbExec(handle, sql);
+    	    status = Ns_DbExecBind(handle, sql, bind);
 	    if (status == NS_DML) {
 		status = NS_OK;
 	    } else {
@@ -335,8 +395,12 @@ Ns_DbDML(Ns_DbHandle *handle, char *sql)
 		status = NS_ERROR;
 	    }
 	} else if (driverPtr->dmlProc != NULL) {
-    	    status = (*driverPtr->dmlProc)(handle, sql);
-	    NsDbLogSql(handle, sql);
+	    Ns_DStringInit(&ds);
+	    if (BindSql(handle, sql, bind, &ds) == NS_OK) {
+    	    	status = (*driverPtr->dmlProc)(handle, ds.string);
+	    	NsDbLogSql(handle, ds.string);
+	    }
+	    Ns_DStringFree(&ds);
 	}
     }
     
@@ -347,9 +411,10 @@ Ns_DbDML(Ns_DbHandle *handle, char *sql)
 /*
  *----------------------------------------------------------------------
  *
- * Ns_DbSelect --
+ * Ns_DbSelect, Ns_DbSelectBind --
  *
- *	Execute an SQL statement which is expected to return rows.
+ *	Execute an SQL statement which is expected to return rows,
+ *	optionally with :name bind variables taken from the given set.
  *
  * Results:
  *	Pointer to Ns_Set of selected columns or NULL on error.
@@ -362,14 +427,21 @@ Ns_DbDML(Ns_DbHandle *handle, char *sql)
 
 Ns_Set *
 Ns_DbSelect(Ns_DbHandle *handle, char *sql)
+{
+    return Ns_DbSelectBind(handle, sql, NULL);
+}
+
+Ns_Set *
+Ns_DbSelectBind(Ns_DbHandle *handle, char *sql, Ns_Set *bind)
 {
     DbDriver *driverPtr = NsDbGetDriver(handle);
+    Ns_DString ds;
     Ns_Set *setPtr = NULL;
 
     if (driverPtr != NULL && handle->connected) {
 
 	if (driverPtr->execProc != NULL) {
-    	    if (Ns_DbExec(handle, sql) == NS_ROWS) {
+    	    if (Ns_DbExecBind(handle, sql, bind) == NS_ROWS) {
     		setPtr = Ns_DbBindRow(handle);
 	    } else {
             if(!handle->dsExceptionMsg.length)  
@@ -377,9 +449,13 @@ Ns_DbSelect(Ns_DbHandle *handle, char *sql)
 		    	"Query was not a statement returning rows.");
 	    }
 	} else if (driverPtr->selectProc != NULL) {
-    	    Ns_SetTrunc(handle->row, 0);
-    	    setPtr = (*driverPtr->selectProc)(handle, sql);	
-	    NsDbLogSql(handle, sql);
+	    Ns_DStringInit(&ds);
+	    if (BindSql(handle, sql, bind, &ds) == NS_OK) {
+    	    	Ns_SetTrunc(handle->row, 0);
+    	    	setPtr = (*driverPtr->selectProc)(handle, ds.string);	
+	    	NsDbLogSql(handle, ds.string);
+	    }
+	    Ns_DStringFree(&ds);
 	}
     }
     
@@ -421,6 +497,59 @@ Ns_DbExec(Ns_DbHandle *handle, char *sql)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbExecBind --
+ *
+ *	Execute an SQL statement with :name bind variables whose values
+ *	are taken from the given set.  If the driver supports prepared
+ *	statements, the statement is prepared once and cached by SQL
+ *	text in the handle's statement cache.  Otherwise, the quoted
+ *	values are substituted into the SQL text and sent with
+ *	Ns_DbExec.
+ *
+ * Results:
+ *	NS_DML, NS_ROWS, or NS_ERROR.
+ *
+ * Side effects:
+ *	SQL is sent to database for evaluation.  A statement may be
+ *	prepared and another evicted from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_DbExecBind(Ns_DbHandle *handle, char *sql, Ns_Set *bind)
+{
+    DbDriver    *driverPtr = NsDbGetDriver(handle);
+    DbStmtCache *cachePtr;
+    Ns_DString   ds;
+    int          status;
+
+    if (bind == NULL) {
+	return Ns_DbExec(handle, sql);
+    }
+    if (!handle->connected || driverPtr == NULL) {
+	return NS_ERROR;
+    }
+    cachePtr = NsDbGetStmtCache(handle);
+    if (cachePtr != NULL && cachePtr->maxstmts > 0
+	    && driverPtr->prepareProc != NULL
+	    && driverPtr->execstmtProc != NULL) {
+	return ExecStmt(handle, cachePtr, sql, bind);
+    }
+    Ns_DStringInit(&ds);
+    status = BindSql(handle, sql, bind, &ds);
+    if (status == NS_OK) {
+	status = Ns_DbExec(handle, ds.string);
+    }
+    Ns_DStringFree(&ds);
+
+    return status;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -492,6 +621,197 @@ Ns_DbGetRow(Ns_DbHandle *handle, Ns_Set *row)
     return status;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbGetRows --
+ *
+ *	Fetch the next batch of up to rowsPtr->maxrows rows after an
+ *	Ns_DbSelect or Ns_DbExec and Ns_DbBindRow.  Drivers which
+ *	provide a GetRows proc fill the buffer directly, otherwise
+ *	rows are fetched one at a time through the handle row set.
+ *
+ * Results:
+ *	NS_OK if more rows may follow, NS_END_DATA if the last batch,
+ *	possibly empty, was fetched, or NS_ERROR.
+ *
+ * Side effects:
+ *	Previous contents of the buffer are replaced by the new batch
+ *	and rowsPtr->nrows is set to the number of rows fetched.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_DbGetRows(Ns_DbHandle *handle, Ns_DbRows *rowsPtr)
+{
+    DbDriver *driverPtr = NsDbGetDriver(handle);
+    Ns_Set   *row = handle->row;
+    int       i, ncols, status;
+
+    if (!handle->connected || driverPtr == NULL || row == NULL
+	    || (driverPtr->getrowsProc == NULL && driverPtr->getProc == NULL)) {
+	return NS_ERROR;
+    }
+
+    /*
+     * Size the offset and length arrays for the current columns.
+     */
+
+    ncols = Ns_SetSize(row);
+    if (ncols > rowsPtr->ncols) {
+	rowsPtr->offsets = ns_realloc(rowsPtr->offsets,
+				ncols * rowsPtr->maxrows * sizeof(int));
+	rowsPtr->lengths = ns_realloc(rowsPtr->lengths,
+				ncols * rowsPtr->maxrows * sizeof(int));
+    }
+    rowsPtr->ncols = ncols;
+    rowsPtr->nrows = 0;
+    Ns_DStringTrunc(&rowsPtr->data, 0);
+
+    if (driverPtr->getrowsProc != NULL) {
+	return (*driverPtr->getrowsProc)(handle, rowsPtr);
+    }
+    status = NS_OK;
+    while (rowsPtr->nrows < rowsPtr->maxrows) {
+	status = (*driverPtr->getProc)(handle, row);
+	if (status != NS_OK) {
+	    break;
+	}
+	for (i = 0; i < ncols; ++i) {
+	    Ns_DbRowsPutValue(rowsPtr, rowsPtr->nrows, i,
+			      Ns_SetValue(row, i), -1);
+	}
+	++rowsPtr->nrows;
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbRowsInit --
+ *
+ *	Initialize a row buffer for batches of up to maxrows rows.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Column arrays are allocated on the first Ns_DbGetRows.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_DbRowsInit(Ns_DbRows *rowsPtr, int maxrows)
+{
+    rowsPtr->ncols = 0;
+    rowsPtr->nrows = 0;
+    rowsPtr->maxrows = (maxrows > 0 ? maxrows : 1);
+    rowsPtr->offsets = NULL;
+    rowsPtr->lengths = NULL;
+    Ns_DStringInit(&rowsPtr->data);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbRowsFree --
+ *
+ *	Free memory used by a row buffer.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_DbRowsFree(Ns_DbRows *rowsPtr)
+{
+    ns_free(rowsPtr->offsets);
+    ns_free(rowsPtr->lengths);
+    Ns_DStringFree(&rowsPtr->data);
+    rowsPtr->offsets = rowsPtr->lengths = NULL;
+    rowsPtr->ncols = rowsPtr->nrows = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbRowsPutValue --
+ *
+ *	Copy a value into a row buffer, called by driver GetRows procs.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A NULL value is recorded as an SQL NULL.  If len is less than
+ *	zero the length of the value is determined with strlen.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_DbRowsPutValue(Ns_DbRows *rowsPtr, int row, int col, char *value, int len)
+{
+    int idx = col * rowsPtr->maxrows + row;
+
+    if (value == NULL) {
+	rowsPtr->offsets[idx] = -1;
+	rowsPtr->lengths[idx] = 0;
+    } else {
+	if (len < 0) {
+	    len = strlen(value);
+	}
+	rowsPtr->offsets[idx] = rowsPtr->data.length;
+	rowsPtr->lengths[idx] = len;
+	Ns_DStringNAppend(&rowsPtr->data, value, len);
+	Ns_DStringNAppend(&rowsPtr->data, "", 1);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbRowsGetValue --
+ *
+ *	Return a value from a row buffer.
+ *
+ * Results:
+ *	Pointer to NUL terminated value or NULL for an SQL NULL.  The
+ *	length is stored in lenPtr if not NULL.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+char *
+Ns_DbRowsGetValue(Ns_DbRows *rowsPtr, int row, int col, int *lenPtr)
+{
+    int idx = col * rowsPtr->maxrows + row;
+
+    if (lenPtr != NULL) {
+	*lenPtr = rowsPtr->lengths[idx];
+    }
+    if (rowsPtr->offsets[idx] < 0) {
+	return NULL;
+    }
+    return rowsPtr->data.string + rowsPtr->offsets[idx];
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -731,7 +1051,7 @@ NsDbOpen(Ns_DbHandle *handle)
  *	None.
  *
  * Side effects:
- *	None.
+ *	Any cached prepared statements are freed.
  *
  *----------------------------------------------------------------------
  */
@@ -740,7 +1060,13 @@ void
 NsDbClose(Ns_DbHandle *handle)
 {
     DbDriver *driverPtr = NsDbGetDriver(handle);
-    
+    DbStmtCache *cachePtr = NsDbGetStmtCache(handle);
+
+    if (cachePtr != NULL) {
+	while (cachePtr->firstPtr != NULL) {
+	    FreeStmt(handle, cachePtr, cachePtr->firstPtr);
+	}
+    }
     if (handle->connected &&
 	driverPtr != NULL &&
 	driverPtr->closeProc != NULL) {
@@ -924,3 +1250,298 @@ Ns_DbSpGetParams(Ns_DbHandle *handle)
 
     return aset;
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ParseSql --
+ *
+ *	Parse :name bind variables from SQL text, skipping quoted
+ *	strings and identifiers, -- and C-style comments and :: type
+ *	casts.  If a bind set is
+ *	given, each variable is replaced by its quoted value, otherwise
+ *	by a ? marker with the name appended to namesPtr as part of a
+ *	null separated list.
+ *
+ * Results:
+ *	Number of bind variables found or -1 if a variable is missing
+ *	from the bind set.
+ *
+ * Side effects:
+ *	The resulting SQL is appended to sqlPtr.  An exception is set
+ *	for a missing variable.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ParseSql(Ns_DbHandle *handle, char *sql, Ns_Set *bind, Ns_DString *sqlPtr,
+	 Ns_DString *namesPtr)
+{
+    Ns_DString name;
+    char *p, *start, *value, quote;
+    int   i, n;
+
+    n = 0;
+    quote = '\0';
+    p = sql;
+    while (*p != '\0') {
+
+	/*
+	 * NB: A quote of '-' is a -- comment to end of line and '*'
+	 * a C-style comment.
+	 */
+
+	if (quote == '-') {
+	    if (*p == '\n') {
+		quote = '\0';
+	    }
+	} else if (quote == '*') {
+	    if (*p == '*' && p[1] == '/') {
+		Ns_DStringNAppend(sqlPtr, p++, 1);
+		quote = '\0';
+	    }
+	} else if (quote != '\0') {
+	    if (*p == quote) {
+		quote = '\0';
+	    }
+	} else if (*p == '\'' || *p == '"') {
+	    quote = *p;
+	} else if (*p == '-' && p[1] == '-') {
+	    quote = '-';
+	} else if (*p == '/' && p[1] == '*') {
+	    Ns_DStringNAppend(sqlPtr, p++, 1);
+	    quote = '*';
+	} else if (*p == ':' && p[1] == ':') {
+	    Ns_DStringNAppend(sqlPtr, p++, 1);
+	} else if (*p == ':' && (isalnum(UCHAR(p[1])) || p[1] == '_')) {
+	    start = ++p;
+	    while (isalnum(UCHAR(*p)) || *p == '_') {
+		++p;
+	    }
+	    ++n;
+	    if (bind == NULL) {
+		Ns_DStringNAppend(namesPtr, start, p - start);
+		Ns_DStringNAppend(namesPtr, "", 1);
+		Ns_DStringNAppend(sqlPtr, "?", 1);
+		continue;
+	    }
+	    Ns_DStringInit(&name);
+	    Ns_DStringNAppend(&name, start, p - start);
+	    i = Ns_SetFind(bind, name.string);
+	    if (i < 0) {
+		Ns_DbSetException(handle, "NSDB", "missing bind variable");
+		Ns_DStringVarAppend(&handle->dsExceptionMsg, ": ", name.string,
+				    NULL);
+	    }
+	    Ns_DStringFree(&name);
+	    if (i < 0) {
+		return -1;
+	    }
+	    value = Ns_SetValue(bind, i);
+	    if (value == NULL) {
+		Ns_DStringAppend(sqlPtr, "NULL");
+	    } else {
+		Ns_DStringNAppend(sqlPtr, "'", 1);
+		Ns_DbQuoteValue(sqlPtr, value);
+		Ns_DStringNAppend(sqlPtr, "'", 1);
+	    }
+	    continue;
+	}
+	Ns_DStringNAppend(sqlPtr, p, 1);
+	++p;
+    }
+    return n;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BindSql --
+ *
+ *	Substitute quoted values from the bind set for the :name bind
+ *	variables in the SQL text, for drivers without prepared
+ *	statement support.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR if a variable is missing from the set.
+ *
+ * Side effects:
+ *	The resulting SQL is appended to the given dstring.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+BindSql(Ns_DbHandle *handle, char *sql, Ns_Set *bind, Ns_DString *dsPtr)
+{
+    if (bind == NULL) {
+	Ns_DStringAppend(dsPtr, sql);
+    } else if (ParseSql(handle, sql, bind, dsPtr, NULL) < 0) {
+	return NS_ERROR;
+    }
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ExecStmt --
+ *
+ *	Execute SQL with bind variables using a cached prepared
+ *	statement, preparing the statement on a cache miss.
+ *
+ * Results:
+ *	NS_DML, NS_ROWS, or NS_ERROR.
+ *
+ * Side effects:
+ *	The least recently used statement may be freed when the cache
+ *	is full.  A statement which fails to execute is evicted in case
+ *	it is no longer valid, e.g., after a schema change.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ExecStmt(Ns_DbHandle *handle, DbStmtCache *cachePtr, char *sql,
+	 Ns_Set *bind)
+{
+    DbDriver       *driverPtr = NsDbGetDriver(handle);
+    DbStmt         *stmtPtr;
+    Tcl_HashEntry  *hPtr;
+    Ns_DString      parsed, names;
+    char           *name, **values, *staticValues[16];
+    int             i, n, new, status;
+
+    hPtr = Tcl_CreateHashEntry(&cachePtr->stmts, sql, &new);
+    if (!new) {
+	stmtPtr = Tcl_GetHashValue(hPtr);
+
+	/*
+	 * Move the statement to the front of the LRU list.
+	 */
+
+	if (stmtPtr->prevPtr != NULL) {
+	    stmtPtr->prevPtr->nextPtr = stmtPtr->nextPtr;
+	    if (stmtPtr->nextPtr != NULL) {
+		stmtPtr->nextPtr->prevPtr = stmtPtr->prevPtr;
+	    } else {
+		cachePtr->lastPtr = stmtPtr->prevPtr;
+	    }
+	    stmtPtr->prevPtr = NULL;
+	    stmtPtr->nextPtr = cachePtr->firstPtr;
+	    cachePtr->firstPtr->prevPtr = stmtPtr;
+	    cachePtr->firstPtr = stmtPtr;
+	}
+    } else {
+	Ns_DStringInit(&parsed);
+	Ns_DStringInit(&names);
+	n = ParseSql(handle, sql, NULL, &parsed, &names);
+	Ns_DStringNAppend(&names, "", 1);
+	stmtPtr = ns_malloc(sizeof(DbStmt));
+	stmtPtr->nparams = n;
+	stmtPtr->names = ns_malloc((size_t) names.length);
+	memcpy(stmtPtr->names, names.string, (size_t) names.length);
+	stmtPtr->stmt = (*driverPtr->prepareProc)(handle, parsed.string, n);
+	Ns_DStringFree(&parsed);
+	Ns_DStringFree(&names);
+	if (stmtPtr->stmt == NULL) {
+	    Tcl_DeleteHashEntry(hPtr);
+	    NsDbLogSql(handle, sql);
+	    ns_free(stmtPtr->names);
+	    ns_free(stmtPtr);
+	    return NS_ERROR;
+	}
+	stmtPtr->hPtr = hPtr;
+	Tcl_SetHashValue(hPtr, stmtPtr);
+	stmtPtr->prevPtr = NULL;
+	stmtPtr->nextPtr = cachePtr->firstPtr;
+	if (cachePtr->firstPtr != NULL) {
+	    cachePtr->firstPtr->prevPtr = stmtPtr;
+	} else {
+	    cachePtr->lastPtr = stmtPtr;
+	}
+	cachePtr->firstPtr = stmtPtr;
+	if (cachePtr->stmts.numEntries > cachePtr->maxstmts) {
+	    FreeStmt(handle, cachePtr, cachePtr->lastPtr);
+	}
+    }
+
+    /*
+     * Gather the values in parameter order and execute.
+     */
+
+    if (stmtPtr->nparams > 16) {
+	values = ns_malloc(sizeof(char *) * stmtPtr->nparams);
+    } else {
+	values = staticValues;
+    }
+    status = NS_OK;
+    name = stmtPtr->names;
+    for (i = 0; i < stmtPtr->nparams; ++i) {
+	n = Ns_SetFind(bind, name);
+	if (n < 0) {
+	    Ns_DbSetException(handle, "NSDB", "missing bind variable");
+	    Ns_DStringVarAppend(&handle->dsExceptionMsg, ": ", name, NULL);
+	    status = NS_ERROR;
+	    break;
+	}
+	values[i] = Ns_SetValue(bind, n);
+	name += strlen(name) + 1;
+    }
+    if (status == NS_OK) {
+	status = (*driverPtr->execstmtProc)(handle, stmtPtr->stmt,
+					    stmtPtr->nparams, values);
+	NsDbLogSql(handle, sql);
+	if (status == NS_ERROR) {
+	    FreeStmt(handle, cachePtr, stmtPtr);
+	}
+    }
+    if (values != staticValues) {
+	ns_free(values);
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeStmt --
+ *
+ *	Remove a statement from the cache and free it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Driver free proc, if any, is called for the statement.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeStmt(Ns_DbHandle *handle, DbStmtCache *cachePtr, DbStmt *stmtPtr)
+{
+    DbDriver *driverPtr = NsDbGetDriver(handle);
+
+    if (stmtPtr->prevPtr != NULL) {
+	stmtPtr->prevPtr->nextPtr = stmtPtr->nextPtr;
+    } else {
+	cachePtr->firstPtr = stmtPtr->nextPtr;
+    }
+    if (stmtPtr->nextPtr != NULL) {
+	stmtPtr->nextPtr->prevPtr = stmtPtr->prevPtr;
+    } else {
+	cachePtr->lastPtr = stmtPtr->prevPtr;
+    }
+    Tcl_DeleteHashEntry(stmtPtr->hPtr);
+    if (driverPtr != NULL && driverPtr->freestmtProc != NULL) {
+	(*driverPtr->freestmtProc)(handle, stmtPtr->stmt);
+    }
+    ns_free(stmtPtr->names);
+    ns_free(stmtPtr);
+}
@@ -39,6 +39,35 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsd
 
 #include "db.h"
 
+/*
+ * The following defines the number of buckets in the pool checkout
+ * wait time histogram.  Bucket i counts waits of less than 10^i
+ * milliseconds with the final bucket collecting everything longer.
+ */
+
+#define NWAITBUCKETS 6
+
+/*
+ * The following structure maintains pool usage statistics.  All
+ * counters are protected by the pool lock.
+ */
+
+typedef struct PoolStats {
+    unsigned long   gets;
+    unsigned long   fastgets;
+    unsigned long   affinity;
+    unsigned long   waits;
+    unsigned long   timeouts;
+    unsigned long   hist[NWAITBUCKETS];
+    Ns_Time         waittime;
+    unsigned long   connects;
+    unsigned long   connfails;
+    Ns_Time         conntime;
+    Ns_Time         connmax;
+    unsigned long   checks;
+    unsigned long   checkfails;
+} PoolStats;
+
 /*
  * The following structure defines a database pool.
  */
@@ -55,6 +84,7 @@ typedef struct Pool {
     Ns_Mutex	    lock;
     Ns_Cond	    waitCond;
     Ns_Cond	    getCond;
+    Ns_Cond	    maintCond;
     char	   *driver;
     struct DbDriver  *driverPtr;
     int		    waiting;
@@ -66,6 +96,18 @@ typedef struct Pool {
     time_t          maxidle;
     time_t          maxopen;
     int             stale_on_close;
+    int             affinity;
+    int             navail;
+    int             minhandles;
+    char           *checksql;
+    int             checkinterval;
+    int             retrywait;
+    int             maxretrywait;
+    int             maxstmts;
+    int             wakeup;
+    int             shutdown;
+    Ns_Thread       maintThread;
+    PoolStats       stats;
 }               Pool;
 
 /*
@@ -90,13 +132,27 @@ typedef struct Handle {
     int             fetchingRows;
     /* Members above must match Ns_DbHandle */
     struct Handle  *nextPtr;
+    struct Handle  *prevPtr;
     struct Pool	   *poolPtr;
     time_t          otime;
     time_t          atime;
     int             stale;
     int             stale_on_close;
+    int             avail;
+    DbStmtCache     stmtCache;
 }               Handle;
 
+/*
+ * The following structure maintains per-thread state for a pool:
+ * the count of handles currently owned and the last handle returned
+ * which is preferred on the next checkout when affinity is enabled.
+ */
+
+typedef struct ThreadPool {
+    int             nowned;
+    Handle         *affinityPtr;
+} ThreadPool;
+
 /*
  * The following structure maintains per-server data.
  */
@@ -112,13 +168,19 @@ typedef struct ServData {
 
 static Pool    *GetPool(char *pool);
 static void     ReturnHandle(Handle * handle);
+static void     UnlinkHandle(Handle * handle);
 static int      IsStale(Handle *, time_t now);
 static int	Connect(Handle *);
 static Pool    *CreatePool(char *pool, char *path, char *driver);
-static int	IncrCount(Pool *poolPtr, int incr);
+static ThreadPool *GetThreadPool(Pool *poolPtr);
 static ServData *GetServer(char *server);
 static Ns_TlsCleanup FreeTable;
 static Ns_Callback CheckPool;
+static void	ValidatePool(Pool *poolPtr, time_t now);
+static int	PreConnect(Pool *poolPtr);
+static void	WakeupPool(Pool *poolPtr);
+static Ns_ThreadProc MaintainThread;
+static Ns_Callback StopPool;
 static Ns_ArgProc CheckArgProc;
 
 /*
@@ -264,6 +326,7 @@ Ns_DbPoolPutHandle(Ns_DbHandle *handle)
 {
     Handle	*handlePtr;
     Pool	*poolPtr;
+    ThreadPool	*tpPtr;
     time_t	 now;
 
     handlePtr = (Handle *) handle;
@@ -290,12 +353,17 @@ Ns_DbPoolPutHandle(Ns_DbHandle *handle)
     } else {
         handlePtr->atime = now;
     }
-    IncrCount(poolPtr, -1);
+    tpPtr = GetThreadPool(poolPtr);
+    --tpPtr->nowned;
+    tpPtr->affinityPtr = handlePtr;
     Ns_MutexLock(&poolPtr->lock);
     ReturnHandle(handlePtr);
     if (poolPtr->waiting) {
 	Ns_CondSignal(&poolPtr->getCond);
     }
+    if (!handlePtr->connected) {
+	WakeupPool(poolPtr);
+    }
     Ns_MutexUnlock(&poolPtr->lock);
 }
 
@@ -403,8 +471,10 @@ Ns_DbPoolTimedGetMultipleHandles(Ns_DbHandle **handles, char *pool,
     Handle    *handlePtr;
     Handle   **handlesPtrPtr = (Handle **) handles;
     Pool      *poolPtr;
-    Ns_Time    timeout, *timePtr;
+    ThreadPool *tpPtr;
+    Ns_Time    timeout, *timePtr, start, now, diff;
     int        i, ngot, status;
+    long       ms;
 
     /*
      * Verify the pool, the number of available handles in the pool,
@@ -423,63 +493,99 @@ Ns_DbPoolTimedGetMultipleHandles(Ns_DbHandle **handles, char *pool,
 	       nwant, poolPtr->nhandles, pool);
 	return NS_ERROR;
     }
-    ngot = IncrCount(poolPtr, nwant);
-    if (ngot > 0) {
+    tpPtr = GetThreadPool(poolPtr);
+    if (tpPtr->nowned > 0) {
 	Ns_Log(Error, "dbinit: db handle limit exceeded: "
 	       "thread already owns %d handle%s from pool '%s'",
-	       ngot, ngot == 1 ? "" : "s", pool);
-	IncrCount(poolPtr, -nwant);
+	       tpPtr->nowned, tpPtr->nowned == 1 ? "" : "s", pool);
 	return NS_ERROR;
     }
-    
-    /*
-     * Wait until this thread can be the exclusive thread aquireing
-     * handles and then wait until all requested handles are available,
-     * watching for timeout in either of these waits.
-     */
-     
-    if (wait < 0) {
-	timePtr = NULL;
-    } else {
-    	Ns_GetTime(&timeout);
-    	Ns_IncrTime(&timeout, wait, 0);
-	timePtr = &timeout;
-    }
+    tpPtr->nowned = nwant;
+    ngot = 0;
     status = NS_OK;
     Ns_MutexLock(&poolPtr->lock);
-    while (status == NS_OK && poolPtr->waiting) {
-	status = Ns_CondTimedWait(&poolPtr->waitCond, &poolPtr->lock, timePtr);
-    }
-    if (status == NS_OK) {
-    	poolPtr->waiting = 1;
-    	while (status == NS_OK && ngot < nwant) {
-	    while (status == NS_OK && poolPtr->firstPtr == NULL) {
-	    	status = Ns_CondTimedWait(&poolPtr->getCond, &poolPtr->lock,
-					  timePtr);
-	    }
-	    if (poolPtr->firstPtr != NULL) {
-		handlePtr = poolPtr->firstPtr;
-		poolPtr->firstPtr = handlePtr->nextPtr;
-		handlePtr->nextPtr = NULL;
-		if (poolPtr->lastPtr == handlePtr) {
-		    poolPtr->lastPtr = NULL;
-		}
-		handlesPtrPtr[ngot++] = handlePtr;
-	    }
+    ++poolPtr->stats.gets;
+
+    /*
+     * Fast path:  A single handle is available and no other thread is
+     * waiting.  Prefer the handle last used by this thread when
+     * affinity is enabled and the handle is still in the pool.
+     */
+
+    if (nwant == 1 && !poolPtr->waiting) {
+	handlePtr = tpPtr->affinityPtr;
+	if (poolPtr->affinity && handlePtr != NULL && handlePtr->avail) {
+	    ++poolPtr->stats.affinity;
+	} else {
+	    handlePtr = poolPtr->firstPtr;
+	}
+	if (handlePtr != NULL) {
+	    UnlinkHandle(handlePtr);
+	    handlesPtrPtr[ngot++] = handlePtr;
+	    ++poolPtr->stats.fastgets;
+	    ++poolPtr->stats.hist[0];
 	}
-	poolPtr->waiting = 0;
-    	Ns_CondSignal(&poolPtr->waitCond);
     }
-    Ns_MutexUnlock(&poolPtr->lock);
 
     /*
-     * Handle special race condition where the final requested handle
-     * arrived just as the condition wait was timing out.
+     * Otherwise, wait until this thread can be the exclusive thread
+     * aquireing handles and then wait until all requested handles are
+     * available, watching for timeout in either of these waits.
      */
 
-    if (status == NS_TIMEOUT && ngot == nwant) {
-	status = NS_OK;
+    if (ngot == 0) {
+	++poolPtr->stats.waits;
+	Ns_GetTime(&start);
+	if (wait < 0) {
+	    timePtr = NULL;
+	} else {
+	    timeout = start;
+	    Ns_IncrTime(&timeout, wait, 0);
+	    timePtr = &timeout;
+	}
+	while (status == NS_OK && poolPtr->waiting) {
+	    status = Ns_CondTimedWait(&poolPtr->waitCond, &poolPtr->lock,
+				      timePtr);
+	}
+	if (status == NS_OK) {
+	    poolPtr->waiting = 1;
+	    while (status == NS_OK && ngot < nwant) {
+		while (status == NS_OK && poolPtr->firstPtr == NULL) {
+		    status = Ns_CondTimedWait(&poolPtr->getCond,
+					      &poolPtr->lock, timePtr);
+		}
+		if (poolPtr->firstPtr != NULL) {
+		    handlePtr = poolPtr->firstPtr;
+		    UnlinkHandle(handlePtr);
+		    handlesPtrPtr[ngot++] = handlePtr;
+		}
+	    }
+	    poolPtr->waiting = 0;
+	    Ns_CondSignal(&poolPtr->waitCond);
+	}
+
+	/*
+	 * Handle special race condition where the final requested handle
+	 * arrived just as the condition wait was timing out.
+	 */
+
+	if (status == NS_TIMEOUT && ngot == nwant) {
+	    status = NS_OK;
+	}
+	if (status == NS_TIMEOUT) {
+	    ++poolPtr->stats.timeouts;
+	} else {
+	    Ns_GetTime(&now);
+	    Ns_DiffTime(&now, &start, &diff);
+	    Ns_IncrTime(&poolPtr->stats.waittime, diff.sec, diff.usec);
+	    ms = diff.sec * 1000 + diff.usec / 1000;
+	    for (i = 0; i < NWAITBUCKETS - 1 && ms > 0; ++i) {
+		ms /= 10;
+	    }
+	    ++poolPtr->stats.hist[i];
+	}
     }
+    Ns_MutexUnlock(&poolPtr->lock);
 
     /*
      * If status is still ok, connect any handles not already connected,
@@ -501,13 +607,14 @@ Ns_DbPoolTimedGetMultipleHandles(Ns_DbHandle **handles, char *pool,
 	if (poolPtr->waiting) {
 	    Ns_CondSignal(&poolPtr->getCond);
 	}
+	WakeupPool(poolPtr);
 	Ns_MutexUnlock(&poolPtr->lock);
-	IncrCount(poolPtr, -nwant);
+	tpPtr->nowned = 0;
     }
     return status;
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -520,6 +627,7 @@ Ns_DbPoolTimedGetMultipleHandles(Ns_DbHandle **handles, char *pool,
  *
  * Side effects:
  *	Handles are all marked stale and then closed by CheckPool.
+ *	The maintenance thread then re-opens any warm handles.
  *
  *----------------------------------------------------------------------
  */
@@ -546,11 +654,82 @@ Ns_DbBouncePool(char *pool)
     }
     Ns_MutexUnlock(&poolPtr->lock);
     CheckPool(poolPtr);
+    Ns_MutexLock(&poolPtr->lock);
+    WakeupPool(poolPtr);
+    Ns_MutexUnlock(&poolPtr->lock);
 
     return NS_OK;
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbPoolStats --
+ *
+ *	Append pool usage statistics to the given dstring as a list
+ *	of name/value pairs.
+ *
+ * Results:
+ *	NS_OK if pool exists, NS_ERROR otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ns_DbPoolStats(char *pool, Ns_DString *dsPtr)
+{
+    Pool	*poolPtr;
+    Handle	*handlePtr;
+    PoolStats	 stats;
+    int		 i, navail, nconnected;
+    static char *buckets[] = {
+	"1ms", "10ms", "100ms", "1s", "10s", "max"
+    };
+
+    poolPtr = GetPool(pool);
+    if (poolPtr == NULL) {
+	return NS_ERROR;
+    }
+    Ns_MutexLock(&poolPtr->lock);
+    stats = poolPtr->stats;
+    navail = poolPtr->navail;
+    nconnected = poolPtr->nhandles - navail;
+    for (handlePtr = poolPtr->firstPtr; handlePtr != NULL;
+	    handlePtr = handlePtr->nextPtr) {
+	if (handlePtr->connected) {
+	    ++nconnected;
+	}
+    }
+    Ns_MutexUnlock(&poolPtr->lock);
+
+    Ns_DStringPrintf(dsPtr, "handles %d avail %d affinity %d",
+		     poolPtr->nhandles, navail, poolPtr->affinity);
+    Ns_DStringPrintf(dsPtr, " gets %lu fastgets %lu affinityhits %lu"
+		     " waits %lu timeouts %lu waittime %ld.%06ld",
+		     stats.gets, stats.fastgets, stats.affinity,
+		     stats.waits, stats.timeouts, (long) stats.waittime.sec,
+		     stats.waittime.usec);
+    Ns_DStringPrintf(dsPtr, " minconnections %d connected %d"
+		     " connects %lu connfails %lu conntime %ld.%06ld"
+		     " connmax %ld.%06ld checks %lu checkfails %lu",
+		     poolPtr->minhandles, nconnected, stats.connects,
+		     stats.connfails, (long) stats.conntime.sec,
+		     stats.conntime.usec, (long) stats.connmax.sec,
+		     stats.connmax.usec, stats.checks, stats.checkfails);
+    Ns_DStringAppend(dsPtr, " waithist {");
+    for (i = 0; i < NWAITBUCKETS; ++i) {
+	Ns_DStringPrintf(dsPtr, "%s%s %lu", i ? " " : "", buckets[i],
+			 stats.hist[i]);
+    }
+    Ns_DStringAppend(dsPtr, "}");
+    return NS_OK;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -562,7 +741,8 @@ Ns_DbBouncePool(char *pool)
  *	None.
  *
  * Side effects:
- *	Pools may be created as configured.
+ *	Pools may be created as configured and the result cache
+ *	initialized.
  *
  *----------------------------------------------------------------------
  */
@@ -602,6 +782,8 @@ NsDbInitPools(void)
 	}
     }
     Ns_RegisterProcInfo(CheckPool, "nsdb:check", CheckArgProc);
+    Ns_RegisterProcInfo(MaintainThread, "nsdb:maintain", CheckArgProc);
+    NsDbInitCache();
 }
 
 
@@ -781,6 +963,35 @@ NsDbGetDriver(Ns_DbHandle *handle)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbGetStmtCache --
+ *
+ *	Return a pointer to the prepared statement cache for a handle.
+ *
+ * Results:
+ *	Pointer to cache or NULL for a handle outside a pool.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+DbStmtCache *
+NsDbGetStmtCache(Ns_DbHandle *handle)
+{
+    Handle *handlePtr = (Handle *) handle;
+
+    if (handlePtr != NULL && handlePtr->poolPtr != NULL) {
+	return &handlePtr->stmtCache;
+    }
+
+    return NULL;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -818,7 +1029,10 @@ GetPool(char *pool)
  *
  *	Return a handle to its pool.  Connected handles are pushed on
  *	the front of the list, disconnected handles are appened to
- *	the end.
+ *	the end.  With affinity enabled, connected handles are instead
+ *	inserted after the last connected handle so other threads take
+ *	the longest idle handle first, leaving recently used handles for
+ *	the threads which last owned them.
  *
  * Results:
  *	None.
@@ -835,21 +1049,75 @@ static void
 ReturnHandle(Handle *handlePtr)
 {
     Pool         *poolPtr;
+    Handle       *afterPtr;
 
     poolPtr = handlePtr->poolPtr;
-    if (poolPtr->firstPtr == NULL) {
-	poolPtr->firstPtr = poolPtr->lastPtr = handlePtr;
-    	handlePtr->nextPtr = NULL;
-    } else if (handlePtr->connected) {
+    handlePtr->avail = 1;
+    ++poolPtr->navail;
+    if (!handlePtr->connected) {
+	afterPtr = poolPtr->lastPtr;
+    } else if (!poolPtr->affinity) {
+	afterPtr = NULL;
+    } else {
+	afterPtr = poolPtr->lastPtr;
+	while (afterPtr != NULL && !afterPtr->connected) {
+	    afterPtr = afterPtr->prevPtr;
+	}
+    }
+    handlePtr->prevPtr = afterPtr;
+    if (afterPtr == NULL) {
 	handlePtr->nextPtr = poolPtr->firstPtr;
 	poolPtr->firstPtr = handlePtr;
     } else {
-	poolPtr->lastPtr->nextPtr = handlePtr;
+	handlePtr->nextPtr = afterPtr->nextPtr;
+	afterPtr->nextPtr = handlePtr;
+    }
+    if (handlePtr->nextPtr == NULL) {
 	poolPtr->lastPtr = handlePtr;
-    	handlePtr->nextPtr = NULL;
+    } else {
+	handlePtr->nextPtr->prevPtr = handlePtr;
     }
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UnlinkHandle --
+ *
+ *	Remove a handle from anywhere in the list of available handles.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Handle is no longer available.  Note:  The pool lock must be
+ *	held by the caller.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+UnlinkHandle(Handle *handlePtr)
+{
+    Pool         *poolPtr;
+
+    poolPtr = handlePtr->poolPtr;
+    if (handlePtr->prevPtr != NULL) {
+	handlePtr->prevPtr->nextPtr = handlePtr->nextPtr;
+    } else {
+	poolPtr->firstPtr = handlePtr->nextPtr;
+    }
+    if (handlePtr->nextPtr != NULL) {
+	handlePtr->nextPtr->prevPtr = handlePtr->prevPtr;
+    } else {
+	poolPtr->lastPtr = handlePtr->prevPtr;
+    }
+    handlePtr->nextPtr = handlePtr->prevPtr = NULL;
+    handlePtr->avail = 0;
+    --poolPtr->navail;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -952,6 +1220,10 @@ CheckPool(void *arg)
     Ns_MutexLock(&poolPtr->lock);
     handlePtr = poolPtr->firstPtr;
     poolPtr->firstPtr = poolPtr->lastPtr = NULL;
+    poolPtr->navail = 0;
+    for (nextPtr = handlePtr; nextPtr != NULL; nextPtr = nextPtr->nextPtr) {
+	nextPtr->avail = 0;
+    }
     Ns_MutexUnlock(&poolPtr->lock);
 
     /*
@@ -986,6 +1258,286 @@ CheckPool(void *arg)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ValidatePool --
+ *
+ *	Run the pool's check SQL on each connected handle which has
+ *	been idle since the given time, one handle at a time so the
+ *	rest of the pool remains available.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Handles which fail the check are closed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ValidatePool(Pool *poolPtr, time_t since)
+{
+    Handle	 *handlePtr;
+    int		  status;
+
+    if (poolPtr->checksql == NULL) {
+	return;
+    }
+    while (1) {
+	Ns_MutexLock(&poolPtr->lock);
+	handlePtr = poolPtr->firstPtr;
+	while (handlePtr != NULL
+	       && (!handlePtr->connected || handlePtr->atime > since)) {
+	    handlePtr = handlePtr->nextPtr;
+	}
+	if (handlePtr != NULL) {
+	    UnlinkHandle(handlePtr);
+	}
+	Ns_MutexUnlock(&poolPtr->lock);
+	if (handlePtr == NULL) {
+	    break;
+	}
+	status = Ns_DbExec((Ns_DbHandle *) handlePtr, poolPtr->checksql);
+	if (status == NS_ERROR) {
+	    Ns_Log(Warning, "dbinit: check failed for handle in pool '%s'",
+		   poolPtr->name);
+	    NsDbDisconnect((Ns_DbHandle *) handlePtr);
+	} else {
+	    Ns_DbFlush((Ns_DbHandle *) handlePtr);
+	    handlePtr->atime = time(NULL);
+	}
+	Ns_DStringFree(&handlePtr->dsExceptionMsg);
+	handlePtr->cExceptionCode[0] = '\0';
+	Ns_MutexLock(&poolPtr->lock);
+	++poolPtr->stats.checks;
+	if (status == NS_ERROR) {
+	    ++poolPtr->stats.checkfails;
+	}
+	ReturnHandle(handlePtr);
+	if (poolPtr->waiting) {
+	    Ns_CondSignal(&poolPtr->getCond);
+	}
+	Ns_MutexUnlock(&poolPtr->lock);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PreConnect --
+ *
+ *	Open idle handles until at least minconnections handles of the
+ *	pool are connected.  Handles currently in use are assumed to be
+ *	connected.
+ *
+ * Results:
+ *	NS_OK if the warm minimum is satisfied, NS_ERROR if a connect
+ *	failed.
+ *
+ * Side effects:
+ *	Database connections may be opened.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+PreConnect(Pool *poolPtr)
+{
+    Handle	 *handlePtr, *nextPtr, *connectPtr;
+    int		  nconnected, status;
+
+    connectPtr = NULL;
+    Ns_MutexLock(&poolPtr->lock);
+    nconnected = poolPtr->nhandles - poolPtr->navail;
+    for (handlePtr = poolPtr->firstPtr; handlePtr != NULL;
+	    handlePtr = handlePtr->nextPtr) {
+	if (handlePtr->connected) {
+	    ++nconnected;
+	}
+    }
+    handlePtr = poolPtr->firstPtr;
+    while (handlePtr != NULL && nconnected < poolPtr->minhandles) {
+	nextPtr = handlePtr->nextPtr;
+	if (!handlePtr->connected) {
+	    UnlinkHandle(handlePtr);
+	    handlePtr->nextPtr = connectPtr;
+	    connectPtr = handlePtr;
+	    ++nconnected;
+	}
+	handlePtr = nextPtr;
+    }
+    Ns_MutexUnlock(&poolPtr->lock);
+
+    /*
+     * Connect the handles outside the lock, stopping at the first
+     * failure, and then return them all to the pool.
+     */
+
+    status = NS_OK;
+    for (handlePtr = connectPtr; handlePtr != NULL;
+	    handlePtr = handlePtr->nextPtr) {
+	if (status == NS_OK) {
+	    status = Connect(handlePtr);
+	}
+    }
+    if (connectPtr != NULL) {
+	Ns_MutexLock(&poolPtr->lock);
+	while (connectPtr != NULL) {
+	    nextPtr = connectPtr->nextPtr;
+	    ReturnHandle(connectPtr);
+	    connectPtr = nextPtr;
+	}
+	if (poolPtr->waiting) {
+	    Ns_CondSignal(&poolPtr->getCond);
+	}
+	Ns_MutexUnlock(&poolPtr->lock);
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WakeupPool --
+ *
+ *	Wakeup the pool maintenance thread, e.g., after a handle has
+ *	been closed.  Note:  The pool lock must be held by the caller.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WakeupPool(Pool *poolPtr)
+{
+    if (poolPtr->minhandles > 0 && !poolPtr->wakeup) {
+	poolPtr->wakeup = 1;
+	Ns_CondSignal(&poolPtr->maintCond);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MaintainThread --
+ *
+ *	Background thread which closes stale handles and validates idle
+ *	handles every checkinterval seconds and keeps minconnections
+ *	handles open, retrying failed connects with exponential backoff.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Database connections are opened and closed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+MaintainThread(void *arg)
+{
+    Pool	 *poolPtr = arg;
+    Ns_DString	  ds;
+    Ns_Time	  timeout;
+    time_t	  now, lastcheck, nextcheck, retryat;
+    int		  backoff;
+
+    Ns_DStringInit(&ds);
+    Ns_DStringVarAppend(&ds, "-nsdb:", poolPtr->name, "-", NULL);
+    Ns_ThreadSetName(ds.string);
+    Ns_DStringFree(&ds);
+
+    lastcheck = time(NULL);
+    nextcheck = lastcheck + poolPtr->checkinterval;
+    retryat = 0;
+    backoff = 0;
+    Ns_MutexLock(&poolPtr->lock);
+    while (!poolPtr->shutdown) {
+	if (!poolPtr->wakeup) {
+	    timeout.usec = 0;
+	    if (poolPtr->checkinterval > 0) {
+		timeout.sec = nextcheck;
+	    } else {
+		timeout.sec = lastcheck + 3600;
+	    }
+	    if (backoff > 0 && retryat < timeout.sec) {
+		timeout.sec = retryat;
+	    }
+	    Ns_CondTimedWait(&poolPtr->maintCond, &poolPtr->lock, &timeout);
+	}
+	poolPtr->wakeup = 0;
+	if (poolPtr->shutdown) {
+	    break;
+	}
+	Ns_MutexUnlock(&poolPtr->lock);
+
+	now = time(NULL);
+	if (poolPtr->checkinterval > 0 && now >= nextcheck) {
+	    CheckPool(poolPtr);
+	    ValidatePool(poolPtr, lastcheck);
+	    lastcheck = now;
+	    nextcheck = now + poolPtr->checkinterval;
+	}
+	if (poolPtr->minhandles > 0 && (backoff == 0 || now >= retryat)) {
+	    if (PreConnect(poolPtr) == NS_OK) {
+		backoff = 0;
+	    } else {
+		if (backoff == 0) {
+		    backoff = poolPtr->retrywait;
+		} else if ((backoff *= 2) > poolPtr->maxretrywait) {
+		    backoff = poolPtr->maxretrywait;
+		}
+		retryat = time(NULL) + backoff;
+		Ns_Log(Warning, "dbinit: pool '%s' connect failed, "
+		       "retrying in %d seconds", poolPtr->name, backoff);
+	    }
+	}
+	Ns_MutexLock(&poolPtr->lock);
+    }
+    Ns_MutexUnlock(&poolPtr->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StopPool --
+ *
+ *	Shutdown callback to stop the pool maintenance thread.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Waits for the thread to finish any check or connect underway.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StopPool(void *arg)
+{
+    Pool *poolPtr = arg;
+
+    Ns_MutexLock(&poolPtr->lock);
+    poolPtr->shutdown = 1;
+    Ns_CondSignal(&poolPtr->maintCond);
+    Ns_MutexUnlock(&poolPtr->lock);
+    Ns_ThreadJoin(&poolPtr->maintThread, NULL);
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1031,6 +1583,7 @@ CreatePool(char *pool, char *path, char *driver)
     Ns_MutexSetName2(&poolPtr->lock, "nsdb", pool);
     Ns_CondInit(&poolPtr->waitCond);
     Ns_CondInit(&poolPtr->getCond);
+    Ns_CondInit(&poolPtr->maintCond);
     poolPtr->source = source;
     poolPtr->name = pool;
     poolPtr->waiting = 0;
@@ -1038,12 +1591,17 @@ CreatePool(char *pool, char *path, char *driver)
     poolPtr->pass = Ns_ConfigGetValue(path, "password");
     poolPtr->desc = Ns_ConfigGetValue("ns/db/pools", pool);
     poolPtr->stale_on_close = 0;
+    poolPtr->navail = 0;
+    memset(&poolPtr->stats, 0, sizeof(poolPtr->stats));
     if (!Ns_ConfigGetBool(path, "verbose", &poolPtr->fVerbose)) {
         poolPtr->fVerbose = 0;
     } 
     if (!Ns_ConfigGetBool(path, "logsqlerrors", &poolPtr->fVerboseError)) {
 	poolPtr->fVerboseError = 0;
     }
+    if (!Ns_ConfigGetBool(path, "affinity", &poolPtr->affinity)) {
+	poolPtr->affinity = 0;
+    }
     if (!Ns_ConfigGetInt(path, "connections", &poolPtr->nhandles)
 	|| poolPtr->nhandles <= 0) {
         poolPtr->nhandles = 2;
@@ -1056,6 +1614,30 @@ CreatePool(char *pool, char *path, char *driver)
         i = 3600;                   /* 1 hour */
     }
     poolPtr->maxopen = i;
+    if (!Ns_ConfigGetInt(path, "minconnections", &poolPtr->minhandles)
+	|| poolPtr->minhandles < 0) {
+	poolPtr->minhandles = 0;
+    } else if (poolPtr->minhandles > poolPtr->nhandles) {
+	poolPtr->minhandles = poolPtr->nhandles;
+    }
+    poolPtr->checksql = Ns_ConfigGetValue(path, "checksql");
+    if (!Ns_ConfigGetInt(path, "retrywait", &poolPtr->retrywait)
+	|| poolPtr->retrywait < 1) {
+	poolPtr->retrywait = 1;
+    }
+    if (!Ns_ConfigGetInt(path, "maxretrywait", &poolPtr->maxretrywait)
+	|| poolPtr->maxretrywait < poolPtr->retrywait) {
+	poolPtr->maxretrywait = 60;
+	if (poolPtr->maxretrywait < poolPtr->retrywait) {
+	    poolPtr->maxretrywait = poolPtr->retrywait;
+	}
+    }
+    if (!Ns_ConfigGetInt(path, "stmtcachesize", &poolPtr->maxstmts)
+	|| poolPtr->maxstmts < 0) {
+	poolPtr->maxstmts = 100;
+    }
+    poolPtr->wakeup = 1;
+    poolPtr->shutdown = 0;
     poolPtr->firstPtr = poolPtr->lastPtr = NULL;
     for (i = 0; i < poolPtr->nhandles; ++i) {
     	handlePtr = ns_malloc(sizeof(Handle));
@@ -1069,6 +1651,10 @@ CreatePool(char *pool, char *path, char *driver)
     	handlePtr->otime = handlePtr->atime = 0;
     	handlePtr->stale = NS_FALSE;
     	handlePtr->stale_on_close = 0;
+    	handlePtr->avail = 0;
+	handlePtr->stmtCache.maxstmts = poolPtr->maxstmts;
+	handlePtr->stmtCache.firstPtr = handlePtr->stmtCache.lastPtr = NULL;
+	Tcl_InitHashTable(&handlePtr->stmtCache.stmts, TCL_STRING_KEYS);
 
 	/*
 	 * The following elements of the Handle structure could
@@ -1089,7 +1675,9 @@ CreatePool(char *pool, char *path, char *driver)
     if (!Ns_ConfigGetInt(path, "checkinterval", &i) || i < 0) {
 	i = 600;	/* 10 minutes. */
     }
-    Ns_ScheduleProc(CheckPool, poolPtr, 0, i);
+    poolPtr->checkinterval = i;
+    Ns_ThreadCreate(MaintainThread, poolPtr, 0, &poolPtr->maintThread);
+    Ns_RegisterAtShutdown(StopPool, poolPtr);
     return poolPtr;
 }
 
@@ -1113,17 +1701,33 @@ CreatePool(char *pool, char *path, char *driver)
 static int
 Connect(Handle *handlePtr)
 {
-    int status;
+    Pool    *poolPtr = handlePtr->poolPtr;
+    Ns_Time  start, end, diff;
+    int      status;
 
+    Ns_GetTime(&start);
     status = NsDbOpen((Ns_DbHandle *) handlePtr);
+    Ns_GetTime(&end);
+    Ns_DiffTime(&end, &start, &diff);
     if (status != NS_OK) {
     	handlePtr->connected = NS_FALSE;
     	handlePtr->atime = handlePtr->otime = 0;
 	handlePtr->stale = NS_FALSE;
     } else {
     	handlePtr->connected = NS_TRUE;
-    	handlePtr->atime = handlePtr->otime = time(NULL);
+    	handlePtr->atime = handlePtr->otime = end.sec;
+    }
+    Ns_MutexLock(&poolPtr->lock);
+    if (status != NS_OK) {
+	++poolPtr->stats.connfails;
+    } else {
+	++poolPtr->stats.connects;
+	Ns_IncrTime(&poolPtr->stats.conntime, diff.sec, diff.usec);
+	if (Ns_DiffTime(&diff, &poolPtr->stats.connmax, NULL) > 0) {
+	    poolPtr->stats.connmax = diff;
+	}
     }
+    Ns_MutexUnlock(&poolPtr->lock);
 
     return status;
 }
@@ -1132,25 +1736,27 @@ Connect(Handle *handlePtr)
 /*
  *----------------------------------------------------------------------
  *
- * IncrCount --
+ * GetThreadPool --
  *
- *	Update per-thread count of allocated handles.
+ *	Get the per-thread state for a pool, tracking the count of
+ *	handles owned and the handle last returned by this thread.
  *
  * Results:
- *	Previous count of allocated handles.
+ *	Pointer to ThreadPool structure.
  *
  * Side effects:
- *	None.
+ *	Structure is allocated on first use and freed at thread exit.
  *
  *----------------------------------------------------------------------
  */
 
-static int
-IncrCount(Pool *poolPtr, int incr)
+static ThreadPool *
+GetThreadPool(Pool *poolPtr)
 {
     Tcl_HashTable *tablePtr;
     Tcl_HashEntry *hPtr;
-    int prev, count, new;
+    ThreadPool    *tpPtr;
+    int new;
 
     tablePtr = Ns_TlsGet(&tls);
     if (tablePtr == NULL) {
@@ -1160,20 +1766,17 @@ IncrCount(Pool *poolPtr, int incr)
     }
     hPtr = Tcl_CreateHashEntry(tablePtr, (char *) poolPtr, &new);
     if (new) {
-	prev = 0;
+	tpPtr = ns_malloc(sizeof(ThreadPool));
+	tpPtr->nowned = 0;
+	tpPtr->affinityPtr = NULL;
+	Tcl_SetHashValue(hPtr, tpPtr);
     } else {
-	prev = (int) Tcl_GetHashValue(hPtr);
+	tpPtr = Tcl_GetHashValue(hPtr);
     }
-    count = prev + incr;
-    if (count == 0) {
-	Tcl_DeleteHashEntry(hPtr);
-    } else {
-	Tcl_SetHashValue(hPtr, (ClientData) count);
-    }
-    return prev;
+    return tpPtr;
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1208,7 +1811,7 @@ GetServer(char *server)
  *
  * FreeTable --
  *
- *	Free the per-thread count of allocated handles table.
+ *	Free the per-thread table of pool state.
  *
  * Results:
  *	None.
@@ -1223,7 +1826,14 @@ static void
 FreeTable(void *arg)
 {
     Tcl_HashTable  *tablePtr = arg;
+    Tcl_HashEntry  *hPtr;
+    Tcl_HashSearch  search;
 
+    hPtr = Tcl_FirstHashEntry(tablePtr, &search);
+    while (hPtr != NULL) {
+	ns_free(Tcl_GetHashValue(hPtr));
+	hPtr = Tcl_NextHashEntry(&search);
+    }
     Tcl_DeleteHashTable(tablePtr);
     ns_free(tablePtr);
 }
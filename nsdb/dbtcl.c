@@ -60,6 +60,17 @@ static int GetHandle(InterpData *idataPtr, char *id,
 		     Ns_DbHandle **handle, int clear, Tcl_HashEntry **hPtrPtr);
 static int GetHandleObj(InterpData *idataPtr, Tcl_Obj *obj,
 		     Ns_DbHandle **handle, int clear, Tcl_HashEntry **hPtrPtr);
+static int GetBindSet(Tcl_Interp *interp, Tcl_Obj *obj, Ns_Set **setPtr);
+static int StreamRows(Ns_Conn *conn, Ns_DbHandle *handle, int json,
+		      int header, int batch, int *nrowsPtr);
+static void AppendCsv(Ns_DString *dsPtr, char *value, int len);
+static void AppendJson(Ns_DString *dsPtr, char *value, int len);
+static int CacheSelect(InterpData *idataPtr, char *id, char *sql,
+		       Ns_Set *bind, int ttl, Tcl_Obj *tagsObj);
+static int FetchRows(Ns_DbHandle *handle, char *sql, Ns_Set *bind,
+		     Ns_DString *dsPtr);
+static void SetDbError(Tcl_Interp *interp, CONST char *op,
+		       Ns_DbHandle *handle);
 static Tcl_InterpDeleteProc FreeData;
 static Ns_TclDeferProc ReleaseDbs;
 static Tcl_ObjCmdProc DbObjCmd;
@@ -67,6 +78,13 @@ static Tcl_CmdProc QuoteListToListCmd, GetCsvCmd, DbErrorCodeCmd,
 	DbErrorMsgCmd, GetCsvCmd, DbConfigPathCmd, PoolDescriptionCmd;
 static char *datakey = "nsdb:data";
 
+/*
+ * The following defines the size of buffered output written to the
+ * connection by ns_db stream.
+ */
+
+#define STREAM_BUFSIZE 16384
+
 
 /*
  *----------------------------------------------------------------------
@@ -162,29 +180,33 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 #define MAXHANDLES 4
     InterpData	   *idataPtr = data;
     Ns_DbHandle    *handle, **handlesPtrPtr, *staticHandles[MAXHANDLES];
-    Ns_Set         *row;
+    Ns_Set         *row, *bind;
     Tcl_HashEntry  *hPtr;
-    Tcl_Obj	   *resultPtr;
-    char           *arg, *pool, buf[32];
-    int		    timeout, nhandles, n, status;
+    Tcl_Obj	   *resultPtr, *bindObj, *tagsObj;
+    Ns_DString	    ds;
+    char           *arg, *pool, *type, buf[32];
+    int		    timeout, nhandles, n, i, status, format, header, ttl;
+    Ns_Conn	   *conn;
     static CONST char *opts[] = {
 	"getrow", "gethandle", "releasehandle", "select", "dml",
 	"1row", "0or1row", "bindrow", "exec", "sp_exec", "sp_getparams",
 	"sp_returncode", "sp_setparam", "sp_start", "exception",
-	"flush", "bouncepool", "cancel", "connected", "datasource",
-	"dbtype", "disconnect", "driver", "interpretsqlfile",
+	"flush", "bouncepool", "cachedrows", "cancel", "connected", "datasource",
+	"dbtype", "disconnect", "driver", "interpretsqlfile", "invalidate",
 	"password", "poolname", "pools", "resethandle", "setexception",
-	"user", "verbose", NULL
+	"stats", "stream", "user", "verbose", NULL
     }; enum {
 	Db_getrowIdx, Db_gethandleIdx, Db_releasehandleIdx,
 	Db_selectIdx, Db_dmlIdx, Db_1rowIdx, Db_0or1rowIdx,
 	Db_bindrowIdx, Db_execIdx, Db_sp_execIdx, Db_sp_getparamsIdx,
 	Db_sp_returncodeIdx, Db_sp_setparamIdx, Db_sp_startIdx,
-	Db_exceptionIdx, Db_flushIdx, Db_bouncepoolIdx, Db_cancelIdx,
+	Db_exceptionIdx, Db_flushIdx, Db_bouncepoolIdx, Db_cachedrowsIdx,
+	Db_cancelIdx,
 	Db_connectedIdx, Db_datasourceIdx, Db_dbtypeIdx, Db_disconnectIdx,
-	Db_driverIdx, Db_interpretsqlfileIdx, Db_passwordIdx,
+	Db_driverIdx, Db_interpretsqlfileIdx, Db_invalidateIdx,
+	Db_passwordIdx,
 	Db_poolnameIdx, Db_poolsIdx, Db_resethandleIdx, Db_setexceptionIdx,
-	Db_userIdx, Db_verboseIdx
+	Db_statsIdx, Db_streamIdx, Db_userIdx, Db_verboseIdx
     } opt;
     static CONST char *spopts[] = {
 	"in", "out", NULL
@@ -192,6 +214,9 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     enum {
 	Sp_inIdx, Sp_outIdx
     } spopt;
+    static CONST char *fmts[] = {
+	"csv", "json", NULL
+    };
 
     if (objc < 2) {
         Tcl_WrongNumArgs(interp, 1, objv, "option ?args?");
@@ -347,18 +372,37 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     case Db_interpretsqlfileIdx:
     case Db_selectIdx:
     case Db_sp_startIdx:
+	bind = NULL;
+	bindObj = NULL;
+	while (objc > 4 && opt != Db_getrowIdx
+		&& opt != Db_interpretsqlfileIdx && opt != Db_sp_startIdx) {
+	    arg = Tcl_GetString(objv[2]);
+	    if (STREQ(arg, "-bind")) {
+		bindObj = objv[3];
+	    } else {
+		break;
+	    }
+	    objv += 2;
+	    objc -= 2;
+	}
     	if (objc != 4) {
-            Tcl_WrongNumArgs(interp, 2, objv, "dbId arg");
+            Tcl_WrongNumArgs(interp, 2, objv, "?-bind bindings? dbId arg");
 	    return 0;
     	}
+	if (bindObj != NULL && GetBindSet(interp, bindObj, &bind) != TCL_OK) {
+	    return TCL_ERROR;
+	}
     	if (GetHandleObj(idataPtr, objv[2], &handle, 1, &hPtr) != TCL_OK) {
+	    if (bind != NULL) {
+		Ns_SetFree(bind);
+	    }
 	    return TCL_ERROR;
 	}
 	arg = Tcl_GetString(objv[3]);
 
 	switch ((int) opt) {
     	case Db_0or1rowIdx:
-            row = Ns_Db0or1Row(handle, arg, &n);
+            row = Ns_Db0or1RowBind(handle, arg, bind, &n);
             if (row != NULL && n == 0) {
                 Ns_SetFree(row);
 	    } else {
@@ -367,16 +411,16 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    break;
 
     	case Db_1rowIdx:
-            row = Ns_Db1Row(handle, arg);
+            row = Ns_Db1RowBind(handle, arg, bind);
 	    EnterRow(interp, row, NS_TCL_SET_DYNAMIC, &status);
 	    break;
 
     	case Db_dmlIdx:
-	    status = Ns_DbDML(handle, arg);
+	    status = Ns_DbDMLBind(handle, arg, bind);
 	    break;
 
         case Db_execIdx:
-	    status = Ns_DbExec(handle, arg);
+	    status = Ns_DbExecBind(handle, arg, bind);
 	    if (status == NS_DML) {
                 Tcl_SetResult(interp, "NS_DML", TCL_STATIC);
 	    } else if (status == NS_ROWS) {
@@ -401,7 +445,7 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    break;
 
     	case Db_selectIdx:
-            row = Ns_DbSelect(handle, arg);
+            row = Ns_DbSelectBind(handle, arg, bind);
             EnterRow(interp, row, NS_TCL_SET_STATIC, &status);
 	    break;
 
@@ -412,6 +456,9 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    }
 	    break;
 	}
+	if (bind != NULL) {
+	    Ns_SetFree(bind);
+	}
 	break;
 
     /*
@@ -541,6 +588,134 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	}
 	break;
 
+    case Db_statsIdx:
+        if (objc != 2 && objc != 3) {
+            Tcl_WrongNumArgs(interp, 2, objv, "?pool?");
+            return TCL_ERROR;
+        }
+	Ns_DStringInit(&ds);
+	if (objc == 3) {
+	    pool = Tcl_GetString(objv[2]);
+	    if (Ns_DbPoolStats(pool, &ds) != NS_OK) {
+		Tcl_AppendResult(interp, "no such pool: \"", pool, "\"", NULL);
+		Ns_DStringFree(&ds);
+		return TCL_ERROR;
+	    }
+	} else {
+	    pool = Ns_DbPoolList(idataPtr->server);
+	    while (pool != NULL && *pool != '\0') {
+		Ns_DStringAppendElement(&ds, pool);
+		Ns_DStringAppend(&ds, " {");
+		Ns_DbPoolStats(pool, &ds);
+		Ns_DStringAppend(&ds, "}");
+		pool = pool + strlen(pool) + 1;
+	    }
+	}
+	Tcl_DStringResult(interp, &ds);
+	break;
+
+    case Db_streamIdx:
+	format = header = 0;
+	n = 100;
+	type = NULL;
+	for (i = 2; i < objc - 1; ++i) {
+	    arg = Tcl_GetString(objv[i]);
+	    if (STREQ(arg, "-header")) {
+		header = 1;
+	    } else if (STREQ(arg, "-format") && i < objc - 2) {
+		if (Tcl_GetIndexFromObj(interp, objv[++i], fmts, "format", 0,
+					&format) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+	    } else if (STREQ(arg, "-batch") && i < objc - 2) {
+		if (Tcl_GetIntFromObj(interp, objv[++i], &n) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if (n < 1) {
+		    Tcl_AppendResult(interp, "invalid batch size: ",
+				     Tcl_GetString(objv[i]), NULL);
+		    return TCL_ERROR;
+		}
+	    } else if (STREQ(arg, "-type") && i < objc - 2) {
+		type = Tcl_GetString(objv[++i]);
+	    } else {
+		break;
+	    }
+	}
+	if (i != objc - 1) {
+            Tcl_WrongNumArgs(interp, 2, objv, "?-format csv|json? "
+			     "?-header? ?-batch rows? ?-type type? dbId");
+	    return TCL_ERROR;
+	}
+	conn = Ns_TclGetConn(interp);
+	if (conn == NULL) {
+	    Tcl_SetResult(interp, "no connection", TCL_STATIC);
+	    return TCL_ERROR;
+	}
+    	if (GetHandleObj(idataPtr, objv[i], &handle, 1, NULL) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	if (!(conn->flags & NS_CONN_SENTHDRS)) {
+	    if (type == NULL) {
+		type = format ? "application/json" : "text/csv";
+	    }
+	    Ns_ConnSetType(conn, type);
+	    Ns_ConnSetStatus(conn, 200);
+	}
+	status = StreamRows(conn, handle, format, header, n, &n);
+	if (status == NS_OK) {
+	    Tcl_SetIntObj(resultPtr, n);
+	}
+	break;
+
+    case Db_cachedrowsIdx:
+	bindObj = tagsObj = NULL;
+	ttl = 0;
+	for (i = 2; i < objc - 2; i += 2) {
+	    arg = Tcl_GetString(objv[i]);
+	    if (STREQ(arg, "-bind")) {
+		bindObj = objv[i+1];
+	    } else if (STREQ(arg, "-tags")) {
+		tagsObj = objv[i+1];
+	    } else if (STREQ(arg, "-ttl")) {
+		if (Tcl_GetIntFromObj(interp, objv[i+1], &ttl) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if (ttl < 0) {
+		    Tcl_AppendResult(interp, "invalid ttl: ",
+				     Tcl_GetString(objv[i+1]), NULL);
+		    return TCL_ERROR;
+		}
+	    } else {
+		break;
+	    }
+	}
+	if (i != objc - 2) {
+            Tcl_WrongNumArgs(interp, 2, objv, "?-bind bindings? "
+			     "?-tags tags? ?-ttl seconds? dbId|pool sql");
+	    return TCL_ERROR;
+	}
+	bind = NULL;
+	if (bindObj != NULL && GetBindSet(interp, bindObj, &bind) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	status = CacheSelect(idataPtr, Tcl_GetString(objv[i]),
+			     Tcl_GetString(objv[i+1]), bind, ttl, tagsObj);
+	if (bind != NULL) {
+	    Ns_SetFree(bind);
+	}
+	return status;
+
+    case Db_invalidateIdx:
+	if (objc < 3) {
+            Tcl_WrongNumArgs(interp, 2, objv, "tag ?tag ...?");
+	    return TCL_ERROR;
+	}
+	for (i = 2; i < objc; ++i) {
+	    Ns_DbCacheInvalidate(Tcl_GetString(objv[i]));
+	}
+	break;
+
     case Db_setexceptionIdx:
         if (objc != 5) {
             Tcl_WrongNumArgs(interp, 2, objv, "dbId code message");
@@ -577,17 +752,7 @@ DbObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     }
 
     if (status == NS_ERROR) {
-    	Tcl_AppendResult(interp, "Database operation \"", opts[opt],
-		"\" failed", NULL);
-	if (handle != NULL && handle->cExceptionCode[0] != '\0') {
-            Tcl_AppendResult(interp, " (exception ",
-			     handle->cExceptionCode, NULL);
-            if (handle->dsExceptionMsg.length > 0) {
-            	Tcl_AppendResult(interp, ", \"",
-				 handle->dsExceptionMsg.string, "\"", NULL);
-	    }
-            Tcl_AppendResult(interp, ")", NULL);
-        }
+	SetDbError(interp, opts[opt], handle);
 	return TCL_ERROR;
     }
 
@@ -951,6 +1116,482 @@ GetHandleObj(InterpData *idataPtr, Tcl_Obj *obj, Ns_DbHandle **handlePtr,
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ * GetBindSet --
+ *
+ *      Get the bind variables for a -bind option, either an ns_set
+ *	id or a list of name value pairs.
+ *
+ * Results:
+ *      TCL_OK or TCL_ERROR if the bindings are invalid.
+ *
+ * Side effects:
+ *	A new set is allocated which the caller must free.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GetBindSet(Tcl_Interp *interp, Tcl_Obj *obj, Ns_Set **setPtr)
+{
+    Ns_Set   *set;
+    Tcl_Obj **elemv;
+    int       i, elemc;
+
+    if (Tcl_ListObjGetElements(interp, obj, &elemc, &elemv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (elemc == 1) {
+	if (Ns_TclGetSet2(interp, Tcl_GetString(obj), &set) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	*setPtr = Ns_SetCopy(set);
+	return TCL_OK;
+    }
+    if (elemc % 2 != 0) {
+	Tcl_AppendResult(interp, "invalid bindings \"", Tcl_GetString(obj),
+			 "\": should be an ns_set or list of name value pairs",
+			 NULL);
+	return TCL_ERROR;
+    }
+    set = Ns_SetCreate(NULL);
+    for (i = 0; i < elemc; i += 2) {
+	Ns_SetPut(set, Tcl_GetString(elemv[i]), Tcl_GetString(elemv[i+1]));
+    }
+    *setPtr = set;
+    return TCL_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * SetDbError --
+ *
+ *      Set the interp result for a failed database operation,
+ *	including any exception of the handle.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetDbError(Tcl_Interp *interp, CONST char *op, Ns_DbHandle *handle)
+{
+    Tcl_AppendResult(interp, "Database operation \"", op, "\" failed", NULL);
+    if (handle != NULL && handle->cExceptionCode[0] != '\0') {
+	Tcl_AppendResult(interp, " (exception ",
+			 handle->cExceptionCode, NULL);
+	if (handle->dsExceptionMsg.length > 0) {
+	    Tcl_AppendResult(interp, ", \"",
+			     handle->dsExceptionMsg.string, "\"", NULL);
+	}
+	Tcl_AppendResult(interp, ")", NULL);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * CacheSelect --
+ *
+ *      Implements ns_db cachedrows, returning a list of column
+ *	names followed by a list of values for each row from the
+ *	result cache.  On a cache miss the query is run on the given
+ *	handle or, if id is a pool name, on an idle handle from that
+ *	pool already held by the interp or else a handle taken from
+ *	the pool just for the query.
+ *
+ * Results:
+ *      Standard Tcl result.
+ *
+ * Side effects:
+ *	The result is cached for ttl seconds or until one of the tags
+ *	is invalidated with ns_db invalidate.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CacheSelect(InterpData *idataPtr, char *id, char *sql, Ns_Set *bind,
+	    int ttl, Tcl_Obj *tagsObj)
+{
+    Tcl_Interp	   *interp = idataPtr->interp;
+    Ns_DbHandle    *handle, *heldPtr;
+    Tcl_HashEntry  *hPtr;
+    Tcl_HashSearch  search;
+    Ns_DString	    key, ds;
+    unsigned long  *gens, staticGens[8];
+    char          **tagv;
+    int		    i, ntags, status, fetched;
+
+    if (tagsObj == NULL) {
+	ntags = 0;
+	tagv = NULL;
+    } else if (Tcl_SplitList(interp, Tcl_GetString(tagsObj), &ntags,
+			     (CONST char ***) &tagv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    hPtr = Tcl_FindHashEntry(&idataPtr->dbs, id);
+    if (hPtr != NULL) {
+	handle = Tcl_GetHashValue(hPtr);
+	Ns_DStringFree(&handle->dsExceptionMsg);
+	handle->cExceptionCode[0] = '\0';
+	id = handle->poolname;
+    } else if (!Ns_DbPoolAllowable(idataPtr->server, id)) {
+	Tcl_AppendResult(interp, "invalid database id or pool:  \"", id,
+			 "\"", NULL);
+	if (tagv != NULL) {
+	    Tcl_Free((char *) tagv);
+	}
+	return TCL_ERROR;
+    } else {
+	handle = NULL;
+    }
+
+    /*
+     * Results are keyed by pool, sql and bind variables.
+     */
+
+    Ns_DStringInit(&key);
+    Ns_DStringInit(&ds);
+    Ns_DStringAppendElement(&key, id);
+    Ns_DStringAppendElement(&key, sql);
+    for (i = 0; bind != NULL && i < Ns_SetSize(bind); ++i) {
+	Ns_DStringAppendElement(&key, Ns_SetKey(bind, i));
+	Ns_DStringAppendElement(&key, Ns_SetValue(bind, i) ?
+				Ns_SetValue(bind, i) : "");
+    }
+    if (ntags > 8) {
+	gens = ns_malloc(ntags * sizeof(unsigned long));
+    } else {
+	gens = staticGens;
+    }
+    status = NsDbCacheGet(key.string, ntags, tagv, gens, &ds);
+    if (status != NS_OK) {
+	heldPtr = NULL;
+	if (hPtr == NULL) {
+
+	    /*
+	     * Prefer an idle handle the interp already holds from the
+	     * pool as getting another one could deadlock on a pool
+	     * which has no free handles.
+	     */
+
+	    hPtr = Tcl_FirstHashEntry(&idataPtr->dbs, &search);
+	    while (hPtr != NULL) {
+		heldPtr = Tcl_GetHashValue(hPtr);
+		if (STREQ(heldPtr->poolname, id) && !heldPtr->fetchingRows) {
+		    break;
+		}
+		heldPtr = NULL;
+		hPtr = Tcl_NextHashEntry(&search);
+	    }
+	    if (heldPtr != NULL) {
+		handle = heldPtr;
+		Ns_DStringFree(&handle->dsExceptionMsg);
+		handle->cExceptionCode[0] = '\0';
+	    } else {
+		handle = Ns_DbPoolGetHandle(id);
+	    }
+	}
+	if (handle == NULL) {
+	    Tcl_AppendResult(interp, "could not get handle from pool: \"",
+			     id, "\"", NULL);
+	    fetched = NS_ERROR;
+	} else {
+	    fetched = FetchRows(handle, sql, bind, &ds);
+	    if (fetched != NS_OK) {
+		SetDbError(interp, "cachedrows", handle);
+	    }
+	    if (hPtr == NULL) {
+		Ns_DbPoolPutHandle(handle);
+	    }
+	}
+	if (status == NS_ERROR) {
+	    NsDbCachePut(key.string, ntags, tagv, gens, ttl,
+			 fetched == NS_OK ? &ds : NULL);
+	}
+	status = fetched;
+    }
+    if (status == NS_OK) {
+	Tcl_DStringResult(interp, &ds);
+    }
+    if (gens != staticGens) {
+	ns_free(gens);
+    }
+    if (tagv != NULL) {
+	Tcl_Free((char *) tagv);
+    }
+    Ns_DStringFree(&key);
+    Ns_DStringFree(&ds);
+    return (status == NS_OK ? TCL_OK : TCL_ERROR);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * FetchRows --
+ *
+ *      Run a select and append the column names and rows as lists.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FetchRows(Ns_DbHandle *handle, char *sql, Ns_Set *bind, Ns_DString *dsPtr)
+{
+    Ns_DbRows  rows;
+    Ns_Set    *row;
+    char      *value;
+    int	       i, j, status;
+
+    row = Ns_DbSelectBind(handle, sql, bind);
+    if (row == NULL) {
+	return NS_ERROR;
+    }
+    Tcl_DStringStartSublist(dsPtr);
+    for (j = 0; j < Ns_SetSize(row); ++j) {
+	Ns_DStringAppendElement(dsPtr, Ns_SetKey(row, j));
+    }
+    Tcl_DStringEndSublist(dsPtr);
+    Ns_DbRowsInit(&rows, 100);
+    do {
+	status = Ns_DbGetRows(handle, &rows);
+	for (i = 0; status != NS_ERROR && i < rows.nrows; ++i) {
+	    Tcl_DStringStartSublist(dsPtr);
+	    for (j = 0; j < rows.ncols; ++j) {
+		value = Ns_DbRowsGetValue(&rows, i, j, NULL);
+		Ns_DStringAppendElement(dsPtr, value ? value : "");
+	    }
+	    Tcl_DStringEndSublist(dsPtr);
+	}
+    } while (status == NS_OK);
+    Ns_DbRowsFree(&rows);
+    return (status == NS_ERROR ? NS_ERROR : NS_OK);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * StreamRows --
+ *
+ *      Write the remaining rows of a select to the connection as CSV
+ *	or a JSON array of objects, fetching batch rows at a time.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR on database or connection write error.  The
+ *	number of rows written is stored in nrowsPtr.
+ *
+ * Side effects:
+ *	The response is streamed to the client and the connection is
+ *	closed.  Remaining rows are flushed on a connection error.  On
+ *	a database error nothing is sent if the response has not yet
+ *	started, otherwise the connection is closed without keep-alive
+ *	or a final chunk so the client sees the response truncated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+StreamRows(Ns_Conn *conn, Ns_DbHandle *handle, int json, int header,
+	   int batch, int *nrowsPtr)
+{
+    Ns_DbRows	rows;
+    Ns_DString	ds;
+    Ns_Set     *row = handle->row;
+    char       *value;
+    int		i, j, len, status, nrows;
+
+    Ns_DStringInit(&ds);
+    Ns_DbRowsInit(&rows, batch);
+    nrows = 0;
+    if (json) {
+	Ns_DStringAppend(&ds, "[");
+    } else if (header && row != NULL) {
+	for (j = 0; j < Ns_SetSize(row); ++j) {
+	    if (j > 0) {
+		Ns_DStringNAppend(&ds, ",", 1);
+	    }
+	    AppendCsv(&ds, Ns_SetKey(row, j), -1);
+	}
+	Ns_DStringNAppend(&ds, "\r\n", 2);
+    }
+    do {
+	status = Ns_DbGetRows(handle, &rows);
+	if (status == NS_ERROR) {
+	    if (conn->flags & NS_CONN_SENTHDRS) {
+		Ns_ConnSetKeepAliveFlag(conn, 0);
+		Ns_ConnClose(conn);
+	    }
+	    break;
+	}
+	for (i = 0; i < rows.nrows; ++i, ++nrows) {
+	    if (json) {
+		Ns_DStringAppend(&ds, nrows > 0 ? ",\n{" : "\n{");
+	    }
+	    for (j = 0; j < rows.ncols; ++j) {
+		value = Ns_DbRowsGetValue(&rows, i, j, &len);
+		if (j > 0) {
+		    Ns_DStringNAppend(&ds, ",", 1);
+		}
+		if (!json) {
+		    AppendCsv(&ds, value, len);
+		    continue;
+		}
+		AppendJson(&ds, Ns_SetKey(row, j), -1);
+		Ns_DStringNAppend(&ds, ":", 1);
+		if (value == NULL) {
+		    Ns_DStringAppend(&ds, "null");
+		} else {
+		    AppendJson(&ds, value, len);
+		}
+	    }
+	    Ns_DStringAppend(&ds, json ? "}" : "\r\n");
+	}
+	if (ds.length >= STREAM_BUFSIZE || status != NS_OK) {
+	    if (status != NS_OK && json) {
+		Ns_DStringAppend(&ds, "\n]\n");
+	    }
+	    if (Ns_ConnFlush(conn, ds.string, ds.length,
+			     status == NS_OK) != NS_OK) {
+		if (status == NS_OK) {
+		    Ns_DbFlush(handle);
+		}
+		Ns_DbSetException(handle, "NSDB",
+				  "could not write to connection");
+		status = NS_ERROR;
+		break;
+	    }
+	    Ns_DStringTrunc(&ds, 0);
+	}
+    } while (status == NS_OK);
+    Ns_DbRowsFree(&rows);
+    Ns_DStringFree(&ds);
+    *nrowsPtr = nrows;
+    return (status == NS_ERROR ? NS_ERROR : NS_OK);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * AppendCsv --
+ *
+ *      Append a CSV field, quoted if it contains a separator, quote
+ *	or line break.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	An SQL NULL is appended as an empty field.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AppendCsv(Ns_DString *dsPtr, char *value, int len)
+{
+    char *p, *end;
+
+    if (value == NULL) {
+	return;
+    }
+    if (len < 0) {
+	len = strlen(value);
+    }
+    end = value + len;
+    for (p = value; p < end; ++p) {
+	if (*p == ',' || *p == '"' || *p == '\r' || *p == '\n') {
+	    break;
+	}
+    }
+    if (p == end) {
+	Ns_DStringNAppend(dsPtr, value, len);
+	return;
+    }
+    Ns_DStringNAppend(dsPtr, "\"", 1);
+    while ((p = memchr(value, '"', end - value)) != NULL) {
+	Ns_DStringNAppend(dsPtr, value, p - value + 1);
+	Ns_DStringNAppend(dsPtr, "\"", 1);
+	value = p + 1;
+    }
+    Ns_DStringNAppend(dsPtr, value, end - value);
+    Ns_DStringNAppend(dsPtr, "\"", 1);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ * AppendJson --
+ *
+ *      Append a quoted JSON string.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AppendJson(Ns_DString *dsPtr, char *value, int len)
+{
+    char *start, *end, buf[8];
+    unsigned char c;
+
+    if (len < 0) {
+	len = strlen(value);
+    }
+    end = value + len;
+    Ns_DStringNAppend(dsPtr, "\"", 1);
+    for (start = value; value < end; ++value) {
+	c = UCHAR(*value);
+	if (c >= 0x20 && c != '"' && c != '\\') {
+	    continue;
+	}
+	Ns_DStringNAppend(dsPtr, start, value - start);
+	start = value + 1;
+	switch (c) {
+	case '"':
+	case '\\':
+	    buf[0] = '\\';
+	    buf[1] = c;
+	    Ns_DStringNAppend(dsPtr, buf, 2);
+	    break;
+	case '\n':
+	    Ns_DStringNAppend(dsPtr, "\\n", 2);
+	    break;
+	case '\r':
+	    Ns_DStringNAppend(dsPtr, "\\r", 2);
+	    break;
+	case '\t':
+	    Ns_DStringNAppend(dsPtr, "\\t", 2);
+	    break;
+	default:
+	    sprintf(buf, "\\u%04x", c);
+	    Ns_DStringNAppend(dsPtr, buf, 6);
+	    break;
+	}
+    }
+    Ns_DStringNAppend(dsPtr, start, value - start);
+    Ns_DStringNAppend(dsPtr, "\"", 1);
+}
+
+
 /*
  *----------------------------------------------------------------------
  * EnterHandle --
@@ -78,10 +78,10 @@ Ns_DbQuoteValue(Ns_DString *pds, char *string)
 /*
  *----------------------------------------------------------------------
  *
- * Ns_Db0or1Row --
+ * Ns_Db0or1Row, Ns_Db0or1RowBind --
  *
  *	Send an SQL statement which should return either no rows or
- *	exactly one row.
+ *	exactly one row, optionally with bind variables.
  *
  * Results:
  *	Pointer to new Ns_Set which must be eventually freed.  The
@@ -97,10 +97,16 @@ Ns_DbQuoteValue(Ns_DString *pds, char *string)
 
 Ns_Set *
 Ns_Db0or1Row(Ns_DbHandle *handle, char *sql, int *nrows)
+{
+    return Ns_Db0or1RowBind(handle, sql, NULL, nrows);
+}
+
+Ns_Set *
+Ns_Db0or1RowBind(Ns_DbHandle *handle, char *sql, Ns_Set *bind, int *nrows)
 {
     Ns_Set *row;
 
-    row = Ns_DbSelect(handle, sql);
+    row = Ns_DbSelectBind(handle, sql, bind);
     if (row != NULL) {
         if (Ns_DbGetRow(handle, row) == NS_END_DATA) {
             *nrows = 0;
@@ -134,9 +140,10 @@ Ns_Db0or1Row(Ns_DbHandle *handle, char *sql, int *nrows)
 /*
  *----------------------------------------------------------------------
  *
- * Ns_Db1Row --
+ * Ns_Db1Row, Ns_Db1RowBind --
  *
- *	Send a SQL statement which is expected to return exactly 1 row.
+ *	Send a SQL statement which is expected to return exactly 1 row,
+ *	optionally with bind variables.
  *
  * Results:
  *	Pointer to Ns_Set with row data or NULL on error.  Set must
@@ -150,11 +157,17 @@ Ns_Db0or1Row(Ns_DbHandle *handle, char *sql, int *nrows)
 
 Ns_Set *
 Ns_Db1Row(Ns_DbHandle *handle, char *sql)
+{
+    return Ns_Db1RowBind(handle, sql, NULL);
+}
+
+Ns_Set *
+Ns_Db1RowBind(Ns_DbHandle *handle, char *sql, Ns_Set *bind)
 {
     Ns_Set         *row;
     int             nrows;
 
-    row = Ns_Db0or1Row(handle, sql, &nrows);
+    row = Ns_Db0or1RowBind(handle, sql, bind, &nrows);
     if (row != NULL) {
         if (nrows != 1) {
             Ns_DbSetException(handle, NS_SQLERRORCODE,
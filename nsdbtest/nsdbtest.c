@@ -0,0 +1,466 @@
+/*
+ * The contents of this file are subject to the AOLserver Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://aolserver.com/.
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is AOLserver Code and related documentation
+ * distributed by AOL.
+ *
+ * The Initial Developer of the Original Code is America Online,
+ * Inc. Portions created by AOL are Copyright (C) 1999 America Online,
+ * Inc. All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+/*
+ * nsdbtest.c --
+ *
+ *	Stub database driver for testing and benchmarking nsdb without
+ *	a database server.  Statements are not parsed as SQL but as
+ *	one of the following commands:
+ *
+ *	rows n		Return n rows of columns a, b and c.
+ *	rows n fail m	Return n rows, failing the fetch after row m.
+ *	sleep ms	Sleep ms milliseconds and return NS_DML.
+ *	error		Fail with exception TEST.
+ *
+ *	Any other statement succeeds as DML.  A datasource of "fail"
+ *	causes connects to fail.
+ */
+
+#include "nsdb.h"
+
+NS_EXPORT int Ns_ModuleVersion = 1;
+
+/*
+ * The following structure maintains the pending result of a handle.
+ */
+
+typedef struct Result {
+    int nrows;
+    int row;
+    int fail;
+} Result;
+
+#define NCOLS 3
+
+static char *colnames[NCOLS] = {"a", "b", "c"};
+
+static char *DbName(Ns_DbHandle *handle);
+static char *DbType(Ns_DbHandle *handle);
+static int DbOpen(Ns_DbHandle *handle);
+static void DbClose(Ns_DbHandle *handle);
+static int DbExec(Ns_DbHandle *handle, char *sql);
+static Ns_Set *DbBindRow(Ns_DbHandle *handle);
+static int DbGetRow(Ns_DbHandle *handle, Ns_Set *row);
+static int DbGetRows(Ns_DbHandle *handle, Ns_DbRows *rowsPtr);
+static int DbFlush(Ns_DbHandle *handle);
+static int FetchFailed(Ns_DbHandle *handle);
+static int DbResetHandle(Ns_DbHandle *handle);
+static void *DbPrepareStmt(Ns_DbHandle *handle, char *sql, int nparams);
+static int DbExecStmt(Ns_DbHandle *handle, void *stmt, int nparams,
+		      char **values);
+static void DbFreeStmt(Ns_DbHandle *handle, void *stmt);
+
+static Ns_DbProc procs[] = {
+    {DbFn_Name, DbName},
+    {DbFn_DbType, DbType},
+    {DbFn_OpenDb, DbOpen},
+    {DbFn_CloseDb, DbClose},
+    {DbFn_Exec, DbExec},
+    {DbFn_BindRow, DbBindRow},
+    {DbFn_GetRow, DbGetRow},
+    {DbFn_GetRows, DbGetRows},
+    {DbFn_Flush, DbFlush},
+    {DbFn_Cancel, DbFlush},
+    {DbFn_ResetHandle, DbResetHandle},
+    {DbFn_PrepareStmt, DbPrepareStmt},
+    {DbFn_ExecStmt, DbExecStmt},
+    {DbFn_FreeStmt, DbFreeStmt},
+    {0, NULL}
+};
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsDbTest_ModInit --
+ *
+ *	Module init routine, called only if the driver is also listed
+ *	as a server module.
+ *
+ * Results:
+ *	NS_OK.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsDbTest_ModInit(char *server, char *module)
+{
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_DbDriverInit --
+ *
+ *	Driver load routine.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+NS_EXPORT int
+Ns_DbDriverInit(char *driver, char *path)
+{
+    return Ns_DbRegisterDriver(driver, procs);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DbName, DbType --
+ *
+ *	Return driver name and database type.
+ *
+ * Results:
+ *	Static string.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+DbName(Ns_DbHandle *handle)
+{
+    return "nsdbtest";
+}
+
+static char *
+DbType(Ns_DbHandle *handle)
+{
+    return "test";
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DbOpen, DbClose --
+ *
+ *	Open or close a handle.
+ *
+ * Results:
+ *	NS_OK or NS_ERROR for the "fail" datasource.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+DbOpen(Ns_DbHandle *handle)
+{
+    if (STREQ(handle->datasource, "fail")) {
+	Ns_DbSetException(handle, "TEST", "connect failed");
+	return NS_ERROR;
+    }
+    handle->connection = ns_calloc(1, sizeof(Result));
+    return NS_OK;
+}
+
+static void
+DbClose(Ns_DbHandle *handle)
+{
+    ns_free(handle->connection);
+    handle->connection = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DbExec --
+ *
+ *	Execute a test statement.
+ *
+ * Results:
+ *	NS_ROWS, NS_DML or NS_ERROR.
+ *
+ * Side effects:
+ *	See top of file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+DbExec(Ns_DbHandle *handle, char *sql)
+{
+    Result        *resPtr = handle->connection;
+    struct timeval tv;
+    int            n;
+
+    if (sscanf(sql, "rows %d", &n) == 1) {
+	resPtr->nrows = n;
+	resPtr->row = 0;
+	if (sscanf(sql, "rows %d fail %d", &n, &resPtr->fail) != 2) {
+	    resPtr->fail = -1;
+	}
+	handle->fetchingRows = 1;
+	return NS_ROWS;
+    }
+    if (sscanf(sql, "sleep %d", &n) == 1) {
+	tv.tv_sec = n / 1000;
+	tv.tv_usec = (n % 1000) * 1000;
+	select(0, NULL, NULL, NULL, &tv);
+	return NS_DML;
+    }
+    if (STREQ(sql, "error")) {
+	Ns_DbSetException(handle, "TEST", "error");
+	return NS_ERROR;
+    }
+    return NS_DML;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DbBindRow --
+ *
+ *	Bind the column names of the pending result.
+ *
+ * Results:
+ *	Pointer to handle row set.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_Set *
+DbBindRow(Ns_DbHandle *handle)
+{
+    int i;
+
+    for (i = 0; i < NCOLS; ++i) {
+	Ns_SetPut(handle->row, colnames[i], NULL);
+    }
+    return handle->row;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DbGetRow, DbGetRows --
+ *
+ *	Fetch the next row or batch of rows.  Column i of row n has
+ *	the value n * 10 + i.
+ *
+ * Results:
+ *	NS_OK, NS_END_DATA or NS_ERROR if no rows are pending or
+ *	the fetch reached the failing row.
+ *
+ * Side effects:
+ *	Pending rows are discarded on error.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+DbGetRow(Ns_DbHandle *handle, Ns_Set *row)
+{
+    Result *resPtr = handle->connection;
+    char    buf[32];
+    int     i;
+
+    if (!handle->fetchingRows) {
+	Ns_DbSetException(handle, "TEST", "no rows waiting");
+	return NS_ERROR;
+    }
+    if (resPtr->row >= resPtr->nrows) {
+	handle->fetchingRows = 0;
+	return NS_END_DATA;
+    }
+    if (resPtr->row == resPtr->fail) {
+	return FetchFailed(handle);
+    }
+    ++resPtr->row;
+    for (i = 0; i < NCOLS; ++i) {
+	sprintf(buf, "%d", resPtr->row * 10 + i);
+	Ns_SetPutValue(row, i, buf);
+    }
+    return NS_OK;
+}
+
+static int
+DbGetRows(Ns_DbHandle *handle, Ns_DbRows *rowsPtr)
+{
+    Result *resPtr = handle->connection;
+    char    buf[32];
+    int     i, len;
+
+    if (!handle->fetchingRows) {
+	Ns_DbSetException(handle, "TEST", "no rows waiting");
+	return NS_ERROR;
+    }
+    while (rowsPtr->nrows < rowsPtr->maxrows
+	    && resPtr->row < resPtr->nrows) {
+	if (resPtr->row == resPtr->fail) {
+	    return FetchFailed(handle);
+	}
+	++resPtr->row;
+	for (i = 0; i < NCOLS; ++i) {
+	    len = sprintf(buf, "%d", resPtr->row * 10 + i);
+	    Ns_DbRowsPutValue(rowsPtr, rowsPtr->nrows, i, buf, len);
+	}
+	++rowsPtr->nrows;
+    }
+    if (resPtr->row >= resPtr->nrows) {
+	handle->fetchingRows = 0;
+	return NS_END_DATA;
+    }
+    return NS_OK;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FetchFailed --
+ *
+ *	Fail a fetch at the failing row of a "rows n fail m" result.
+ *
+ * Results:
+ *	NS_ERROR.
+ *
+ * Side effects:
+ *	Sets exception TEST and discards the pending rows.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FetchFailed(Ns_DbHandle *handle)
+{
+    Ns_DbSetException(handle, "TEST", "fetch failed");
+    DbFlush(handle);
+    return NS_ERROR;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DbFlush, DbResetHandle --
+ *
+ *	Discard pending rows.
+ *
+ * Results:
+ *	NS_OK.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+DbFlush(Ns_DbHandle *handle)
+{
+    Result *resPtr = handle->connection;
+
+    resPtr->row = resPtr->nrows;
+    handle->fetchingRows = 0;
+    return NS_OK;
+}
+
+static int
+DbResetHandle(Ns_DbHandle *handle)
+{
+    return DbFlush(handle);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DbPrepareStmt, DbExecStmt, DbFreeStmt --
+ *
+ *	Prepared statements which substitute ? parameters and execute
+ *	the result as with DbExec.
+ *
+ * Results:
+ *	See DbExec.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+DbPrepareStmt(Ns_DbHandle *handle, char *sql, int nparams)
+{
+    return ns_strdup(sql);
+}
+
+static int
+DbExecStmt(Ns_DbHandle *handle, void *stmt, int nparams, char **values)
+{
+    Ns_DString  ds;
+    char       *p;
+    int         i, status;
+
+    Ns_DStringInit(&ds);
+    i = 0;
+    for (p = stmt; *p != '\0'; ++p) {
+	if (*p == '?' && i < nparams) {
+	    Ns_DStringAppend(&ds, values[i] ? values[i] : "NULL");
+	    ++i;
+	} else {
+	    Ns_DStringNAppend(&ds, p, 1);
+	}
+    }
+    status = DbExec(handle, ds.string);
+    Ns_DStringFree(&ds);
+    return status;
+}
+
+static void
+DbFreeStmt(Ns_DbHandle *handle, void *stmt)
+{
+    ns_free(stmt);
+}
@@ -37,10 +37,37 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsp
 
 #include "nsproxy.h"
 #include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #define MAJOR 1
 #define MINOR 1
 
+/*
+ * Protocol version 1.2 requests are followed by a tag which is
+ * echoed before the response, allowing several requests to be
+ * pipelined to one slave and matched with their results.
+ */
+
+#define MINOR_TAGGED 2
+
+/*
+ * The following structure defines a shared memory segment used to
+ * return large results.  The slave writes the error code, error info
+ * and result to the segment and sends only the Res header over the
+ * pipe, growing the segment as needed.
+ */
+
+typedef struct Shm {
+    int fd;			/* Memory file descriptor or -1. */
+    int min;			/* Min result size to return in segment. */
+    char *addr;			/* Mapped address. */
+    size_t size;		/* Mapped size. */
+} Shm;
+
 /*
  * The following structure defines a running proxy child process.
  */
@@ -51,6 +78,8 @@ typedef struct Proc {
     int rfd;			/* Read file descriptor. */
     int wfd;			/* Write file descriptor. */
     int pid;			/* Process id. */
+    int nonblock;		/* Write pipe set non-blocking. */
+    Shm shm;			/* Result segment, if any. */
 } Proc;
 
 /*
@@ -72,6 +101,8 @@ typedef struct Res {
     uint32_t rlen;
 } Res;
 
+typedef uint32_t Tag;
+
 /*
  * The following structure defines a proxy connection allocated
  * from a pool.
@@ -91,6 +122,13 @@ typedef struct Proxy {
     Tcl_HashEntry *idPtr;	/* Pointer to proxy table entry. */
     Tcl_HashEntry *cntPtr;	/* Pointer to count of proxies allocated. */
     Tcl_DString in;		/* Request dstring. */ 
+    int nevals;			/* Scripts sent to current process. */
+    Tag nexttag;		/* Next tag for pipelined requests. */
+    int npending;		/* Pipelined requests sent but not received. */
+    int busy;			/* Thread sending or receiving tagged data. */
+    Tcl_HashTable results;	/* Results of pipelined requests by tag. */
+    Ns_Mutex lock;		/* Lock around pipelined requests. */
+    Ns_Cond cond;		/* Cond to wait for busy proxy or results. */
 } Proxy;
 
 /*
@@ -117,6 +155,16 @@ typedef struct Pool {
     int   trecv;		/* Receive timeout. */
     Ns_Mutex lock;		/* Lock around pool. */
     Ns_Cond cond;		/* Cond for use while allocating handles. */
+    struct Proxy *sharedPtr;	/* Proxy shared by all threads, if any. */
+    int   maxevals;		/* Scripts before a process is recycled. */
+    int   maxrss;		/* Max idle process size in KB before recycle. */
+    int   shmmin;		/* Min result size returned in shared memory. */
+    int   nspawn;		/* Number of processes started. */
+    int   nrecycle;		/* Number of processes recycled. */
+    Ns_Time spawntime;		/* Total time to start processes. */
+    Ns_Time spawnmax;		/* Max time to start a process. */
+    int   warmwait;		/* Seconds to wait after a failed start. */
+    time_t warmretry;		/* Time to retry a failed start. */
 } Pool;
 
 /*
@@ -155,6 +203,7 @@ typedef enum Err {
  */
 
 static Tcl_InterpDeleteProc DeleteData;
+static Proxy *NewProxy(Pool *poolPtr, char *suffix);
 static void PutProxy(Proxy *proxyPtr);
 static int ReleaseProxy(Tcl_Interp *interp, Proxy *proxyPtr);
 static Pool *GetPool(InterpData *idataPtr, Tcl_Obj *obj);
@@ -165,26 +214,47 @@ static void FreeProxy(Proxy *proxyPtr);
 static Tcl_ObjCmdProc ProxyObjCmd;
 static Tcl_ObjCmdProc ConfigObjCmd;
 static Tcl_ObjCmdProc GetObjCmd;
+static Tcl_ObjCmdProc StatsObjCmd;
 static Err Check(Tcl_Interp *interp, Proxy *proxyPtr);
 static Proc *Exec(Tcl_Interp *interp, Proxy *proxyPtr);
 static int Eval(Tcl_Interp *interp, Proxy *proxyPtr, char *script, int ms);
 static int Send(Tcl_Interp *interp, Proxy *proxyPtr, char *script);
 static int Wait(Tcl_Interp *interp, Proxy *proxyPtr, int ms);
 static int Recv(Tcl_Interp *interp, Proxy *proxyPtr);
+static int Queue(Tcl_Interp *interp, Proxy *proxyPtr, char *script,
+		 Tag *tagPtr);
+static int Collect(Tcl_Interp *interp, Proxy *proxyPtr, Tag tag, int ms,
+		   int abandon);
+static int SharedEval(Tcl_Interp *interp, Pool *poolPtr, char *script,
+		      int ms);
+static int SendTagged(Proxy *proxyPtr, Tcl_DString *dsPtr);
+static void SetNonBlock(Proc *procPtr, int nonblock);
+static int RecvTagged(Proxy *proxyPtr);
+static void Fail(Proxy *proxyPtr);
+static void Discard(Proxy *proxyPtr);
 static void Kill(Proc *procPtr, int sig);
 static char *ProxyError(Tcl_Interp *interp, Err err);
 static void Reset(Proxy *proxyPtr);
 static int SendBuf(Proc *procPtr, int ms, Tcl_DString *dsPtr);
 static int RecvBuf(Proc *procPtr, int ms, Tcl_DString *dsPtr);
 static int WaitFd(int fd, int events, int ms);
-static int Import(Tcl_Interp *interp, Tcl_DString *dsPtr, int *resultPtr);
-static void Export(Tcl_Interp *interp, int code, Tcl_DString *dsPtr);
+static int Import(Tcl_Interp *interp, char *buf, int len, Shm *shmPtr,
+		  int *resultPtr);
+static void Export(Tcl_Interp *interp, int code, Tcl_DString *dsPtr,
+		   Shm *shmPtr);
+static int MapShm(Shm *shmPtr, size_t size, int grow);
+static void UnmapShm(Shm *shmPtr);
 static void UpdateIov(struct iovec *iov, int n);
 static void FatalExit(char *func);
-static void SetOpt(char *str, char **optPtr);
+static int SetOpt(char *str, char **optPtr);
 static void Append(Tcl_Interp *interp, char *flag, char *val);
 static void AppendInt(Tcl_Interp *interp, char *flag, int i);
 static Ns_ThreadProc CloseThread;
+static Ns_ThreadProc WarmThread;
+static void Warm(Tcl_Interp *interp, Pool *poolPtr);
+static void WakeWarm(void);
+static Ns_Callback StopWarm;
+static int GetRss(int pid);
 
 /*
  * Static variables defined in this file.
@@ -196,6 +266,19 @@ static Ns_Cond pcond;
 static Ns_Mutex plock;
 static Proc *firstClosePtr = NULL;
 static Ns_DString defexec;
+static Tcl_DString dead;	/* Result marker of requests to dead procs. */
+static Ns_Mutex wlock;		/* Lock for the warm thread. */
+static Ns_Cond wcond;		/* Cond to wake the warm thread. */
+static int wsignal;		/* Pools have changed. */
+static int wshutdown;		/* Server is shutting down. */
+static Ns_Thread wthread;	/* Warm thread, if started. */
+
+/*
+ * The following defines the max seconds to wait before retrying
+ * to start a process after failed starts in a pool.
+ */
+
+#define WARM_MAXWAIT 60
 
 
 /*
@@ -285,7 +368,8 @@ Ns_ProxyMain(int argc, char **argv, Tcl_AppInitProc *init)
     Req *reqPtr;
     Tcl_DString in, out;
     char *script, *active, *dots;
-    uint16_t major, minor;
+    uint16_t major, minor, tagged;
+    Shm shm, *shmPtr;
 
     if (argc < 4) {
 	active = NULL;
@@ -297,6 +381,23 @@ Ns_ProxyMain(int argc, char **argv, Tcl_AppInitProc *init)
 	}
     }
 
+    /*
+     * Use the parent's result segment, if any, inherited as the
+     * given descriptor.
+     */
+
+    memset(&shm, 0, sizeof(shm));
+    shm.fd = -1;
+    if (argc > 5) {
+	shm.min = atoi(argv[5]);
+	shm.fd = atoi(argv[4]);
+	if (shm.fd <= 2 || Ns_CloseOnExec(shm.fd) != NS_OK) {
+	    fprintf(stderr, "proxy[%d]: invalid segment fd %s: %s\n",
+		    getpid(), argv[4], strerror(errno));
+	    shm.fd = -1;
+	}
+    }
+
     /*
      * Move the proxy input and output fd's from 0 and 1 to avoid
      * protocal errors with scripts accessing stdin and stdout.
@@ -305,6 +406,7 @@ Ns_ProxyMain(int argc, char **argv, Tcl_AppInitProc *init)
 
     major = htons(MAJOR);
     minor = htons(MINOR);
+    tagged = htons(MINOR_TAGGED);
     proc.pid = -1;
     proc.rfd = dup(0);
     if (proc.rfd < 0) {
@@ -345,14 +447,30 @@ Ns_ProxyMain(int argc, char **argv, Tcl_AppInitProc *init)
 	    break;
 	}
 	reqPtr = (Req *) in.string;
-	if (reqPtr->major != major || reqPtr->minor != minor) {
+	if (reqPtr->major != major
+		|| (reqPtr->minor != minor && reqPtr->minor != tagged)) {
 	    FatalExit("version mismatch");
 	}
 	len = ntohl(reqPtr->len);
+	script = in.string + sizeof(Req);
+
+	/*
+	 * Responses to pipelined requests can't use the segment as
+	 * a later result could overwrite it before it is received.
+	 */
+
+	shmPtr = &shm;
+	if (reqPtr->minor == tagged) {
+	    if (in.length < sizeof(Req) + sizeof(Tag)) {
+		break;
+	    }
+	    Tcl_DStringAppend(&out, script, sizeof(Tag));
+	    script += sizeof(Tag);
+	    shmPtr = NULL;
+	}
 	if (len == 0) {
-	    Export(NULL, TCL_OK, &out); 
+	    Export(NULL, TCL_OK, &out, NULL); 
 	} else if (len > 0) {
-	    script = in.string + sizeof(Req);
 	    if (active != NULL) {
 		n = len;
 		if (n < max) {
@@ -364,7 +482,7 @@ Ns_ProxyMain(int argc, char **argv, Tcl_AppInitProc *init)
 		sprintf(active, "{%.*s%s}", n, script, dots);
 	    }
 	    result = Tcl_EvalEx(interp, script, len, 0);
-	    Export(interp, result, &out); 
+	    Export(interp, result, &out, shmPtr); 
 	    if (active != NULL) {
 		active[0] = '\0';
 	    }
@@ -435,16 +553,23 @@ ProxyObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     InterpData *idataPtr = data;
     Pool *poolPtr;
     Proxy *proxyPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    Tcl_WideInt w;
+    Tag tag;
+    char buf[20];
     int result, ms;
     static char *opts[] = {
 	"get", "release", "eval", "cleanup",
 	"config", "ping", "active",
-	"send", "wait", "recv", NULL
+	"send", "wait", "recv",
+	"queue", "collect", "pending", "shared", "stats", NULL
     };
     enum {
 	PGetIdx, PReleaseIdx, PEvalIdx, PCleanupIdx, 
 	PConfigIdx, PPingIdx, PActiveIdx,
-	PSendIdx, PWaitIdx, PRecvIdx
+	PSendIdx, PWaitIdx, PRecvIdx,
+	PQueueIdx, PCollectIdx, PPendingIdx, PSharedIdx, PStatsIdx
     } opt;
 
     if (objc < 2) {
@@ -490,6 +615,10 @@ ProxyObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	result = GetObjCmd(data, interp, objc, objv);
 	break;
 
+    case PStatsIdx:
+	result = StatsObjCmd(data, interp, objc, objv);
+	break;
+
     case PSendIdx:
 	if (objc != 4) {
 	    Tcl_WrongNumArgs(interp, 2, objv, "handle script");
@@ -544,6 +673,72 @@ ProxyObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	result = Eval(interp, proxyPtr, Tcl_GetString(objv[3]), ms);
 	break;
 
+    case PQueueIdx:
+	if (objc != 4) {
+	    Tcl_WrongNumArgs(interp, 2, objv, "handle script");
+	    return TCL_ERROR;
+	}
+	if (!GetProxy(interp, idataPtr, objv[2], &proxyPtr)) {
+	    return TCL_ERROR;
+	}
+	result = Queue(interp, proxyPtr, Tcl_GetString(objv[3]), &tag);
+	if (result == TCL_OK) {
+	    Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) tag));
+	}
+	break;
+
+    case PCollectIdx:
+	if (objc != 4 && objc != 5) {
+	    Tcl_WrongNumArgs(interp, 2, objv, "handle tag ?timeout?");
+	    return TCL_ERROR;
+	}
+	if (!GetProxy(interp, idataPtr, objv[2], &proxyPtr)) {
+	    return TCL_ERROR;
+	}
+	if (Tcl_GetWideIntFromObj(interp, objv[3], &w) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	if (objc == 4) {
+	    ms = -1;
+	} else if (Tcl_GetIntFromObj(interp, objv[4], &ms) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	result = Collect(interp, proxyPtr, (Tag) w, ms, 0);
+	break;
+
+    case PPendingIdx:
+	if (objc != 3) {
+	    Tcl_WrongNumArgs(interp, 2, objv, "handle");
+	    return TCL_ERROR;
+	}
+	if (!GetProxy(interp, idataPtr, objv[2], &proxyPtr)) {
+	    return TCL_ERROR;
+	}
+	Ns_MutexLock(&proxyPtr->lock);
+	hPtr = Tcl_FirstHashEntry(&proxyPtr->results, &search);
+	while (hPtr != NULL) {
+	    tag = (Tag) (long) Tcl_GetHashKey(&proxyPtr->results, hPtr);
+	    sprintf(buf, "%u", (unsigned int) tag);
+	    Tcl_AppendElement(interp, buf);
+	    hPtr = Tcl_NextHashEntry(&search);
+	}
+	Ns_MutexUnlock(&proxyPtr->lock);
+	break;
+
+    case PSharedIdx:
+	if (objc != 4 && objc != 5) {
+	    Tcl_WrongNumArgs(interp, 2, objv, "pool script ?timeout?");
+	    return TCL_ERROR;
+	}
+	if (objc == 4) {
+	    ms = -1;
+	} else if (Tcl_GetIntFromObj(interp, objv[4], &ms) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	poolPtr = GetPool(idataPtr, objv[2]);
+	result = SharedEval(interp, poolPtr, Tcl_GetString(objv[3]), ms);
+	break;
+
     case PActiveIdx:
 	if (objc != 3) {
 	    Tcl_WrongNumArgs(interp, 2, objv, "pool");
@@ -589,17 +784,18 @@ ConfigObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 {
     InterpData *idataPtr = data;
     Pool *poolPtr;
-    Proxy *proxyPtr;
+    Proxy *proxyPtr, **proxyPtrPtr;
     char *str;
-    int i, incr, n, nrun, result;
+    int i, incr, n, nrun, result, changed;
     static char *flags[] = {
 	"-init", "-reinit", "-min", "-max", "-exec",
 	"-getimeout", "-evaltimeout", "-sendtimeout", "-recvtimeout",
-	"-waittimeout", NULL
+	"-waittimeout", "-maxevals", "-maxrss", "-shmthreshold", NULL
     };
     enum {
 	CInitIdx, CReinitIdx, CMinIdx, CMaxIdx, CExecIdx,
-	CGetIdx, CEvalIdx, CSendIdx, CRecvIdx, CWaitIdx
+	CGetIdx, CEvalIdx, CSendIdx, CRecvIdx, CWaitIdx,
+	CMaxEvalsIdx, CMaxRssIdx, CShmIdx
     } flag;
 
     if (objc < 3 || (objc % 2) != 1) {
@@ -610,6 +806,7 @@ ConfigObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     poolPtr = GetPool(idataPtr, objv[2]);
     Ns_MutexLock(&poolPtr->lock);
     nrun = poolPtr->max - poolPtr->avail;
+    changed = 0;
     for (i = 3; i < (objc - 1); ++i) {
 	if (Tcl_GetIndexFromObj(interp, objv[i], flags, "flags", 0,
 		(int *) &flag)) {
@@ -626,6 +823,9 @@ ConfigObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	case CWaitIdx:
 	case CMinIdx:
 	case CMaxIdx:
+	case CMaxEvalsIdx:
+	case CMaxRssIdx:
+	case CShmIdx:
 	    if (Tcl_GetIntFromObj(interp, objv[i], &n) != TCL_OK) {
 	    	goto err;
 	    }
@@ -656,34 +856,61 @@ ConfigObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	    case CMaxIdx:
 		poolPtr->max = n;
 		break;
+	    case CMaxEvalsIdx:
+		poolPtr->maxevals = n;
+		break;
+	    case CMaxRssIdx:
+		poolPtr->maxrss = n;
+		break;
+	    case CShmIdx:
+		poolPtr->shmmin = n;
+		break;
 	    }
 	    break;
 	case CInitIdx:
-	    SetOpt(str, &poolPtr->init);
+	    changed |= SetOpt(str, &poolPtr->init);
 	    break;
 	case CReinitIdx:
-	    SetOpt(str, &poolPtr->reinit);
+	    changed |= SetOpt(str, &poolPtr->reinit);
 	    break;
 	case CExecIdx:
-	    SetOpt(str, &poolPtr->exec);
+	    changed |= SetOpt(str, &poolPtr->exec);
 	    break;
 	}
     }
 
     /*
-     * Adjust limits and dump any lingering proxies.  Note
-     * "avail" can be negative if "max" was adjusted down
-     * below the number of currently running proxies.  This
-     * will be corrected as those active proxies are returned.
+     * Adjust limits and dump any lingering proxies if the
+     * program or scripts changed, otherwise only those above a
+     * lowered "max".  Note "avail" can be negative if "max" was
+     * adjusted down below the number of currently running
+     * proxies.  This will be corrected as those active proxies
+     * are returned.
      */
 
     if (poolPtr->min > poolPtr->max) {
 	poolPtr->min = poolPtr->max;
     }
     poolPtr->avail = poolPtr->max - nrun;
-    while ((proxyPtr = poolPtr->firstPtr) != NULL) {
-	poolPtr->firstPtr = proxyPtr->nextPtr;
-	FreeProxy(proxyPtr);
+    poolPtr->warmwait = 0;
+    n = 0;
+    proxyPtrPtr = &poolPtr->firstPtr;
+    while ((proxyPtr = *proxyPtrPtr) != NULL) {
+	if (changed || n >= poolPtr->avail) {
+	    *proxyPtrPtr = proxyPtr->nextPtr;
+	    FreeProxy(proxyPtr);
+	} else {
+	    proxyPtrPtr = &proxyPtr->nextPtr;
+	    ++n;
+	}
+    }
+    proxyPtr = poolPtr->sharedPtr;
+    if (changed && proxyPtr != NULL) {
+	Ns_MutexLock(&proxyPtr->lock);
+	if (!proxyPtr->busy && proxyPtr->npending == 0) {
+	    Close(proxyPtr);
+	}
+	Ns_MutexUnlock(&proxyPtr->lock);
     }
 
     Append(interp, flags[CExecIdx], poolPtr->exec);
@@ -696,24 +923,34 @@ ConfigObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
     AppendInt(interp, flags[CSendIdx], poolPtr->tsend);
     AppendInt(interp, flags[CRecvIdx], poolPtr->trecv);
     AppendInt(interp, flags[CWaitIdx], poolPtr->twait);
+    AppendInt(interp, flags[CMaxEvalsIdx], poolPtr->maxevals);
+    AppendInt(interp, flags[CMaxRssIdx], poolPtr->maxrss);
+    AppendInt(interp, flags[CShmIdx], poolPtr->shmmin);
     result = TCL_OK;
 err:
     Ns_MutexUnlock(&poolPtr->lock);
+    if (result == TCL_OK && (poolPtr->min > 0 || poolPtr->maxrss > 0)) {
+	WakeWarm();
+    }
     return result;
 }
 
 
-static void
+static int
 SetOpt(char *str, char **optPtr)
 {
+    if (str != NULL && *str == '\0') {
+	str = NULL;
+    }
+    if (str == NULL ? *optPtr == NULL
+		    : (*optPtr != NULL && STREQ(str, *optPtr))) {
+	return 0;
+    }
     if (*optPtr != NULL) {
 	ns_free(*optPtr);
     }
-    if (str != NULL && *str != '\0') {
-	*optPtr = ns_strdup(str);
-    } else {
-	*optPtr = NULL;
-    }
+    *optPtr = (str != NULL ? ns_strdup(str) : NULL);
+    return 1;
 }
 
 static void
@@ -732,6 +969,63 @@ AppendInt(Tcl_Interp *interp, char *flag, int i)
     Append(interp, flag, buf);
 }
 
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StatsObjCmd --
+ *
+ *	Sub-command to return pool statistics.
+ *
+ * Results:
+ *	Standard Tcl result.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+StatsObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
+{
+    InterpData *idataPtr = data;
+    Pool *poolPtr;
+    Proxy *proxyPtr;
+    int nidle, nwarm, avg;
+
+    if (objc != 3) {
+	Tcl_WrongNumArgs(interp, 2, objv, "pool");
+	return TCL_ERROR;
+    }
+    poolPtr = GetPool(idataPtr, objv[2]);
+    Ns_MutexLock(&poolPtr->lock);
+    nidle = nwarm = 0;
+    for (proxyPtr = poolPtr->firstPtr; proxyPtr != NULL;
+	    proxyPtr = proxyPtr->nextPtr) {
+	++nidle;
+	if (proxyPtr->procPtr != NULL) {
+	    ++nwarm;
+	}
+    }
+    avg = 0;
+    if (poolPtr->nspawn > 0) {
+	avg = (poolPtr->spawntime.sec * 1000000 + poolPtr->spawntime.usec)
+	    / poolPtr->nspawn;
+    }
+    AppendInt(interp, "active", poolPtr->max - poolPtr->avail);
+    AppendInt(interp, "idle", nidle);
+    AppendInt(interp, "warm", nwarm);
+    AppendInt(interp, "spawns", poolPtr->nspawn);
+    AppendInt(interp, "spawnavg", avg);
+    AppendInt(interp, "spawnmax", poolPtr->spawnmax.sec * 1000000
+	      + poolPtr->spawnmax.usec);
+    AppendInt(interp, "recycled", poolPtr->nrecycle);
+    Ns_MutexUnlock(&poolPtr->lock);
+    return TCL_OK;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -836,23 +1130,7 @@ GetObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 		if (proxyPtr != NULL) {
 		    poolPtr->firstPtr = proxyPtr->nextPtr;
 		} else {
-                    char int_buf[20]; /* same value as in other places */
-
-		    proxyPtr = ns_calloc(1, sizeof(Proxy));
-		    proxyPtr->poolPtr = poolPtr;
-                    
-                    /* The user provided name is used together with a
-                       constant string and a running number to the
-                       proxy id.  We have to truncate the name if it
-                       is too long to prevent buffer overflows; the
-                       constant part "-proxy-" is 7 characters long */
-                    sprintf(int_buf, "%d", poolPtr->nextid++);
-                    strncat(proxyPtr->id, poolPtr->name,  
-                            MAX_PROXY_ID_LEN - (strlen(int_buf) + 7 + 1));
-                    strcat(proxyPtr->id, "-proxy-");
-                    strcat(proxyPtr->id, int_buf);
-                    
-		    Tcl_DStringInit(&proxyPtr->in);
+		    proxyPtr = NewProxy(poolPtr, NULL);
 		}
 		proxyPtr->nextPtr = firstPtr;
 		firstPtr = proxyPtr;
@@ -913,9 +1191,59 @@ GetObjCmd(ClientData data, Tcl_Interp *interp, int objc, Tcl_Obj **objv)
 	proxyPtr->idPtr  = idPtr;
 	Tcl_AppendElement(interp, proxyPtr->id);
     }
+    if (poolPtr->min > 0) {
+	WakeWarm();
+    }
     return TCL_OK;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NewProxy --
+ *
+ *	Allocate a new proxy, called with the pool locked.
+ *
+ * Results:
+ *	Pointer to new Proxy.
+ *
+ * Side effects:
+ *	The proxy id is built from the pool name and the given suffix
+ *	or the next id number of the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Proxy *
+NewProxy(Pool *poolPtr, char *suffix)
+{
+    Proxy *proxyPtr;
+    char int_buf[20]; /* same value as in other places */
+
+    proxyPtr = ns_calloc(1, sizeof(Proxy));
+    proxyPtr->poolPtr = poolPtr;
+                    
+    /* The user provided name is used together with a
+       constant string and a running number to the
+       proxy id.  We have to truncate the name if it
+       is too long to prevent buffer overflows; the
+       constant part "-proxy-" is 7 characters long */
+    if (suffix == NULL) {
+	sprintf(int_buf, "%d", poolPtr->nextid++);
+	suffix = int_buf;
+    }
+    strncat(proxyPtr->id, poolPtr->name,  
+	    MAX_PROXY_ID_LEN - (strlen(suffix) + 7 + 1));
+    strcat(proxyPtr->id, "-proxy-");
+    strcat(proxyPtr->id, suffix);
+                    
+    Tcl_DStringInit(&proxyPtr->in);
+    Tcl_InitHashTable(&proxyPtr->results, TCL_ONE_WORD_KEYS);
+    return proxyPtr;
+}
+
+
 
 /*
  *----------------------------------------------------------------------
@@ -1015,6 +1343,7 @@ static Err
 Check(Tcl_Interp *interp, Proxy *proxyPtr)
 {
     Pool *poolPtr = proxyPtr->poolPtr;
+    Ns_Time start, end, diff;
     Err err = ENone;
 
     if (proxyPtr->procPtr != NULL
@@ -1023,6 +1352,7 @@ Check(Tcl_Interp *interp, Proxy *proxyPtr)
 	Tcl_ResetResult(interp);
     }
     if (proxyPtr->procPtr == NULL) {
+	Ns_GetTime(&start);
 	proxyPtr->procPtr = Exec(interp, proxyPtr);
 	if (proxyPtr->procPtr == NULL) {
 	    err = EExec;
@@ -1030,6 +1360,17 @@ Check(Tcl_Interp *interp, Proxy *proxyPtr)
 		&& Eval(interp, proxyPtr, poolPtr->init, -1) != TCL_OK) {
 	    Close(proxyPtr);
 	    err = EInit;
+	} else {
+	    Ns_GetTime(&end);
+	    Ns_DiffTime(&end, &start, &diff);
+	    Ns_MutexLock(&poolPtr->lock);
+	    ++poolPtr->nspawn;
+	    Ns_IncrTime(&poolPtr->spawntime, diff.sec, diff.usec);
+	    if (Ns_DiffTime(&diff, &poolPtr->spawnmax, NULL) > 0) {
+		poolPtr->spawnmax = diff;
+	    }
+	    Ns_MutexUnlock(&poolPtr->lock);
+	    proxyPtr->nevals = 0;
 	}
     }
     return err;
@@ -1056,9 +1397,9 @@ static Proc *
 Exec(Tcl_Interp *interp, Proxy *proxyPtr)
 {
     Pool *poolPtr = proxyPtr->poolPtr;
-    char *argv[5], active[100];
+    char *argv[7], active[100], fd[20], min[20];
     Proc *procPtr;
-    int rpipe[2], wpipe[2], pid, len;
+    int rpipe[2], wpipe[2], pid, len, shmfd, cfd;
 
     len = sizeof(active) - 1;
     memset(active, ' ', len);
@@ -1068,32 +1409,76 @@ Exec(Tcl_Interp *interp, Proxy *proxyPtr)
     argv[2] = proxyPtr->id;
     argv[3] = active;
     argv[4] = NULL;
+
+    /*
+     * Create the result segment.  The slave inherits a copy of the
+     * descriptor without close-on-exec, made just before the exec
+     * so other children forked meanwhile are unlikely to get it,
+     * and is passed its number.
+     */
+
+    shmfd = cfd = -1;
+#ifdef SYS_memfd_create
+    if (poolPtr->shmmin > 0) {
+	shmfd = syscall(SYS_memfd_create, "nsproxy", 1 /* MFD_CLOEXEC */);
+	if (shmfd < 0) {
+	    Ns_Log(Warning, "nsproxy: memfd_create failed: %s",
+		   strerror(errno));
+	}
+    }
+#endif
     if (ns_pipe(rpipe) != 0) {
 	Tcl_AppendResult(interp, "pipe failed: ", Tcl_PosixError(interp), NULL);
-	return NULL;
+	goto err;
     }
     if (ns_pipe(wpipe) != 0) {
 	Tcl_AppendResult(interp, "pipe failed: ", Tcl_PosixError(interp), NULL);
 	close(rpipe[0]);
 	close(rpipe[1]);
-	return NULL;
+	goto err;
+    }
+    if (shmfd >= 0) {
+	cfd = dup(shmfd);
+	if (cfd < 0) {
+	    Ns_Log(Warning, "nsproxy: dup failed: %s", strerror(errno));
+	    close(shmfd);
+	    shmfd = -1;
+	} else {
+	    sprintf(fd, "%d", cfd);
+	    sprintf(min, "%d", poolPtr->shmmin);
+	    argv[4] = fd;
+	    argv[5] = min;
+	    argv[6] = NULL;
+	}
     }
     pid = Ns_ExecArgv(poolPtr->exec, NULL, rpipe[0], wpipe[1], argv, NULL);
+    if (cfd >= 0) {
+	close(cfd);
+    }
     close(rpipe[0]);
     close(wpipe[1]);
     if (pid < 0) {
 	Tcl_AppendResult(interp, "exec failed: ", Tcl_PosixError(interp), NULL);
 	close(wpipe[0]);
 	close(rpipe[1]);
-	return NULL;
+	goto err;
     }
     procPtr = ns_malloc(sizeof(Proc));
     procPtr->poolPtr = proxyPtr->poolPtr;
     procPtr->nextPtr = NULL;
     procPtr->pid = pid;
+    procPtr->nonblock = 0;
     procPtr->rfd = wpipe[0];
     procPtr->wfd = rpipe[1];
+    memset(&procPtr->shm, 0, sizeof(Shm));
+    procPtr->shm.fd = shmfd;
     return procPtr;
+
+err:
+    if (shmfd >= 0) {
+	close(shmfd);
+    }
+    return NULL;
 }
 
 
@@ -1155,7 +1540,7 @@ Send(Tcl_Interp *interp, Proxy *proxyPtr, char *script)
 
     if (proxyPtr->procPtr == NULL) {
 	err = EDead;
-    } else if (proxyPtr->state != Idle) {
+    } else if (proxyPtr->state != Idle || proxyPtr->npending > 0) {
 	err = EBusy;
     } else {
 	len = script ? strlen(script) : 0;
@@ -1163,10 +1548,14 @@ Send(Tcl_Interp *interp, Proxy *proxyPtr, char *script)
 	req.major = htons(MAJOR);
 	req.minor = htons(MINOR);
 	proxyPtr->state = Busy;
+	if (len > 0) {
+	    ++proxyPtr->nevals;
+	}
 	Tcl_DStringAppend(&proxyPtr->in, (char *) &req, sizeof(req));
 	if (len > 0) {
 	    Tcl_DStringAppend(&proxyPtr->in, script, len);
 	}
+	SetNonBlock(proxyPtr->procPtr, 0);
 	if (!SendBuf(proxyPtr->procPtr, proxyPtr->poolPtr->tsend, &proxyPtr->in)) {
 	    Reset(proxyPtr);
 	    err = ESend;
@@ -1257,7 +1646,8 @@ Recv(Tcl_Interp *interp, Proxy *proxyPtr)
 	Tcl_DStringInit(&out);
 	if (!RecvBuf(procPtr, poolPtr->trecv, &out)) {
 	    err = ERecv;
-	} else if (!Import(interp, &out, &result)) {
+	} else if (!Import(interp, out.string, out.length, &procPtr->shm,
+			   &result)) {
 	    err = EImport;
 	} else {
 	    proxyPtr->state = Idle;
@@ -1277,108 +1667,576 @@ Recv(Tcl_Interp *interp, Proxy *proxyPtr)
 /*
  *----------------------------------------------------------------------
  *
- * SendBuf --
+ * Queue --
  *
- *	Send a dstring buffer.
+ *	Send a tagged script to a proxy without waiting for the result.
+ *	Several scripts may be queued to the same proxy and their
+ *	results later collected in any order with Collect.
  *
  * Results:
- *	1 if sent, 0 on error.
+ *	TCL_OK if script sent, TCL_ERROR otherwise.
  *
  * Side effects:
- *	None.
+ *	The request tag is stored in given tagPtr.  Will format error
+ *	message in given interp on failure.
  *
  *----------------------------------------------------------------------
  */
 
 static int
-SendBuf(Proc *procPtr, int ms, Tcl_DString *dsPtr)
+Queue(Tcl_Interp *interp, Proxy *proxyPtr, char *script, Tag *tagPtr)
 {
-    int n;
-    uint32_t ulen;
-    struct iovec iov[2];
+    Tcl_HashEntry *hPtr;
+    Tcl_DString ds;
+    Err err = ENone;
+    Req req;
+    Tag tag, ntag;
+    int len, new;
 
-    ulen = htonl(dsPtr->length);
-    iov[0].iov_base = (caddr_t) &ulen;
-    iov[0].iov_len  = sizeof(ulen);
-    iov[1].iov_base = dsPtr->string;
-    iov[1].iov_len  = dsPtr->length;
-    while ((iov[0].iov_len + iov[1].iov_len) > 0) {
-	n = writev(procPtr->wfd, iov, 2);
-	if (n < 0 && errno == EAGAIN
-		&& WaitFd(procPtr->wfd, POLLOUT, ms)) {
-	    n = writev(procPtr->wfd, iov, 2);
+    len = strlen(script);
+    Tcl_DStringInit(&ds);
+    Ns_MutexLock(&proxyPtr->lock);
+    while (proxyPtr->busy) {
+	Ns_CondWait(&proxyPtr->cond, &proxyPtr->lock);
+    }
+    if (proxyPtr->procPtr == NULL) {
+	err = EDead;
+    } else if (proxyPtr->state != Idle) {
+	err = EBusy;
+    } else {
+	do {
+	    tag = ++proxyPtr->nexttag;
+	    hPtr = Tcl_CreateHashEntry(&proxyPtr->results, (char *) (long) tag,
+				       &new);
+	} while (!new);
+	Tcl_SetHashValue(hPtr, NULL);
+	req.len = htonl(len);
+	req.major = htons(MAJOR);
+	req.minor = htons(MINOR_TAGGED);
+	ntag = htonl(tag);
+	Tcl_DStringAppend(&ds, (char *) &req, sizeof(req));
+	Tcl_DStringAppend(&ds, (char *) &ntag, sizeof(ntag));
+	Tcl_DStringAppend(&ds, script, len);
+	++proxyPtr->npending;
+	++proxyPtr->nevals;
+	proxyPtr->busy = 1;
+	Ns_MutexUnlock(&proxyPtr->lock);
+	if (!SendTagged(proxyPtr, &ds)) {
+	    err = ESend;
 	}
-	if (n < 0) {
-	    return 0;
+	Ns_MutexLock(&proxyPtr->lock);
+	proxyPtr->busy = 0;
+	if (err != ENone) {
+	    Tcl_DeleteHashEntry(hPtr);
+	    Fail(proxyPtr);
 	}
-	UpdateIov(iov, n);
+	Ns_CondBroadcast(&proxyPtr->cond);
     }
-    return 1;
+    Ns_MutexUnlock(&proxyPtr->lock);
+    Tcl_DStringFree(&ds);
+    if (err != ENone) {
+	Tcl_AppendResult(interp, "could not queue script \"", script,
+			 "\" to proxy \"", proxyPtr->id, "\": ",
+			 ProxyError(interp, err), NULL);
+	return TCL_ERROR;
+    }
+    *tagPtr = tag;
+    return TCL_OK;
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
- * RecvBuf --
+ * Collect --
  *
- *	Receive a dstring buffer.
+ *	Wait for and receive the result of a queued script.  Any
+ *	thread waiting for a result reads responses from the pipe
+ *	for all other waiting threads.
  *
  * Results:
- *	1 if received, 0 on error.
+ *	Depends on script.
  *
  * Side effects:
- *	Will resize output dstring as needed.
+ *	Will return proxy response or format error message in given
+ *	interp.  On timeout the request remains pending unless
+ *	abandon is set in which case the result will be discarded.
  *
  *----------------------------------------------------------------------
  */
 
 static int
-RecvBuf(Proc *procPtr, int ms, Tcl_DString *dsPtr)
+Collect(Tcl_Interp *interp, Proxy *proxyPtr, Tag tag, int ms, int abandon)
 {
-    uint32_t ulen;
-    struct iovec iov[2];
-    char *ptr;
-    int n, len, avail;
+    Tcl_HashEntry *hPtr;
+    Tcl_DString *dsPtr;
+    Ns_Time timeout, now, diff;
+    Err err = ENone;
+    char buf[20];
+    int rfd, result, ready;
 
-    avail = dsPtr->spaceAvl - 1;
-    iov[0].iov_base = (caddr_t) &ulen;
-    iov[0].iov_len  = sizeof(ulen);
-    iov[1].iov_base = dsPtr->string;
-    iov[1].iov_len  = avail;
-    while (iov[0].iov_len > 0) {
-    	n = readv(procPtr->rfd, iov, 2);
-	if (n < 0 && errno == EAGAIN
-		&& WaitFd(procPtr->rfd, POLLIN, ms)) {
-    	    n = readv(procPtr->rfd, iov, 2);
-	}
-    	if (n <= 0) {
-	    goto err;
-	}
-	UpdateIov(iov, n);
+    if (ms < 0) {
+	ms = proxyPtr->poolPtr->teval;
     }
-    n = avail - iov[1].iov_len;
-    Tcl_DStringSetLength(dsPtr, n);
-    len = ntohl(ulen);
-    Tcl_DStringSetLength(dsPtr, len);
-    len -= n;
-    ptr  = dsPtr->string + n;
-    while (len > 0) {
-	n = read(procPtr->rfd, ptr, len);
-	if (n < 0 && errno == EAGAIN
-		&& WaitFd(procPtr->rfd, POLLIN, ms)) {
-	    n = read(procPtr->rfd, ptr, len);
-	}
-	if (n <= 0) {
-	    goto err;
-	}
-	len -= n;
-	ptr += n;
+    Ns_GetTime(&timeout);
+    Ns_IncrTime(&timeout, 0, ms * 1000);
+    Ns_MutexLock(&proxyPtr->lock);
+    hPtr = Tcl_FindHashEntry(&proxyPtr->results, (char *) (long) tag);
+    if (hPtr == NULL) {
+	Ns_MutexUnlock(&proxyPtr->lock);
+	sprintf(buf, "%u", (unsigned int) tag);
+	Tcl_AppendResult(interp, "no such request in proxy \"",
+			 proxyPtr->id, "\": ", buf, NULL);
+	return TCL_ERROR;
     }
-    return 1;
+    while (err == ENone && (dsPtr = Tcl_GetHashValue(hPtr)) == NULL) {
+	Ns_GetTime(&now);
+	if (proxyPtr->procPtr == NULL) {
+	    err = EDead;
+	} else if (Ns_DiffTime(&timeout, &now, &diff) <= 0) {
+	    err = EEvalTimeout;
+	} else if (proxyPtr->busy) {
+	    (void) Ns_CondTimedWait(&proxyPtr->cond, &proxyPtr->lock,
+				    &timeout);
+	} else {
 
-err:
-    if (n == 0) {
+	    /*
+	     * Wait for a response without the lock, then receive it if
+	     * no other thread did so in the meantime.
+	     */
+
+	    rfd = proxyPtr->procPtr->rfd;
+	    Ns_MutexUnlock(&proxyPtr->lock);
+	    ready = WaitFd(rfd, POLLIN, diff.sec * 1000 + diff.usec / 1000 + 1);
+	    Ns_MutexLock(&proxyPtr->lock);
+	    if (ready && !proxyPtr->busy && proxyPtr->procPtr != NULL
+		    && proxyPtr->procPtr->rfd == rfd && WaitFd(rfd, POLLIN, 0)) {
+		proxyPtr->busy = 1;
+		Ns_MutexUnlock(&proxyPtr->lock);
+		ready = RecvTagged(proxyPtr);
+		Ns_MutexLock(&proxyPtr->lock);
+		proxyPtr->busy = 0;
+		if (!ready) {
+		    Fail(proxyPtr);
+		}
+		Ns_CondBroadcast(&proxyPtr->cond);
+	    }
+	}
+    }
+    if (dsPtr != NULL || err == EDead || abandon) {
+	Tcl_DeleteHashEntry(hPtr);
+    }
+    Ns_MutexUnlock(&proxyPtr->lock);
+    if (dsPtr == &dead) {
+	err = EDead;
+    } else if (dsPtr != NULL) {
+	if (!Import(interp, dsPtr->string + sizeof(Tag),
+		    dsPtr->length - sizeof(Tag), NULL, &result)) {
+	    err = EImport;
+	}
+	Tcl_DStringFree(dsPtr);
+	ns_free(dsPtr);
+    }
+    if (err != ENone) {
+	Tcl_AppendResult(interp, "could not collect result from proxy \"",
+			 proxyPtr->id, "\": ", ProxyError(interp, err), NULL);
+	return TCL_ERROR;
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SharedEval --
+ *
+ *	Evaluate a script in the pool's shared proxy.  Requests from
+ *	all threads are tagged and multiplexed over a single slave
+ *	process which is started as needed.
+ *
+ * Results:
+ *	Depends on script.
+ *
+ * Side effects:
+ *	Will return proxy response or format error message in given
+ *	interp.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SharedEval(Tcl_Interp *interp, Pool *poolPtr, char *script, int ms)
+{
+    Proxy *proxyPtr;
+    Err err = ENone;
+    Tag tag;
+
+    Ns_MutexLock(&poolPtr->lock);
+    if (poolPtr->sharedPtr == NULL) {
+	poolPtr->sharedPtr = NewProxy(poolPtr, "shared");
+    }
+    proxyPtr = poolPtr->sharedPtr;
+    Ns_MutexUnlock(&poolPtr->lock);
+
+    Ns_MutexLock(&proxyPtr->lock);
+    while (proxyPtr->busy) {
+	Ns_CondWait(&proxyPtr->cond, &proxyPtr->lock);
+    }
+    if (proxyPtr->procPtr == NULL) {
+	proxyPtr->busy = 1;
+	Ns_MutexUnlock(&proxyPtr->lock);
+	err = Check(interp, proxyPtr);
+	Ns_MutexLock(&proxyPtr->lock);
+	proxyPtr->busy = 0;
+	Ns_CondBroadcast(&proxyPtr->cond);
+    }
+    Ns_MutexUnlock(&proxyPtr->lock);
+    if (err != ENone) {
+	Tcl_AppendResult(interp, "could not start shared proxy \"",
+			 proxyPtr->id, "\": ", ProxyError(interp, err), NULL);
+	return TCL_ERROR;
+    }
+    if (Queue(interp, proxyPtr, script, &tag) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    return Collect(interp, proxyPtr, tag, ms, 1);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SendTagged --
+ *
+ *	Send a tagged request, called by the thread which set the
+ *	proxy busy.  The write pipe is made non-blocking and responses
+ *	are received while it is full to avoid a deadlock with a slave
+ *	blocked writing results.
+ *
+ * Results:
+ *	1 if sent, 0 on error.
+ *
+ * Side effects:
+ *	May store results of earlier requests.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SendTagged(Proxy *proxyPtr, Tcl_DString *dsPtr)
+{
+    Proc *procPtr = proxyPtr->procPtr;
+    struct pollfd pfds[2];
+    struct iovec iov[2];
+    uint32_t ulen;
+    int n;
+
+    SetNonBlock(procPtr, 1);
+    ulen = htonl(dsPtr->length);
+    iov[0].iov_base = (caddr_t) &ulen;
+    iov[0].iov_len  = sizeof(ulen);
+    iov[1].iov_base = dsPtr->string;
+    iov[1].iov_len  = dsPtr->length;
+    pfds[0].fd = procPtr->wfd;
+    pfds[0].events = POLLOUT;
+    pfds[1].fd = procPtr->rfd;
+    pfds[1].events = POLLIN;
+    while ((iov[0].iov_len + iov[1].iov_len) > 0) {
+	n = writev(procPtr->wfd, iov, 2);
+	if (n < 0 && errno == EAGAIN) {
+	    pfds[0].revents = pfds[1].revents = 0;
+	    do {
+		n = poll(pfds, 2, proxyPtr->poolPtr->tsend);
+	    } while (n < 0 && errno == EINTR);
+	    if (n <= 0) {
+		if (n == 0) {
+		    errno = ETIMEDOUT;
+		}
+		return 0;
+	    }
+	    if (pfds[1].revents != 0 && !RecvTagged(proxyPtr)) {
+		return 0;
+	    }
+	    continue;
+	}
+	if (n < 0) {
+	    return 0;
+	}
+	UpdateIov(iov, n);
+    }
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RecvTagged --
+ *
+ *	Receive a tagged response, called by the thread which set the
+ *	proxy busy.
+ *
+ * Results:
+ *	1 if received, 0 on error.
+ *
+ * Side effects:
+ *	The response is stored for the request with the same tag, or
+ *	discarded if the request was abandoned.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+RecvTagged(Proxy *proxyPtr)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_DString *dsPtr;
+    Tag tag;
+
+    dsPtr = ns_malloc(sizeof(Tcl_DString));
+    Tcl_DStringInit(dsPtr);
+    if (!RecvBuf(proxyPtr->procPtr, proxyPtr->poolPtr->trecv, dsPtr)
+	    || dsPtr->length < sizeof(Tag) + sizeof(Res)) {
+	Tcl_DStringFree(dsPtr);
+	ns_free(dsPtr);
+	return 0;
+    }
+    memcpy(&tag, dsPtr->string, sizeof(Tag));
+    tag = ntohl(tag);
+    Ns_MutexLock(&proxyPtr->lock);
+    --proxyPtr->npending;
+    hPtr = Tcl_FindHashEntry(&proxyPtr->results, (char *) (long) tag);
+    if (hPtr != NULL && Tcl_GetHashValue(hPtr) == NULL) {
+	Tcl_SetHashValue(hPtr, dsPtr);
+	dsPtr = NULL;
+	Ns_CondBroadcast(&proxyPtr->cond);
+    }
+    Ns_MutexUnlock(&proxyPtr->lock);
+    if (dsPtr != NULL) {
+	Tcl_DStringFree(dsPtr);
+	ns_free(dsPtr);
+    }
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Fail --
+ *
+ *	Close a proxy after a pipelined send or receive error, called
+ *	with the proxy locked.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	All pending requests will fail with EDead.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Fail(Proxy *proxyPtr)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+
+    Close(proxyPtr);
+    hPtr = Tcl_FirstHashEntry(&proxyPtr->results, &search);
+    while (hPtr != NULL) {
+	if (Tcl_GetHashValue(hPtr) == NULL) {
+	    Tcl_SetHashValue(hPtr, &dead);
+	}
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+    proxyPtr->npending = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Discard --
+ *
+ *	Discard all uncollected results of pipelined requests.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The proxy process is closed if any responses are in transit.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Discard(Proxy *proxyPtr)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    Tcl_DString *dsPtr;
+
+    if (proxyPtr->npending > 0) {
+	Close(proxyPtr);
+	proxyPtr->npending = 0;
+    }
+    hPtr = Tcl_FirstHashEntry(&proxyPtr->results, &search);
+    while (hPtr != NULL) {
+	dsPtr = Tcl_GetHashValue(hPtr);
+	if (dsPtr != NULL && dsPtr != &dead) {
+	    Tcl_DStringFree(dsPtr);
+	    ns_free(dsPtr);
+	}
+	Tcl_DeleteHashEntry(hPtr);
+	hPtr = Tcl_NextHashEntry(&search);
+    }
+}
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SendBuf --
+ *
+ *	Send a dstring buffer.
+ *
+ * Results:
+ *	1 if sent, 0 on error.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SendBuf(Proc *procPtr, int ms, Tcl_DString *dsPtr)
+{
+    int n;
+    uint32_t ulen;
+    struct iovec iov[2];
+
+    ulen = htonl(dsPtr->length);
+    iov[0].iov_base = (caddr_t) &ulen;
+    iov[0].iov_len  = sizeof(ulen);
+    iov[1].iov_base = dsPtr->string;
+    iov[1].iov_len  = dsPtr->length;
+    while ((iov[0].iov_len + iov[1].iov_len) > 0) {
+	n = writev(procPtr->wfd, iov, 2);
+	if (n < 0 && errno == EAGAIN
+		&& WaitFd(procPtr->wfd, POLLOUT, ms)) {
+	    n = writev(procPtr->wfd, iov, 2);
+	}
+	if (n < 0) {
+	    return 0;
+	}
+	UpdateIov(iov, n);
+    }
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetNonBlock --
+ *
+ *	Set the write pipe blocking for classic requests or non-blocking
+ *	for tagged requests.  Classic sends block until the slave reads
+ *	the request as before pipelining was supported.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Mode of the write pipe is changed if necessary.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetNonBlock(Proc *procPtr, int nonblock)
+{
+    int status;
+
+    if (procPtr->nonblock != nonblock) {
+	if (nonblock) {
+	    status = Ns_SockSetNonBlocking(procPtr->wfd);
+	} else {
+	    status = Ns_SockSetBlocking(procPtr->wfd);
+	}
+	if (status != NS_OK) {
+	    Ns_Log(Warning, "nsproxy: could not set pipe %d %sblocking: %s",
+		   procPtr->wfd, nonblock ? "non-" : "", strerror(errno));
+	} else {
+	    procPtr->nonblock = nonblock;
+	}
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RecvBuf --
+ *
+ *	Receive a dstring buffer.
+ *
+ * Results:
+ *	1 if received, 0 on error.
+ *
+ * Side effects:
+ *	Will resize output dstring as needed.  Only the length header
+ *	is read before the buffer to avoid reading into the next of
+ *	several pipelined buffers.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+RecvBuf(Proc *procPtr, int ms, Tcl_DString *dsPtr)
+{
+    uint32_t ulen;
+    char *ptr;
+    int n, len;
+
+    ptr = (char *) &ulen;
+    len = sizeof(ulen);
+    while (len > 0) {
+	n = read(procPtr->rfd, ptr, len);
+	if (n < 0 && errno == EAGAIN
+		&& WaitFd(procPtr->rfd, POLLIN, ms)) {
+	    n = read(procPtr->rfd, ptr, len);
+	}
+	if (n <= 0) {
+	    goto err;
+	}
+	len -= n;
+	ptr += n;
+    }
+    len = ntohl(ulen);
+    Tcl_DStringSetLength(dsPtr, len);
+    ptr  = dsPtr->string;
+    while (len > 0) {
+	n = read(procPtr->rfd, ptr, len);
+	if (n < 0 && errno == EAGAIN
+		&& WaitFd(procPtr->rfd, POLLIN, ms)) {
+	    n = read(procPtr->rfd, ptr, len);
+	}
+	if (n <= 0) {
+	    goto err;
+	}
+	len -= n;
+	ptr += n;
+    }
+    return 1;
+
+err:
+    if (n == 0) {
 	errno = EPIPE;
     }
     return 0;
@@ -1471,10 +2329,10 @@ UpdateIov(struct iovec *iov, int n)
  */
 
 static void
-Export(Tcl_Interp *interp, int code, Tcl_DString *dsPtr)
+Export(Tcl_Interp *interp, int code, Tcl_DString *dsPtr, Shm *shmPtr)
 {
     Res hdr;
-    char *einfo = NULL, *ecode = NULL, *result;
+    char *einfo = NULL, *ecode = NULL, *result = NULL, *ptr;
     int   clen, ilen, rlen;
 
     clen = ilen = rlen = 0;
@@ -1495,6 +2353,30 @@ Export(Tcl_Interp *interp, int code, Tcl_DString *dsPtr)
     hdr.ilen = htonl(ilen);
     hdr.rlen = htonl(rlen);
     Tcl_DStringAppend(dsPtr, (char *) &hdr, sizeof(hdr));
+
+    /*
+     * Copy large results directly to the segment, sending only the
+     * header which Import recognizes by the missing data.
+     */
+
+    if (shmPtr != NULL && shmPtr->fd >= 0 && shmPtr->min > 0
+	    && (clen + ilen + rlen) >= shmPtr->min
+	    && MapShm(shmPtr, clen + ilen + rlen + 1, 1)) {
+	ptr = shmPtr->addr;
+	if (clen > 0) {
+	    memcpy(ptr, ecode, clen);
+	    ptr += clen;
+	}
+	if (ilen > 0) {
+	    memcpy(ptr, einfo, ilen);
+	    ptr += ilen;
+	}
+	if (rlen > 0) {
+	    memcpy(ptr, result, rlen);
+	}
+	ptr[rlen] = '\0';
+	return;
+    }
     if (clen > 0) {
     	Tcl_DStringAppend(dsPtr, ecode, clen);
     }
@@ -1506,6 +2388,7 @@ Export(Tcl_Interp *interp, int code, Tcl_DString *dsPtr)
     }
 }
 
+
 
 /*
  *----------------------------------------------------------------------
@@ -1524,21 +2407,27 @@ Export(Tcl_Interp *interp, int code, Tcl_DString *dsPtr)
  */
 
 static int
-Import(Tcl_Interp *interp, Tcl_DString *dsPtr, int *resultPtr)
+Import(Tcl_Interp *interp, char *buf, int len, Shm *shmPtr, int *resultPtr)
 {
     Res *resPtr;
     char *str;
     int rlen, clen, ilen;
 
-    if (dsPtr->length < sizeof(Res)) {
+    if (len < sizeof(Res)) {
 	return 0;
     }
-    resPtr = (Res *) dsPtr->string;
-    str = dsPtr->string + sizeof(Res);
+    resPtr = (Res *) buf;
+    str = buf + sizeof(Res);
     clen = ntohl(resPtr->clen);
     ilen = ntohl(resPtr->ilen);
     rlen = ntohl(resPtr->rlen);
-    if ((clen + ilen + rlen) > (dsPtr->length - sizeof(Res))) {
+    if (len == sizeof(Res) && (clen + ilen + rlen) > 0 && shmPtr != NULL
+	    && shmPtr->fd >= 0) {
+	if (!MapShm(shmPtr, clen + ilen + rlen + 1, 0)) {
+	    return 0;
+	}
+	str = shmPtr->addr;
+    } else if ((clen + ilen + rlen) > (len - sizeof(Res))) {
 	return 0;
     }
     if (clen > 0) {
@@ -1550,12 +2439,102 @@ Import(Tcl_Interp *interp, Tcl_DString *dsPtr, int *resultPtr)
 	str += ilen;
     }
     if (rlen > 0) {
-    	Tcl_SetResult(interp, str, TCL_VOLATILE);
+    	Tcl_SetObjResult(interp, Tcl_NewStringObj(str, rlen));
     }
     *resultPtr = ntohl(resPtr->code);
     return 1;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MapShm --
+ *
+ *	Map at least size bytes of a result segment.  The slave grows
+ *	the segment as needed while the parent maps the size set by
+ *	the slave.
+ *
+ * Results:
+ *	1 if mapped, 0 on error.
+ *
+ * Side effects:
+ *	Segment may be resized and remapped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+MapShm(Shm *shmPtr, size_t size, int grow)
+{
+    struct stat st;
+    size_t pagesize;
+
+    if (shmPtr->size >= size) {
+	return 1;
+    }
+    if (fstat(shmPtr->fd, &st) != 0) {
+	return 0;
+    }
+    if ((size_t) st.st_size < size) {
+	if (!grow) {
+	    return 0;
+	}
+
+	/*
+	 * Round up to a page and at least double the current size to
+	 * avoid resizing for each slightly larger result.
+	 */
+
+	pagesize = getpagesize();
+	if (size < (size_t) st.st_size * 2) {
+	    size = st.st_size * 2;
+	}
+	size = (size + pagesize - 1) & ~(pagesize - 1);
+	if (ftruncate(shmPtr->fd, size) != 0) {
+	    return 0;
+	}
+	st.st_size = size;
+    }
+    UnmapShm(shmPtr);
+    shmPtr->addr = mmap(NULL, st.st_size, PROT_READ | (grow ? PROT_WRITE : 0),
+			MAP_SHARED, shmPtr->fd, 0);
+    if (shmPtr->addr == MAP_FAILED) {
+	shmPtr->addr = NULL;
+	return 0;
+    }
+    shmPtr->size = st.st_size;
+    return 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UnmapShm --
+ *
+ *	Unmap a result segment.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+UnmapShm(Shm *shmPtr)
+{
+    if (shmPtr->addr != NULL) {
+	munmap(shmPtr->addr, shmPtr->size);
+	shmPtr->addr = NULL;
+	shmPtr->size = 0;
+    }
+}
+
+
 
 /*
  *----------------------------------------------------------------------
@@ -1642,8 +2621,12 @@ Close(Proxy *proxyPtr)
 static void
 FreeProxy(Proxy *proxyPtr)
 {
+    Discard(proxyPtr);
     Close(proxyPtr);
     Ns_DStringFree(&proxyPtr->in);
+    Tcl_DeleteHashTable(&proxyPtr->results);
+    Ns_MutexDestroy(&proxyPtr->lock);
+    Ns_CondDestroy(&proxyPtr->cond);
     ns_free(proxyPtr);
 }
 
@@ -1715,13 +2698,25 @@ PutProxy(Proxy *proxyPtr)
 static int
 ReleaseProxy(Tcl_Interp *interp, Proxy *proxyPtr)
 {
+    Pool *poolPtr = proxyPtr->poolPtr;
     int result = TCL_OK;
 
+    Discard(proxyPtr);
     Reset(proxyPtr);
-    if (proxyPtr->poolPtr->reinit != NULL) {
-	result = Eval(interp, proxyPtr, proxyPtr->poolPtr->reinit, -1);
+    if (poolPtr->reinit != NULL) {
+	result = Eval(interp, proxyPtr, poolPtr->reinit, -1);
+    }
+    if (poolPtr->maxevals > 0 && proxyPtr->procPtr != NULL
+	    && proxyPtr->nevals >= poolPtr->maxevals) {
+	Close(proxyPtr);
+	Ns_MutexLock(&poolPtr->lock);
+	++poolPtr->nrecycle;
+	Ns_MutexUnlock(&poolPtr->lock);
     }
     PutProxy(proxyPtr);
+    if (poolPtr->min > 0) {
+	WakeWarm();
+    }
     return result;
 }
 
@@ -1835,10 +2830,285 @@ CloseThread(void *ignored)
 	} else {
 	    Ns_Log(Warning, "zombie: %d", procPtr->pid);
 	}
+	UnmapShm(&procPtr->shm);
+	if (procPtr->shm.fd >= 0) {
+	    close(procPtr->shm.fd);
+	}
 	ns_free(procPtr);
     }
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WakeWarm --
+ *
+ *	Wake the warm thread, creating it the first time.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Registers StopWarm to stop the thread at shutdown.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WakeWarm(void)
+{
+    static int once = 0;
+
+    Ns_MutexLock(&wlock);
+    if (!once) {
+	Ns_ThreadCreate(WarmThread, NULL, 0, &wthread);
+	Ns_RegisterAtShutdown(StopWarm, NULL);
+	once = 1;
+    }
+    wsignal = 1;
+    Ns_CondSignal(&wcond);
+    Ns_MutexUnlock(&wlock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StopWarm --
+ *
+ *	Shutdown callback to stop the warm thread.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Waits for the thread to finish any process being started.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StopWarm(void *ignored)
+{
+    Ns_MutexLock(&wlock);
+    wshutdown = 1;
+    Ns_CondSignal(&wcond);
+    Ns_MutexUnlock(&wlock);
+    Ns_ThreadJoin(&wthread, NULL);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WarmThread --
+ *
+ *	Background thread to keep min idle processes started in each
+ *	pool and recycle idle processes which exceed the max size.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Pools are checked when signaled and once a second until
+ *	shutdown.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WarmThread(void *ignored)
+{
+    Tcl_Interp *interp;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    Ns_DString ds;
+    Pool *poolPtr, **poolPtrPtr;
+    Ns_Time timeout;
+    int i, n;
+
+    Ns_ThreadSetName("-nsproxy:warm-");
+    interp = Tcl_CreateInterp();
+    Ns_DStringInit(&ds);
+    while (1) {
+	Ns_MutexLock(&wlock);
+	if (!wsignal && !wshutdown) {
+	    Ns_GetTime(&timeout);
+	    Ns_IncrTime(&timeout, 1, 0);
+	    (void) Ns_CondTimedWait(&wcond, &wlock, &timeout);
+	}
+	wsignal = 0;
+	if (wshutdown) {
+	    Ns_MutexUnlock(&wlock);
+	    break;
+	}
+	Ns_MutexUnlock(&wlock);
+
+	Ns_DStringTrunc(&ds, 0);
+	Ns_MutexLock(&plock);
+	hPtr = Tcl_FirstHashEntry(&pools, &search);
+	while (hPtr != NULL) {
+	    poolPtr = Tcl_GetHashValue(hPtr);
+	    Ns_DStringNAppend(&ds, (char *) &poolPtr, sizeof(Pool *));
+	    hPtr = Tcl_NextHashEntry(&search);
+	}
+	Ns_MutexUnlock(&plock);
+	poolPtrPtr = (Pool **) ds.string;
+	n = ds.length / sizeof(Pool *);
+	for (i = 0; i < n; ++i) {
+	    Warm(interp, poolPtrPtr[i]);
+	}
+    }
+    Ns_DStringFree(&ds);
+    Tcl_DeleteInterp(interp);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Warm --
+ *
+ *	Recycle oversized idle processes and start processes until
+ *	min idle proxies are ready.  After a failed start, starts are
+ *	retried after a wait doubling from 1 up to WARM_MAXWAIT seconds
+ *	until a start succeeds or the pool is configured.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Proxies being started are not available to other threads.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Warm(Tcl_Interp *interp, Pool *poolPtr)
+{
+    Proxy *proxyPtr, **nextPtrPtr;
+    int nidle, nwarm, rss;
+    Err err;
+
+    Ns_MutexLock(&poolPtr->lock);
+    if (poolPtr->maxrss > 0) {
+	for (proxyPtr = poolPtr->firstPtr; proxyPtr != NULL;
+		proxyPtr = proxyPtr->nextPtr) {
+	    if (proxyPtr->procPtr != NULL) {
+		rss = GetRss(proxyPtr->procPtr->pid);
+		if (rss > poolPtr->maxrss) {
+		    Ns_Log(Notice, "nsproxy: recycling %s: %d KB",
+			   proxyPtr->id, rss);
+		    Close(proxyPtr);
+		    ++poolPtr->nrecycle;
+		}
+	    }
+	}
+    }
+    while (1) {
+	nidle = nwarm = 0;
+	proxyPtr = NULL;
+	nextPtrPtr = &poolPtr->firstPtr;
+	while (*nextPtrPtr != NULL) {
+	    ++nidle;
+	    if ((*nextPtrPtr)->procPtr != NULL) {
+		++nwarm;
+	    } else if (proxyPtr == NULL) {
+		proxyPtr = *nextPtrPtr;
+		*nextPtrPtr = proxyPtr->nextPtr;
+		continue;
+	    }
+	    nextPtrPtr = &(*nextPtrPtr)->nextPtr;
+	}
+	if (nwarm >= poolPtr->min
+		|| (proxyPtr == NULL && nidle >= poolPtr->avail)) {
+	    if (proxyPtr != NULL) {
+		proxyPtr->nextPtr = poolPtr->firstPtr;
+		poolPtr->firstPtr = proxyPtr;
+	    }
+	    break;
+	}
+	if (poolPtr->warmwait > 0 && time(NULL) < poolPtr->warmretry) {
+	    if (proxyPtr != NULL) {
+		proxyPtr->nextPtr = poolPtr->firstPtr;
+		poolPtr->firstPtr = proxyPtr;
+	    }
+	    break;
+	}
+	if (proxyPtr == NULL) {
+	    proxyPtr = NewProxy(poolPtr, NULL);
+	}
+	--poolPtr->avail;
+	Ns_MutexUnlock(&poolPtr->lock);
+	err = Check(interp, proxyPtr);
+	Ns_MutexLock(&poolPtr->lock);
+	if (err == ENone) {
+	    poolPtr->warmwait = 0;
+	} else {
+	    if (poolPtr->warmwait == 0) {
+		poolPtr->warmwait = 1;
+	    } else if ((poolPtr->warmwait *= 2) > WARM_MAXWAIT) {
+		poolPtr->warmwait = WARM_MAXWAIT;
+	    }
+	    poolPtr->warmretry = time(NULL) + poolPtr->warmwait;
+	    Ns_Log(Error, "nsproxy: could not start %s: %s, "
+		   "retrying in %d seconds", proxyPtr->id,
+		   Tcl_GetStringResult(interp), poolPtr->warmwait);
+	}
+	Tcl_ResetResult(interp);
+	++poolPtr->avail;
+	proxyPtr->nextPtr = poolPtr->firstPtr;
+	poolPtr->firstPtr = proxyPtr;
+	Ns_CondBroadcast(&poolPtr->cond);
+	if (err != ENone) {
+	    break;
+	}
+    }
+    Ns_MutexUnlock(&poolPtr->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetRss --
+ *
+ *	Get the resident size of a process.
+ *
+ * Results:
+ *	Size in KB or 0 if not available.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GetRss(int pid)
+{
+#ifdef __linux__
+    FILE *fp;
+    char file[64];
+    long size, rss;
+
+    sprintf(file, "/proc/%d/statm", pid);
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+	return 0;
+    }
+    if (fscanf(fp, "%ld %ld", &size, &rss) != 2) {
+	rss = 0;
+    }
+    fclose(fp);
+    return (int) (rss * (getpagesize() / 1024));
+#else
+    return 0;
+#endif
+}
+
+
 
 /*
  *----------------------------------------------------------------------
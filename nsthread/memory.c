@@ -27,24 +27,150 @@
  * version of this file under either the License or the GPL.
  */
 
+
 /* 
  * memory.c --
  *
- *	Memory allocation routines.
+ *	Memory allocation routines, either wrappers for Tcl_Alloc or,
+ *	if enabled with Ns_MemorySetCache, a thread cached allocator.
+ *
+ *	The cached allocator rounds requests up to power of two size
+ *	classes.  Each thread keeps lists of free blocks per class,
+ *	refilled from and returned in batches to shared lists.  Blocks
+ *	freed by a thread other than the one which allocated them are
+ *	returned directly to the shared lists.  Each block has a header
+ *	recording the allocating thread's cache and the requested size
+ *	for the per-thread counters returned by Ns_MemoryList.
+ *
+ *	Blocks are carved from regions aligned to 1MB grains which are
+ *	marked in a bitmap, so ns_free and ns_realloc recognize cached
+ *	blocks by address alone and pass any other pointer, e.g., one
+ *	from Tcl_Alloc or Ns_DStringExport, to Tcl_Free or Tcl_Realloc.
  */
 
 static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsthread/memory.c,v 1.3 2003/01/18 19:56:30 jgdavidson Exp $, compiled: " __DATE__ " " __TIME__;
 
 #include "thread.h"
 
-
+/*
+ * The following constants define the size classes of the cached
+ * allocator, blocks of 32 bytes to 16k including the header.  Larger
+ * requests are passed to Tcl_Alloc without a header.
+ */
+
+#define HDRSIZE		16
+#define MINBLOCK	32
+#define NBUCKETS	10
+#define MAXBLOCK	(MINBLOCK << (NBUCKETS - 1))
+#define LARGE		NBUCKETS
+
+/*
+ * The following constants define the regions of 8 grains from which
+ * chunks of blocks are carved and the bitmap marking grains in
+ * regions.  The bitmap has a leaf of 32768 bits allocated as needed
+ * for each 32GB of address space up to 128TB.  Bits are only ever set,
+ * under the lock, before any block of the grain is returned so the
+ * bitmap is read without the lock.
+ */
+
+#define GRAINSHIFT	20
+#define GRAINSIZE	((uintptr_t) 1 << GRAINSHIFT)
+#define REGIONGRAINS	8
+#define REGIONSIZE	(REGIONGRAINS * GRAINSIZE)
+#define LEAFSHIFT	15
+#define LEAFBITS	(1 << LEAFSHIFT)
+#define NLEAVES		4096
+
+/*
+ * The following macro returns the number of blocks moved at once
+ * between a thread and the shared lists, about 8k worth.  A thread
+ * keeps at most twice this number of free blocks in each class.
+ */
+
+#define NBATCH(b)	((MINBLOCK << (b)) >= 2048 ? 4 : 8192 / (MINBLOCK << (b)))
+
+/*
+ * The following structure is the header of each block.  The header
+ * is followed by the memory returned to the caller.
+ */
+
+typedef struct Block {
+    union {
+	struct Block *nextPtr;	/* Next free block. */
+	struct Cache *cachePtr;	/* Cache which allocated the block. */
+    } u;
+    size_t size;		/* Requested size. */
+} Block;
+
+#define BLOCK2PTR(b)	((void *) ((char *) (b) + HDRSIZE))
+#define PTR2BLOCK(p)	((Block *) ((char *) (p) - HDRSIZE))
+
+/*
+ * The following structure defines a list of free blocks.
+ */
+
+typedef struct Bucket {
+    Block	    *firstPtr;
+    int		     nfree;
+} Bucket;
+
+/*
+ * The following structure defines the cache of a thread.  Caches are
+ * never freed as allocated blocks refer to them, instead they are
+ * reused by new threads.  The counters are updated only by the owning
+ * thread except nremote which is updated with the lock held.
+ */
+
+typedef struct Cache {
+    struct Cache    *nextPtr;		/* Next in list of all caches. */
+    int		     active;		/* Cache is in use by a thread. */
+    char	     name[NS_THREAD_NAMESIZE+1];
+    Bucket	     buckets[NBUCKETS];	/* Free blocks per class. */
+    unsigned long    nalloc[NBUCKETS+1];/* Allocations per class. */
+    unsigned long    nfree;		/* Frees of own blocks. */
+    unsigned long    nxfree;		/* Frees of other threads' blocks. */
+    unsigned long    nbytes;		/* Bytes allocated. */
+    unsigned long    nfreed;		/* Own bytes freed. */
+    unsigned long    nremote;		/* Bytes freed by other threads. */
+} Cache;
+
+/*
+ * Static functions defined in this file.
+ */
+
+static Cache *GetCache(void);
+static int GetBucket(size_t size);
+static void *CacheAlloc(size_t size);
+static void CacheFree(Block *blockPtr);
+static void *CacheRealloc(Block *blockPtr, size_t size);
+static void Refill(Cache *cachePtr, int bucket);
+static void Shrink(Cache *cachePtr, int bucket);
+static char *NewChunk(size_t size);
+static int IsCached(void *ptr);
+
+/*
+ * Static variables defined in this file.
+ */
+
+static Ns_Mutex	lock;			/* Lock for shared and caches. */
+static Bucket	shared[NBUCKETS];	/* Shared free blocks. */
+static Cache   *firstCachePtr;		/* List of all caches. */
+static int	enabled;		/* Cached allocator enabled. */
+static int	cached;			/* Cached allocator ever enabled. */
+static char    *regionPtr;		/* Next free byte in region. */
+static char    *regionEnd;		/* End of region. */
+static unsigned char *grains[NLEAVES];	/* Bitmap of grains in regions. */
+
+
 /*
  *----------------------------------------------------------------------
  *
  * ns_realloc, ns_malloc, ns_calloc, ns_free, ns_strdup, ns_strcopy --
  *
- *	Memory allocation wrappers which either call the platform
- *	versions or the fast pool allocator for a per-thread pool.
+ *	Memory allocation wrappers which either call the Tcl versions
+ *	or the thread cached allocator.  Blocks not allocated by the
+ *	cached allocator, e.g., those allocated before it was enabled,
+ *	are recognized by address and passed to Tcl_Free or Tcl_Realloc.
  *
  * Results:
  *	As with system functions.
@@ -58,12 +184,21 @@ static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nst
 void *
 ns_realloc(void *ptr, size_t size)
 {
-    return (ptr ? Tcl_Realloc(ptr, size) : Tcl_Alloc(size));
+    if (ptr == NULL) {
+	return ns_malloc(size);
+    }
+    if (cached && IsCached(ptr)) {
+	return CacheRealloc(PTR2BLOCK(ptr), size);
+    }
+    return Tcl_Realloc(ptr, size);
 }
 
 void *
 ns_malloc(size_t size)
 {
+    if (enabled) {
+	return CacheAlloc(size);
+    }
     return Tcl_Alloc(size);
 }
 
@@ -71,7 +206,11 @@ void
 ns_free(void *ptr)
 {
     if (ptr != NULL) {
-	Tcl_Free(ptr);
+	if (cached && IsCached(ptr)) {
+	    CacheFree(PTR2BLOCK(ptr));
+	} else {
+	    Tcl_Free(ptr);
+	}
     }
 }
 
@@ -104,3 +243,537 @@ ns_strdup(const char *old)
 
     return new;
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_MemorySetCache --
+ *
+ *	Enable or disable the thread cached allocator.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Blocks allocated while enabled are freed to the cached allocator
+ *	even after it is disabled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_MemorySetCache(int enable)
+{
+    if (enable && !cached) {
+	Ns_MutexSetName(&lock, "ns:memory");
+	cached = 1;
+    }
+    enabled = enable;
+    NsMemorySetName(Ns_ThreadGetName());
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_MemoryList --
+ *
+ *	Append info on the cache of each thread which has used the
+ *	cached allocator.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	For each cache, a list of the thread name, bytes in use, frees
+ *	of the thread's own blocks, frees of other threads' blocks and
+ *	a list of size and allocation count pairs for each class is
+ *	appended to dsPtr.  The size of the large class is "large";
+ *	large blocks are counted as allocated but otherwise not tracked.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_MemoryList(Tcl_DString *dsPtr)
+{
+    Cache *cachePtr;
+    char buf[100];
+    int i;
+
+    if (!cached) {
+	return;
+    }
+    Ns_MutexLock(&lock);
+    for (cachePtr = firstCachePtr; cachePtr != NULL;
+	    cachePtr = cachePtr->nextPtr) {
+	Tcl_DStringStartSublist(dsPtr);
+	Tcl_DStringAppendElement(dsPtr, cachePtr->name);
+	sprintf(buf, " %lu %lu %lu",
+		cachePtr->nbytes - cachePtr->nfreed - cachePtr->nremote,
+		cachePtr->nfree, cachePtr->nxfree);
+	Tcl_DStringAppend(dsPtr, buf, -1);
+	Tcl_DStringStartSublist(dsPtr);
+	for (i = 0; i < NBUCKETS; ++i) {
+	    sprintf(buf, "%d %lu", (MINBLOCK << i) - HDRSIZE,
+		    cachePtr->nalloc[i]);
+	    Tcl_DStringAppendElement(dsPtr, buf);
+	}
+	sprintf(buf, "large %lu", cachePtr->nalloc[LARGE]);
+	Tcl_DStringAppendElement(dsPtr, buf);
+	Tcl_DStringEndSublist(dsPtr);
+	Tcl_DStringEndSublist(dsPtr);
+    }
+    Ns_MutexUnlock(&lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsMemorySetName --
+ *
+ *	Set the thread name reported for the cache of the current
+ *	thread, called as threads are created and named.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsMemorySetName(char *name)
+{
+    if (enabled) {
+	strncpy(GetCache()->name, name, NS_THREAD_NAMESIZE);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFreeCache --
+ *
+ *	Return the free blocks of an exiting thread's cache to the
+ *	shared lists.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The cache is available for reuse by a new thread.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsFreeCache(void *arg)
+{
+    Cache *cachePtr = arg;
+    Bucket *bucketPtr;
+    Block *blockPtr;
+    int i;
+
+    Ns_MutexLock(&lock);
+    for (i = 0; i < NBUCKETS; ++i) {
+	bucketPtr = &cachePtr->buckets[i];
+	while ((blockPtr = bucketPtr->firstPtr) != NULL) {
+	    bucketPtr->firstPtr = blockPtr->u.nextPtr;
+	    blockPtr->u.nextPtr = shared[i].firstPtr;
+	    shared[i].firstPtr = blockPtr;
+	    ++shared[i].nfree;
+	}
+	bucketPtr->nfree = 0;
+    }
+    cachePtr->active = 0;
+    Ns_MutexUnlock(&lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetCache --
+ *
+ *	Return the cache of the current thread, reusing the cache of
+ *	an exited thread or allocating a new cache the first time.
+ *
+ * Results:
+ *	Pointer to Cache.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Cache *
+GetCache(void)
+{
+    Cache *cachePtr;
+
+    cachePtr = NsGetCache();
+    if (cachePtr == NULL) {
+	Ns_MutexLock(&lock);
+	cachePtr = firstCachePtr;
+	while (cachePtr != NULL && cachePtr->active) {
+	    cachePtr = cachePtr->nextPtr;
+	}
+	if (cachePtr == NULL) {
+	    cachePtr = (Cache *) Tcl_Alloc(sizeof(Cache));
+	    memset(cachePtr, 0, sizeof(Cache));
+	    cachePtr->nextPtr = firstCachePtr;
+	    firstCachePtr = cachePtr;
+	}
+	cachePtr->active = 1;
+	Ns_MutexUnlock(&lock);
+	NsSetCache(cachePtr);
+    }
+    return cachePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetBucket --
+ *
+ *	Return the size class for a request.
+ *
+ * Results:
+ *	Index of bucket or LARGE.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GetBucket(size_t size)
+{
+    int bucket;
+
+    if (size > MAXBLOCK - HDRSIZE) {
+	return LARGE;
+    }
+    size += HDRSIZE;
+    bucket = 0;
+    while ((size_t) (MINBLOCK << bucket) < size) {
+	++bucket;
+    }
+    return bucket;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheAlloc --
+ *
+ *	Allocate a block from the current thread's cache.
+ *
+ * Results:
+ *	Pointer to memory following the block header or, for large
+ *	requests, from Tcl_Alloc.
+ *
+ * Side effects:
+ *	The cache may be refilled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+CacheAlloc(size_t size)
+{
+    Cache *cachePtr = GetCache();
+    Bucket *bucketPtr;
+    Block *blockPtr;
+    int bucket;
+
+    bucket = GetBucket(size);
+    blockPtr = NULL;
+    if (bucket != LARGE) {
+	bucketPtr = &cachePtr->buckets[bucket];
+	if (bucketPtr->firstPtr == NULL) {
+	    Refill(cachePtr, bucket);
+	}
+	blockPtr = bucketPtr->firstPtr;
+    }
+    if (blockPtr == NULL) {
+	++cachePtr->nalloc[LARGE];
+	return Tcl_Alloc(size);
+    }
+    bucketPtr->firstPtr = blockPtr->u.nextPtr;
+    --bucketPtr->nfree;
+    blockPtr->u.cachePtr = cachePtr;
+    blockPtr->size = size;
+    ++cachePtr->nalloc[bucket];
+    cachePtr->nbytes += size;
+    return BLOCK2PTR(blockPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheFree --
+ *
+ *	Free a block to the current thread's cache or, if allocated by
+ *	another thread, to the shared lists.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Excess free blocks may be returned to the shared lists.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheFree(Block *blockPtr)
+{
+    Cache *cachePtr = GetCache();
+    Cache *ownerPtr = blockPtr->u.cachePtr;
+    Bucket *bucketPtr;
+    int bucket;
+
+    bucket = GetBucket(blockPtr->size);
+    if (ownerPtr == cachePtr) {
+	++cachePtr->nfree;
+	cachePtr->nfreed += blockPtr->size;
+	bucketPtr = &cachePtr->buckets[bucket];
+	blockPtr->u.nextPtr = bucketPtr->firstPtr;
+	bucketPtr->firstPtr = blockPtr;
+	if (++bucketPtr->nfree > 2 * NBATCH(bucket)) {
+	    Shrink(cachePtr, bucket);
+	}
+    } else {
+	++cachePtr->nxfree;
+	Ns_MutexLock(&lock);
+	ownerPtr->nremote += blockPtr->size;
+	blockPtr->u.nextPtr = shared[bucket].firstPtr;
+	shared[bucket].firstPtr = blockPtr;
+	++shared[bucket].nfree;
+	Ns_MutexUnlock(&lock);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheRealloc --
+ *
+ *	Resize a block, in place if the new size is in the same class
+ *	and the block belongs to the current thread.
+ *
+ * Results:
+ *	Pointer to memory as returned by CacheAlloc.
+ *
+ * Side effects:
+ *	Block may be copied and freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+CacheRealloc(Block *blockPtr, size_t size)
+{
+    Cache *cachePtr = GetCache();
+    void *new;
+    int bucket;
+
+    bucket = GetBucket(size);
+    if (blockPtr->u.cachePtr == cachePtr
+	    && bucket == GetBucket(blockPtr->size)) {
+	cachePtr->nfreed += blockPtr->size;
+	cachePtr->nbytes += size;
+	blockPtr->size = size;
+	return BLOCK2PTR(blockPtr);
+    }
+    new = CacheAlloc(size);
+    memcpy(new, BLOCK2PTR(blockPtr), size < blockPtr->size ? size : blockPtr->size);
+    CacheFree(blockPtr);
+    return new;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Refill --
+ *
+ *	Refill an empty list of free blocks from the shared list or, if
+ *	the shared list is empty, from a new chunk of memory.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The list remains empty if no chunk could be allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Refill(Cache *cachePtr, int bucket)
+{
+    Bucket *bucketPtr = &cachePtr->buckets[bucket];
+    Block *blockPtr;
+    char *chunk;
+    int i, n, size;
+
+    n = NBATCH(bucket);
+    Ns_MutexLock(&lock);
+    while (n > 0 && (blockPtr = shared[bucket].firstPtr) != NULL) {
+	shared[bucket].firstPtr = blockPtr->u.nextPtr;
+	--shared[bucket].nfree;
+	blockPtr->u.nextPtr = bucketPtr->firstPtr;
+	bucketPtr->firstPtr = blockPtr;
+	++bucketPtr->nfree;
+	--n;
+    }
+    if (bucketPtr->firstPtr == NULL) {
+	size = MINBLOCK << bucket;
+	n = NBATCH(bucket);
+	chunk = NewChunk((size_t) (size * n));
+	if (chunk != NULL) {
+	    for (i = 0; i < n; ++i) {
+		blockPtr = (Block *) (chunk + i * size);
+		blockPtr->u.nextPtr = bucketPtr->firstPtr;
+		bucketPtr->firstPtr = blockPtr;
+	    }
+	    bucketPtr->nfree = n;
+	}
+    }
+    Ns_MutexUnlock(&lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Shrink --
+ *
+ *	Move a batch of free blocks to the shared list.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Shrink(Cache *cachePtr, int bucket)
+{
+    Bucket *bucketPtr = &cachePtr->buckets[bucket];
+    Block *blockPtr;
+    int n;
+
+    n = NBATCH(bucket);
+    Ns_MutexLock(&lock);
+    while (n-- > 0) {
+	blockPtr = bucketPtr->firstPtr;
+	bucketPtr->firstPtr = blockPtr->u.nextPtr;
+	--bucketPtr->nfree;
+	blockPtr->u.nextPtr = shared[bucket].firstPtr;
+	shared[bucket].firstPtr = blockPtr;
+	++shared[bucket].nfree;
+    }
+    Ns_MutexUnlock(&lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NewChunk --
+ *
+ *	Carve a chunk from the current region, allocating a new region
+ *	if needed, called with the lock held.  The rest of a region too
+ *	small for the chunk is abandoned.
+ *
+ * Results:
+ *	Pointer to chunk or NULL if a new region lies beyond the address
+ *	space covered by the bitmap.
+ *
+ * Side effects:
+ *	Grains of a new region are marked in the bitmap.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+NewChunk(size_t size)
+{
+    unsigned char *leaf;
+    uintptr_t grain;
+    char *region, *chunk;
+    int i;
+
+    if (regionPtr == NULL || (size_t) (regionEnd - regionPtr) < size) {
+	region = Tcl_Alloc(REGIONSIZE + GRAINSIZE);
+	grain = ((uintptr_t) region + GRAINSIZE - 1) >> GRAINSHIFT;
+	if (((grain + REGIONGRAINS - 1) >> LEAFSHIFT) >= NLEAVES) {
+	    Tcl_Free(region);
+	    return NULL;
+	}
+	regionPtr = (char *) (grain << GRAINSHIFT);
+	regionEnd = regionPtr + REGIONSIZE;
+	for (i = 0; i < REGIONGRAINS; ++i, ++grain) {
+	    leaf = grains[grain >> LEAFSHIFT];
+	    if (leaf == NULL) {
+		leaf = (unsigned char *) Tcl_Alloc(LEAFBITS / 8);
+		memset(leaf, 0, LEAFBITS / 8);
+		grains[grain >> LEAFSHIFT] = leaf;
+	    }
+	    leaf[(grain % LEAFBITS) / 8] |= 1 << (grain % 8);
+	}
+    }
+    chunk = regionPtr;
+    regionPtr += size;
+    return chunk;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * IsCached --
+ *
+ *	Check if a pointer is in a region of the cached allocator.
+ *
+ * Results:
+ *	1 if cached, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+IsCached(void *ptr)
+{
+    unsigned char *leaf;
+    uintptr_t grain;
+
+    grain = (uintptr_t) ptr >> GRAINSHIFT;
+    if ((grain >> LEAFSHIFT) >= NLEAVES) {
+	return 0;
+    }
+    leaf = grains[grain >> LEAFSHIFT];
+    grain %= LEAFBITS;
+    return (leaf != NULL && (leaf[grain / 8] & (1 << (grain % 8))));
+}
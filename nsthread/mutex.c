@@ -30,13 +30,41 @@
 /* 
  * mutex.c --
  *
- *	Mutex locks with metering.
+ *	Mutex locks with metering, optional adaptive spinning and
+ *	optional wait and hold time profiling.
  */
 
 static const char *RCSID = "@(#) $Header: /Users/dossy/Desktop/cvs/aolserver/nsthread/mutex.c,v 1.4 2003/03/07 18:08:51 vasiljevic Exp $, compiled: " __DATE__ " " __TIME__;
 
 #include "thread.h"
 
+/*
+ * The following structure defines the wait and hold time profile
+ * of a mutex.  Times are recorded in histograms with power of two
+ * microsecond buckets, i.e., bucket i counts times less than 2^i
+ * microseconds with the last bucket counting all longer times.
+ * The threads with the longest total wait are also tracked.  The
+ * profile is only updated while holding the mutex.
+ */
+
+#define NBUCKETS 16
+#define NWAITERS 4
+
+typedef struct Profile {
+    Ns_Time	     locked;		/* Time lock was acquired. */
+    unsigned long    totalwait;		/* Total wait time in usec. */
+    unsigned long    maxwait;		/* Max wait time in usec. */
+    unsigned long    totalhold;		/* Total hold time in usec. */
+    unsigned long    maxhold;		/* Max hold time in usec. */
+    unsigned long    wait[NBUCKETS];	/* Wait time histogram. */
+    unsigned long    hold[NBUCKETS];	/* Hold time histogram. */
+    struct {
+	unsigned long nwait;
+	unsigned long totalwait;
+	char	      name[NS_THREAD_NAMESIZE+1];
+    } waiters[NWAITERS];		/* Threads with longest total wait. */
+} Profile;
+
 /*
  * The following structure defines a mutex with
  * string name and lock and busy counters.
@@ -48,12 +76,35 @@ typedef struct Mutex {
     unsigned int     id;
     unsigned long    nlock;
     unsigned long    nbusy;
+    unsigned long    nspin;	/* Busy locks acquired while spinning. */
+    int		     spin;	/* Adaptive spin count. */
+    Profile	    *profPtr;	/* Profile, if enabled. */
     char	     name[NS_THREAD_NAMESIZE+1];
 } Mutex;
 
+/*
+ * The following macro is used in spin loops to reduce power and
+ * memory traffic.
+ */
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SPINPAUSE() __asm__ __volatile__ ("pause")
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define SPINPAUSE() __asm__ __volatile__ ("yield")
+#else
+#define SPINPAUSE()
+#endif
+
 #define GETMUTEX(mutex) (*(mutex)?((Mutex *)*(mutex)):GetMutex((mutex)))
 static Mutex *GetMutex(Ns_Mutex *mutex);
+static Profile *GetProfile(Mutex *mutexPtr);
+static void Record(unsigned long *hist, unsigned long *totalPtr,
+		   unsigned long *maxPtr, Ns_Time *t1, Ns_Time *t0);
+static void RecordWaiter(Profile *profPtr, Ns_Time *t1, Ns_Time *t0);
+static void AppendHist(Tcl_DString *dsPtr, unsigned long *hist);
 static Mutex *firstMutexPtr;
+static int maxspin;		/* Max spins before blocking, 0 to disable. */
+static int profile;		/* Profiling enabled. */
 
 
 /*
@@ -200,12 +251,55 @@ void
 Ns_MutexLock(Ns_Mutex *mutex)
 {
     Mutex *mutexPtr = GETMUTEX(mutex);
+    Profile *profPtr;
+    Ns_Time start, now;
+    int n, max, locked;
     
     if (!NsLockTry(mutexPtr->lock)) {
-	NsLockSet(mutexPtr->lock);
+	if (profile) {
+	    Ns_GetTime(&start);
+	}
+
+	/*
+	 * Spin up to twice the recent average number of spins
+	 * needed before blocking, adapting the average as for
+	 * glibc adaptive mutexes.
+	 */
+
+	locked = 0;
+	n = 0;
+	if (maxspin > 0) {
+	    max = mutexPtr->spin * 2 + 10;
+	    if (max > maxspin) {
+		max = maxspin;
+	    }
+	    while (n < max) {
+		++n;
+		SPINPAUSE();
+		if (NsLockTry(mutexPtr->lock)) {
+		    locked = 1;
+		    break;
+		}
+	    }
+	    mutexPtr->spin += (n - mutexPtr->spin) / 8;
+	}
+	if (!locked) {
+	    NsLockSet(mutexPtr->lock);
+	} else {
+	    ++mutexPtr->nspin;
+	}
 	++mutexPtr->nbusy;
+	if (profile && (profPtr = GetProfile(mutexPtr)) != NULL) {
+	    Ns_GetTime(&now);
+	    Record(profPtr->wait, &profPtr->totalwait, &profPtr->maxwait,
+		   &now, &start);
+	    RecordWaiter(profPtr, &now, &start);
+	}
     }
     ++mutexPtr->nlock;
+    if (profile) {
+	NsMutexHold(mutex, 1);
+    }
 }
 
 
@@ -234,6 +328,9 @@ Ns_MutexTryLock(Ns_Mutex *mutex)
     	return NS_TIMEOUT;
     }
     ++mutexPtr->nlock;
+    if (profile) {
+	NsMutexHold(mutex, 1);
+    }
     return NS_OK;
 }
 
@@ -259,6 +356,9 @@ Ns_MutexUnlock(Ns_Mutex *mutex)
 {
     Mutex *mutexPtr = (Mutex *) *mutex;
 
+    if (mutexPtr->profPtr != NULL) {
+	NsMutexHold(mutex, 0);
+    }
     NsLockUnset(mutexPtr->lock);
 }
 
@@ -283,7 +383,9 @@ void
 Ns_MutexList(Tcl_DString *dsPtr)
 {
     Mutex *mutexPtr;
-    char buf[100];
+    Profile *profPtr;
+    char buf[200];
+    int i;
 
     Ns_MasterLock();
     mutexPtr = firstMutexPtr;
@@ -291,14 +393,122 @@ Ns_MutexList(Tcl_DString *dsPtr)
 	Tcl_DStringStartSublist(dsPtr);
 	Tcl_DStringAppendElement(dsPtr, mutexPtr->name);
 	Tcl_DStringAppendElement(dsPtr, "");
-	sprintf(buf, " %d %lu %lu", mutexPtr->id, mutexPtr->nlock, mutexPtr->nbusy);
+	sprintf(buf, " %d %lu %lu %lu", mutexPtr->id, mutexPtr->nlock,
+		mutexPtr->nbusy, mutexPtr->nspin);
 	Tcl_DStringAppend(dsPtr, buf, -1);
+	profPtr = mutexPtr->profPtr;
+	if (profPtr == NULL) {
+	    Tcl_DStringAppend(dsPtr, " 0 0 0 0 {} {} {}", -1);
+	} else {
+	    sprintf(buf, " %lu %lu %lu %lu", profPtr->totalwait,
+		    profPtr->maxwait, profPtr->totalhold, profPtr->maxhold);
+	    Tcl_DStringAppend(dsPtr, buf, -1);
+	    AppendHist(dsPtr, profPtr->wait);
+	    AppendHist(dsPtr, profPtr->hold);
+	    Tcl_DStringStartSublist(dsPtr);
+	    for (i = 0; i < NWAITERS; ++i) {
+		if (profPtr->waiters[i].nwait > 0) {
+		    Tcl_DStringAppendElement(dsPtr, profPtr->waiters[i].name);
+		    sprintf(buf, " %lu %lu", profPtr->waiters[i].nwait,
+			    profPtr->waiters[i].totalwait);
+		    Tcl_DStringAppend(dsPtr, buf, -1);
+		}
+	    }
+	    Tcl_DStringEndSublist(dsPtr);
+	}
 	Tcl_DStringEndSublist(dsPtr);
 	mutexPtr = mutexPtr->nextPtr;
     }
     Ns_MasterUnlock();
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_MutexSetSpin --
+ *
+ *	Set the max number of times to spin on a busy mutex before
+ *	blocking.  The actual number adapts to the recent history of
+ *	each mutex.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A value of 0, the default, disables spinning.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_MutexSetSpin(int spin)
+{
+    maxspin = spin < 0 ? 0 : spin;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_MutexSetProfile --
+ *
+ *	Enable or disable wait and hold time profiling.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Profiles are allocated as mutexes are next locked and remain
+ *	available to Ns_MutexList after profiling is disabled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_MutexSetProfile(int enabled)
+{
+    profile = enabled;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsMutexHold --
+ *
+ *	Start or end the hold time of a locked mutex, also called by
+ *	condition waits which unlock the mutex directly.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Hold time is recorded when ended.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsMutexHold(Ns_Mutex *mutex, int start)
+{
+    Mutex *mutexPtr = (Mutex *) *mutex;
+    Profile *profPtr;
+    Ns_Time now;
+
+    if (start) {
+	if (profile && (profPtr = GetProfile(mutexPtr)) != NULL) {
+	    Ns_GetTime(&profPtr->locked);
+	}
+    } else if ((profPtr = mutexPtr->profPtr) != NULL
+	    && profPtr->locked.sec != 0) {
+	Ns_GetTime(&now);
+	Record(profPtr->hold, &profPtr->totalhold, &profPtr->maxhold,
+	       &now, &profPtr->locked);
+	profPtr->locked.sec = 0;
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -383,3 +593,151 @@ GetMutex(Ns_Mutex *mutex)
     Ns_MasterUnlock();
     return (Mutex *) *mutex;
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetProfile --
+ *
+ *	Return the profile of a locked mutex, allocating it the first
+ *	time.  The profile is allocated with calloc as ns_calloc may
+ *	itself lock a mutex.
+ *
+ * Results:
+ *	Pointer to Profile or NULL if allocation failed.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Profile *
+GetProfile(Mutex *mutexPtr)
+{
+    if (mutexPtr->profPtr == NULL) {
+	mutexPtr->profPtr = calloc(1, sizeof(Profile));
+    }
+    return mutexPtr->profPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Record --
+ *
+ *	Record an elapsed time in a histogram and totals.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Record(unsigned long *hist, unsigned long *totalPtr, unsigned long *maxPtr,
+       Ns_Time *t1, Ns_Time *t0)
+{
+    Ns_Time diff;
+    unsigned long usec;
+    int i;
+
+    if (Ns_DiffTime(t1, t0, &diff) < 0) {
+	return;
+    }
+    usec = diff.sec * 1000000 + diff.usec;
+    *totalPtr += usec;
+    if (usec > *maxPtr) {
+	*maxPtr = usec;
+    }
+    for (i = 0; i < NBUCKETS - 1 && usec >= (1UL << i); ++i) {
+	;
+    }
+    ++hist[i];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RecordWaiter --
+ *
+ *	Record the wait time of the current thread, replacing the
+ *	waiter with the least total wait if the thread is not yet
+ *	tracked.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RecordWaiter(Profile *profPtr, Ns_Time *t1, Ns_Time *t0)
+{
+    Ns_Time diff;
+    char *name;
+    int i, min;
+
+    name = Ns_ThreadGetName();
+    min = 0;
+    for (i = 0; i < NWAITERS; ++i) {
+	if (strcmp(profPtr->waiters[i].name, name) == 0) {
+	    break;
+	}
+	if (profPtr->waiters[i].totalwait < profPtr->waiters[min].totalwait) {
+	    min = i;
+	}
+    }
+    if (i == NWAITERS) {
+	i = min;
+	strncpy(profPtr->waiters[i].name, name, NS_THREAD_NAMESIZE);
+	profPtr->waiters[i].nwait = 0;
+    }
+    Ns_DiffTime(t1, t0, &diff);
+    ++profPtr->waiters[i].nwait;
+    profPtr->waiters[i].totalwait += diff.sec * 1000000 + diff.usec;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AppendHist --
+ *
+ *	Append a histogram as a list element, omitting trailing
+ *	empty buckets.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AppendHist(Tcl_DString *dsPtr, unsigned long *hist)
+{
+    char buf[20];
+    int i, n;
+
+    for (n = NBUCKETS; n > 0 && hist[n - 1] == 0; --n) {
+	;
+    }
+    Tcl_DStringStartSublist(dsPtr);
+    for (i = 0; i < n; ++i) {
+	sprintf(buf, "%lu", hist[i]);
+	Tcl_DStringAppendElement(dsPtr, buf);
+    }
+    Tcl_DStringEndSublist(dsPtr);
+}
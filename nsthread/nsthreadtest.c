@@ -222,10 +222,10 @@ AtExit(void)
 /*
  * MemThread, MemTime -
  *
- *	Time allocations of malloc and zippy ns_malloc.
+ *	Time allocations of malloc, zippy ns_malloc and cached ns_malloc.
  */
 
-#define NA 10000
+#define NA 100000
 
 int             nthreads = 10;
 int             memstart;
@@ -272,8 +272,10 @@ MemTime(int ns)
     nrunning = 0;
     memstart = 0;
     Ns_MutexUnlock(&lock);
-    printf("starting %d %smalloc threads...", nthreads, ns ? "ns_" : "");
+    printf("starting %d %smalloc threads...", nthreads,
+	   ns == 2 ? "cached ns_" : ns ? "ns_" : "");
     fflush(stdout);
+    Ns_MemorySetCache(ns == 2);
     Ns_GetTime(&start);
     for (i = 0; i < nthreads; ++i) {
 	Ns_ThreadCreate(MemThread, (void *) ns, 0, &tids[i]);
@@ -427,6 +429,7 @@ int main(int argc, char *argv[])
     pthread_t tids[10];
 #endif
 
+    Tcl_FindExecutable(argv[0]);
     NsThreads_LibInit();
     Ns_ThreadSetName("-main-");
 
@@ -510,5 +513,6 @@ int main(int argc, char *argv[])
 mem:
     MemTime(0);
     MemTime(1);
+    MemTime(2);
     return 0;
 }
@@ -83,6 +83,14 @@ static Ns_Mutex uidlock;
 
 static pthread_key_t	key;
 
+/*
+ * The following Tls key is used to store the cache of the thread
+ * cached allocator.  It's separate from the Thread struct which is
+ * itself allocated with ns_calloc.
+ */
+
+static pthread_key_t	cachekey;
+
 /*
  * The following variables are used to manage stack sizes, guardzones, and
  * size monitoring.
@@ -122,6 +130,10 @@ NsInitThreads(void)
     if (err != 0) {
 	NsThreadFatal("NsPthreadsInit", "pthread_key_create", err);
     }
+    err = pthread_key_create(&cachekey, NsFreeCache);
+    if (err != 0) {
+	NsThreadFatal("NsPthreadsInit", "pthread_key_create", err);
+    }
     stackdown = StackDown(&env);
     pagesize = getpagesize();
     env = getenv("NS_THREAD_GUARDSIZE");
@@ -170,6 +182,40 @@ NsGetTls(void)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsGetCache, NsSetCache --
+ *
+ *	Get or set the allocator cache of the current thread.
+ *
+ * Results:
+ *	Pointer to cache or NULL if not yet set.
+ *
+ * Side effects:
+ *	NsFreeCache is called for a non-NULL cache at thread exit.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void *
+NsGetCache(void)
+{
+    return pthread_getspecific(cachekey);
+}
+
+void
+NsSetCache(void *cache)
+{
+    int err;
+
+    err = pthread_setspecific(cachekey, cache);
+    if (err != 0) {
+	NsThreadFatal("NsSetCache", "pthread_setspecific", err);
+    }
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -737,10 +783,12 @@ Ns_CondWait(Ns_Cond *cond, Ns_Mutex *mutex)
 {
     int              err;
 
+    NsMutexHold(mutex, 0);
     err = pthread_cond_wait(GetCond(cond), NsGetLock(mutex));
     if (err != 0) {
 	NsThreadFatal("Ns_CondWait", "pthread_cond_wait", err);
     }
+    NsMutexHold(mutex, 1);
 }
 
 
@@ -788,9 +836,11 @@ Ns_CondTimedWait(Ns_Cond *cond, Ns_Mutex *mutex, Ns_Time *timePtr)
      * ts structure has not been modified.
      */
 
+    NsMutexHold(mutex, 0);
     do {
     	err = pthread_cond_timedwait(GetCond(cond), NsGetLock(mutex), &ts);
     } while (err == EINTR);
+    NsMutexHold(mutex, 1);
     if (err == ETIMEDOUT) {
 	status = NS_TIMEOUT;
     } else if (err != 0) {
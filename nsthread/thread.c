@@ -296,6 +296,7 @@ Ns_ThreadSetName(char *name)
     Ns_MutexLock(&threadlock);
     strncpy(thrPtr->name, name, NS_THREAD_NAMESIZE);
     Ns_MutexUnlock(&threadlock);
+    NsMemorySetName(thrPtr->name);
 }
 
 
@@ -398,6 +399,7 @@ NewThread(ThreadArg *argPtr)
     Ns_GetTime(&thrPtr->ctime);
     thrPtr->tid = Ns_ThreadId();
     sprintf(thrPtr->name, "-thread%d-", thrPtr->tid);
+    NsMemorySetName(thrPtr->name);
     if (argPtr == NULL) {
     	thrPtr->flags = FLAG_DETACHED;
     } else {
@@ -51,6 +51,7 @@ extern void   NsInitThreads(void);
 extern void   NsInitMaster(void);
 extern void   NsInitReentrant(void);
 extern void   NsMutexInitNext(Ns_Mutex *mutex, char *prefix, unsigned int *nextPtr);
+extern void   NsMutexHold(Ns_Mutex *mutex, int start);
 extern void  *NsGetLock(Ns_Mutex *mutex);
 extern void  *NsLockAlloc(void);
 extern void   NsLockFree(void *lock);
@@ -59,6 +60,10 @@ extern int    NsLockTry(void *lock);
 extern void   NsLockUnset(void *lock);
 extern void   NsCleanupTls(void **slots);
 extern void **NsGetTls(void);
+extern void  *NsGetCache(void);
+extern void   NsSetCache(void *cache);
+extern void   NsFreeCache(void *cache);
+extern void   NsMemorySetName(char *name);
 extern void   NsThreadMain(void *arg);
 extern void   NsCreateThread(void *arg, long stacksize, Ns_Thread *threadPtr);
 extern void   NsThreadFatal(char *func, char *osfunc, int err) _nsnoreturn;
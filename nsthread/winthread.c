@@ -113,6 +113,13 @@ static unsigned __stdcall ThreadMain(void *arg);
 
 static DWORD		tlskey;
 
+/*
+ * The following Tls key is used to store the cache of the thread
+ * cached allocator.
+ */
+
+static DWORD		cachekey;
+
 
 /*
  *----------------------------------------------------------------------
@@ -135,6 +142,7 @@ BOOL APIENTRY
 DllMain(HANDLE hModule, DWORD why, LPVOID lpReserved)
 {
     WinThread *wPtr;
+    void *cache;
 
     switch (why) {
     case DLL_PROCESS_ATTACH:
@@ -170,10 +178,17 @@ DllMain(HANDLE hModule, DWORD why, LPVOID lpReserved)
 	    }
 	    ns_free(wPtr);
 	}
+	cache = TlsGetValue(cachekey);
+	if (cache) {
+	    if (!TlsSetValue(cachekey, NULL)) {
+	        NsThreadFatal("DllMain", "TlsSetValue", GetLastError());
+	    }
+	    NsFreeCache(cache);
+	}
 	break;
 
     case DLL_PROCESS_DETACH:
-	if (!TlsFree(tlskey)) {
+	if (!TlsFree(tlskey) || !TlsFree(cachekey)) {
 	    NsThreadFatal("DllMain", "TlsFree", GetLastError());
 	}
 	break;
@@ -205,6 +220,41 @@ NsInitThreads(void)
     if (tlskey == 0xFFFFFFFF) {
 	NsThreadFatal("NsInitThreads", "TlsAlloc", GetLastError());
     }
+    cachekey = TlsAlloc();
+    if (cachekey == 0xFFFFFFFF) {
+	NsThreadFatal("NsInitThreads", "TlsAlloc", GetLastError());
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsGetCache, NsSetCache --
+ *
+ *	Get or set the allocator cache of the current thread.
+ *
+ * Results:
+ *	Pointer to cache or NULL if not yet set.
+ *
+ * Side effects:
+ *	NsFreeCache is called for a non-NULL cache at thread detach.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void *
+NsGetCache(void)
+{
+    return TlsGetValue(cachekey);
+}
+
+void
+NsSetCache(void *cache)
+{
+    if (!TlsSetValue(cachekey, cache)) {
+	NsThreadFatal("NsSetCache", "TlsSetValue", GetLastError());
+    }
 }
 
 
@@ -66,6 +66,7 @@ static char header[] = {
 static Ns_TclTraceProc ZlibTrace;
 static Tcl_ObjCmdProc ZlibObjCmd;
 static Ns_GzipProc ZlibGzip;
+static Ns_GzipStreamProc ZlibGzipStream;
 
 
 /*
@@ -103,7 +104,8 @@ Nszlib_Init(Tcl_Interp *interp)
  *      NS_OK.
  *
  * Side effects:
- *	Installs ZlibGzip as the Ns_Gzip proc and registers
+ *	Installs ZlibGzip and ZlibGzipStream as the Ns_Gzip and
+ *	Ns_GzipStream procs and registers
  *	a trace to create ns_zlib command in all new interps.
  *
  *----------------------------------------------------------------------
@@ -113,6 +115,7 @@ int
 NsZlibModInit(char *server, char *module)
 {
     Ns_SetGzipProc(ZlibGzip);
+    Ns_SetGzipStreamProc(ZlibGzipStream);
     Ns_TclRegisterTrace(server, ZlibTrace, NULL, NS_TCL_TRACE_CREATE);
     return NS_OK;
 }
@@ -283,6 +286,89 @@ ZlibGzip(char *buf, int len, int level, Tcl_DString *dsPtr)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ZlibGzipStream --
+ *
+ *      Stream compress procedure for Ns_GzipStream, using a deflate
+ *	stream with a gzip header and trailer.
+ *
+ * Results:
+ *      NS_OK if compression worked, NS_ERROR otherwise.
+ *
+ * Side effects:
+ *      Will append compressed content to given Tcl_DString.  The
+ *	z_stream is allocated on first call and freed on finish, free,
+ *	or error.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ZlibGzipStream(void **ctxPtr, char *buf, int len, int level, int flags,
+	       Tcl_DString *dsPtr)
+{
+    z_stream *zPtr = *ctxPtr;
+    int off, flush, status;
+
+    if (flags & NS_GZIP_FREE) {
+	if (zPtr != NULL) {
+	    deflateEnd(zPtr);
+	    ns_free(zPtr);
+	    *ctxPtr = NULL;
+	}
+	return NS_OK;
+    }
+    if (zPtr == NULL) {
+	zPtr = ns_calloc(1, sizeof(z_stream));
+	if (deflateInit2(zPtr, level, Z_DEFLATED, MAX_WBITS + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+	    ns_free(zPtr);
+	    return NS_ERROR;
+	}
+	*ctxPtr = zPtr;
+    }
+    if (flags & NS_GZIP_FINISH) {
+	flush = Z_FINISH;
+    } else if (flags & NS_GZIP_FLUSH) {
+	flush = Z_SYNC_FLUSH;
+    } else {
+	flush = Z_NO_FLUSH;
+    }
+    zPtr->next_in = (Bytef *) buf;
+    zPtr->avail_in = (uInt) len;
+    do {
+	off = Tcl_DStringLength(dsPtr);
+	Tcl_DStringSetLength(dsPtr,
+			     off + (int) deflateBound(zPtr, (uLong) len) + 16);
+	zPtr->next_out = (Bytef *) dsPtr->string + off;
+	zPtr->avail_out = (uInt) (Tcl_DStringLength(dsPtr) - off);
+	status = deflate(zPtr, flush);
+	Tcl_DStringSetLength(dsPtr,
+			     Tcl_DStringLength(dsPtr) - (int) zPtr->avail_out);
+    } while (status == Z_OK && zPtr->avail_out == 0);
+
+    /*
+     * Z_BUF_ERROR indicates only that no progress was possible,
+     * e.g., on a repeated flush without new input.
+     */
+
+    if (flush == Z_FINISH ? status != Z_STREAM_END
+	    : (status != Z_OK && status != Z_BUF_ERROR)) {
+	status = NS_ERROR;
+    } else {
+	status = NS_OK;
+    }
+    if (flush == Z_FINISH || status != NS_OK) {
+	deflateEnd(zPtr);
+	ns_free(zPtr);
+	*ctxPtr = NULL;
+    }
+    return status;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -212,6 +212,7 @@ ns_section "ns/server/${servername}/module/nssock"
 ns_param   port            $httpport
 ns_param   hostname        $hostname
 ns_param   address         $address
+ns_param   maxinput        2024      ;# Spool larger content to a temp file.
 
 
 #